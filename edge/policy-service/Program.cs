@@ -22,6 +22,9 @@ builder.Services.AddSingleton<TopologyRepository>();
 builder.Services.AddSingleton<DeduplicationService>();
 builder.Services.AddSingleton<AlertStateMachine>();
 builder.Services.AddSingleton<RateLimitService>();
+builder.Services.AddSingleton<DevicePresenceService>();
+builder.Services.AddSingleton<LatencyProbeService>();
+builder.Services.AddSingleton<DeviceStatusService>();
 builder.Services.AddHostedService<MqttHandlerService>();
 
 // Add health checks
@@ -99,6 +102,24 @@ app.MapPost("/api/rate-limit/tenant/{tenantId}/reset", (string tenantId, RateLim
     return Results.Ok(new { message = $"Rate limit reset for tenant: {tenantId}" });
 });
 
+// Device presence (from retained presence topic)
+app.MapGet("/api/devices/presence", (DevicePresenceService presence) =>
+{
+    return Results.Ok(presence.GetStatus());
+});
+
+// Device state reconstructed from status keyframes + deltas
+app.MapGet("/api/devices/status", (DeviceStatusService deviceStatus) =>
+{
+    return Results.Ok(deviceStatus.GetStatus());
+});
+
+// Device latency probe results
+app.MapGet("/api/latency", (LatencyProbeService latencyProbe) =>
+{
+    return Results.Ok(latencyProbe.GetStatus());
+});
+
 var logger = app.Logger;
 logger.LogInformation("╔═══════════════════════════════════════════════════════════╗");
 logger.LogInformation("║   SafeSignal Edge - Policy Service                        ║");
@@ -0,0 +1,148 @@
+using System.Collections.Concurrent;
+using System.Text.Json;
+using Prometheus;
+
+namespace SafeSignal.Edge.PolicyService.Services;
+
+/// <summary>
+/// Device Presence Service
+///
+/// Tracks ESP32 online/offline state from the retained presence topic
+/// safesignal/{tenant}/{building}/device/{deviceId}/presence. Devices publish a
+/// retained "online" birth message on connect and register a retained "offline"
+/// Last Will, so the broker reports lost devices once their keepalive lapses and
+/// a restarted edge receives the current state of every device on subscribe.
+/// </summary>
+public class DevicePresenceService
+{
+    private readonly ILogger<DevicePresenceService> _logger;
+
+    // Presence state: Key = tenant/building/deviceId. A device moved by config_set
+    // publishes offline on its old topic and online on the new one: two entries.
+    private readonly ConcurrentDictionary<string, DevicePresence> _devices = new();
+
+    // Prometheus metrics
+    private static readonly Gauge DevicesOnline = Metrics.CreateGauge(
+        "devices_online",
+        "ESP32 devices currently online (retained presence)",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "tenant", "building" }
+        });
+
+    private static readonly Counter PresenceTransitionsTotal = Metrics.CreateCounter(
+        "device_presence_transitions_total",
+        "Device presence changes",
+        new CounterConfiguration
+        {
+            LabelNames = new[] { "state" }
+        });
+
+    public DevicePresenceService(ILogger<DevicePresenceService> logger)
+    {
+        _logger = logger;
+    }
+
+    /// <summary>
+    /// Process a presence message (birth, Will, or retained replay)
+    /// Topic: safesignal/{tenant}/{building}/device/{deviceId}/presence
+    /// </summary>
+    public void HandlePresence(string topic, string payload)
+    {
+        var parts = topic.Split('/');
+        if (parts.Length != 6)
+            return;
+
+        var tenantId = parts[1];
+        var buildingId = parts[2];
+        var deviceId = parts[4];
+
+        using var doc = JsonDocument.Parse(payload);
+        var root = doc.RootElement;
+
+        var online = root.TryGetProperty("state", out var state) && state.GetString() == "online";
+        var version = root.TryGetProperty("version", out var v) ? v.GetString() : null;
+
+        var presence = _devices.GetOrAdd($"{tenantId}/{buildingId}/{deviceId}", _ => new DevicePresence
+        {
+            DeviceId = deviceId,
+            TenantId = tenantId,
+            BuildingId = buildingId
+        });
+
+        var changed = presence.Online != online;
+        presence.Online = online;
+        presence.Since = DateTimeOffset.UtcNow;
+        if (version != null)
+            presence.Version = version;
+
+        if (changed)
+        {
+            PresenceTransitionsTotal.WithLabels(online ? "online" : "offline").Inc();
+
+            if (online)
+            {
+                _logger.LogInformation("Device online: Device={DeviceId}, Tenant={Tenant}, Building={Building}, Version={Version}",
+                    deviceId, tenantId, buildingId, presence.Version);
+            }
+            else
+            {
+                _logger.LogWarning("Device offline: Device={DeviceId}, Tenant={Tenant}, Building={Building}",
+                    deviceId, tenantId, buildingId);
+            }
+        }
+
+        UpdateOnlineGauge(tenantId, buildingId);
+    }
+
+    /// <summary>
+    /// Get devices currently online, one entry per device (the latest, should a
+    /// stale retained "online" remain on a topic the device has left)
+    /// </summary>
+    public IEnumerable<DevicePresence> GetOnlineDevices()
+    {
+        return _devices.Values
+            .Where(d => d.Online)
+            .GroupBy(d => d.DeviceId)
+            .Select(g => g.OrderByDescending(d => d.Since).First());
+    }
+
+    /// <summary>
+    /// Get presence summary for the status dashboard
+    /// </summary>
+    public object GetStatus()
+    {
+        var devices = _devices.Values.OrderBy(d => d.DeviceId).ToList();
+
+        return new
+        {
+            online = devices.Count(d => d.Online),
+            offline = devices.Count(d => !d.Online),
+            devices = devices.Select(d => new
+            {
+                deviceId = d.DeviceId,
+                tenantId = d.TenantId,
+                buildingId = d.BuildingId,
+                online = d.Online,
+                since = d.Since,
+                version = d.Version
+            })
+        };
+    }
+
+    private void UpdateOnlineGauge(string tenantId, string buildingId)
+    {
+        var count = _devices.Values.Count(d => d.Online && d.TenantId == tenantId && d.BuildingId == buildingId);
+        DevicesOnline.WithLabels(tenantId, buildingId).Set(count);
+    }
+
+    public class DevicePresence
+    {
+        public string DeviceId { get; init; } = string.Empty;
+        public string TenantId { get; init; } = string.Empty;
+        public string BuildingId { get; init; } = string.Empty;
+        public bool Online { get; set; }
+        public DateTimeOffset Since { get; set; }
+        public string? Version { get; set; }
+    }
+}
@@ -0,0 +1,218 @@
+using System.Collections.Concurrent;
+using System.Text.Json;
+using Prometheus;
+
+namespace SafeSignal.Edge.PolicyService.Services;
+
+/// <summary>
+/// Device Status Service
+///
+/// Reconstructs full per-device state from change-driven status reports on
+/// safesignal/{tenant}/{building}/device/status. Devices send a full STATUS
+/// keyframe on connect and on a long interval, and compact STATUS_DELTA messages
+/// carrying only changed fields in between. Every message has a sequence number;
+/// a gap means a delta was lost (QoS 0) and a fresh keyframe is requested over the
+/// device command channel.
+/// </summary>
+public class DeviceStatusService
+{
+    private readonly ILogger<DeviceStatusService> _logger;
+
+    // Reconstructed state: Key = tenant/building/deviceId. A device moved by config_set
+    // starts a new entry (keyframe on reconnect); keyframe requests follow its new topic.
+    private readonly ConcurrentDictionary<string, DeviceState> _devices = new();
+
+    // Don't flood a device with keyframe requests while its link is lossy
+    private static readonly TimeSpan KeyframeRequestInterval = TimeSpan.FromSeconds(60);
+
+    // Prometheus metrics
+    private static readonly Gauge DeviceRssiDbm = Metrics.CreateGauge(
+        "device_rssi_dbm",
+        "Last reported WiFi RSSI per device",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "device" }
+        });
+
+    private static readonly Gauge DeviceFreeHeapBytes = Metrics.CreateGauge(
+        "device_free_heap_bytes",
+        "Last reported free heap per device",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "device" }
+        });
+
+    private static readonly Gauge DeviceQueueDepth = Metrics.CreateGauge(
+        "device_queue_depth",
+        "Last reported pending alert queue depth per device",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "device" }
+        });
+
+    private static readonly Gauge DeviceFlashWarning = Metrics.CreateGauge(
+        "device_flash_warning",
+        "Last reported flash wear/usage warning level per device (0 ok, 1 low, 2 critical)",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "device" }
+        });
+
+    private static readonly Counter DeviceStatusMessagesTotal = Metrics.CreateCounter(
+        "device_status_messages_total",
+        "Device status messages by kind",
+        new CounterConfiguration
+        {
+            LabelNames = new[] { "kind" }
+        });
+
+    public DeviceStatusService(ILogger<DeviceStatusService> logger)
+    {
+        _logger = logger;
+    }
+
+    /// <summary>
+    /// Apply a status keyframe or delta
+    /// </summary>
+    /// <returns>Command topic to request a keyframe on, or null if state is consistent</returns>
+    public string? HandleStatus(string topic, string payload)
+    {
+        var parts = topic.Split('/');
+        if (parts.Length != 5)
+            return null;
+
+        using var doc = JsonDocument.Parse(payload);
+        var root = doc.RootElement;
+
+        var deviceId = root.GetProperty("deviceId").GetString();
+        var type = root.GetProperty("type").GetString();
+        var seq = root.TryGetProperty("seq", out var seqElement) ? seqElement.GetInt64() : 0;
+
+        if (string.IsNullOrEmpty(deviceId))
+            return null;
+
+        var state = _devices.GetOrAdd($"{parts[1]}/{parts[2]}/{deviceId}", _ => new DeviceState
+        {
+            DeviceId = deviceId,
+            TenantId = parts[1],
+            BuildingId = parts[2]
+        });
+
+        lock (state)
+        {
+            if (type == "STATUS")
+            {
+                // Keyframe: replaces everything and resets the sequence baseline
+                state.RoomId = root.TryGetProperty("roomId", out var room) ? room.GetString() : state.RoomId;
+                state.Version = root.TryGetProperty("version", out var version) ? version.GetString() : state.Version;
+                state.Uptime = root.TryGetProperty("uptime", out var uptime) ? uptime.GetInt64() : state.Uptime;
+                ApplyFields(state, root);
+
+                state.Seq = seq;
+                state.Synced = true;
+                DeviceStatusMessagesTotal.WithLabels("keyframe").Inc();
+            }
+            else if (type == "STATUS_DELTA")
+            {
+                DeviceStatusMessagesTotal.WithLabels("delta").Inc();
+
+                if (!state.Synced || seq != state.Seq + 1)
+                {
+                    // Missed a delta (or restarted edge): fields we don't have may be stale
+                    _logger.LogWarning(
+                        "Status delta out of sequence: Device={DeviceId}, Expected={Expected}, Got={Seq}",
+                        deviceId, state.Seq + 1, seq);
+
+                    ApplyFields(state, root);
+                    state.Seq = seq;
+                    state.Synced = false;
+                    DeviceStatusMessagesTotal.WithLabels("gap").Inc();
+                }
+                else
+                {
+                    ApplyFields(state, root);
+                    state.Seq = seq;
+                }
+            }
+            else
+            {
+                return null;
+            }
+
+            state.UpdatedAt = DateTimeOffset.UtcNow;
+            UpdateGauges(state);
+
+            if (state.Synced || DateTimeOffset.UtcNow - state.KeyframeRequestedAt < KeyframeRequestInterval)
+                return null;
+
+            state.KeyframeRequestedAt = DateTimeOffset.UtcNow;
+            DeviceStatusMessagesTotal.WithLabels("keyframe_requested").Inc();
+            return $"safesignal/{state.TenantId}/{state.BuildingId}/device/{state.DeviceId}/cmd";
+        }
+    }
+
+    /// <summary>
+    /// Get reconstructed state for all devices
+    /// </summary>
+    public IEnumerable<object> GetStatus()
+    {
+        return _devices.Values.OrderBy(d => d.DeviceId).Select(d => new
+        {
+            deviceId = d.DeviceId,
+            tenantId = d.TenantId,
+            buildingId = d.BuildingId,
+            roomId = d.RoomId,
+            version = d.Version,
+            rssi = d.Rssi,
+            freeHeap = d.FreeHeap,
+            queueDepth = d.QueueDepth,
+            flashWarn = d.FlashWarn,
+            uptimeAtKeyframe = d.Uptime,
+            seq = d.Seq,
+            synced = d.Synced,
+            updatedAt = d.UpdatedAt
+        });
+    }
+
+    private static void ApplyFields(DeviceState state, JsonElement root)
+    {
+        if (root.TryGetProperty("rssi", out var rssi))
+            state.Rssi = rssi.GetInt32();
+        if (root.TryGetProperty("freeHeap", out var heap))
+            state.FreeHeap = heap.GetInt64();
+        if (root.TryGetProperty("queueDepth", out var queue))
+            state.QueueDepth = queue.GetInt32();
+        if (root.TryGetProperty("flashWarn", out var flash))
+            state.FlashWarn = flash.GetInt32();
+    }
+
+    private static void UpdateGauges(DeviceState state)
+    {
+        if (state.Rssi.HasValue)
+            DeviceRssiDbm.WithLabels(state.DeviceId).Set(state.Rssi.Value);
+        if (state.FreeHeap.HasValue)
+            DeviceFreeHeapBytes.WithLabels(state.DeviceId).Set(state.FreeHeap.Value);
+        if (state.QueueDepth.HasValue)
+            DeviceQueueDepth.WithLabels(state.DeviceId).Set(state.QueueDepth.Value);
+        if (state.FlashWarn.HasValue)
+            DeviceFlashWarning.WithLabels(state.DeviceId).Set(state.FlashWarn.Value);
+    }
+
+    private class DeviceState
+    {
+        public string DeviceId { get; init; } = string.Empty;
+        public string TenantId { get; init; } = string.Empty;
+        public string BuildingId { get; init; } = string.Empty;
+        public string? RoomId { get; set; }
+        public string? Version { get; set; }
+        public int? Rssi { get; set; }
+        public long? FreeHeap { get; set; }
+        public int? QueueDepth { get; set; }
+        public int? FlashWarn { get; set; }
+        public long? Uptime { get; set; }
+        public long Seq { get; set; }
+        public bool Synced { get; set; }
+        public DateTimeOffset UpdatedAt { get; set; }
+        public DateTimeOffset KeyframeRequestedAt { get; set; } = DateTimeOffset.MinValue;
+    }
+}
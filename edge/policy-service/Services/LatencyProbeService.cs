@@ -0,0 +1,234 @@
+using System.Collections.Concurrent;
+using System.Diagnostics;
+using System.Text.Json;
+using Prometheus;
+
+namespace SafeSignal.Edge.PolicyService.Services;
+
+/// <summary>
+/// Device Latency Probe Service
+///
+/// Measures edge ↔ device round-trip latency over the device command channel.
+/// Devices are taken from DevicePresenceService; each online one is pinged periodically on
+/// safesignal/{tenant}/{building}/device/{deviceId}/cmd and the echoed pong
+/// (receive/send timestamps from the device's MQTT task) is turned into RTT and
+/// clock skew histograms per building.
+/// </summary>
+public class LatencyProbeService
+{
+    private readonly ILogger<LatencyProbeService> _logger;
+    private readonly DevicePresenceService _presence;
+
+    // Probe state for online devices: Key = deviceId
+    private readonly ConcurrentDictionary<string, ProbeTarget> _devices = new();
+
+    // Probes awaiting a pong: Key = probe id
+    private readonly ConcurrentDictionary<string, PendingProbe> _pending = new();
+
+    private long _nextProbeId = 0;
+
+    // Configuration (loaded from appsettings.json)
+    private readonly TimeSpan _probeInterval;
+    private readonly TimeSpan _probeTimeout;
+
+    // Prometheus metrics
+    private static readonly Histogram DeviceRttSeconds = Metrics.CreateHistogram(
+        "device_rtt_seconds",
+        "Edge to device round-trip time, excluding device processing time",
+        new HistogramConfiguration
+        {
+            LabelNames = new[] { "tenant", "building" },
+            Buckets = Histogram.ExponentialBuckets(0.005, 2, 11) // 5 ms .. ~5 s
+        });
+
+    private static readonly Histogram DeviceClockSkewSeconds = Metrics.CreateHistogram(
+        "device_clock_skew_seconds",
+        "Device clock offset from edge clock (positive = device ahead)",
+        new HistogramConfiguration
+        {
+            LabelNames = new[] { "tenant", "building" },
+            Buckets = new[] { -5, -2, -1, -0.5, -0.25, -0.1, 0, 0.1, 0.25, 0.5, 1, 2, 5 }
+        });
+
+    private static readonly Gauge DeviceLastRttSeconds = Metrics.CreateGauge(
+        "device_last_rtt_seconds",
+        "Most recent round-trip time per device",
+        new GaugeConfiguration
+        {
+            LabelNames = new[] { "device" }
+        });
+
+    private static readonly Counter DeviceProbesTotal = Metrics.CreateCounter(
+        "device_probes_total",
+        "Latency probes by result",
+        new CounterConfiguration
+        {
+            LabelNames = new[] { "result" }
+        });
+
+    public LatencyProbeService(
+        DevicePresenceService presence,
+        ILogger<LatencyProbeService> logger,
+        IConfiguration configuration)
+    {
+        _presence = presence;
+        _logger = logger;
+
+        // Load configuration with defaults
+        _probeInterval = TimeSpan.FromSeconds(int.Parse(configuration["LatencyProbe:IntervalSeconds"] ?? "30"));
+        _probeTimeout = TimeSpan.FromSeconds(int.Parse(configuration["LatencyProbe:TimeoutSeconds"] ?? "10"));
+
+        _logger.LogInformation(
+            "Latency probe initialized: Interval={Interval}s, Timeout={Timeout}s",
+            _probeInterval.TotalSeconds, _probeTimeout.TotalSeconds);
+    }
+
+    /// <summary>
+    /// How often the MQTT handler should ask for due probes
+    /// </summary>
+    public TimeSpan TickInterval => TimeSpan.FromSeconds(1);
+
+    /// <summary>
+    /// Build ping commands for devices whose probe interval has elapsed
+    /// Also expires unanswered probes and forgets devices that went offline.
+    /// </summary>
+    public IReadOnlyList<(string Topic, string Payload)> CreateDueProbes()
+    {
+        var now = DateTimeOffset.UtcNow;
+        var probes = new List<(string Topic, string Payload)>();
+
+        foreach (var (id, probe) in _pending)
+        {
+            if (Stopwatch.GetElapsedTime(probe.SentTimestamp) > _probeTimeout && _pending.TryRemove(id, out _))
+            {
+                DeviceProbesTotal.WithLabels("timeout").Inc();
+                _logger.LogWarning("Latency probe timed out: Device={DeviceId}, ProbeId={ProbeId}",
+                    probe.Target.DeviceId, id);
+            }
+        }
+
+        var online = _presence.GetOnlineDevices().ToDictionary(d => d.DeviceId);
+
+        foreach (var deviceId in _devices.Keys)
+        {
+            if (!online.ContainsKey(deviceId) && _devices.TryRemove(deviceId, out _))
+                DeviceLastRttSeconds.RemoveLabelled(deviceId);
+        }
+
+        foreach (var device in online.Values)
+        {
+            var target = _devices.GetOrAdd(device.DeviceId,
+                _ => new ProbeTarget(device.TenantId, device.BuildingId, device.DeviceId));
+
+            // Moved to another tenant/building (config_set): probe its new cmd topic
+            if (target.TenantId != device.TenantId || target.BuildingId != device.BuildingId)
+            {
+                target = new ProbeTarget(device.TenantId, device.BuildingId, device.DeviceId);
+                _devices[device.DeviceId] = target;
+            }
+
+            if (now - target.LastProbe < _probeInterval)
+                continue;
+
+            var probeId = Interlocked.Increment(ref _nextProbeId).ToString();
+            var t0 = now.ToUnixTimeMilliseconds();
+
+            target.LastProbe = now;
+            _pending[probeId] = new PendingProbe(target, t0, Stopwatch.GetTimestamp());
+
+            var topic = $"safesignal/{target.TenantId}/{target.BuildingId}/device/{target.DeviceId}/cmd";
+            var payload = $"{{\"cmd\":\"ping\",\"id\":\"{probeId}\",\"t0\":{t0}}}";
+            probes.Add((topic, payload));
+
+            DeviceProbesTotal.WithLabels("sent").Inc();
+        }
+
+        return probes;
+    }
+
+    /// <summary>
+    /// Process a command response; pongs complete the matching probe
+    /// Topic: safesignal/{tenant}/{building}/device/{deviceId}/cmd/resp
+    /// </summary>
+    public void HandleCommandResponse(string topic, string payload)
+    {
+        var receivedTimestamp = Stopwatch.GetTimestamp();
+
+        using var doc = JsonDocument.Parse(payload);
+        var root = doc.RootElement;
+
+        if (!root.TryGetProperty("cmd", out var cmd) || cmd.GetString() != "ping")
+            return;
+
+        var probeId = root.TryGetProperty("id", out var idElement) ? idElement.GetString() : null;
+        if (probeId == null || !_pending.TryRemove(probeId, out var probe))
+        {
+            // Late pong after timeout, or a ping sent by another tool
+            DeviceProbesTotal.WithLabels("unmatched").Inc();
+            return;
+        }
+
+        var rxUs = root.GetProperty("rxUs").GetInt64();
+        var txUs = root.GetProperty("txUs").GetInt64();
+        var epochMs = root.GetProperty("epochMs").GetInt64();
+
+        // Remove time spent on the device between receive and send
+        var totalSeconds = Stopwatch.GetElapsedTime(probe.SentTimestamp, receivedTimestamp).TotalSeconds;
+        var deviceSeconds = Math.Max(0, txUs - rxUs) / 1_000_000.0;
+        var rttSeconds = Math.Max(0, totalSeconds - deviceSeconds);
+
+        var target = probe.Target;
+        DeviceRttSeconds.WithLabels(target.TenantId, target.BuildingId).Observe(rttSeconds);
+        DeviceLastRttSeconds.WithLabels(target.DeviceId).Set(rttSeconds);
+        DeviceProbesTotal.WithLabels("received").Inc();
+
+        target.LastRttMs = rttSeconds * 1000;
+
+        // Clock skew: device receive time vs. edge estimate of when the ping arrived
+        if (epochMs > 0)
+        {
+            var skewMs = epochMs - (probe.T0 + rttSeconds * 1000 / 2);
+            DeviceClockSkewSeconds.WithLabels(target.TenantId, target.BuildingId).Observe(skewMs / 1000);
+            target.LastSkewMs = skewMs;
+        }
+
+        _logger.LogDebug(
+            "Latency probe: Device={DeviceId}, RTT={Rtt:F1}ms, DeviceTime={DeviceTime:F2}ms, Skew={Skew}ms",
+            target.DeviceId, rttSeconds * 1000, deviceSeconds * 1000, target.LastSkewMs);
+    }
+
+    /// <summary>
+    /// Get latest probe results for all known devices
+    /// </summary>
+    public IEnumerable<object> GetStatus()
+    {
+        return _devices.Values.Select(t => new
+        {
+            deviceId = t.DeviceId,
+            tenantId = t.TenantId,
+            buildingId = t.BuildingId,
+            lastProbe = t.LastProbe,
+            lastRttMs = t.LastRttMs,
+            lastSkewMs = t.LastSkewMs
+        });
+    }
+
+    private class ProbeTarget
+    {
+        public ProbeTarget(string tenantId, string buildingId, string deviceId)
+        {
+            TenantId = tenantId;
+            BuildingId = buildingId;
+            DeviceId = deviceId;
+        }
+
+        public string TenantId { get; }
+        public string BuildingId { get; }
+        public string DeviceId { get; }
+        public DateTimeOffset LastProbe { get; set; } = DateTimeOffset.MinValue;
+        public double? LastRttMs { get; set; }
+        public double? LastSkewMs { get; set; }
+    }
+
+    private record PendingProbe(ProbeTarget Target, long T0, long SentTimestamp);
+}
@@ -17,6 +17,9 @@ public class MqttHandlerService : BackgroundService
 {
     private readonly AlertStateMachine _stateMachine;
     private readonly RateLimitService _rateLimitService;
+    private readonly LatencyProbeService _latencyProbe;
+    private readonly DevicePresenceService _presence;
+    private readonly DeviceStatusService _deviceStatus;
     private readonly ILogger<MqttHandlerService> _logger;
     private readonly IConfiguration _configuration;
     private IManagedMqttClient? _mqttClient;
@@ -40,11 +43,17 @@ public class MqttHandlerService : BackgroundService
     public MqttHandlerService(
         AlertStateMachine stateMachine,
         RateLimitService rateLimitService,
+        LatencyProbeService latencyProbe,
+        DevicePresenceService presence,
+        DeviceStatusService deviceStatus,
         ILogger<MqttHandlerService> logger,
         IConfiguration configuration)
     {
         _stateMachine = stateMachine;
         _rateLimitService = rateLimitService;
+        _latencyProbe = latencyProbe;
+        _presence = presence;
+        _deviceStatus = deviceStatus;
         _logger = logger;
         _configuration = configuration;
     }
@@ -57,8 +66,12 @@ public class MqttHandlerService : BackgroundService
         {
             await ConnectToMqttBroker(stoppingToken);
 
-            // Keep service running
-            await Task.Delay(Timeout.Infinite, stoppingToken);
+            // Keep service running, pinging devices for latency measurements
+            while (!stoppingToken.IsCancellationRequested)
+            {
+                await Task.Delay(_latencyProbe.TickInterval, stoppingToken);
+                await SendLatencyProbes();
+            }
         }
         catch (OperationCanceledException)
         {
@@ -169,6 +182,29 @@ public class MqttHandlerService : BackgroundService
         var paStatusTopic = "pa/+/status";
         await _mqttClient.SubscribeAsync(paStatusTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtMostOnce);
         _logger.LogInformation("Subscribed to PA status topic: {Topic}", paStatusTopic);
+
+        // Subscribe to ESP32 presence (retained birth/Will messages) and command responses
+        var presenceTopic = "safesignal/+/+/device/+/presence";
+        await _mqttClient.SubscribeAsync(presenceTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtLeastOnce);
+        _logger.LogInformation("Subscribed to device presence topic: {Topic}", presenceTopic);
+
+        var statusTopic = "safesignal/+/+/device/status";
+        await _mqttClient.SubscribeAsync(statusTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtMostOnce);
+        _logger.LogInformation("Subscribed to device status topic: {Topic}", statusTopic);
+
+        var commandResponseTopic = "safesignal/+/+/device/+/cmd/resp";
+        await _mqttClient.SubscribeAsync(commandResponseTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtMostOnce);
+        _logger.LogInformation("Subscribed to device command response topic: {Topic}", commandResponseTopic);
+
+        // ESP32 alerts: one per message; after an outage the newest still comes here, first
+        var deviceAlertTopic = "safesignal/+/+/alerts/trigger";
+        await _mqttClient.SubscribeAsync(deviceAlertTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtLeastOnce);
+        _logger.LogInformation("Subscribed to device alert topic: {Topic}", deviceAlertTopic);
+
+        // ESP32 backlog batches (JSON array of queued alerts, sent after an outage)
+        var alertBatchTopic = "safesignal/+/+/alerts/batch";
+        await _mqttClient.SubscribeAsync(alertBatchTopic, MQTTnet.Protocol.MqttQualityOfServiceLevel.AtLeastOnce);
+        _logger.LogInformation("Subscribed to device alert batch topic: {Topic}", alertBatchTopic);
     }
 
     private Task OnDisconnectedAsync(MqttClientDisconnectedEventArgs args)
@@ -195,6 +231,28 @@ public class MqttHandlerService : BackgroundService
             {
                 await HandlePaStatus(topic, payload);
             }
+            else if (topic.StartsWith("safesignal/") && topic.EndsWith("/presence"))
+            {
+                _presence.HandlePresence(topic, payload);
+                MqttMessagesTotal.WithLabels("device_presence", "received").Inc();
+            }
+            else if (topic.StartsWith("safesignal/") && topic.EndsWith("/device/status"))
+            {
+                await HandleDeviceStatus(topic, payload);
+            }
+            else if (topic.StartsWith("safesignal/") && topic.EndsWith("/alerts/trigger"))
+            {
+                await HandleDeviceAlert(topic, payload);
+            }
+            else if (topic.StartsWith("safesignal/") && topic.EndsWith("/alerts/batch"))
+            {
+                await HandleAlertBatch(topic, payload);
+            }
+            else if (topic.StartsWith("safesignal/") && topic.EndsWith("/cmd/resp"))
+            {
+                _latencyProbe.HandleCommandResponse(topic, payload);
+                MqttMessagesTotal.WithLabels("device_cmd_resp", "received").Inc();
+            }
         }
         catch (Exception ex)
         {
@@ -219,48 +277,226 @@ public class MqttHandlerService : BackgroundService
                 return;
             }
 
-            MqttMessagesTotal.WithLabels("alert", "received").Inc();
+            await ProcessAlertTrigger(trigger, receivedAt);
+        }
+        catch (Exception ex)
+        {
+            _logger.LogError(ex, "Error handling alert trigger: Topic={Topic}", topic);
+            MqttMessagesTotal.WithLabels("alert", "error").Inc();
+        }
+    }
 
-            _logger.LogInformation(
-                "Alert trigger received: AlertId={AlertId}, Tenant={Tenant}, Building={Building}, " +
-                "SourceRoom={Room}, Origin={Origin}, Device={DeviceId}",
-                trigger.AlertId, trigger.TenantId, trigger.BuildingId, trigger.SourceRoomId, trigger.Origin, trigger.DeviceId);
+    /// <summary>
+    /// Tenant and building of safesignal/{tenant}/{building}/alerts/{trigger|batch}.
+    /// The broker ACL ties the topic to the publishing device; the IDs inside the
+    /// payload are not trusted.
+    /// </summary>
+    private static bool TryParseDeviceAlertTopic(string topic, out string tenantId, out string buildingId)
+    {
+        var parts = topic.Split('/');
+        tenantId = parts.Length == 5 ? parts[1] : string.Empty;
+        buildingId = parts.Length == 5 ? parts[2] : string.Empty;
+        return parts.Length == 5;
+    }
 
-            // Check rate limits (device + tenant)
-            if (!_rateLimitService.CheckAlert(trigger.DeviceId, trigger.TenantId))
-            {
-                _logger.LogWarning(
-                    "╔═══════════════════════════════════════════════════════════╗\n" +
-                    "║   ⚠️  RATE LIMIT EXCEEDED - ALERT BLOCKED                ║\n" +
-                    "╚═══════════════════════════════════════════════════════════╝\n" +
-                    "Alert: {AlertId}, Device: {DeviceId}, Tenant: {TenantId}",
-                    trigger.AlertId, trigger.DeviceId, trigger.TenantId);
+    private async Task HandleDeviceAlert(string topic, string payload)
+    {
+        var receivedAt = DateTimeOffset.UtcNow;
 
-                MqttMessagesTotal.WithLabels("alert", "rate_limited").Inc();
+        if (!TryParseDeviceAlertTopic(topic, out var tenantId, out var buildingId))
+        {
+            _logger.LogError("Malformed device alert topic: {Topic}", topic);
+            MqttMessagesTotal.WithLabels("alert", "parse_error").Inc();
+            return;
+        }
+
+        try
+        {
+            using var doc = JsonDocument.Parse(payload);
+            var trigger = ParseDeviceAlert(doc.RootElement, receivedAt);
+            if (trigger == null)
+            {
+                _logger.LogError("Invalid device alert: {Payload}", payload);
+                MqttMessagesTotal.WithLabels("alert", "parse_error").Inc();
                 return;
             }
 
-            // Process through FSM
-            var alertEvent = await _stateMachine.ProcessTrigger(trigger, receivedAt);
-            if (alertEvent == null)
+            if (trigger.TenantId != tenantId || trigger.BuildingId != buildingId)
             {
-                // Alert was rejected by FSM
-                MqttMessagesTotal.WithLabels("alert", "rejected").Inc();
+                _logger.LogWarning(
+                    "Device alert does not match its topic, rejected: AlertId={AlertId}, " +
+                    "Tenant={Tenant}, Building={Building}, Topic={Topic}",
+                    trigger.AlertId, trigger.TenantId, trigger.BuildingId, topic);
+                MqttMessagesTotal.WithLabels("alert", "topic_mismatch").Inc();
                 return;
             }
 
-            // Fan out PA commands to target rooms
-            await FanOutPaCommands(alertEvent);
-
-            MqttMessagesTotal.WithLabels("alert", "processed").Inc();
+            await ProcessAlertTrigger(trigger, receivedAt);
+        }
+        catch (JsonException ex)
+        {
+            _logger.LogError(ex, "Failed to parse device alert: Topic={Topic}", topic);
+            MqttMessagesTotal.WithLabels("alert", "parse_error").Inc();
         }
         catch (Exception ex)
         {
-            _logger.LogError(ex, "Error handling alert trigger: Topic={Topic}", topic);
+            _logger.LogError(ex, "Error handling device alert: Topic={Topic}", topic);
             MqttMessagesTotal.WithLabels("alert", "error").Inc();
         }
     }
 
+    private async Task HandleAlertBatch(string topic, string payload)
+    {
+        var receivedAt = DateTimeOffset.UtcNow;
+
+        if (!TryParseDeviceAlertTopic(topic, out var tenantId, out var buildingId))
+        {
+            _logger.LogError("Malformed alert batch topic: {Topic}", topic);
+            MqttMessagesTotal.WithLabels("alert_batch", "parse_error").Inc();
+            return;
+        }
+
+        try
+        {
+            using var doc = JsonDocument.Parse(payload);
+            if (doc.RootElement.ValueKind != JsonValueKind.Array)
+            {
+                _logger.LogError("Alert batch is not a JSON array: Topic={Topic}", topic);
+                MqttMessagesTotal.WithLabels("alert_batch", "parse_error").Inc();
+                return;
+            }
+
+            MqttMessagesTotal.WithLabels("alert_batch", "received").Inc();
+            _logger.LogInformation("Alert batch received: Topic={Topic}, Count={Count}",
+                topic, doc.RootElement.GetArrayLength());
+
+            // Items are in the device's delivery order; process them one by one in that order
+            string? deviceId = null;
+            foreach (var item in doc.RootElement.EnumerateArray())
+            {
+                var trigger = ParseDeviceAlert(item, receivedAt);
+                if (trigger == null)
+                {
+                    _logger.LogError("Invalid alert in batch: {Item}", item.GetRawText());
+                    MqttMessagesTotal.WithLabels("alert", "parse_error").Inc();
+                    continue;
+                }
+
+                // A batch comes from one device (its own queue), for the topic's tenant and
+                // building; the topic has no device segment, so the first item fixes the device
+                deviceId ??= trigger.SourceDeviceId;
+                if (trigger.TenantId != tenantId || trigger.BuildingId != buildingId ||
+                    trigger.SourceDeviceId != deviceId)
+                {
+                    _logger.LogWarning(
+                        "Batched alert does not match its topic, rejected: AlertId={AlertId}, " +
+                        "Tenant={Tenant}, Building={Building}, Device={DeviceId}, Topic={Topic}",
+                        trigger.AlertId, trigger.TenantId, trigger.BuildingId, trigger.SourceDeviceId, topic);
+                    MqttMessagesTotal.WithLabels("alert", "topic_mismatch").Inc();
+                    continue;
+                }
+
+                try
+                {
+                    await ProcessAlertTrigger(trigger, receivedAt);
+                }
+                catch (Exception ex)
+                {
+                    _logger.LogError(ex, "Error handling batched alert: AlertId={AlertId}", trigger.AlertId);
+                    MqttMessagesTotal.WithLabels("alert", "error").Inc();
+                }
+            }
+        }
+        catch (JsonException ex)
+        {
+            _logger.LogError(ex, "Failed to parse alert batch: Topic={Topic}", topic);
+            MqttMessagesTotal.WithLabels("alert_batch", "parse_error").Inc();
+        }
+    }
+
+    /// <summary>
+    /// Map an ESP32 queued alert (firmware alert payload) to an alert trigger
+    /// </summary>
+    private static AlertTrigger? ParseDeviceAlert(JsonElement item, DateTimeOffset receivedAt)
+    {
+        if (item.ValueKind != JsonValueKind.Object ||
+            !item.TryGetProperty("alertId", out var alertId) ||
+            !item.TryGetProperty("deviceId", out var deviceId) ||
+            !item.TryGetProperty("tenantId", out var tenantId) ||
+            !item.TryGetProperty("buildingId", out var buildingId) ||
+            !item.TryGetProperty("sourceRoomId", out var roomId))
+        {
+            return null;
+        }
+
+        var mode = item.TryGetProperty("mode", out var modeValue) && modeValue.ValueKind == JsonValueKind.Number
+            ? modeValue.GetInt32() switch
+            {
+                0 => "SILENT",
+                2 => "LOCKDOWN",
+                3 => "EVACUATION",
+                _ => "AUDIBLE"
+            }
+            : "AUDIBLE";
+
+        // Device timestamps before 2020 are boot-relative (clock not synced yet)
+        var timestamp = item.TryGetProperty("timestamp", out var ts) && ts.ValueKind == JsonValueKind.Number &&
+                        ts.GetInt64() >= 1577836800
+            ? DateTimeOffset.FromUnixTimeSeconds(ts.GetInt64())
+            : receivedAt;
+
+        return new AlertTrigger
+        {
+            AlertId = alertId.GetString() ?? string.Empty,
+            TenantId = tenantId.GetString() ?? string.Empty,
+            BuildingId = buildingId.GetString() ?? string.Empty,
+            SourceDeviceId = deviceId.GetString() ?? string.Empty,
+            SourceRoomId = roomId.GetString() ?? string.Empty,
+            Origin = "ESP32",
+            CausalChainId = alertId.GetString() ?? string.Empty,
+            Mode = mode,
+            Timestamp = timestamp.ToString("O")
+        };
+    }
+
+    private async Task ProcessAlertTrigger(AlertTrigger trigger, DateTimeOffset receivedAt)
+    {
+        MqttMessagesTotal.WithLabels("alert", "received").Inc();
+
+        _logger.LogInformation(
+            "Alert trigger received: AlertId={AlertId}, Tenant={Tenant}, Building={Building}, " +
+            "SourceRoom={Room}, Origin={Origin}, Device={DeviceId}",
+            trigger.AlertId, trigger.TenantId, trigger.BuildingId, trigger.SourceRoomId, trigger.Origin, trigger.DeviceId);
+
+        // Check rate limits (device + tenant)
+        if (!_rateLimitService.CheckAlert(trigger.DeviceId, trigger.TenantId))
+        {
+            _logger.LogWarning(
+                "╔═══════════════════════════════════════════════════════════╗\n" +
+                "║   ⚠️  RATE LIMIT EXCEEDED - ALERT BLOCKED                ║\n" +
+                "╚═══════════════════════════════════════════════════════════╝\n" +
+                "Alert: {AlertId}, Device: {DeviceId}, Tenant: {TenantId}",
+                trigger.AlertId, trigger.DeviceId, trigger.TenantId);
+
+            MqttMessagesTotal.WithLabels("alert", "rate_limited").Inc();
+            return;
+        }
+
+        // Process through FSM
+        var alertEvent = await _stateMachine.ProcessTrigger(trigger, receivedAt);
+        if (alertEvent == null)
+        {
+            // Alert was rejected by FSM
+            MqttMessagesTotal.WithLabels("alert", "rejected").Inc();
+            return;
+        }
+
+        // Fan out PA commands to target rooms
+        await FanOutPaCommands(alertEvent);
+
+        MqttMessagesTotal.WithLabels("alert", "processed").Inc();
+    }
+
     private async Task FanOutPaCommands(AlertEvent alertEvent)
     {
         _logger.LogInformation(
@@ -300,6 +536,46 @@ public class MqttHandlerService : BackgroundService
         }
     }
 
+    private async Task HandleDeviceStatus(string topic, string payload)
+    {
+        var keyframeTopic = _deviceStatus.HandleStatus(topic, payload);
+        MqttMessagesTotal.WithLabels("device_status", "received").Inc();
+
+        if (keyframeTopic == null)
+            return;
+
+        // Lost delta: ask the device for a full keyframe
+        var message = new MqttApplicationMessageBuilder()
+            .WithTopic(keyframeTopic)
+            .WithPayload("{\"cmd\":\"status\",\"id\":\"keyframe\"}")
+            .WithQualityOfServiceLevel(MQTTnet.Protocol.MqttQualityOfServiceLevel.AtLeastOnce)
+            .WithRetainFlag(false)
+            .Build();
+
+        await _mqttClient!.EnqueueAsync(message);
+
+        _logger.LogInformation("Status keyframe requested: Topic={Topic}", keyframeTopic);
+    }
+
+    private async Task SendLatencyProbes()
+    {
+        if (_mqttClient == null || !_mqttClient.IsConnected)
+            return;
+
+        foreach (var (topic, payload) in _latencyProbe.CreateDueProbes())
+        {
+            // QoS 0: a redelivered ping would measure the retry, not the link
+            var message = new MqttApplicationMessageBuilder()
+                .WithTopic(topic)
+                .WithPayload(payload)
+                .WithQualityOfServiceLevel(MQTTnet.Protocol.MqttQualityOfServiceLevel.AtMostOnce)
+                .WithRetainFlag(false)
+                .Build();
+
+            await _mqttClient.EnqueueAsync(message);
+        }
+    }
+
     private Task HandlePaStatus(string topic, string payload)
     {
         try
@@ -80,6 +80,35 @@ else
     fail "ACL file uses incorrect format"
 fi
 
+# Check the file authorization source is enabled with default deny
+if grep -q "EMQX_AUTHORIZATION__SOURCES=.*acl.conf" edge/docker-compose.yml && \
+   grep -q "EMQX_AUTHORIZATION__NO_MATCH=deny" edge/docker-compose.yml; then
+    pass "File ACL enabled with no_match = deny"
+else
+    fail "File ACL not enabled (acl.conf is not enforced)"
+fi
+
+# Retained alerts/PA commands must be denied (retain is on for device presence).
+# policy-service may publish pa/+/play, pa-service may subscribe to it: a
+# retained message that survives the deny rule would be replayed here.
+CERTS=edge/certs
+RETAIN_TOPIC="pa/verify-retain-$$/play"
+if command -v mosquitto_pub &> /dev/null; then
+    mosquitto_pub -h localhost -p 8883 --cafile $CERTS/ca/ca.crt \
+        --cert $CERTS/policy-service/client.crt --key $CERTS/policy-service/client.key \
+        -t "$RETAIN_TOPIC" -m '{"verify":"retain"}' -q 1 -r 2>/dev/null || true
+    RETAINED=$(mosquitto_sub -h localhost -p 8883 --cafile $CERTS/ca/ca.crt \
+        --cert $CERTS/pa-service/client.crt --key $CERTS/pa-service/client.key \
+        -t "$RETAIN_TOPIC" -C 1 -W 3 2>/dev/null || true)
+    if [ -z "$RETAINED" ]; then
+        pass "Retained PA command was not stored (deny-retain rule active)"
+    else
+        fail "Retained PA command was replayed to a new subscriber"
+    fi
+else
+    warn "mosquitto clients not installed, retained-message check skipped"
+fi
+
 echo ""
 
 # 2. Check MinIO TLS configuration
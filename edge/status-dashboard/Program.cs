@@ -26,5 +26,13 @@ app.MapGet("/api/proxy/alerts", async (IHttpClientFactory factory, int limit = 2
     return Results.Content(response, "application/json");
 });
 
+app.MapGet("/api/proxy/presence", async (IHttpClientFactory factory) =>
+{
+    var http = factory.CreateClient();
+    var policyServiceUrl = Environment.GetEnvironmentVariable("POLICY_SERVICE_URL") ?? "http://policy-service:5000";
+    var response = await http.GetStringAsync($"{policyServiceUrl}/api/devices/presence");
+    return Results.Content(response, "application/json");
+});
+
 app.Logger.LogInformation("SafeSignal Status Dashboard running on http://+:5200");
 await app.RunAsync();
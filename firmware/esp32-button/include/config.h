@@ -43,6 +43,11 @@
 #define MQTT_QOS 1
 #define MQTT_RECONNECT_INTERVAL_MS 5000
 
+/* Device identity: ECDSA P-256 (scripts/seed-certs.sh). RSA client keys make
+ * the mTLS handshake several times slower; provisioning rejects them unless
+ * this is set. Keys stored by older firmware keep working either way. */
+#define PROVISION_ALLOW_RSA_KEYS false
+
 /* Device Configuration */
 /* ========================================================================== */
 
@@ -64,8 +69,21 @@ typedef enum {
 /* Timing & Performance */
 /* ========================================================================== */
 
-#define STATUS_REPORT_INTERVAL_MS 60000
-#define HEARTBEAT_INTERVAL_MS 30000
+/* Liveness comes from MQTT keepalive + Last Will (presence topic); status is
+ * also sent on every connect, so these only catch silent drift */
+#define STATUS_REPORT_INTERVAL_MS 900000    /* 15 minutes */
+#define HEARTBEAT_INTERVAL_MS 600000        /* 10 minutes */
+
+/* Change-driven status: a delta is sent when a field crosses its threshold */
+#define STATUS_DELTA_CHECK_INTERVAL_MS 10000
+#define STATUS_DELTA_RSSI_DB 5
+#define STATUS_DELTA_HEAP_BYTES 8192
+
+/* Background jobs (see scheduler.h); jitter spreads fleet-wide publishes */
+#define STATUS_REPORT_JITTER_MS 30000
+#define HEARTBEAT_JITTER_MS 30000
+#define METRICS_FLUSH_INTERVAL_MS 300000    /* 5 minutes - batches queue stats writes to NVS */
+#define COREDUMP_UPLOAD_INTERVAL_MS 1000    /* One chunk per run while a dump is pending */
 #define ALERT_TRIGGER_TIMEOUT_MS 100
 #define MQTT_PUBLISH_TIMEOUT_MS 5000
 
@@ -81,6 +99,76 @@ typedef enum {
 /* Individual alert throttling (debounce for accidental presses) */
 #define ALERT_MIN_INTERVAL_MS 2000          /* Minimum 2s between alerts */
 
+/* Remote Configuration */
+/* ========================================================================== */
+
+/* config_set command (see mqtt_cmd.h): heartbeat, rate limits and power
+ * profile override the defaults above; pushed values are checked against
+ * these bounds. The rate limit maximum cannot exceed RATE_LIMIT_MAX_ALERTS. */
+#define POWER_PROFILE_DEFAULT 1             /* 0 performance, 1 balanced, 2 low */
+#define REMOTE_HEARTBEAT_MIN_S 60
+#define REMOTE_HEARTBEAT_MAX_S 86400
+#define REMOTE_RATE_WINDOW_MAX_S 3600
+#define REMOTE_COOLDOWN_MAX_S 86400
+
+/* OTA Updates */
+/* ========================================================================== */
+
+/* Streaming OTA from the edge (see ota.h): one chunk per request, paced to
+ * the manifest rate, paused while alerts are queued or a button was pressed
+ * recently. The rate bounds apply to the signed ota_begin command. */
+#define OTA_STEP_INTERVAL_MS 100            /* Session step while an update is active */
+#define OTA_DEFAULT_RATE_BPS 8192           /* Bytes/s when the manifest sets no rate */
+#define OTA_MIN_RATE_BPS 1024
+#define OTA_MAX_RATE_BPS 65536
+#define OTA_CHUNK_TIMEOUT_MS 10000          /* Request the chunk again after this */
+#define OTA_CHECKPOINT_BYTES 65536          /* NVS checkpoint interval (sector multiple) */
+#define OTA_ALERT_HOLDOFF_MS 60000          /* Transfer paused after a button press */
+#define OTA_RESTART_DELAY_MS 5000           /* Lets the ready status go out before restart */
+#define OTA_DELTA_STEP_BYTES 16384          /* Delta: image bytes reconstructed per step */
+
+/* Health gate for the first boot of an update (see ota_health.h): WiFi, MQTT,
+ * an acknowledged test publish and a watchdog-clean period, all within the
+ * timeout, or the bootloader reverts to the previous image. */
+#define OTA_HEALTH_TIMEOUT_MS 300000        /* From boot; rollback after this */
+#define OTA_HEALTH_CLEAN_MS 60000           /* After the PUBACK, before confirming */
+#define OTA_HEALTH_ACK_TIMEOUT_MS 10000     /* Test publish sent again after this */
+#define OTA_HEALTH_STEP_INTERVAL_MS 1000
+
+/* Alert Queue Storage */
+/* ========================================================================== */
+
+/* Persist queued alerts in the append-only log on the alert_log partition
+ * (256 alerts, sequential wear-levelled writes). false: one NVS blob per
+ * alert in the shared nvs partition (50 alerts) - see alert_store.h */
+#define ALERT_QUEUE_FLASH_LOG true
+
+/* Backlog delivery in batches: after an outage, queued alerts are packed as
+ * a JSON array on safesignal/{tenant}/{building}/alerts/batch (one PUBACK
+ * per batch). The newest alert is still published alone, first. Opt-in:
+ * the edge must subscribe to the batch topic. */
+#define ALERT_BATCH_ENABLED false
+#define ALERT_BATCH_MAX 8                   /* Alerts per batch message */
+
+/* Flash wear (see flash_stats.h): flashWarn in status when crossed */
+#define FLASH_ENDURANCE_CYCLES 100000       /* Erase cycles per sector (datasheet minimum) */
+#define FLASH_LIFETIME_TARGET_YEARS 10      /* Warn if projected wear-out is sooner */
+#define FLASH_NVS_WARN_PCT 75               /* nvs partition entries used: warning */
+#define FLASH_NVS_CRITICAL_PCT 90           /* nvs partition entries used: critical */
+
+/* Diagnostics */
+/* ========================================================================== */
+
+/* Serial console in normal operation (log_dump, log_level, tls_bench).
+ * Diagnostic commands only; provisioning commands are registered only while
+ * the device is unprovisioned - see CONSOLE_COMMANDS.md */
+#define DIAG_CONSOLE_ENABLED true
+
+/* Binary UART provisioning (provision_binary, scripts/provision_factory.py) */
+#define PROV_UART_MAX_BAUD 921600           /* Highest rate a host may negotiate */
+#define PROV_UART_BAUD_CONFIRM_MS 1000      /* Revert to the console rate if the host does not follow */
+#define PROV_UART_IDLE_TIMEOUT_MS 10000     /* Session ends when the host goes silent */
+
 /* Buffer Sizes */
 /* ========================================================================== */
 
@@ -1,68 +1,544 @@
 #include "alert_queue.h"
+#include "alert_store.h"
 #include "mqtt.h"
 #include "config.h"
+#include "log_ring.h"
+#include "time_sync.h"
+#include "watchdog.h"
+#include "flash_stats.h"
 
 #include <string.h>
+#include <time.h>
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 
 static const char *TAG = "ALERT_QUEUE";
 
 #define NVS_NAMESPACE "alert_queue"
-#define NVS_KEY_COUNT "count"
 #define NVS_KEY_STATS "stats"
-#define NVS_KEY_ALERT_PREFIX "alert_"
+
+/* Delivery task */
+#define DELIVERY_TASK_STACK 4096
+#define DELIVERY_TASK_PRIORITY 6            /* Above button (5) and status (3) */
+#define DELIVERY_MAX_SLEEP_MS 5000          /* Watchdog feed + expiry check interval */
+#define DELIVERY_DEADLINE_MS 20000          /* Supervisor deadline (see watchdog.h) */
+#define DELIVERY_ACK_QUEUE_LEN 8
+
+/* Task notification bits */
+#define NOTIFY_KICK          BIT0   /* New alert enqueued */
+#define NOTIFY_RETRY         BIT1   /* Ignore backoff (manual flush) */
+#define NOTIFY_CONNECTED     BIT2
+#define NOTIFY_DISCONNECTED  BIT3
+#define NOTIFY_ACK           BIT4   /* msg_id posted to ack_queue */
+
+#define RTC_ALERT_MAGIC 0x41525431    /* "ART1" */
+
+/* Timestamps before this are boot-relative (time was not synced) */
+#define MIN_VALID_EPOCH 1577836800  /* 2020-01-01 */
+
+/* Delivery priority by alert mode (higher goes first, lower is evicted first) */
+static uint8_t mode_priority(uint8_t mode)
+{
+    switch (mode) {
+        case ALERT_MODE_EVACUATION: return 3;
+        case ALERT_MODE_LOCKDOWN:   return 2;
+        case ALERT_MODE_AUDIBLE:    return 1;
+        case ALERT_MODE_SILENT:     return 0;
+        default:                    return 1;   /* Unknown: treat as default mode */
+    }
+}
+
+/* Per-slot delivery state (RAM only; rebuilt from the store at boot) */
+typedef struct {
+    bool used;
+    bool persisted;             /* In the store; otherwise only in rtc_alerts */
+    uint32_t ref;               /* Store record (persisted) */
+    int rtc_slot;               /* rtc_alerts entry, -1 if none */
+    int64_t persist_due_us;     /* Write to the store by then unless acknowledged */
+    uint32_t alert_id;
+    uint8_t priority;           /* mode_priority() of the alert mode */
+    uint32_t timestamp;         /* UTC, or boot-relative if time was not synced */
+    int64_t first_seen_us;      /* Enqueued or loaded this boot (esp_timer time) */
+    int64_t next_attempt_us;    /* Backoff deadline */
+    int64_t sent_us;            /* Publish time while waiting for PUBACK */
+    uint32_t attempts;
+    int msg_id;                 /* Outstanding publish, -1 if none */
+    uint32_t gen;               /* Bumped when the slot is freed: detects reuse across unlocked I/O */
+} slot_state_t;
 
 /* Queue state */
-static nvs_handle_t nvs_handle;
+static nvs_handle_t nvs_handle;     /* Stats blob */
+static const alert_store_t *store = NULL;
+static uint32_t queue_capacity = 0; /* min(ALERT_QUEUE_MAX_SIZE, store capacity) */
 static bool initialized = false;
 static alert_queue_stats_t stats = {0};
+static bool stats_dirty = false;    /* Stats changed since last flush */
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Slot table, rtc_alerts and in_flight are owned by slot_lock, held only for
+ * bookkeeping: never across a publish, flash I/O or logging. Work that needs
+ * either copies the slot out, drops the lock and re-checks slot gen after. */
+static portMUX_TYPE slot_lock = portMUX_INITIALIZER_UNLOCKED;
+static slot_state_t slots[ALERT_QUEUE_MAX_SIZE];
+static int in_flight = 0;
+
+/* Serializes store and stats NVS calls; held for one call at a time, so the
+ * button task waits on it only when it has to write flash itself */
+static SemaphoreHandle_t store_lock = NULL;
+static bool link_up = false;        /* Delivery task view of the MQTT connection */
+
+static TaskHandle_t delivery_task_handle = NULL;
+static QueueHandle_t ack_queue = NULL;
+
+/* Alerts not yet in the store. RTC slow memory survives soft resets and
+ * panics; alert_queue_init() persists whatever a reset left here. */
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    queued_alert_t alert;
+} rtc_alert_t;
+
+static RTC_NOINIT_ATTR rtc_alert_t rtc_alerts[ALERT_RTC_SLOTS];
+
+static uint32_t rtc_alert_crc(const queued_alert_t *alert)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)alert, sizeof(*alert));
+}
+
+static bool rtc_alert_valid(const rtc_alert_t *entry)
+{
+    return entry->magic == RTC_ALERT_MAGIC && entry->crc == rtc_alert_crc(&entry->alert);
+}
+
+/* Helper: Park an alert in RTC memory; returns the entry or -1 if all are taken.
+ * crc is rtc_alert_crc(alert), computed before taking the lock (caller holds slot_lock) */
+static int rtc_alert_put(const queued_alert_t *alert, uint32_t crc)
+{
+    bool taken[ALERT_RTC_SLOTS] = {0};
+
+    for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        if (slots[i].used && slots[i].rtc_slot >= 0) {
+            taken[slots[i].rtc_slot] = true;
+        }
+    }
+
+    for (int i = 0; i < ALERT_RTC_SLOTS; i++) {
+        if (!taken[i]) {
+            memcpy(&rtc_alerts[i].alert, alert, sizeof(*alert));
+            rtc_alerts[i].crc = crc;
+            rtc_alerts[i].magic = RTC_ALERT_MAGIC;  /* Valid only once complete */
+            return i;
+        }
+    }
+
+    return -1;
+}
 
-/* Helper: Generate NVS key for alert index */
-static void get_alert_key(uint32_t index, char *key_buf, size_t buf_size)
+static void rtc_alert_clear(int i)
 {
-    snprintf(key_buf, buf_size, "%s%lu", NVS_KEY_ALERT_PREFIX, index);
+    rtc_alerts[i].magic = 0;
 }
 
-/* Helper: Load stats from NVS */
+/* Helper: Load stats from NVS (older, shorter blobs leave new counters zeroed) */
 static esp_err_t load_stats(void)
 {
     size_t required_size = sizeof(alert_queue_stats_t);
+    memset(&stats, 0, sizeof(stats));
     esp_err_t ret = nvs_get_blob(nvs_handle, NVS_KEY_STATS, &stats, &required_size);
 
     if (ret == ESP_ERR_NVS_NOT_FOUND) {
-        /* First run, initialize stats */
-        memset(&stats, 0, sizeof(stats));
+        /* First run, stats stay zeroed */
         return ESP_OK;
     }
 
     return ret;
 }
 
-/* Helper: Save stats to NVS */
-static esp_err_t save_stats(void)
+/* Helper: Update a stats counter (stats are read lock-free by other tasks) */
+static void stats_add(uint32_t *counter, int32_t delta)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *counter += delta;
+    stats_dirty = true;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/* Helper: Detach a slot from its outstanding publish; the message stops counting
+ * as in flight once no slot carries it (a batch spans several) (caller holds slot_lock) */
+static void release_msg(slot_state_t *slot)
+{
+    int msg_id = slot->msg_id;
+
+    slot->msg_id = -1;
+    for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        if (slots[i].used && slots[i].msg_id == msg_id) {
+            return;
+        }
+    }
+    in_flight--;
+}
+
+/* Helper: True if the slot still holds the alert it held at generation gen (caller holds slot_lock) */
+static bool slot_current(uint32_t index, uint32_t gen)
+{
+    return slots[index].used && slots[index].gen == gen;
+}
+
+/* Helper: Copy a slot out of the table */
+static slot_state_t slot_copy(uint32_t index)
+{
+    portENTER_CRITICAL(&slot_lock);
+    slot_state_t copy = slots[index];
+    portEXIT_CRITICAL(&slot_lock);
+    return copy;
+}
+
+/* Helper: Free a slot; returns its state for release_detached() (caller holds slot_lock) */
+static slot_state_t detach_slot(uint32_t index)
 {
-    esp_err_t ret = nvs_set_blob(nvs_handle, NVS_KEY_STATS, &stats, sizeof(stats));
+    slot_state_t old = slots[index];
+
+    if (old.rtc_slot >= 0) {
+        rtc_alert_clear(old.rtc_slot);
+    }
+    if (old.msg_id >= 0) {
+        release_msg(&slots[index]);
+    }
+    memset(&slots[index], 0, sizeof(slots[index]));
+    slots[index].msg_id = -1;
+    slots[index].rtc_slot = -1;
+    slots[index].gen = old.gen + 1;
+
+    return old;
+}
+
+/* Helper: Free a slot unless it was reused since gen was read */
+static bool detach_if_current(uint32_t index, uint32_t gen, slot_state_t *old)
+{
+    portENTER_CRITICAL(&slot_lock);
+    bool current = slot_current(index, gen);
+    if (current) {
+        *old = detach_slot(index);
+    }
+    portEXIT_CRITICAL(&slot_lock);
+    return current;
+}
+
+/* Helper: Remove a detached alert from the store (outside slot_lock) */
+static void release_detached(const slot_state_t *old)
+{
+    if (old->persisted) {
+        xSemaphoreTake(store_lock, portMAX_DELAY);
+        esp_err_t ret = store->remove(old->ref);
+        xSemaphoreGive(store_lock);
+        if (ret != ESP_OK) {
+            /* Left in the store: redelivered after reboot as a new trigger. alert_id
+             * restarts every boot and the edge does not dedup on it: PA may fire again */
+            ESP_LOGW(TAG, "[QUEUE] Failed to remove alert %lu: %s",
+                     old->alert_id, esp_err_to_name(ret));
+        }
+    }
+
+    stats_add(&stats.pending_count, -1);
+}
+
+/* Helper: Fetch an alert from RTC memory or the store, with retry_count set to the
+ * slot's attempts. ESP_ERR_INVALID_STATE if the slot was reused since gen was read. */
+static esp_err_t read_slot_alert(uint32_t index, uint32_t gen, queued_alert_t *alert)
+{
+    rtc_alert_t entry;
+    bool persisted;
+    uint32_t ref;
+    uint32_t attempts;
+
+    portENTER_CRITICAL(&slot_lock);
+    if (!slot_current(index, gen)) {
+        portEXIT_CRITICAL(&slot_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    persisted = slots[index].persisted;
+    ref = slots[index].ref;
+    attempts = slots[index].attempts;
+    if (!persisted) {
+        entry = rtc_alerts[slots[index].rtc_slot];
+    }
+    portEXIT_CRITICAL(&slot_lock);
+
+    if (!persisted) {
+        if (!rtc_alert_valid(&entry)) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        memcpy(alert, &entry.alert, sizeof(*alert));
+    } else {
+        /* The slot may be evicted meanwhile; callers re-check gen before using the result */
+        xSemaphoreTake(store_lock, portMAX_DELAY);
+        esp_err_t ret = store->read(ref, alert);
+        xSemaphoreGive(store_lock);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    /* Attempt count is RAM-only: no flash write per retry */
+    alert->retry_count = attempts;
+    return ESP_OK;
+}
+
+/* Helper: Drop an alert that can no longer be read (no-op if the slot was reused) */
+static void drop_unreadable(uint32_t index, uint32_t gen, esp_err_t err)
+{
+    slot_state_t old;
+
+    if (detach_if_current(index, gen, &old)) {
+        ESP_LOGE(TAG, "[QUEUE] Failed to read alert %lu: %s, dropping",
+                 old.alert_id, esp_err_to_name(err));
+        release_detached(&old);
+    }
+}
+
+/* Helper: Write an unacknowledged alert to the store */
+static esp_err_t persist_slot(uint32_t index, uint32_t gen, int64_t now_us)
+{
+    queued_alert_t alert;
+    uint32_t ref;
+
+    esp_err_t ret = read_slot_alert(index, gen, &alert);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        return ret;
+    }
     if (ret == ESP_OK) {
-        ret = nvs_commit(nvs_handle);
+        xSemaphoreTake(store_lock, portMAX_DELAY);
+        ret = store->append(&alert, &ref);
+        xSemaphoreGive(store_lock);
+    }
+
+    portENTER_CRITICAL(&slot_lock);
+    bool current = slot_current(index, gen);
+    uint32_t alert_id = slots[index].alert_id;
+    if (current && ret == ESP_OK) {
+        rtc_alert_clear(slots[index].rtc_slot);
+        slots[index].rtc_slot = -1;
+        slots[index].ref = ref;
+        slots[index].persisted = true;
+    } else if (current) {
+        slots[index].persist_due_us = now_us + (int64_t)ALERT_PERSIST_WINDOW_MS * 1000;
+    }
+    portEXIT_CRITICAL(&slot_lock);
+
+    if (!current) {
+        /* Evicted or expired during the write: drop the copy */
+        if (ret == ESP_OK) {
+            xSemaphoreTake(store_lock, portMAX_DELAY);
+            store->remove(ref);
+            xSemaphoreGive(store_lock);
+        }
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[QUEUE] Failed to persist alert %lu: %s",
+                 alert_id, esp_err_to_name(ret));
     }
     return ret;
 }
 
+/* Helper: Jittered exponential backoff ("equal jitter": half fixed, half random) */
+static int64_t backoff_us(uint32_t attempts)
+{
+    uint32_t shift = attempts > 0 ? attempts - 1 : 0;
+    uint32_t delay_ms = ALERT_RETRY_MAX_MS;
+
+    if (shift < 16 && ((uint32_t)ALERT_RETRY_BASE_MS << shift) < ALERT_RETRY_MAX_MS) {
+        delay_ms = (uint32_t)ALERT_RETRY_BASE_MS << shift;
+    }
+
+    uint32_t half = delay_ms / 2;
+    return ((int64_t)half + (esp_random() % (half + 1))) * 1000;
+}
+
+/* Helper: Alert age by wall clock when available, else since enqueue/boot */
+static uint32_t slot_age_seconds(const slot_state_t *slot, int64_t now_us)
+{
+    if (slot->timestamp >= MIN_VALID_EPOCH && time_is_synchronized()) {
+        time_t now;
+        time(&now);
+        if ((uint32_t)now >= slot->timestamp) {
+            return (uint32_t)now - slot->timestamp;
+        }
+    }
+
+    return (uint32_t)((now_us - slot->first_seen_us) / 1000000);
+}
+
+/* Helper: True if slot a was raised before slot b */
+static bool slot_older(const slot_state_t *a, const slot_state_t *b)
+{
+    if (a->timestamp >= MIN_VALID_EPOCH && b->timestamp >= MIN_VALID_EPOCH &&
+        a->timestamp != b->timestamp) {
+        return a->timestamp < b->timestamp;
+    }
+    if (a->first_seen_us != b->first_seen_us) {
+        return a->first_seen_us < b->first_seen_us;
+    }
+    return a->alert_id < b->alert_id;
+}
+
+/* Helper: True if slot a should be delivered before slot b (mode, then age) */
+static bool slot_before(const slot_state_t *a, const slot_state_t *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return slot_older(a, b);
+}
+
+/* Helper: Eviction victim - oldest alert of the lowest priority (caller holds slot_lock) */
+static int eviction_victim(void)
+{
+    int victim = -1;
+
+    for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        if (!slots[i].used) {
+            continue;
+        }
+        if (victim < 0 || slots[i].priority < slots[victim].priority ||
+            (slots[i].priority == slots[victim].priority && slot_older(&slots[i], &slots[victim]))) {
+            victim = i;
+        }
+    }
+
+    return victim;
+}
+
+/* Helper: Expire old alerts */
+static int expire_slots(int64_t now_us)
+{
+    int removed = 0;
+
+    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        slot_state_t old = slot_copy(i);
+
+        /* Age is computed outside the lock (reads the wall clock) */
+        if (!old.used || slot_age_seconds(&old, now_us) <= ALERT_QUEUE_EXPIRY_SECONDS ||
+            !detach_if_current(i, old.gen, &old)) {
+            continue;
+        }
+
+        LOGR_W(TAG, "[QUEUE] Alert %lu expired after %lu attempts, removing",
+               old.alert_id, old.attempts);
+        release_detached(&old);
+        stats_add(&stats.total_expired, 1);
+        removed++;
+    }
+
+    return removed;
+}
+
+/* Helper: Schedule a retry after a failed attempt; the caller counts it in
+ * total_failed once out of the lock (caller holds slot_lock) */
+static void schedule_retry(slot_state_t *slot, int64_t now_us)
+{
+    if (slot->msg_id >= 0) {
+        release_msg(slot);
+    }
+    slot->next_attempt_us = now_us + backoff_us(slot->attempts);
+}
+
+/* Init: place a persisted alert in the slot table; everything pending is due immediately.
+ * Alerts arrive oldest first: first_seen_us keeps that order for unsynced timestamps. */
+static bool load_visit(uint32_t ref, const queued_alert_t *alert, void *ctx)
+{
+    uint32_t *count = ctx;
+
+    if (*count >= queue_capacity) {
+        ESP_LOGW(TAG, "[QUEUE] More alerts stored than slots, ignoring the rest");
+        return false;
+    }
+
+    /* 1 us apart, all in the past */
+    int64_t now_us = esp_timer_get_time() - ALERT_QUEUE_MAX_SIZE + *count;
+
+    slots[*count] = (slot_state_t) {
+        .used = true,
+        .persisted = true,
+        .ref = ref,
+        .rtc_slot = -1,
+        .alert_id = alert->alert_id,
+        .priority = mode_priority(alert->mode),
+        .timestamp = alert->timestamp,
+        .first_seen_us = now_us,
+        .next_attempt_us = now_us,
+        .msg_id = -1,
+    };
+    (*count)++;
+    return true;
+}
+
+/* Init: move alerts queued in NVS by older firmware into the flash log */
+static bool migrate_visit(uint32_t ref, const queued_alert_t *alert, void *ctx)
+{
+    uint64_t *migrated = ctx;
+    uint32_t new_ref;
+
+    if (ref >= 64 || store->append(alert, &new_ref) != ESP_OK) {
+        ESP_LOGW(TAG, "[QUEUE] Failed to migrate alert %lu, left in NVS", alert->alert_id);
+        return true;
+    }
+    *migrated |= 1ULL << ref;
+    return true;
+}
+
+static void migrate_from_nvs(void)
+{
+    uint32_t capacity;
+    if (alert_store_nvs.init(&capacity) != ESP_OK) {
+        return;
+    }
+
+    uint64_t migrated = 0;     /* Bit per NVS ref */
+    alert_store_nvs.load(migrate_visit, &migrated);
+
+    /* Remove only once copied into the log: a reset in between duplicates
+     * alerts (each replayed as a new trigger), never loses them */
+    uint32_t count = 0;
+    for (uint32_t ref = 0; ref < 64; ref++) {
+        if (migrated & (1ULL << ref)) {
+            alert_store_nvs.remove(ref);
+            count++;
+        }
+    }
+
+    if (count > 0) {
+        LOGR_I(TAG, "[QUEUE] Migrated %lu alerts from NVS to the flash log", count);
+    }
+}
+
 esp_err_t alert_queue_init(void)
 {
     if (initialized) {
         return ESP_OK;
     }
 
-    /* Open NVS namespace */
+    /* Open NVS namespace (queue statistics) */
     esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "[QUEUE] Failed to open NVS: %s", esp_err_to_name(ret));
         return ret;
     }
 
+    store_lock = xSemaphoreCreateMutex();
+    ack_queue = xQueueCreate(DELIVERY_ACK_QUEUE_LEN, sizeof(int));
+    if (store_lock == NULL || ack_queue == NULL) {
+        ESP_LOGE(TAG, "[QUEUE] Failed to create delivery primitives");
+        return ESP_ERR_NO_MEM;
+    }
+
     /* Load statistics */
     ret = load_stats();
     if (ret != ESP_OK) {
@@ -70,24 +546,79 @@ esp_err_t alert_queue_init(void)
         /* Continue anyway with zeroed stats */
     }
 
-    /* Load pending count */
+    /* Open the storage backend */
+    uint32_t capacity = 0;
+#if ALERT_QUEUE_FLASH_LOG
+    store = &alert_store_flash_log;
+    ret = store->init(&capacity);
+    if (ret == ESP_OK) {
+        migrate_from_nvs();
+    } else {
+        LOGR_E(TAG, "[QUEUE] Flash log unavailable (%s), falling back to NVS",
+               esp_err_to_name(ret));
+        store = &alert_store_nvs;
+        ret = store->init(&capacity);
+    }
+#else
+    store = &alert_store_nvs;
+    ret = store->init(&capacity);
+#endif
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "[QUEUE] Failed to open store: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    queue_capacity = capacity < ALERT_QUEUE_MAX_SIZE ? capacity : ALERT_QUEUE_MAX_SIZE;
+
+    /* Alerts a reset caught between RAM and flash: they are the newest, so
+     * append them before rebuilding (a reset here can duplicate, not lose) */
+    for (int i = 0; i < ALERT_RTC_SLOTS; i++) {
+        uint32_t ref;
+        if (rtc_alert_valid(&rtc_alerts[i]) && store->append(&rtc_alerts[i].alert, &ref) == ESP_OK) {
+            LOGR_W(TAG, "[QUEUE] Recovered unpersisted alert %lu from RTC memory",
+                   rtc_alerts[i].alert.alert_id);
+        }
+        rtc_alert_clear(i);
+    }
+
+    /* Rebuild the slot table from the store */
     uint32_t count = 0;
-    ret = nvs_get_u32(nvs_handle, NVS_KEY_COUNT, &count);
-    if (ret == ESP_ERR_NVS_NOT_FOUND) {
-        count = 0;
-    } else if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "[QUEUE] Failed to load count: %s", esp_err_to_name(ret));
-        count = 0;
+    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        slots[i].msg_id = -1;
+        slots[i].rtc_slot = -1;
     }
+    store->load(load_visit, &count);
 
     stats.pending_count = count;
     initialized = true;
 
-    ESP_LOGI(TAG, "[QUEUE] Initialized: %lu pending alerts", count);
+    ESP_LOGI(TAG, "[QUEUE] Initialized: %lu pending alerts (%s store, capacity %lu)",
+             count, store->name, queue_capacity);
 
     return ESP_OK;
 }
 
+/* Helper: Take a free slot or evict one for an alert of this priority; returns the
+ * index, or -1 if everything queued outranks it (caller holds slot_lock) */
+static int claim_slot(uint8_t priority, slot_state_t *evicted)
+{
+    evicted->used = false;
+
+    for (int i = 0; i < (int)queue_capacity; i++) {
+        if (!slots[i].used) {
+            return i;
+        }
+    }
+
+    /* Full: make room by dropping the least important alert, unless that
+     * would be the new one */
+    int victim = eviction_victim();
+    if (victim < 0 || slots[victim].priority > priority) {
+        return -1;
+    }
+    *evicted = detach_slot(victim);
+    return victim;
+}
+
 esp_err_t alert_queue_enqueue(const queued_alert_t *alert)
 {
     if (!initialized) {
@@ -95,198 +626,574 @@ esp_err_t alert_queue_enqueue(const queued_alert_t *alert)
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (stats.pending_count >= ALERT_QUEUE_MAX_SIZE) {
-        ESP_LOGE(TAG, "[QUEUE] Queue full (%d alerts)", ALERT_QUEUE_MAX_SIZE);
-        return ESP_ERR_NO_MEM;
-    }
+    uint8_t priority = mode_priority(alert->mode);
+    uint32_t crc = rtc_alert_crc(alert);
+    bool persisted = false;
+    uint32_t ref = 0;
+    slot_state_t evicted;
+    int index;
 
-    /* Find next available slot */
-    uint32_t index = 0;
-    char key[32];
+    /* Fast path: park the alert in RTC memory and publish first; the delivery
+     * task persists it unless the PUBACK beats ALERT_PERSIST_WINDOW_MS.
+     * Only a short critical section: the delivery task never blocks this. */
+    while (1) {
+        int64_t now_us = esp_timer_get_time();
 
-    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
-        get_alert_key(i, key, sizeof(key));
+        portENTER_CRITICAL(&slot_lock);
+        int rtc_slot = persisted ? -1 : rtc_alert_put(alert, crc);
+        if (rtc_slot < 0 && !persisted) {
+            portEXIT_CRITICAL(&slot_lock);
 
-        size_t required_size = 0;
-        esp_err_t ret = nvs_get_blob(nvs_handle, key, NULL, &required_size);
+            /* RTC entries all taken (burst while offline): persist synchronously */
+            xSemaphoreTake(store_lock, portMAX_DELAY);
+            esp_err_t ret = store->append(alert, &ref);
+            xSemaphoreGive(store_lock);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "[QUEUE] Failed to store alert: %s", esp_err_to_name(ret));
+                return ret;
+            }
+            persisted = true;
+            continue;
+        }
 
-        if (ret == ESP_ERR_NVS_NOT_FOUND) {
-            /* Found empty slot */
-            index = i;
-            break;
+        index = claim_slot(priority, &evicted);
+        if (index >= 0) {
+            slots[index] = (slot_state_t) {
+                .used = true,
+                .persisted = persisted,
+                .ref = ref,
+                .rtc_slot = rtc_slot,
+                .alert_id = alert->alert_id,
+                .priority = priority,
+                .timestamp = alert->timestamp,
+                .first_seen_us = now_us,
+                .next_attempt_us = now_us,
+                .persist_due_us = now_us + (int64_t)ALERT_PERSIST_WINDOW_MS * 1000,
+                .msg_id = -1,
+                .gen = slots[index].gen,
+            };
+        } else if (rtc_slot >= 0) {
+            rtc_alert_clear(rtc_slot);
         }
+        portEXIT_CRITICAL(&slot_lock);
+        break;
     }
 
-    /* Store alert in NVS */
-    get_alert_key(index, key, sizeof(key));
-    esp_err_t ret = nvs_set_blob(nvs_handle, key, alert, sizeof(queued_alert_t));
+    if (index < 0) {
+        if (persisted) {
+            xSemaphoreTake(store_lock, portMAX_DELAY);
+            store->remove(ref);
+            xSemaphoreGive(store_lock);
+        }
+        ESP_LOGE(TAG, "[QUEUE] Queue full (%lu higher-priority alerts)", queue_capacity);
+        return ESP_ERR_NO_MEM;
+    }
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "[QUEUE] Failed to store alert: %s", esp_err_to_name(ret));
-        return ret;
+    stats_add(&stats.pending_count, 1);
+    stats_add(&stats.total_enqueued, 1);
+    if (delivery_task_handle != NULL) {
+        xTaskNotify(delivery_task_handle, NOTIFY_KICK, eSetBits);
     }
 
-    /* Update count */
-    stats.pending_count++;
-    stats.total_enqueued++;
+    /* Flash I/O for the evicted alert only once the new one is on its way */
+    if (evicted.used) {
+        LOGR_W(TAG, "[QUEUE] Queue full, evicting alert %lu (mode priority %d)",
+               evicted.alert_id, evicted.priority);
+        release_detached(&evicted);
+        stats_add(&stats.total_evicted, 1);
+    }
 
-    ret = nvs_set_u32(nvs_handle, NVS_KEY_COUNT, stats.pending_count);
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "[QUEUE] Failed to update count: %s", esp_err_to_name(ret));
+    LOGR_I(TAG, "[QUEUE] Enqueued alert %lu (index %d, %lu pending)",
+           alert->alert_id, index, stats.pending_count);
+
+    return ESP_OK;
+}
+
+int alert_queue_retry_now(void)
+{
+    if (!initialized) {
+        return 0;
     }
 
-    /* Commit changes */
-    ret = nvs_commit(nvs_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "[QUEUE] Failed to commit: %s", esp_err_to_name(ret));
+    /* Backoff is reset by the delivery task; never block here (caller may be the MQTT task) */
+    if (delivery_task_handle != NULL) {
+        xTaskNotify(delivery_task_handle, NOTIFY_RETRY, eSetBits);
     }
 
-    /* Save stats */
-    save_stats();
+    return stats.pending_count;
+}
 
-    ESP_LOGI(TAG, "[QUEUE] Enqueued alert %lu (index %lu, %lu pending)",
-             alert->alert_id, index, stats.pending_count);
+int alert_queue_get_count(void)
+{
+    return stats.pending_count;
+}
 
-    return ESP_OK;
+uint32_t alert_queue_capacity(void)
+{
+    return queue_capacity;
 }
 
-int alert_queue_process(void)
+int alert_queue_cleanup_expired(void)
 {
     if (!initialized) {
-        ESP_LOGE(TAG, "[QUEUE] Not initialized");
         return 0;
     }
 
-    if (stats.pending_count == 0) {
-        return 0;
+    int removed = expire_slots(esp_timer_get_time());
+
+    if (removed > 0) {
+        ESP_LOGI(TAG, "[QUEUE] Cleanup: %d expired alerts removed", removed);
     }
 
-    if (!mqtt_is_connected()) {
-        ESP_LOGD(TAG, "[QUEUE] MQTT not connected, skipping processing");
-        return 0;
+    return removed;
+}
+
+void alert_queue_on_connected(void)
+{
+    if (delivery_task_handle != NULL) {
+        xTaskNotify(delivery_task_handle, NOTIFY_CONNECTED, eSetBits);
+    }
+}
+
+void alert_queue_on_disconnected(void)
+{
+    if (delivery_task_handle != NULL) {
+        xTaskNotify(delivery_task_handle, NOTIFY_DISCONNECTED, eSetBits);
+    }
+}
+
+void alert_queue_on_published(int msg_id)
+{
+    if (delivery_task_handle == NULL) {
+        return;
     }
 
-    int delivered = 0;
-    char key[32];
+    /* Acks for other publishers are filtered by the delivery task. A dropped
+     * ack only costs a PUBACK timeout and a duplicate delivery. */
+    if (xQueueSend(ack_queue, &msg_id, 0) == pdTRUE) {
+        xTaskNotify(delivery_task_handle, NOTIFY_ACK, eSetBits);
+    }
+}
+
+/* Delivery: apply acknowledgements */
+static void handle_acks(void)
+{
+    int msg_id;
+
+    while (xQueueReceive(ack_queue, &msg_id, 0) == pdTRUE) {
+        /* One PUBACK acknowledges every alert of a batch */
+        for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+            slot_state_t old;
+
+            portENTER_CRITICAL(&slot_lock);
+            bool acked = slots[i].used && slots[i].msg_id == msg_id;
+            if (acked) {
+                old = detach_slot(i);
+            }
+            portEXIT_CRITICAL(&slot_lock);
+
+            if (acked) {
+                LOGR_I(TAG, "[QUEUE] Alert %lu delivered (%lu attempts)",
+                       old.alert_id, old.attempts);
+                release_detached(&old);
+                stats_add(&stats.total_delivered, 1);
+            }
+        }
+    }
+}
+
+/* Delivery: publish one alert. The slot is read and published outside slot_lock;
+ * one evicted or expired meanwhile is left alone (a duplicate at most). */
+static void deliver_slot(uint32_t index, uint32_t gen, int64_t now_us)
+{
     queued_alert_t alert;
-    size_t required_size;
 
-    ESP_LOGI(TAG, "[QUEUE] Processing %lu pending alerts", stats.pending_count);
+    esp_err_t ret = read_slot_alert(index, gen, &alert);
+    if (ret != ESP_OK) {
+        drop_unreadable(index, gen, ret);
+        return;
+    }
 
-    /* Iterate through all possible slots */
-    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
-        get_alert_key(i, key, sizeof(key));
-        required_size = sizeof(queued_alert_t);
+    LOGR_D(TAG, "[QUEUE] Attempting delivery of alert %lu (retry %lu)",
+           alert.alert_id, alert.retry_count);
 
-        esp_err_t ret = nvs_get_blob(nvs_handle, key, &alert, &required_size);
+    int msg_id = mqtt_publish_alert_from_queue(&alert);
 
-        if (ret == ESP_ERR_NVS_NOT_FOUND) {
-            continue;  /* Empty slot */
+    if (msg_id == 0) {
+        /* QoS 0: no PUBACK will follow */
+        slot_state_t old;
+        if (detach_if_current(index, gen, &old)) {
+            release_detached(&old);
+            stats_add(&stats.total_delivered, 1);
         }
+        return;
+    }
 
-        if (ret != ESP_OK) {
-            ESP_LOGW(TAG, "[QUEUE] Failed to read alert %lu: %s", i, esp_err_to_name(ret));
-            continue;
+    portENTER_CRITICAL(&slot_lock);
+    bool current = slot_current(index, gen);
+    if (current) {
+        slot_state_t *slot = &slots[index];
+        slot->attempts++;
+        if (msg_id < 0) {
+            schedule_retry(slot, now_us);
+        } else {
+            slot->msg_id = msg_id;
+            slot->sent_us = now_us;
+            in_flight++;
         }
+    }
+    portEXIT_CRITICAL(&slot_lock);
+
+    if (current && msg_id < 0) {
+        LOGR_W(TAG, "[QUEUE] Alert %lu delivery failed", alert.alert_id);
+        stats_add(&stats.total_failed, 1);
+    }
+}
 
-        /* Check if alert expired */
-        uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS / 1000;
-        if ((now - alert.created_at) > ALERT_QUEUE_EXPIRY_SECONDS) {
-            ESP_LOGW(TAG, "[QUEUE] Alert %lu expired, removing", alert.alert_id);
-            nvs_erase_key(nvs_handle, key);
-            stats.pending_count--;
-            stats.total_expired++;
-            save_stats();
+/* Delivery: most important due alert not already in flight (caller holds slot_lock) */
+static int next_due_slot(int64_t now_us)
+{
+    int best = -1;
+
+    for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        const slot_state_t *slot = &slots[i];
+        if (!slot->used || slot->msg_id >= 0 || slot->next_attempt_us > now_us) {
             continue;
         }
+        if (best < 0 || slot_before(slot, &slots[best])) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+#if ALERT_BATCH_ENABLED
+/* Delivery: most recently raised alert, sent alone rather than batched (caller holds slot_lock) */
+static int newest_slot(void)
+{
+    int newest = -1;
+
+    for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        if (slots[i].used && (newest < 0 || slot_older(&slots[newest], &slots[i]))) {
+            newest = i;
+        }
+    }
+
+    return newest;
+}
 
-        /* Check retry limit */
-        if (alert.retry_count >= ALERT_QUEUE_MAX_RETRIES) {
-            ESP_LOGE(TAG, "[QUEUE] Alert %lu exceeded retry limit, removing", alert.alert_id);
-            nvs_erase_key(nvs_handle, key);
-            stats.pending_count--;
-            stats.total_failed++;
-            save_stats();
+/* Delivery: pack due backlog alerts (by priority, same tenant/building) into one
+ * publish. Returns the number sent, 0 if fewer than two are due. */
+static int deliver_batch(int exclude, int64_t now_us)
+{
+    static queued_alert_t batch[ALERT_BATCH_MAX];
+    int picked[ALERT_BATCH_MAX];
+    uint32_t gens[ALERT_BATCH_MAX];
+    int candidates = 0;
+    int count = 0;
+
+    /* Pick candidates under the lock, read them (flash) outside it */
+    portENTER_CRITICAL(&slot_lock);
+    while (candidates < ALERT_BATCH_MAX) {
+        int best = -1;
+
+        for (int i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+            const slot_state_t *slot = &slots[i];
+            bool taken = i == exclude;
+
+            for (int k = 0; k < candidates && !taken; k++) {
+                taken = picked[k] == i;
+            }
+            if (taken || !slot->used || slot->msg_id >= 0 || slot->next_attempt_us > now_us) {
+                continue;
+            }
+            if (best < 0 || slot_before(slot, &slots[best])) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        picked[candidates] = best;
+        gens[candidates] = slots[best].gen;
+        candidates++;
+    }
+    portEXIT_CRITICAL(&slot_lock);
+
+    for (int k = 0; k < candidates; k++) {
+        esp_err_t ret = read_slot_alert(picked[k], gens[k], &batch[count]);
+        if (ret != ESP_OK) {
+            drop_unreadable(picked[k], gens[k], ret);
             continue;
         }
 
-        /* Attempt to publish */
-        ESP_LOGI(TAG, "[QUEUE] Attempting delivery of alert %lu (retry %lu)",
-                 alert.alert_id, alert.retry_count);
+        /* Topic is per tenant/building: a re-provisioned device starts a new batch */
+        if (count > 0 && (strcmp(batch[count].tenant_id, batch[0].tenant_id) != 0 ||
+                          strcmp(batch[count].building_id, batch[0].building_id) != 0)) {
+            break;
+        }
+        picked[count] = picked[k];
+        gens[count] = gens[k];
+        count++;
+    }
+
+    if (count < 2) {
+        return 0;
+    }
 
-        if (mqtt_publish_alert_from_queue(&alert)) {
-            /* Success - remove from queue */
-            ESP_LOGI(TAG, "[QUEUE] ✓ Alert %lu delivered", alert.alert_id);
-            nvs_erase_key(nvs_handle, key);
-            stats.pending_count--;
-            stats.total_delivered++;
-            delivered++;
-            save_stats();
-        } else {
-            /* Failed - increment retry count */
-            ESP_LOGW(TAG, "[QUEUE] ✗ Alert %lu delivery failed", alert.alert_id);
-            alert.retry_count++;
-            nvs_set_blob(nvs_handle, key, &alert, sizeof(queued_alert_t));
+    int msg_id = mqtt_publish_alert_batch(batch, count);
+
+    if (msg_id == 0) {
+        /* QoS 0: no PUBACK will follow */
+        for (int k = 0; k < count; k++) {
+            slot_state_t old;
+            if (detach_if_current(picked[k], gens[k], &old)) {
+                release_detached(&old);
+                stats_add(&stats.total_delivered, 1);
+            }
         }
+        return count;
     }
 
-    /* Update count in NVS */
-    nvs_set_u32(nvs_handle, NVS_KEY_COUNT, stats.pending_count);
-    nvs_commit(nvs_handle);
+    int failed = 0;
+    bool sent = false;
+
+    portENTER_CRITICAL(&slot_lock);
+    for (int k = 0; k < count; k++) {
+        slot_state_t *slot = &slots[picked[k]];
+        if (!slot_current(picked[k], gens[k])) {
+            continue;   /* Evicted or expired during the publish */
+        }
+        slot->attempts++;
+        if (msg_id < 0) {
+            schedule_retry(slot, now_us);
+            failed++;
+        } else {
+            slot->msg_id = msg_id;
+            slot->sent_us = now_us;
+            sent = true;
+        }
+    }
+    if (sent) {
+        in_flight++;
+    }
+    portEXIT_CRITICAL(&slot_lock);
 
-    ESP_LOGI(TAG, "[QUEUE] Processing complete: %d delivered, %lu remaining",
-             delivered, stats.pending_count);
+    if (msg_id < 0) {
+        LOGR_W(TAG, "[QUEUE] Batch of %d alerts delivery failed", count);
+        stats_add(&stats.total_failed, failed);
+    }
 
-    return delivered;
+    return count;
 }
+#endif
 
-int alert_queue_get_count(void)
+/* Delivery: one pass, returns when the task must wake next */
+static int64_t delivery_pass(uint32_t events)
 {
-    return stats.pending_count;
-}
+    int64_t now_us = esp_timer_get_time();
 
-int alert_queue_cleanup_expired(void)
-{
-    if (!initialized) {
-        return 0;
+    if (events & NOTIFY_DISCONNECTED) {
+        link_up = false;
+    }
+    if (events & NOTIFY_CONNECTED) {
+        link_up = mqtt_is_connected();
     }
 
-    int removed = 0;
-    char key[32];
-    queued_alert_t alert;
-    size_t required_size;
-    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS / 1000;
+    portENTER_CRITICAL(&slot_lock);
+    if (events & (NOTIFY_CONNECTED | NOTIFY_DISCONNECTED)) {
+        /* New session: outstanding publishes are void, send everything now */
+        for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+            slots[i].msg_id = -1;
+            slots[i].next_attempt_us = now_us;
+        }
+        in_flight = 0;
+    } else if (events & NOTIFY_RETRY) {
+        for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+            slots[i].next_attempt_us = now_us;
+        }
+    }
+    portEXIT_CRITICAL(&slot_lock);
+
+    handle_acks();
+    expire_slots(now_us);
+
+    /* Persist window elapsed without a PUBACK */
+    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        slot_state_t slot = slot_copy(i);
+        if (slot.used && !slot.persisted && slot.persist_due_us <= now_us) {
+            persist_slot(i, slot.gen, now_us);
+        }
+    }
 
+    /* PUBACK timeouts */
     for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
-        get_alert_key(i, key, sizeof(key));
-        required_size = sizeof(queued_alert_t);
+        slot_state_t *slot = &slots[i];
+        uint32_t alert_id = 0;
+        int msg_id = -1;
+
+        portENTER_CRITICAL(&slot_lock);
+        if (slot->used && slot->msg_id >= 0 &&
+            now_us - slot->sent_us >= (int64_t)ALERT_PUBACK_TIMEOUT_MS * 1000) {
+            alert_id = slot->alert_id;
+            msg_id = slot->msg_id;
+            schedule_retry(slot, now_us);
+        }
+        portEXIT_CRITICAL(&slot_lock);
 
-        esp_err_t ret = nvs_get_blob(nvs_handle, key, &alert, &required_size);
+        if (msg_id >= 0) {
+            LOGR_W(TAG, "[QUEUE] Alert %lu PUBACK timeout (msg_id=%d)", alert_id, msg_id);
+            stats_add(&stats.total_failed, 1);
+        }
+    }
 
-        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+#if ALERT_BATCH_ENABLED
+    /* Backlog: the newest alert goes alone and first, the rest in batches */
+    portENTER_CRITICAL(&slot_lock);
+    int newest = newest_slot();
+    uint32_t newest_gen = newest >= 0 ? slots[newest].gen : 0;
+    bool newest_due = newest >= 0 && link_up && in_flight < ALERT_MAX_IN_FLIGHT &&
+                      slots[newest].msg_id < 0 && slots[newest].next_attempt_us <= now_us;
+    portEXIT_CRITICAL(&slot_lock);
+    if (newest_due) {
+        deliver_slot(newest, newest_gen, now_us);
+    }
+#endif
+
+    /* Publish due alerts by priority, up to the in-flight limit */
+    while (link_up) {
+        portENTER_CRITICAL(&slot_lock);
+        bool room = in_flight < ALERT_MAX_IN_FLIGHT;
+        portEXIT_CRITICAL(&slot_lock);
+        if (!room) {
+            break;
+        }
+#if ALERT_BATCH_ENABLED
+        if (deliver_batch(newest, now_us) > 0) {
             continue;
         }
+#endif
+        portENTER_CRITICAL(&slot_lock);
+        int index = next_due_slot(now_us);
+        uint32_t gen = index >= 0 ? slots[index].gen : 0;
+        portEXIT_CRITICAL(&slot_lock);
+        if (index < 0) {
+            break;
+        }
+        deliver_slot(index, gen, now_us);
+    }
 
-        if (ret != ESP_OK) {
+    /* Next wakeup: earliest persist deadline, backoff deadline or PUBACK timeout */
+    int64_t wake_us = now_us + (int64_t)DELIVERY_MAX_SLEEP_MS * 1000;
+    portENTER_CRITICAL(&slot_lock);
+    for (uint32_t i = 0; i < ALERT_QUEUE_MAX_SIZE; i++) {
+        const slot_state_t *slot = &slots[i];
+        int64_t due;
+
+        if (!slot->used) {
             continue;
         }
+        if (!slot->persisted && slot->persist_due_us < wake_us) {
+            wake_us = slot->persist_due_us;
+        }
 
-        if ((now - alert.created_at) > ALERT_QUEUE_EXPIRY_SECONDS) {
-            nvs_erase_key(nvs_handle, key);
-            stats.pending_count--;
-            stats.total_expired++;
-            removed++;
+        if (slot->msg_id >= 0) {
+            due = slot->sent_us + (int64_t)ALERT_PUBACK_TIMEOUT_MS * 1000;
+        } else if (link_up && in_flight < ALERT_MAX_IN_FLIGHT) {
+            due = slot->next_attempt_us;
+        } else {
+            continue;   /* Woken by connect or ack */
+        }
+
+        if (due < wake_us) {
+            wake_us = due;
         }
     }
+    portEXIT_CRITICAL(&slot_lock);
 
-    if (removed > 0) {
-        nvs_set_u32(nvs_handle, NVS_KEY_COUNT, stats.pending_count);
-        nvs_commit(nvs_handle);
-        save_stats();
-        ESP_LOGI(TAG, "[QUEUE] Cleanup: %d expired alerts removed", removed);
+    return wake_us;
+}
+
+static void delivery_task(void *pvParameters)
+{
+    watchdog_task_id_t wdt_id;
+    watchdog_supervise(DELIVERY_DEADLINE_MS, &wdt_id);
+
+    ESP_LOGI(TAG, "[QUEUE] Delivery task started");
+
+    uint32_t events = 0;
+
+    while (1) {
+        watchdog_feed();
+        watchdog_checkpoint(wdt_id, "delivery");
+
+        int64_t wake_us = delivery_pass(events);
+
+        int64_t sleep_ms = (wake_us - esp_timer_get_time() + 999) / 1000;
+        if (sleep_ms < 1) {
+            sleep_ms = 1;
+        }
+
+        watchdog_checkpoint(wdt_id, "delivery_wait");
+        events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(sleep_ms));
     }
+}
 
-    return removed;
+esp_err_t alert_queue_start_delivery(TaskHandle_t *out_handle)
+{
+    if (!initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (delivery_task_handle == NULL &&
+        xTaskCreate(delivery_task, "delivery_task", DELIVERY_TASK_STACK, NULL,
+                    DELIVERY_TASK_PRIORITY, &delivery_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "[QUEUE] Failed to create delivery task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Pick up a connection that came up before the task existed */
+    if (mqtt_is_connected()) {
+        alert_queue_on_connected();
+    }
+
+    if (out_handle != NULL) {
+        *out_handle = delivery_task_handle;
+    }
+    return ESP_OK;
+}
+
+esp_err_t alert_queue_flush_stats(void)
+{
+    if (!initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!stats_dirty) {
+        return ESP_OK;
+    }
+
+    alert_queue_stats_t snapshot;
+    portENTER_CRITICAL(&stats_lock);
+    snapshot = stats;
+    stats_dirty = false;
+    portEXIT_CRITICAL(&stats_lock);
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    esp_err_t ret = nvs_set_blob(nvs_handle, NVS_KEY_STATS, &snapshot, sizeof(snapshot));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs_handle);
+    }
+    flash_stats_record_write(FLASH_SUBSYS_QUEUE_STATS, sizeof(snapshot), ret);
+    xSemaphoreGive(store_lock);
+
+    if (ret != ESP_OK) {
+        stats_dirty = true;
+        ESP_LOGW(TAG, "[QUEUE] Failed to flush stats: %s", esp_err_to_name(ret));
+    }
+    return ret;
 }
 
 esp_err_t alert_queue_get_stats(alert_queue_stats_t *out_stats)
@@ -295,6 +1202,8 @@ esp_err_t alert_queue_get_stats(alert_queue_stats_t *out_stats)
         return ESP_ERR_INVALID_ARG;
     }
 
+    portENTER_CRITICAL(&stats_lock);
     memcpy(out_stats, &stats, sizeof(alert_queue_stats_t));
+    portEXIT_CRITICAL(&stats_lock);
     return ESP_OK;
 }
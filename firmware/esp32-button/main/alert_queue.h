@@ -4,24 +4,52 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "config.h"
 
 /**
- * Alert Queue - NVS-based persistent storage for reliable alert delivery
+ * Alert Queue - persistent storage for reliable alert delivery
  *
  * Ensures alerts are never lost due to network failures by:
- * - Storing alerts in NVS before MQTT publish attempt
- * - Retrying failed alerts on reconnection
- * - Implementing retry limits and expiration
+ * - Keeping a new alert in RTC slow memory (survives soft resets and panics)
+ *   and publishing it at once; it is written to flash (flash log or NVS
+ *   backend, see alert_store.h) only if no PUBACK arrives within
+ *   ALERT_PERSIST_WINDOW_MS
+ * - Delivering from a dedicated task, woken on enqueue, MQTT connect and
+ *   PUBACK timeout (no polling)
+ * - Removing an alert only once its PUBACK arrives (MQTT_EVENT_PUBLISHED)
+ * - Retrying with per-alert jittered exponential backoff
+ * - Expiring undeliverable alerts by age, not by a retry budget
+ * - Delivering by priority: alert mode first (EVACUATION > LOCKDOWN > AUDIBLE >
+ *   SILENT), then oldest first
+ * - When full, evicting the oldest alert of the lowest priority to make room;
+ *   a new alert is only rejected if everything queued outranks it
+ * - With ALERT_BATCH_ENABLED, sending a backlog as batches of up to
+ *   ALERT_BATCH_MAX alerts per publish; the newest alert still goes alone, first
+ *
+ * MQTT event hooks (alert_queue_on_*) only post to the delivery task and never
+ * block, so they are safe to call from the MQTT event handler.
  */
 
-#define ALERT_QUEUE_MAX_SIZE 50
-#define ALERT_QUEUE_MAX_RETRIES 10
-#define ALERT_QUEUE_EXPIRY_SECONDS 3600  /* 1 hour */
+#if ALERT_QUEUE_FLASH_LOG
+#define ALERT_QUEUE_MAX_SIZE 256            /* Bounded by RAM: slot table + log index */
+#else
+#define ALERT_QUEUE_MAX_SIZE 50             /* Bounded by the nvs partition */
+#endif
+#define ALERT_QUEUE_EXPIRY_SECONDS 3600     /* 1 hour */
+
+#define ALERT_RETRY_BASE_MS 1000            /* First retry delay */
+#define ALERT_RETRY_MAX_MS 60000            /* Backoff ceiling */
+#define ALERT_PUBACK_TIMEOUT_MS 10000       /* Retry if no PUBACK within this time */
+#define ALERT_MAX_IN_FLIGHT 4               /* Unacknowledged publishes at once */
+#define ALERT_PERSIST_WINDOW_MS 2000        /* Unacknowledged alerts reach flash within this time */
+#define ALERT_RTC_SLOTS 8                   /* Alerts awaiting persistence; beyond this enqueue writes flash */
 
 typedef struct {
     uint32_t alert_id;          /* Unique alert identifier */
     uint32_t timestamp;         /* UTC timestamp (seconds since epoch) */
-    uint32_t retry_count;       /* Number of retry attempts */
+    uint32_t retry_count;       /* Delivery attempts so far (filled in on publish) */
     uint32_t created_at;        /* Boot time when alert was created */
     char device_id[32];
     char tenant_id[32];
@@ -33,24 +61,38 @@ typedef struct {
 
 /**
  * Initialize alert queue system
- * - Opens NVS namespace
+ * - Opens the storage backend (falls back to NVS if the flash log fails)
+ * - Moves alerts left in NVS by older firmware into the flash log
+ * - Persists alerts a reset left in RTC memory
  * - Loads any pending alerts from previous session
  * @return ESP_OK on success
  */
 esp_err_t alert_queue_init(void);
 
+/**
+ * Start the delivery task
+ * Call after alert_queue_init(), before MQTT connects.
+ * @param out_handle Task handle for watchdog registration (output, may be NULL)
+ * @return ESP_OK on success
+ */
+esp_err_t alert_queue_start_delivery(TaskHandle_t *out_handle);
+
 /**
  * Enqueue a new alert for delivery
+ * Parks the alert in RTC memory and wakes the delivery task; no flash write
+ * unless all ALERT_RTC_SLOTS entries are taken. Never waits on a publish in
+ * progress: the slot table is held only for a short critical section. When the
+ * queue is full the oldest lowest-priority alert is evicted (counted in total_evicted).
  * @param alert Alert data to persist
- * @return ESP_OK on success, ESP_ERR_NO_MEM if queue full
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if queue full of higher-priority alerts
  */
 esp_err_t alert_queue_enqueue(const queued_alert_t *alert);
 
 /**
- * Attempt to deliver all pending alerts
- * @return Number of alerts successfully delivered
+ * Retry all pending alerts now, ignoring their backoff
+ * @return Number of alerts pending
  */
-int alert_queue_process(void);
+int alert_queue_retry_now(void);
 
 /**
  * Get count of pending alerts in queue
@@ -58,12 +100,34 @@ int alert_queue_process(void);
  */
 int alert_queue_get_count(void);
 
+/**
+ * Maximum number of queued alerts with the active backend
+ */
+uint32_t alert_queue_capacity(void);
+
 /**
  * Clear expired alerts from queue
+ * Also run by the delivery task on every wakeup.
  * @return Number of alerts removed
  */
 int alert_queue_cleanup_expired(void);
 
+/**
+ * MQTT connected: send pending alerts immediately
+ */
+void alert_queue_on_connected(void);
+
+/**
+ * MQTT disconnected: in-flight publishes are retried after reconnect
+ */
+void alert_queue_on_disconnected(void);
+
+/**
+ * MQTT acknowledged a message (MQTT_EVENT_PUBLISHED)
+ * @param msg_id Message ID from the event
+ */
+void alert_queue_on_published(int msg_id);
+
 /**
  * Get queue statistics
  */
@@ -71,10 +135,19 @@ typedef struct {
     uint32_t total_enqueued;
     uint32_t total_delivered;
     uint32_t total_expired;
-    uint32_t total_failed;
+    uint32_t total_failed;      /* Publish errors and PUBACK timeouts (attempts, not alerts) */
     uint32_t pending_count;
+    uint32_t total_evicted;     /* Dropped to make room for a new alert */
 } alert_queue_stats_t;
 
 esp_err_t alert_queue_get_stats(alert_queue_stats_t *stats);
 
+/**
+ * Persist queue statistics if they changed
+ * Stats are batched in RAM and written by the periodic metrics flush; the
+ * pending count is rebuilt from the store at boot.
+ * @return ESP_OK on success (also when nothing changed)
+ */
+esp_err_t alert_queue_flush_stats(void);
+
 #endif /* SAFESIGNAL_ALERT_QUEUE_H */
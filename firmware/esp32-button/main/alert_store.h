@@ -0,0 +1,56 @@
+#ifndef SAFESIGNAL_ALERT_STORE_H
+#define SAFESIGNAL_ALERT_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "alert_queue.h"
+
+/**
+ * Alert Store - persistence backend for the alert queue
+ *
+ * The queue keeps delivery state in RAM and uses a store only to persist
+ * alerts. Records are addressed by an opaque ref chosen by the store.
+ *
+ * Backends:
+ * - alert_store_nvs: one NVS blob per alert in the "alert_queue" namespace
+ *   (shares the small nvs partition with certificates and provisioning),
+ *   each with a {magic, version, seq, CRC32} header
+ * - alert_store_flash_log: append-only, CRC-checked log on the alert_log
+ *   partition (see flash_log.h)
+ *
+ * Both backends rebuild occupancy and order from the records at init and
+ * drop records that fail their CRC; nothing else (no count key) is stored.
+ *
+ * Calls are serialized by the queue; stores need no locking of their own.
+ */
+
+/**
+ * Callback for load(): one call per persisted alert
+ * @return true to continue, false to stop
+ */
+typedef bool (*alert_store_visit_fn_t)(uint32_t ref, const queued_alert_t *alert, void *ctx);
+
+typedef struct {
+    const char *name;
+
+    /* Open the backend and recover its state; returns capacity in alerts */
+    esp_err_t (*init)(uint32_t *out_capacity);
+
+    /* Visit every persisted alert in enqueue order (boot recovery) */
+    esp_err_t (*load)(alert_store_visit_fn_t visit, void *ctx);
+
+    /* Persist a new alert */
+    esp_err_t (*append)(const queued_alert_t *alert, uint32_t *out_ref);
+
+    /* Read an alert back */
+    esp_err_t (*read)(uint32_t ref, queued_alert_t *alert);
+
+    /* Delete an alert */
+    esp_err_t (*remove)(uint32_t ref);
+} alert_store_t;
+
+extern const alert_store_t alert_store_nvs;
+extern const alert_store_t alert_store_flash_log;
+
+#endif /* SAFESIGNAL_ALERT_STORE_H */
@@ -0,0 +1,129 @@
+#include "alert_store.h"
+#include "flash_log.h"
+#include "flash_stats.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+
+static const char *TAG = "ALERT_STORE";
+
+#define ALERT_LOG_PARTITION_LABEL "alert_log"
+
+static const esp_partition_t *partition = NULL;
+static flash_log_io_t log_io;
+static flash_log_t alert_log;
+static flash_log_entry_t log_index[ALERT_QUEUE_MAX_SIZE];
+
+static int partition_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read((const esp_partition_t *)ctx, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    esp_err_t ret = esp_partition_write((const esp_partition_t *)ctx, offset, buf, len);
+    flash_stats_record_write(FLASH_SUBSYS_ALERT_LOG, len, ret);
+    return ret == ESP_OK ? 0 : -1;
+}
+
+static int partition_erase(void *ctx, uint32_t offset, size_t len)
+{
+    esp_err_t ret = esp_partition_erase_range((const esp_partition_t *)ctx, offset, len);
+    if (ret == ESP_OK) {
+        flash_stats_record_erase(FLASH_SUBSYS_ALERT_LOG, len / FLASH_LOG_SECTOR_SIZE);
+    }
+    return ret == ESP_OK ? 0 : -1;
+}
+
+static esp_err_t to_esp_err(int ret)
+{
+    switch (ret) {
+        case FLASH_LOG_OK:            return ESP_OK;
+        case FLASH_LOG_ERR_FULL:      return ESP_ERR_NO_MEM;
+        case FLASH_LOG_ERR_NOT_FOUND: return ESP_ERR_NOT_FOUND;
+        case FLASH_LOG_ERR_CORRUPT:   return ESP_ERR_INVALID_CRC;
+        case FLASH_LOG_ERR_INVALID:   return ESP_ERR_INVALID_ARG;
+        default:                      return ESP_FAIL;
+    }
+}
+
+static esp_err_t flash_store_init(uint32_t *out_capacity)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                         ALERT_LOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "[LOG] Partition '%s' not found", ALERT_LOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    log_io = (flash_log_io_t) {
+        .ctx = (void *)partition,
+        .size = partition->size - (partition->size % FLASH_LOG_SECTOR_SIZE),
+        .read = partition_read,
+        .write = partition_write,
+        .erase = partition_erase,
+    };
+    flash_stats_set_partition_sectors(FLASH_SUBSYS_ALERT_LOG, log_io.size / FLASH_LOG_SECTOR_SIZE);
+
+    int64_t start = esp_timer_get_time();
+    int ret = flash_log_mount(&alert_log, &log_io, sizeof(queued_alert_t),
+                              log_index, ALERT_QUEUE_MAX_SIZE);
+    if (ret != FLASH_LOG_OK) {
+        ESP_LOGE(TAG, "[LOG] Mount failed: %d", ret);
+        return to_esp_err(ret);
+    }
+
+    ESP_LOGI(TAG, "[LOG] Mounted in %lld us: %lu records, capacity %lu, %lu corrupt skipped",
+             esp_timer_get_time() - start, flash_log_count(&alert_log),
+             alert_log.capacity, alert_log.stats.corrupt);
+
+    if (out_capacity != NULL) {
+        *out_capacity = alert_log.capacity;
+    }
+    return ESP_OK;
+}
+
+typedef struct {
+    alert_store_visit_fn_t visit;
+    void *ctx;
+} load_ctx_t;
+
+static bool load_visit(uint32_t seq, const void *payload, void *ctx)
+{
+    const load_ctx_t *load = ctx;
+    queued_alert_t alert;
+    memcpy(&alert, payload, sizeof(alert));     /* Payload is not aligned for the struct */
+    return load->visit(seq, &alert, load->ctx);
+}
+
+static esp_err_t flash_store_load(alert_store_visit_fn_t visit, void *ctx)
+{
+    load_ctx_t load = { .visit = visit, .ctx = ctx };
+    return to_esp_err(flash_log_foreach(&alert_log, load_visit, &load));
+}
+
+static esp_err_t flash_store_append(const queued_alert_t *alert, uint32_t *out_ref)
+{
+    return to_esp_err(flash_log_append(&alert_log, alert, out_ref));
+}
+
+static esp_err_t flash_store_read(uint32_t ref, queued_alert_t *alert)
+{
+    return to_esp_err(flash_log_read(&alert_log, ref, alert));
+}
+
+static esp_err_t flash_store_remove(uint32_t ref)
+{
+    return to_esp_err(flash_log_remove(&alert_log, ref));
+}
+
+const alert_store_t alert_store_flash_log = {
+    .name = "flash_log",
+    .init = flash_store_init,
+    .load = flash_store_load,
+    .append = flash_store_append,
+    .read = flash_store_read,
+    .remove = flash_store_remove,
+};
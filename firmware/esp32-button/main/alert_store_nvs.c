@@ -0,0 +1,334 @@
+#include "alert_store.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "log_ring.h"
+#include "flash_stats.h"
+
+static const char *TAG = "ALERT_STORE";
+
+#define NVS_NAMESPACE "alert_queue"
+#define NVS_KEY_ALERT_PREFIX "alert_"
+#define NVS_KEY_QUARANTINE_PREFIX "bad_"
+#define NVS_KEY_QUARANTINE_NEXT "bad_next"
+#define NVS_KEY_LEGACY_COUNT "count"    /* Written by older firmware, no longer used */
+
+#define NVS_STORE_SLOTS 50      /* Bounded by the 24 KB nvs partition */
+#define QUARANTINE_SLOTS 4      /* Corrupt records kept for inspection (round robin) */
+
+#define RECORD_MAGIC 0x51544C41u    /* "ALTQ" */
+#define RECORD_VERSION 1
+
+/* One NVS blob per alert. NVS writes each blob atomically; the header catches
+ * what that does not: bit rot, and records of another firmware's layout. */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;               /* sizeof(queued_alert_t) when written */
+    uint32_t seq;               /* Enqueue order, rebuilt at boot */
+    uint32_t crc;               /* CRC32 of the fields above and the alert */
+    queued_alert_t alert;
+} nvs_record_t;
+
+static nvs_handle_t nvs_handle;
+static bool opened = false;
+static bool used[NVS_STORE_SLOTS];
+static uint32_t seqs[NVS_STORE_SLOTS];
+static uint32_t next_seq = 1;
+static nvs_record_t record;     /* Scratch; calls are serialized by the queue */
+
+/* Helper: Generate NVS key for alert index */
+static void get_alert_key(uint32_t index, char *key_buf, size_t buf_size)
+{
+    snprintf(key_buf, buf_size, "%s%lu", NVS_KEY_ALERT_PREFIX, index);
+}
+
+static uint32_t record_crc(const nvs_record_t *rec)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(nvs_record_t, crc));
+    return esp_rom_crc32_le(crc, (const uint8_t *)&rec->alert, sizeof(rec->alert));
+}
+
+/* Helper: Write a record for an alert at index (caller commits) */
+static esp_err_t write_record(uint32_t index, const queued_alert_t *alert, uint32_t seq)
+{
+    char key[32];
+
+    record.magic = RECORD_MAGIC;
+    record.version = RECORD_VERSION;
+    record.len = sizeof(queued_alert_t);
+    record.seq = seq;
+    memcpy(&record.alert, alert, sizeof(record.alert));
+    record.crc = record_crc(&record);
+
+    get_alert_key(index, key, sizeof(key));
+    esp_err_t ret = nvs_set_blob(nvs_handle, key, &record, sizeof(record));
+    flash_stats_record_write(FLASH_SUBSYS_ALERT_NVS, sizeof(record), ret);
+    return ret;
+}
+
+/* Helper: Move an unreadable blob out of the queue, keeping a copy for inspection */
+static void quarantine(uint32_t index, const char *reason)
+{
+    char key[32];
+    char bad_key[16];
+    uint32_t next = 0;
+
+    get_alert_key(index, key, sizeof(key));
+    nvs_get_u32(nvs_handle, NVS_KEY_QUARANTINE_NEXT, &next);
+    snprintf(bad_key, sizeof(bad_key), "%s%lu", NVS_KEY_QUARANTINE_PREFIX, next % QUARANTINE_SLOTS);
+
+    /* Raw copy (blobs larger than a record are only dropped) */
+    size_t size = 0;
+    if (nvs_get_blob(nvs_handle, key, NULL, &size) == ESP_OK && size <= sizeof(record) &&
+        nvs_get_blob(nvs_handle, key, &record, &size) == ESP_OK) {
+        flash_stats_record_write(FLASH_SUBSYS_ALERT_NVS, size,
+                                 nvs_set_blob(nvs_handle, bad_key, &record, size));
+        flash_stats_record_write(FLASH_SUBSYS_ALERT_NVS, sizeof(next),
+                                 nvs_set_u32(nvs_handle, NVS_KEY_QUARANTINE_NEXT, next + 1));
+    }
+
+    flash_stats_record_write(FLASH_SUBSYS_ALERT_NVS, 0, nvs_erase_key(nvs_handle, key));
+    /* Ring entries keep %s pointers: the key is rebuilt from the literal prefix */
+    LOGR_W(TAG, "[NVS] Alert record %lu quarantined as " NVS_KEY_QUARANTINE_PREFIX "%lu: %s",
+           index, next % QUARANTINE_SLOTS, reason);
+}
+
+/* Helper: Validate the blob at index; loads it into record */
+static esp_err_t check_record(uint32_t index, size_t size, const char **reason)
+{
+    char key[32];
+
+    if (size != sizeof(record)) {
+        *reason = "size mismatch";
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    get_alert_key(index, key, sizeof(key));
+    esp_err_t ret = nvs_get_blob(nvs_handle, key, &record, &size);
+    if (ret != ESP_OK) {
+        *reason = "read failed";
+        return ret;
+    }
+
+    if (record.magic != RECORD_MAGIC || record.version != RECORD_VERSION ||
+        record.len != sizeof(queued_alert_t)) {
+        *reason = "bad header";
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    if (record.crc != record_crc(&record)) {
+        *reason = "CRC mismatch";
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t nvs_store_init(uint32_t *out_capacity)
+{
+    if (!opened) {
+        esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "[NVS] Failed to open: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        opened = true;
+    }
+
+    /* Occupancy and order come from the records themselves */
+    char key[32];
+    uint32_t count = 0;
+    uint32_t quarantined = 0;
+    bool legacy[NVS_STORE_SLOTS] = {0};
+
+    next_seq = 1;
+    for (uint32_t i = 0; i < NVS_STORE_SLOTS; i++) {
+        size_t size = 0;
+        const char *reason = NULL;
+
+        used[i] = false;
+        get_alert_key(i, key, sizeof(key));
+        if (nvs_get_blob(nvs_handle, key, NULL, &size) != ESP_OK) {
+            continue;
+        }
+
+        if (size == sizeof(queued_alert_t)) {
+            legacy[i] = true;   /* Bare alert from older firmware: upgraded below */
+            continue;
+        }
+
+        if (check_record(i, size, &reason) != ESP_OK) {
+            quarantine(i, reason);
+            quarantined++;
+            continue;
+        }
+
+        used[i] = true;
+        seqs[i] = record.seq;
+        if (record.seq >= next_seq) {
+            next_seq = record.seq + 1;
+        }
+        count++;
+    }
+
+    /* Upgrade legacy records in place, ordered after every current record */
+    for (uint32_t i = 0; i < NVS_STORE_SLOTS; i++) {
+        if (!legacy[i]) {
+            continue;
+        }
+
+        queued_alert_t alert;
+        size_t size = sizeof(alert);
+        get_alert_key(i, key, sizeof(key));
+        if (nvs_get_blob(nvs_handle, key, &alert, &size) != ESP_OK ||
+            write_record(i, &alert, next_seq) != ESP_OK) {
+            quarantine(i, "legacy upgrade failed");
+            quarantined++;
+            continue;
+        }
+
+        used[i] = true;
+        seqs[i] = next_seq++;
+        count++;
+    }
+
+    nvs_erase_key(nvs_handle, NVS_KEY_LEGACY_COUNT);
+    nvs_commit(nvs_handle);
+
+    if (count > 0 || quarantined > 0) {
+        ESP_LOGI(TAG, "[NVS] Recovered %lu records, %lu quarantined", count, quarantined);
+    }
+
+    if (out_capacity != NULL) {
+        *out_capacity = NVS_STORE_SLOTS;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t nvs_store_load(alert_store_visit_fn_t visit, void *ctx)
+{
+    /* Visit in enqueue order: index list sorted by seq */
+    uint8_t order[NVS_STORE_SLOTS];
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < NVS_STORE_SLOTS; i++) {
+        if (!used[i]) {
+            continue;
+        }
+        uint32_t pos = n++;
+        while (pos > 0 && seqs[order[pos - 1]] > seqs[i]) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = (uint8_t)i;
+    }
+
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = order[k];
+        char key[32];
+        size_t size = sizeof(record);
+
+        get_alert_key(i, key, sizeof(key));
+        esp_err_t ret = nvs_get_blob(nvs_handle, key, &record, &size);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "[NVS] Failed to read alert %lu: %s", i, esp_err_to_name(ret));
+            continue;
+        }
+
+        if (!visit(i, &record.alert, ctx)) {
+            break;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t nvs_store_append(const queued_alert_t *alert, uint32_t *out_ref)
+{
+    /* Find next available slot */
+    uint32_t index = NVS_STORE_SLOTS;
+    for (uint32_t i = 0; i < NVS_STORE_SLOTS; i++) {
+        if (!used[i]) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == NVS_STORE_SLOTS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = write_record(index, alert, next_seq);
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs_handle);
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    used[index] = true;
+    seqs[index] = next_seq++;
+
+    *out_ref = index;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_store_read(uint32_t ref, queued_alert_t *alert)
+{
+    if (ref >= NVS_STORE_SLOTS || !used[ref]) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char key[32];
+    size_t size = sizeof(record);
+    get_alert_key(ref, key, sizeof(key));
+    esp_err_t ret = nvs_get_blob(nvs_handle, key, &record, &size);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (size != sizeof(record) || record.crc != record_crc(&record)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    memcpy(alert, &record.alert, sizeof(*alert));
+    return ESP_OK;
+}
+
+static esp_err_t nvs_store_remove(uint32_t ref)
+{
+    if (ref >= NVS_STORE_SLOTS || !used[ref]) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char key[32];
+    get_alert_key(ref, key, sizeof(key));
+    esp_err_t ret = nvs_erase_key(nvs_handle, key);
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs_handle);
+        flash_stats_record_write(FLASH_SUBSYS_ALERT_NVS, 0, ret);
+    } else if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = ESP_OK;
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    used[ref] = false;
+    return ESP_OK;
+}
+
+const alert_store_t alert_store_nvs = {
+    .name = "nvs",
+    .init = nvs_store_init,
+    .load = nvs_store_load,
+    .append = nvs_store_append,
+    .read = nvs_store_read,
+    .remove = nvs_store_remove,
+};
@@ -0,0 +1,432 @@
+/**
+ * SafeSignal Diagnostic Console Commands
+ *
+ * Interactive console commands for field diagnostics via UART.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "argtable3/argtable3.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/ecdh.h"
+#include "log_ring.h"
+#include "mqtt_cmd.h"
+
+static const char *TAG = "CMD_DIAG";
+
+/* ========================================================================== */
+/* Command: log_dump                                                          */
+/* ========================================================================== */
+
+static struct {
+    struct arg_lit *raw;
+    struct arg_lit *clear;
+    struct arg_end *end;
+} log_dump_args;
+
+static int cmd_log_dump(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&log_dump_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, log_dump_args.end, argv[0]);
+        return 1;
+    }
+
+    bool raw = log_dump_args.raw->count > 0;
+    bool clear = log_dump_args.clear->count > 0;
+
+    int printed = log_ring_dump(raw, clear);
+
+    uint32_t written = 0;
+    uint32_t lost = 0;
+    log_ring_get_stats(&written, &lost);
+    printf("%d entries (%lu written since boot, %lu overwritten)\n",
+           printed, (unsigned long)written, (unsigned long)lost);
+
+    return 0;
+}
+
+static void register_log_dump(void)
+{
+    log_dump_args.raw = arg_lit0("r", "raw", "Print undecoded entries for scripts/decode_log.py");
+    log_dump_args.clear = arg_lit0("c", "clear", "Discard entries after printing");
+    log_dump_args.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "log_dump",
+        .help = "Print buffered hot-path log entries",
+        .hint = NULL,
+        .func = &cmd_log_dump,
+        .argtable = &log_dump_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+/* ========================================================================== */
+/* Command: log_level                                                         */
+/* ========================================================================== */
+
+static struct {
+    struct arg_str *level;
+    struct arg_end *end;
+} log_level_args;
+
+static int cmd_log_level(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&log_level_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, log_level_args.end, argv[0]);
+        return 1;
+    }
+
+    if (log_level_args.level->count == 0) {
+        printf("Log level: %s\n", log_ring_level_name(log_ring_get_level()));
+        return 0;
+    }
+
+    const char *name = log_level_args.level->sval[0];
+    esp_log_level_t level;
+    if (log_ring_parse_level(name, strlen(name), &level)) {
+        log_ring_set_level(level);
+        printf("Log level set to %s\n", log_ring_level_name(level));
+        return 0;
+    }
+
+    printf("Error: Invalid level. Use: none, error, warn, info, debug, or verbose\n");
+    return 1;
+}
+
+static void register_log_level(void)
+{
+    log_level_args.level = arg_str0(NULL, NULL, "<level>",
+        "none, error, warn, info, debug, or verbose");
+    log_level_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "log_level",
+        .help = "Show or change the runtime log level",
+        .hint = NULL,
+        .func = &cmd_log_level,
+        .argtable = &log_level_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+/* ========================================================================== */
+/* Command: tls_bench                                                         */
+/* ========================================================================== */
+
+/*
+ * Times the public key work a device does in one mTLS handshake (TLS 1.2,
+ * ECDHE): verify the server certificate signature, ECDHE on P-256 and sign
+ * CertificateVerify with the device key. Symmetric crypto and round trips
+ * are the same for both profiles and are left out. Keys are generated on
+ * the device, so no second identity needs to be provisioned.
+ */
+
+#define BENCH_RSA_BITS 2048
+#define BENCH_ITERATIONS_DEFAULT 5
+#define BENCH_ITERATIONS_MAX 50
+#define BENCH_YIELD_US 100000       /* Let the idle task run during RSA keygen */
+
+typedef struct {
+    int64_t keygen_us;
+    int64_t sign_us;                /* Totals over all iterations */
+    int64_t verify_us;
+    int64_t ecdhe_us;
+    size_t heap_peak;               /* mbedTLS heap during the handshake operations */
+    size_t sig_len;
+} bench_result_t;
+
+static struct {
+    struct arg_int *iterations;
+    struct arg_end *end;
+} tls_bench_args;
+
+static portMUX_TYPE bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static size_t bench_heap_now;
+static size_t bench_heap_peak;
+static int64_t bench_yield_us;
+static unsigned char bench_sig[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+
+/* Counting allocator installed for mbedTLS while the benchmark runs. Sizes
+ * come from the heap, so blocks allocated before the swap free correctly. */
+static void *bench_calloc(size_t n, size_t size)
+{
+    void *p = MBEDTLS_PLATFORM_STD_CALLOC(n, size);
+    if (p != NULL) {
+        size_t bytes = heap_caps_get_allocated_size(p);
+        portENTER_CRITICAL(&bench_lock);
+        bench_heap_now += bytes;
+        if (bench_heap_now > bench_heap_peak) {
+            bench_heap_peak = bench_heap_now;
+        }
+        portEXIT_CRITICAL(&bench_lock);
+    }
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (p != NULL) {
+        size_t bytes = heap_caps_get_allocated_size(p);
+        portENTER_CRITICAL(&bench_lock);
+        bench_heap_now = bytes < bench_heap_now ? bench_heap_now - bytes : 0;
+        portEXIT_CRITICAL(&bench_lock);
+    }
+    MBEDTLS_PLATFORM_STD_FREE(p);
+}
+
+static void bench_heap_reset(void)
+{
+    portENTER_CRITICAL(&bench_lock);
+    bench_heap_now = 0;
+    bench_heap_peak = 0;
+    portEXIT_CRITICAL(&bench_lock);
+}
+
+static int bench_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    /* Called for every prime candidate: a cheap place to yield */
+    int64_t now = esp_timer_get_time();
+    if (now - bench_yield_us >= BENCH_YIELD_US) {
+        vTaskDelay(1);
+        bench_yield_us = esp_timer_get_time();
+    }
+
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+/* Helper: Ephemeral P-256 key pair and shared secret (both profiles use ECDHE) */
+static int bench_ecdhe(void)
+{
+    mbedtls_ecp_group grp;
+    mbedtls_ecp_point q;
+    mbedtls_mpi d;
+    mbedtls_mpi z;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_ecp_point_init(&q);
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&z);
+
+    /* The peer's share is our own point: same cost as a random one */
+    int rc = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (rc == 0) {
+        rc = mbedtls_ecdh_gen_public(&grp, &d, &q, bench_rng, NULL);
+    }
+    if (rc == 0) {
+        rc = mbedtls_ecdh_compute_shared(&grp, &z, &q, &d, bench_rng, NULL);
+    }
+
+    mbedtls_mpi_free(&z);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_point_free(&q);
+    mbedtls_ecp_group_free(&grp);
+    return rc;
+}
+
+static int bench_profile(mbedtls_pk_type_t type, int iterations, bench_result_t *res)
+{
+    mbedtls_pk_context pk;
+    unsigned char hash[32];
+    size_t sig_len = 0;
+
+    memset(res, 0, sizeof(*res));
+    mbedtls_pk_init(&pk);
+    esp_fill_random(hash, sizeof(hash));
+
+    int64_t start = esp_timer_get_time();
+    int rc = mbedtls_pk_setup(&pk, mbedtls_pk_info_from_type(type));
+    if (rc == 0 && type == MBEDTLS_PK_RSA) {
+        rc = mbedtls_rsa_gen_key(mbedtls_pk_rsa(pk), bench_rng, NULL, BENCH_RSA_BITS, 65537);
+    } else if (rc == 0) {
+        rc = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(pk), bench_rng, NULL);
+    }
+    res->keygen_us = esp_timer_get_time() - start;
+
+    /* Peak above what the key itself holds */
+    bench_heap_reset();
+
+    for (int i = 0; rc == 0 && i < iterations; i++) {
+        int64_t t0 = esp_timer_get_time();
+        rc = mbedtls_pk_sign(&pk, MBEDTLS_MD_SHA256, hash, sizeof(hash),
+                             bench_sig, sizeof(bench_sig), &sig_len, bench_rng, NULL);
+        int64_t t1 = esp_timer_get_time();
+        if (rc == 0) {
+            rc = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, hash, sizeof(hash), bench_sig, sig_len);
+        }
+        int64_t t2 = esp_timer_get_time();
+        if (rc == 0) {
+            rc = bench_ecdhe();
+        }
+        int64_t t3 = esp_timer_get_time();
+
+        res->sign_us += t1 - t0;
+        res->verify_us += t2 - t1;
+        res->ecdhe_us += t3 - t2;
+        vTaskDelay(1);
+    }
+
+    portENTER_CRITICAL(&bench_lock);
+    res->heap_peak = bench_heap_peak;
+    portEXIT_CRITICAL(&bench_lock);
+    res->sig_len = sig_len;
+
+    mbedtls_pk_free(&pk);
+    return rc;
+}
+
+static void bench_print(const char *name, const bench_result_t *res, int iterations)
+{
+    int64_t total_us = (res->sign_us + res->verify_us + res->ecdhe_us) / iterations;
+
+    printf("%-10s %8lld %8lld %8lld %8lld %10zu %6zu %10lld\n", name,
+           (long long)(res->sign_us / iterations / 1000),
+           (long long)(res->verify_us / iterations / 1000),
+           (long long)(res->ecdhe_us / iterations / 1000),
+           (long long)(total_us / 1000),
+           res->heap_peak, res->sig_len,
+           (long long)(res->keygen_us / 1000));
+}
+
+static int cmd_tls_bench(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&tls_bench_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, tls_bench_args.end, argv[0]);
+        return 1;
+    }
+
+    int iterations = BENCH_ITERATIONS_DEFAULT;
+    if (tls_bench_args.iterations->count > 0) {
+        iterations = tls_bench_args.iterations->ival[0];
+    }
+    if (iterations < 1 || iterations > BENCH_ITERATIONS_MAX) {
+        printf("Error: Iterations must be 1-%d\n", BENCH_ITERATIONS_MAX);
+        return 1;
+    }
+
+#if CONFIG_MBEDTLS_HARDWARE_ECC
+    const char *ecc = "ECC peripheral";
+#elif CONFIG_MBEDTLS_HARDWARE_MPI
+    const char *ecc = "software, RSA on MPI accelerator";
+#else
+    const char *ecc = "software";
+#endif
+    printf("Handshake public key operations, %d iterations (%s)\n", iterations, ecc);
+    printf("RSA-%d key generation takes a while...\n", BENCH_RSA_BITS);
+
+    /* Heap counts include other tasks' mbedTLS use (e.g. an MQTT reconnect) */
+    bench_result_t rsa;
+    bench_result_t ec;
+    bench_yield_us = esp_timer_get_time();
+    mbedtls_platform_set_calloc_free(bench_calloc, bench_free);
+    int rc = bench_profile(MBEDTLS_PK_RSA, iterations, &rsa);
+    if (rc == 0) {
+        rc = bench_profile(MBEDTLS_PK_ECKEY, iterations, &ec);
+    }
+    mbedtls_platform_set_calloc_free(MBEDTLS_PLATFORM_STD_CALLOC, MBEDTLS_PLATFORM_STD_FREE);
+
+    if (rc != 0) {
+        printf("Error: mbedTLS error -0x%04x\n", (unsigned)-rc);
+        return 1;
+    }
+
+    printf("\n%-10s %8s %8s %8s %8s %10s %6s %10s\n", "profile", "sign_ms", "verify", "ecdhe",
+           "total", "heap_peak", "sig_B", "keygen_ms");
+    bench_print("RSA-2048", &rsa, iterations);
+    bench_print("P-256", &ec, iterations);
+
+    int64_t ec_total = ec.sign_us + ec.verify_us + ec.ecdhe_us;
+    if (ec_total > 0) {
+        int64_t rsa_total = rsa.sign_us + rsa.verify_us + rsa.ecdhe_us;
+        printf("\nP-256 handshake crypto: %lld.%lldx faster than RSA-2048\n",
+               (long long)(rsa_total / ec_total), (long long)(rsa_total * 10 / ec_total % 10));
+    }
+
+    ESP_LOGI(TAG, "tls_bench: RSA %lld ms, P-256 %lld ms per handshake",
+             (long long)((rsa.sign_us + rsa.verify_us + rsa.ecdhe_us) / iterations / 1000),
+             (long long)(ec_total / iterations / 1000));
+    return 0;
+}
+
+static void register_tls_bench(void)
+{
+    tls_bench_args.iterations = arg_int0("n", "iterations", "<n>",
+        "Handshakes per profile (default 5)");
+    tls_bench_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "tls_bench",
+        .help = "Compare mTLS handshake crypto time and heap: RSA-2048 vs P-256",
+        .hint = NULL,
+        .func = &cmd_tls_bench,
+        .argtable = &tls_bench_args
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+/* ========================================================================== */
+/* Command: latency                                                           */
+/* ========================================================================== */
+
+static void print_histogram(const char *name, const uint32_t *counts, int n, bool skew)
+{
+    printf("%s:\n", name);
+    for (int i = 0; i < n; i++) {
+        int32_t bound = mqtt_cmd_latency_bound(skew, i);
+        if (bound == INT32_MAX) {
+            printf("  %8s  %lu\n", "+inf", (unsigned long)counts[i]);
+        } else {
+            printf("  <= %5ld ms  %lu\n", (long)bound, (unsigned long)counts[i]);
+        }
+    }
+}
+
+static int cmd_latency_show(int argc, char **argv)
+{
+    mqtt_cmd_latency_t lat;
+    mqtt_cmd_get_latency(&lat);
+
+    print_histogram("RTT (ping response to PUBACK)", lat.rtt, MQTT_CMD_RTT_BUCKETS, false);
+    printf("  last %lu ms, %lu unacknowledged\n",
+           (unsigned long)lat.rtt_last_ms, (unsigned long)lat.rtt_lost);
+    print_histogram("One-way (device receive - edge t0)", lat.skew, MQTT_CMD_SKEW_BUCKETS, true);
+    printf("  last %ld ms\n", (long)lat.skew_last_ms);
+    return 0;
+}
+
+static void register_latency(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "latency",
+        .help = "Show device-side latency probe histograms (edge pings)",
+        .hint = NULL,
+        .func = &cmd_latency_show,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+/* ========================================================================== */
+/* Public API: Register all diagnostic commands                               */
+/* ========================================================================== */
+
+void register_diag_commands(void)
+{
+    ESP_LOGI(TAG, "Registering diagnostic console commands");
+
+    register_log_dump();
+    register_log_level();
+    register_latency();
+    register_tls_bench();
+}
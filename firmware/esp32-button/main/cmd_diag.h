@@ -0,0 +1,20 @@
+/**
+ * SafeSignal Diagnostic Console Commands
+ * Header file
+ */
+
+#ifndef SAFESIGNAL_CMD_DIAG_H
+#define SAFESIGNAL_CMD_DIAG_H
+
+/**
+ * @brief Register all diagnostic console commands
+ *
+ * Registers the following commands:
+ * - log_dump: Print buffered hot-path log entries
+ * - log_level: Show or change the runtime log level
+ * - latency: Device-side latency probe histograms
+ * - tls_bench: Compare mTLS handshake crypto time and heap, RSA-2048 vs P-256
+ */
+void register_diag_commands(void);
+
+#endif /* SAFESIGNAL_CMD_DIAG_H */
@@ -11,9 +11,19 @@
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
 #include "provisioning.h"
+#include "prov_uart.h"
 
 static const char *TAG = "CMD_PROVISION";
 
+/* Console edits are staged and applied together by provision_complete */
+static esp_err_t ensure_staging(void)
+{
+    if (provision_stage_active()) {
+        return ESP_OK;
+    }
+    return provision_stage_begin();
+}
+
 /* ========================================================================== */
 /* Command: provision_status                                                  */
 /* ========================================================================== */
@@ -28,6 +38,9 @@ static int cmd_provision_status(int argc, char **argv)
 
     bool provisioned = provision_is_provisioned();
     printf("Status: %s\n", provisioned ? "PROVISIONED ✓" : "NOT PROVISIONED ✗");
+    if (provision_stage_active()) {
+        printf("Staged changes pending: 'provision_complete' applies, 'provision_discard' drops them\n");
+    }
     printf("\n");
 
     if (provisioned) {
@@ -47,16 +60,13 @@ static int cmd_provision_status(int argc, char **argv)
             printf("Error loading configuration: %s\n", esp_err_to_name(err));
         }
 
-        /* Check for certificates */
-        device_certs_t certs = {0};
-        err = provision_load_certificates(&certs);
-        if (err == ESP_OK) {
+        /* Check for certificates (presence only, nothing decrypted) */
+        if (provision_has_certificate(PROVISION_CERT_CA) &&
+            provision_has_certificate(PROVISION_CERT_CLIENT) &&
+            provision_has_certificate(PROVISION_CERT_KEY)) {
             printf("Certificates: PRESENT ✓\n");
-            provision_free_certificates(&certs);
-        } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-            printf("Certificates: NOT CONFIGURED\n");
         } else {
-            printf("Certificates: ERROR (%s)\n", esp_err_to_name(err));
+            printf("Certificates: NOT CONFIGURED\n");
         }
     }
 
@@ -106,22 +116,27 @@ static int cmd_provision_set_wifi(int argc, char **argv)
         return 1;
     }
 
-    /* Save WiFi credentials */
-    esp_err_t err;
-    err = provision_set_string(PROVISION_KEY_WIFI_SSID, ssid);
+    /* Stage WiFi credentials */
+    esp_err_t err = ensure_staging();
     if (err != ESP_OK) {
-        printf("Error saving WiFi SSID: %s\n", esp_err_to_name(err));
+        printf("Error opening staging session: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    err = provision_set_string(PROVISION_KEY_WIFI_PASS, password);
+    err = provision_stage_string(PROVISION_KEY_WIFI_SSID, ssid);
     if (err != ESP_OK) {
-        printf("Error saving WiFi password: %s\n", esp_err_to_name(err));
+        printf("Error staging WiFi SSID: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    printf("WiFi credentials saved: SSID='%s'\n", ssid);
-    printf("Note: Reboot required for changes to take effect\n");
+    err = provision_stage_string(PROVISION_KEY_WIFI_PASS, password);
+    if (err != ESP_OK) {
+        printf("Error staging WiFi password: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("WiFi credentials staged: SSID='%s'\n", ssid);
+    printf("Note: Run 'provision_complete' to apply, then reboot\n");
     return 0;
 }
 
@@ -184,38 +199,43 @@ static int cmd_provision_set_device(int argc, char **argv)
         return 1;
     }
 
-    /* Save device configuration */
-    esp_err_t err;
-    err = provision_set_string(PROVISION_KEY_DEVICE_ID, device_id);
+    /* Stage device configuration */
+    esp_err_t err = ensure_staging();
     if (err != ESP_OK) {
-        printf("Error saving device ID: %s\n", esp_err_to_name(err));
+        printf("Error opening staging session: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    err = provision_set_string(PROVISION_KEY_TENANT_ID, tenant_id);
+    err = provision_stage_string(PROVISION_KEY_DEVICE_ID, device_id);
     if (err != ESP_OK) {
-        printf("Error saving tenant ID: %s\n", esp_err_to_name(err));
+        printf("Error staging device ID: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    err = provision_set_string(PROVISION_KEY_BUILDING_ID, building_id);
+    err = provision_stage_string(PROVISION_KEY_TENANT_ID, tenant_id);
     if (err != ESP_OK) {
-        printf("Error saving building ID: %s\n", esp_err_to_name(err));
+        printf("Error staging tenant ID: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    err = provision_set_string(PROVISION_KEY_ROOM_ID, room_id);
+    err = provision_stage_string(PROVISION_KEY_BUILDING_ID, building_id);
     if (err != ESP_OK) {
-        printf("Error saving room ID: %s\n", esp_err_to_name(err));
+        printf("Error staging building ID: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    printf("Device configuration saved:\n");
+    err = provision_stage_string(PROVISION_KEY_ROOM_ID, room_id);
+    if (err != ESP_OK) {
+        printf("Error staging room ID: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("Device configuration staged:\n");
     printf("  Device ID:   %s\n", device_id);
     printf("  Tenant ID:   %s\n", tenant_id);
     printf("  Building ID: %s\n", building_id);
     printf("  Room ID:     %s\n", room_id);
-    printf("Note: Reboot required for changes to take effect\n");
+    printf("Note: Run 'provision_complete' to apply, then reboot\n");
     return 0;
 }
 
@@ -243,25 +263,17 @@ static void register_provision_set_device(void)
 
 static int cmd_provision_complete(int argc, char **argv)
 {
-    /* Verify minimum required configuration */
-    char test_buf[64];
-
-    esp_err_t err = provision_get_string(PROVISION_KEY_WIFI_SSID, test_buf, sizeof(test_buf));
-    if (err != ESP_OK) {
-        printf("Error: WiFi SSID not configured\n");
-        printf("Use: provision_set_wifi <ssid> <password>\n");
-        return 1;
-    }
-
-    err = provision_get_string(PROVISION_KEY_DEVICE_ID, test_buf, sizeof(test_buf));
-    if (err != ESP_OK) {
-        printf("Error: Device ID not configured\n");
-        printf("Use: provision_set_device <device_id> <tenant_id> <building_id> <room_id>\n");
+    /* Commit everything staged and mark as provisioned in one switch; the
+     * commit checks WiFi SSID, device ID and the certificate/key pairing */
+    esp_err_t err = provision_stage_active() ? provision_stage_commit(true)
+                                             : provision_mark_provisioned();
+    if (err == ESP_ERR_INVALID_ARG) {
+        printf("Error: configuration incomplete or inconsistent, nothing applied\n");
+        printf("Required: provision_set_wifi <ssid> <password>\n");
+        printf("          provision_set_device <device_id> <tenant_id> <building_id> <room_id>\n");
+        printf("A client certificate needs its matching key (provision_set_cert client/key)\n");
         return 1;
     }
-
-    /* Mark as provisioned */
-    err = provision_mark_provisioned();
     if (err != ESP_OK) {
         printf("Error marking device as provisioned: %s\n", esp_err_to_name(err));
         return 1;
@@ -283,13 +295,40 @@ static void register_provision_complete(void)
 {
     const esp_console_cmd_t cmd = {
         .command = "provision_complete",
-        .help = "Mark provisioning as complete",
+        .help = "Apply staged changes and mark provisioning as complete",
         .hint = NULL,
         .func = &cmd_provision_complete,
     };
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+/* ========================================================================== */
+/* Command: provision_discard                                                 */
+/* ========================================================================== */
+
+static int cmd_provision_discard(int argc, char **argv)
+{
+    if (!provision_stage_active()) {
+        printf("No staged changes\n");
+        return 0;
+    }
+
+    provision_stage_abort();
+    printf("Staged changes discarded; stored configuration unchanged\n");
+    return 0;
+}
+
+static void register_provision_discard(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "provision_discard",
+        .help = "Drop staged changes not yet applied with provision_complete",
+        .hint = NULL,
+        .func = &cmd_provision_discard,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 /* ========================================================================== */
 /* Command: provision_reset (factory reset)                                   */
 /* ========================================================================== */
@@ -420,14 +459,14 @@ static int cmd_provision_set_cert(int argc, char **argv)
     const char *cert_type = provision_cert_args.cert_type->sval[0];
     const char *cert_data = provision_cert_args.cert_data->sval[0];
 
-    /* Map type to NVS key */
-    const char *key = NULL;
+    /* Map type to certificate slot */
+    provision_cert_t which;
     if (strcmp(cert_type, "ca") == 0) {
-        key = PROVISION_KEY_CA_CERT;
+        which = PROVISION_CERT_CA;
     } else if (strcmp(cert_type, "client") == 0) {
-        key = PROVISION_KEY_CLIENT_CERT;
+        which = PROVISION_CERT_CLIENT;
     } else if (strcmp(cert_type, "key") == 0) {
-        key = PROVISION_KEY_CLIENT_KEY;
+        which = PROVISION_CERT_KEY;
     } else {
         printf("Error: Invalid certificate type. Use: ca, client, or key\n");
         return 1;
@@ -455,14 +494,21 @@ static int cmd_provision_set_cert(int argc, char **argv)
         return 1;
     }
 
-    /* Save certificate */
-    esp_err_t err = provision_set_string(key, cert_data);
+    /* Stage certificate (parsed and stored as DER, paired with the key at provision_complete) */
+    esp_err_t err = ensure_staging();
+    if (err == ESP_OK) {
+        err = provision_stage_certificate(which, cert_data);
+    }
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        printf("Error: Device identity must be ECDSA P-256 (scripts/seed-certs.sh)\n");
+        return 1;
+    }
     if (err != ESP_OK) {
-        printf("Error saving certificate: %s\n", esp_err_to_name(err));
+        printf("Error staging certificate: %s\n", esp_err_to_name(err));
         return 1;
     }
 
-    printf("Certificate '%s' saved successfully (%zu bytes)\n", cert_type, cert_len);
+    printf("Certificate '%s' staged (%zu bytes), run 'provision_complete' to apply\n", cert_type, cert_len);
     printf("Note: Use 'provision_load_cert_file' to load from file instead\n");
     return 0;
 }
@@ -495,38 +541,13 @@ static int cmd_provision_cert_status(int argc, char **argv)
     printf("Certificate Status:\n");
     printf("------------------\n");
 
-    char test_buf[64];
-    esp_err_t err;
-
-    /* Check CA certificate */
-    err = provision_get_string(PROVISION_KEY_CA_CERT, test_buf, sizeof(test_buf));
-    if (err == ESP_OK) {
-        printf("  CA Certificate:     PRESENT ✓\n");
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        printf("  CA Certificate:     NOT CONFIGURED ✗\n");
-    } else {
-        printf("  CA Certificate:     ERROR (%s)\n", esp_err_to_name(err));
-    }
-
-    /* Check client certificate */
-    err = provision_get_string(PROVISION_KEY_CLIENT_CERT, test_buf, sizeof(test_buf));
-    if (err == ESP_OK) {
-        printf("  Client Certificate: PRESENT ✓\n");
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        printf("  Client Certificate: NOT CONFIGURED ✗\n");
-    } else {
-        printf("  Client Certificate: ERROR (%s)\n", esp_err_to_name(err));
-    }
-
-    /* Check client key */
-    err = provision_get_string(PROVISION_KEY_CLIENT_KEY, test_buf, sizeof(test_buf));
-    if (err == ESP_OK) {
-        printf("  Client Key:         PRESENT ✓\n");
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        printf("  Client Key:         NOT CONFIGURED ✗\n");
-    } else {
-        printf("  Client Key:         ERROR (%s)\n", esp_err_to_name(err));
-    }
+    /* Presence from the provisioning snapshot (a cert does not fit a test buffer) */
+    printf("  CA Certificate:     %s\n",
+           provision_has_certificate(PROVISION_CERT_CA) ? "PRESENT ✓" : "NOT CONFIGURED ✗");
+    printf("  Client Certificate: %s\n",
+           provision_has_certificate(PROVISION_CERT_CLIENT) ? "PRESENT ✓" : "NOT CONFIGURED ✗");
+    printf("  Client Key:         %s\n",
+           provision_has_certificate(PROVISION_CERT_KEY) ? "PRESENT ✓" : "NOT CONFIGURED ✗");
 
     printf("\n");
     printf("Note: Certificates are optional. Device will use embedded certificates\n");
@@ -547,6 +568,39 @@ static void register_provision_cert_status(void)
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+/* ========================================================================== */
+/* Command: provision_binary                                                  */
+/* ========================================================================== */
+
+static int cmd_provision_binary(int argc, char **argv)
+{
+    /* Frames start right after this line; the host tool waits for no banner */
+    esp_err_t err = prov_uart_run();
+
+    if (err == ESP_ERR_TIMEOUT) {
+        printf("Binary provisioning: host went silent, session closed\n");
+        return 1;
+    }
+    if (err != ESP_OK) {
+        printf("Binary provisioning failed: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("Binary provisioning session complete\n");
+    return 0;
+}
+
+static void register_provision_binary(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "provision_binary",
+        .help = "Enter the binary provisioning protocol (scripts/provision_factory.py)",
+        .hint = NULL,
+        .func = &cmd_provision_binary,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 /* ========================================================================== */
 /* Public API: Register all provisioning commands                             */
 /* ========================================================================== */
@@ -559,8 +613,10 @@ void register_provision_commands(void)
     register_provision_set_wifi();
     register_provision_set_device();
     register_provision_complete();
+    register_provision_discard();
     register_provision_reset();
     register_provision_get();
     register_provision_set_cert();
     register_provision_cert_status();
+    register_provision_binary();
 }
@@ -16,6 +16,7 @@
  * - provision_complete: Mark provisioning as complete
  * - provision_reset: Factory reset (erase all provisioning data)
  * - provision_get: Get provisioning value by key
+ * - provision_binary: Binary framed provisioning session (factory stations)
  */
 void register_provision_commands(void);
 
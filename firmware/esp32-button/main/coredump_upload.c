@@ -0,0 +1,172 @@
+#include "coredump_upload.h"
+#include "mqtt.h"
+#include "alert_queue.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_core_dump.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "COREDUMP";
+
+#define ACK_TIMEOUT_MS 30000  /* Resend the in-flight chunk after this */
+
+/* Upload state (accessed from status task and MQTT task) */
+static const esp_partition_t *partition = NULL;
+static size_t dump_offset = 0;          /* Image offset within the partition */
+static size_t dump_size = 0;
+static volatile bool pending = false;
+static volatile size_t acked_bytes = 0;
+static volatile int inflight_msg_id = -1;
+static volatile size_t inflight_end = 0;
+static int64_t inflight_since_us = 0;
+static portMUX_TYPE inflight_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Chunk buffer: header followed by payload */
+static uint8_t chunk_buf[sizeof(coredump_chunk_header_t) + COREDUMP_CHUNK_SIZE];
+
+esp_err_t coredump_upload_init(void)
+{
+    size_t addr = 0;
+    size_t size = 0;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                         ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "[COREDUMP] No coredump partition, upload disabled");
+        return ESP_OK;
+    }
+
+    esp_err_t ret = esp_core_dump_image_check();
+    if (ret != ESP_OK) {
+        /* No image, or a corrupt one that the decoder could not use anyway */
+        if (ret != ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "[COREDUMP] Stored image invalid (%s), erasing",
+                     esp_err_to_name(ret));
+            esp_core_dump_image_erase();
+        }
+        return ESP_OK;
+    }
+
+    ret = esp_core_dump_image_get(&addr, &size);
+    if (ret != ESP_OK || addr < partition->address) {
+        ESP_LOGW(TAG, "[COREDUMP] Failed to locate image: %s", esp_err_to_name(ret));
+        return ESP_OK;
+    }
+
+    dump_offset = addr - partition->address;
+    dump_size = size;
+    acked_bytes = 0;
+    inflight_msg_id = -1;
+    pending = true;
+
+    esp_core_dump_summary_t summary;
+    if (esp_core_dump_get_summary(&summary) == ESP_OK) {
+        ESP_LOGW(TAG, "[COREDUMP] Crash in task '%s' at PC 0x%08lx (%u bytes queued for upload)",
+                 summary.exc_task, (unsigned long)summary.exc_pc, (unsigned)dump_size);
+    } else {
+        ESP_LOGW(TAG, "[COREDUMP] Core dump found (%u bytes queued for upload)",
+                 (unsigned)dump_size);
+    }
+
+    return ESP_OK;
+}
+
+bool coredump_upload_pending(void)
+{
+    return pending;
+}
+
+bool coredump_upload_step(void)
+{
+    if (!pending || !mqtt_is_connected()) {
+        return false;
+    }
+
+    /* Alerts always take the link first */
+    if (alert_queue_get_count() > 0) {
+        return false;
+    }
+
+    /* One chunk in flight; resend if its PUBACK never arrived */
+    if (inflight_msg_id >= 0) {
+        if ((esp_timer_get_time() - inflight_since_us) / 1000 < ACK_TIMEOUT_MS) {
+            return false;
+        }
+        ESP_LOGW(TAG, "[COREDUMP] Chunk at %u not acknowledged, resending", (unsigned)acked_bytes);
+        inflight_msg_id = -1;
+    }
+
+    size_t offset = acked_bytes;
+    size_t len = dump_size - offset;
+    if (len > COREDUMP_CHUNK_SIZE) {
+        len = COREDUMP_CHUNK_SIZE;
+    }
+
+    coredump_chunk_header_t *hdr = (coredump_chunk_header_t *)chunk_buf;
+    uint8_t *payload = chunk_buf + sizeof(coredump_chunk_header_t);
+
+    esp_err_t ret = esp_partition_read(partition, dump_offset + offset, payload, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "[COREDUMP] Flash read failed at %u: %s",
+                 (unsigned)offset, esp_err_to_name(ret));
+        return false;
+    }
+
+    hdr->magic = COREDUMP_CHUNK_MAGIC;
+    hdr->dump_size = dump_size;
+    hdr->offset = offset;
+    hdr->length = len;
+    hdr->reserved = 0;
+    hdr->crc32 = esp_rom_crc32_le(0, payload, len);
+
+    inflight_end = offset + len;
+    inflight_since_us = esp_timer_get_time();
+
+    int msg_id = mqtt_publish_coredump_chunk(chunk_buf, sizeof(coredump_chunk_header_t) + len);
+    if (msg_id < 0) {
+        return false;
+    }
+
+    inflight_msg_id = msg_id;
+    ESP_LOGD(TAG, "[COREDUMP] Chunk %u-%u/%u sent (msg_id=%d)",
+             (unsigned)offset, (unsigned)inflight_end, (unsigned)dump_size, msg_id);
+
+    /* The PUBACK may have been dispatched before msg_id was recorded */
+    if (mqtt_puback_seen(msg_id)) {
+        coredump_upload_on_published(msg_id);
+    }
+    return true;
+}
+
+void coredump_upload_on_published(int msg_id)
+{
+    /* Called from both tasks for the same PUBACK (see above): only the first
+     * one advances */
+    portENTER_CRITICAL(&inflight_lock);
+    bool match = pending && msg_id == inflight_msg_id;
+    if (match) {
+        inflight_msg_id = -1;
+    }
+    portEXIT_CRITICAL(&inflight_lock);
+
+    if (!match) {
+        return;
+    }
+
+    acked_bytes = inflight_end;
+
+    if (acked_bytes >= dump_size) {
+        pending = false;
+        esp_core_dump_image_erase();
+        ESP_LOGI(TAG, "[COREDUMP] Upload complete (%u bytes), image erased", (unsigned)dump_size);
+    }
+}
+
+void coredump_upload_on_disconnect(void)
+{
+    inflight_msg_id = -1;
+}
@@ -0,0 +1,66 @@
+#ifndef SAFESIGNAL_COREDUMP_UPLOAD_H
+#define SAFESIGNAL_COREDUMP_UPLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * Core Dump Upload
+ *
+ * Ships the core dump left in the `coredump` flash partition by a panic
+ * (watchdog timeout, ESP_ERROR_CHECK abort, exception) to the edge:
+ * - Dump is read in fixed-size chunks straight from flash (no full copy in RAM)
+ * - One chunk in flight at a time, confirmed by PUBACK before advancing
+ * - Chunks are only sent while the alert queue is empty, so alerts always go first
+ * - Image is erased after the last chunk is acknowledged
+ *
+ * Decode on the host with scripts/decode_coredump.py and the build's ELF.
+ */
+
+#define COREDUMP_CHUNK_SIZE 1024
+#define COREDUMP_CHUNK_MAGIC 0x504D4443  /* "CDMP" */
+
+/**
+ * Chunk header prepended to every published chunk (little endian)
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;         /* COREDUMP_CHUNK_MAGIC */
+    uint32_t dump_size;     /* Total size of the core dump image */
+    uint32_t offset;        /* Offset of this chunk within the image */
+    uint16_t length;        /* Payload bytes following the header */
+    uint16_t reserved;
+    uint32_t crc32;         /* CRC32 (little endian) of the payload */
+} coredump_chunk_header_t;
+
+/**
+ * Check the coredump partition for a stored image
+ * @return ESP_OK on success (also when no dump is present)
+ */
+esp_err_t coredump_upload_init(void);
+
+/**
+ * Check if a core dump is waiting to be uploaded
+ * @return true if an image is pending
+ */
+bool coredump_upload_pending(void);
+
+/**
+ * Send the next chunk if the link is idle
+ * Call periodically from a low-priority context; sends at most one chunk.
+ * @return true if a chunk was handed to MQTT
+ */
+bool coredump_upload_step(void);
+
+/**
+ * Notify that MQTT acknowledged a message (MQTT_EVENT_PUBLISHED)
+ * @param msg_id Acknowledged message ID
+ */
+void coredump_upload_on_published(int msg_id);
+
+/**
+ * Notify that the MQTT link dropped; the unacknowledged chunk is resent
+ */
+void coredump_upload_on_disconnect(void);
+
+#endif /* SAFESIGNAL_COREDUMP_UPLOAD_H */
@@ -0,0 +1,545 @@
+#include "flash_log.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+#endif
+
+#define SECTOR_MAGIC        0x474F4C53u     /* "SLOG" */
+#define RECORD_MAGIC        0x44524352u     /* "RCRD" */
+#define FORMAT_VERSION      1
+#define SECTOR_HEADER_SIZE  16
+
+/* Record state word, excluded from the CRC so it can be programmed in place */
+#define STATE_ERASED        0xFFFFFFFFu
+#define STATE_VALID         0x55AA55AAu
+#define STATE_DELETED       0x00000000u
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slot_size;
+    uint32_t sector_seq;
+    uint32_t crc;           /* CRC32 of the preceding 12 bytes */
+} sector_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t state;
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t crc;           /* CRC32 of magic..reserved + payload */
+} record_header_t;
+
+#define RECORD_CRC_OFFSET   4   /* CRC starts at magic */
+#define RECORD_CRC_SPAN     (sizeof(record_header_t) - RECORD_CRC_OFFSET - sizeof(uint32_t))
+
+typedef enum {
+    SECTOR_ERASED,
+    SECTOR_VALID,
+    SECTOR_BAD,
+} sector_state_t;
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+#ifdef ESP_PLATFORM
+    return esp_rom_crc32_le(crc, data, len);
+#else
+    /* Same polynomial and conditioning as esp_rom_crc32_le / zlib crc32 */
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+#endif
+}
+
+static bool all_erased(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t sector_offset(uint32_t sector)
+{
+    return sector * FLASH_LOG_SECTOR_SIZE;
+}
+
+static uint32_t slot_offset(const flash_log_t *log, uint32_t sector, uint32_t slot)
+{
+    return sector_offset(sector) + SECTOR_HEADER_SIZE + slot * log->slot_size;
+}
+
+static int io_read(flash_log_t *log, uint32_t offset, void *buf, size_t len)
+{
+    return log->io->read(log->io->ctx, offset, buf, len) == 0 ? FLASH_LOG_OK : FLASH_LOG_ERR_IO;
+}
+
+static int io_write(flash_log_t *log, uint32_t offset, const void *buf, size_t len)
+{
+    if (log->io->write(log->io->ctx, offset, buf, len) != 0) {
+        return FLASH_LOG_ERR_IO;
+    }
+    log->stats.bytes_written += len;
+    return FLASH_LOG_OK;
+}
+
+static int erase_sector(flash_log_t *log, uint32_t sector)
+{
+    if (log->io->erase(log->io->ctx, sector_offset(sector), FLASH_LOG_SECTOR_SIZE) != 0) {
+        return FLASH_LOG_ERR_IO;
+    }
+    log->stats.erases++;
+    return FLASH_LOG_OK;
+}
+
+static int read_sector_state(flash_log_t *log, uint32_t sector, sector_state_t *state, uint32_t *sector_seq)
+{
+    sector_header_t hdr;
+    int ret = io_read(log, sector_offset(sector), &hdr, sizeof(hdr));
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    if (all_erased((const uint8_t *)&hdr, sizeof(hdr))) {
+        *state = SECTOR_ERASED;
+    } else if (hdr.magic == SECTOR_MAGIC && hdr.version == FORMAT_VERSION &&
+               hdr.slot_size == log->slot_size &&
+               hdr.crc == crc32_update(0, &hdr, offsetof(sector_header_t, crc))) {
+        *state = SECTOR_VALID;
+        *sector_seq = hdr.sector_seq;
+    } else {
+        *state = SECTOR_BAD;    /* Torn header, interrupted erase or foreign data */
+    }
+    return FLASH_LOG_OK;
+}
+
+/* Erase unless every byte already reads 0xFF (cheap read instead of an erase) */
+static int ensure_blank(flash_log_t *log, uint32_t sector)
+{
+    for (uint32_t off = 0; off < FLASH_LOG_SECTOR_SIZE; off += sizeof(log->scratch)) {
+        int ret = io_read(log, sector_offset(sector) + off, log->scratch, sizeof(log->scratch));
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+        if (!all_erased(log->scratch, sizeof(log->scratch))) {
+            return erase_sector(log, sector);
+        }
+    }
+    return FLASH_LOG_OK;
+}
+
+static int open_sector(flash_log_t *log, uint32_t sector, uint32_t sector_seq)
+{
+    sector_header_t hdr = {
+        .magic = SECTOR_MAGIC,
+        .version = FORMAT_VERSION,
+        .slot_size = (uint16_t)log->slot_size,
+        .sector_seq = sector_seq,
+    };
+    hdr.crc = crc32_update(0, &hdr, offsetof(sector_header_t, crc));
+
+    int ret = io_write(log, sector_offset(sector), &hdr, sizeof(hdr));
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    log->head_sector = sector;
+    log->head_slot = 0;
+    log->sector_seq = sector_seq;
+    return FLASH_LOG_OK;
+}
+
+/* Read a slot into scratch and check its CRC (and that it is live, unless any_state) */
+static int read_slot(flash_log_t *log, uint32_t offset, bool any_state)
+{
+    int ret = io_read(log, offset, log->scratch, log->slot_size);
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    const record_header_t *hdr = (const record_header_t *)log->scratch;
+    if ((!any_state && hdr->state != STATE_VALID) ||
+        hdr->magic != RECORD_MAGIC || hdr->len != log->payload_size) {
+        return FLASH_LOG_ERR_CORRUPT;
+    }
+
+    uint32_t crc = crc32_update(0, log->scratch + RECORD_CRC_OFFSET, RECORD_CRC_SPAN);
+    crc = crc32_update(crc, log->scratch + sizeof(record_header_t), log->payload_size);
+    return crc == hdr->crc ? FLASH_LOG_OK : FLASH_LOG_ERR_CORRUPT;
+}
+
+static int find_entry(const flash_log_t *log, uint32_t seq)
+{
+    for (uint32_t i = 0; i < log->live; i++) {
+        if (log->index[i].seq == seq) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void drop_entry(flash_log_t *log, uint32_t i)
+{
+    log->index[i] = log->index[--log->live];
+}
+
+static int tombstone(flash_log_t *log, uint32_t offset)
+{
+    uint32_t state = STATE_DELETED;
+    return io_write(log, offset, &state, sizeof(state));
+}
+
+/* Copy live records of a sector to the head, then erase it */
+static int relocate_sector(flash_log_t *log, uint32_t victim, uint32_t slot_limit)
+{
+    for (uint32_t i = 0; i < log->live; ) {
+        flash_log_entry_t *e = &log->index[i];
+        if (e->offset / FLASH_LOG_SECTOR_SIZE != victim) {
+            i++;
+            continue;
+        }
+
+        if (log->head_slot >= slot_limit) {
+            return FLASH_LOG_ERR_FULL;  /* Unreachable while capacity holds */
+        }
+
+        int ret = read_slot(log, e->offset, false);
+        if (ret == FLASH_LOG_ERR_CORRUPT) {
+            log->stats.corrupt++;
+            drop_entry(log, i);
+            continue;
+        } else if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        /* Raw copy: seq and CRC are unchanged */
+        uint32_t offset = slot_offset(log, log->head_sector, log->head_slot);
+        ret = io_write(log, offset, log->scratch, log->slot_size);
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        e->offset = offset;
+        log->head_slot++;
+        log->stats.relocations++;
+        i++;
+    }
+
+    return erase_sector(log, victim);
+}
+
+/* Keep the sector after the head erased, compacting it if it holds data */
+static int prepare_next(flash_log_t *log, uint32_t slot_limit)
+{
+    uint32_t next = (log->head_sector + 1) % log->sector_count;
+    sector_state_t state;
+    uint32_t seq;
+
+    int ret = read_sector_state(log, next, &state, &seq);
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    switch (state) {
+        case SECTOR_VALID:
+            return relocate_sector(log, next, slot_limit);
+        case SECTOR_BAD:
+            return erase_sector(log, next);
+        case SECTOR_ERASED:
+        default:
+            return ensure_blank(log, next);
+    }
+}
+
+/* Move the head into the (erased) next sector; one slot per sector is held
+ * back so an interrupted compaction can always be resumed at mount */
+static int advance_head(flash_log_t *log)
+{
+    uint32_t limit = log->slots_per_sector - 1;
+
+    for (uint32_t guard = 0; log->head_slot >= limit; guard++) {
+        if (guard >= log->sector_count) {
+            return FLASH_LOG_ERR_FULL;
+        }
+
+        int ret = open_sector(log, (log->head_sector + 1) % log->sector_count, log->sector_seq + 1);
+        if (ret == FLASH_LOG_OK) {
+            ret = prepare_next(log, limit);
+        }
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+    }
+
+    return FLASH_LOG_OK;
+}
+
+static int format(flash_log_t *log)
+{
+    for (uint32_t s = 0; s < log->sector_count; s++) {
+        int ret = erase_sector(log, s);
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+    }
+
+    log->next_seq = 1;
+    return open_sector(log, 0, 1);
+}
+
+/* Mount: index the live records of one sector */
+static int scan_sector(flash_log_t *log, uint32_t sector, bool is_head)
+{
+    for (uint32_t slot = 0; slot < log->slots_per_sector; slot++) {
+        uint32_t offset = slot_offset(log, sector, slot);
+        record_header_t hdr;
+
+        int ret = io_read(log, offset, &hdr, sizeof(hdr));
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        if (all_erased((const uint8_t *)&hdr, sizeof(hdr))) {
+            /* Writes are sequential: the rest of the sector is free */
+            if (is_head) {
+                log->head_slot = slot;
+            }
+            return FLASH_LOG_OK;
+        }
+
+        if (hdr.state == STATE_DELETED) {
+            /* Never reuse the seq of a deleted record (only trusted if its CRC holds) */
+            if (read_slot(log, offset, true) == FLASH_LOG_OK && hdr.seq >= log->next_seq) {
+                log->next_seq = hdr.seq + 1;
+            }
+            continue;
+        }
+
+        ret = read_slot(log, offset, false);
+        if (ret == FLASH_LOG_ERR_CORRUPT) {
+            /* Torn write or bit rot: tombstone so it is skipped cheaply next time */
+            log->stats.corrupt++;
+            tombstone(log, offset);
+            continue;
+        } else if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        if (hdr.seq >= log->next_seq) {
+            log->next_seq = hdr.seq + 1;
+        }
+
+        /* Same seq twice: compaction copied it before a reset. Sectors are
+         * scanned oldest first, so keep the newer copy. */
+        int dup = find_entry(log, hdr.seq);
+        if (dup >= 0) {
+            tombstone(log, log->index[dup].offset);
+            log->index[dup].offset = offset;
+            continue;
+        }
+
+        if (log->live < log->capacity) {
+            log->index[log->live].seq = hdr.seq;
+            log->index[log->live].offset = offset;
+            log->live++;
+        }
+    }
+
+    if (is_head) {
+        log->head_slot = log->slots_per_sector;
+    }
+    return FLASH_LOG_OK;
+}
+
+int flash_log_mount(flash_log_t *log, const flash_log_io_t *io, uint32_t payload_size,
+                    flash_log_entry_t *index, uint32_t index_len)
+{
+    if (log == NULL || io == NULL || index == NULL || payload_size == 0 ||
+        io->size % FLASH_LOG_SECTOR_SIZE != 0) {
+        return FLASH_LOG_ERR_INVALID;
+    }
+
+    memset(log, 0, sizeof(*log));
+    log->io = io;
+    log->payload_size = payload_size;
+    log->slot_size = (sizeof(record_header_t) + payload_size + 15) & ~15u;
+    log->slots_per_sector = (FLASH_LOG_SECTOR_SIZE - SECTOR_HEADER_SIZE) / log->slot_size;
+    log->sector_count = io->size / FLASH_LOG_SECTOR_SIZE;
+    log->index = index;
+
+    if (log->slot_size > FLASH_LOG_MAX_SLOT_SIZE || log->slots_per_sector < 2 ||
+        log->sector_count < 3 || log->sector_count > FLASH_LOG_MAX_SECTORS) {
+        return FLASH_LOG_ERR_INVALID;
+    }
+
+    /* Two sectors of slack: the erased one after the head and the one being compacted */
+    log->capacity = (log->sector_count - 2) * (log->slots_per_sector - 1);
+    if (log->capacity > index_len) {
+        log->capacity = index_len;
+    }
+
+    /* Classify sectors and order the valid ones oldest first */
+    uint8_t order[FLASH_LOG_MAX_SECTORS];
+    uint32_t seqs[FLASH_LOG_MAX_SECTORS];
+    uint32_t valid = 0;
+
+    for (uint32_t s = 0; s < log->sector_count; s++) {
+        sector_state_t state;
+        uint32_t seq = 0;
+        int ret = read_sector_state(log, s, &state, &seq);
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        if (state == SECTOR_VALID) {
+            uint32_t pos = valid++;
+            while (pos > 0 && seqs[pos - 1] > seq) {
+                seqs[pos] = seqs[pos - 1];
+                order[pos] = order[pos - 1];
+                pos--;
+            }
+            seqs[pos] = seq;
+            order[pos] = (uint8_t)s;
+        } else if (state == SECTOR_BAD) {
+            /* Holds nothing committed: the header is written before any record */
+            ret = erase_sector(log, s);
+            if (ret != FLASH_LOG_OK) {
+                return ret;
+            }
+        }
+    }
+
+    if (valid == 0) {
+        return format(log);
+    }
+
+    log->head_sector = order[valid - 1];
+    log->sector_seq = seqs[valid - 1];
+    log->next_seq = 1;
+
+    for (uint32_t i = 0; i < valid; i++) {
+        int ret = scan_sector(log, order[i], order[i] == log->head_sector);
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+    }
+
+    /* Finish a compaction cut short by a reset; it may use the held-back slot */
+    return prepare_next(log, log->slots_per_sector);
+}
+
+int flash_log_append(flash_log_t *log, const void *payload, uint32_t *out_seq)
+{
+    if (log->live >= log->capacity) {
+        return FLASH_LOG_ERR_FULL;
+    }
+
+    int ret = advance_head(log);
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    record_header_t *hdr = (record_header_t *)log->scratch;
+    memset(log->scratch, 0xFF, log->slot_size);
+    hdr->state = STATE_VALID;
+    hdr->magic = RECORD_MAGIC;
+    hdr->seq = log->next_seq;
+    hdr->len = (uint16_t)log->payload_size;
+    hdr->reserved = 0;
+    memcpy(log->scratch + sizeof(record_header_t), payload, log->payload_size);
+    hdr->crc = crc32_update(crc32_update(0, log->scratch + RECORD_CRC_OFFSET, RECORD_CRC_SPAN),
+                            payload, log->payload_size);
+
+    uint32_t offset = slot_offset(log, log->head_sector, log->head_slot);
+    ret = io_write(log, offset, log->scratch, log->slot_size);
+    log->head_slot++;   /* Consumed even on failure: the slot may be partly programmed */
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    log->index[log->live].seq = log->next_seq;
+    log->index[log->live].offset = offset;
+    log->live++;
+    log->stats.appends++;
+
+    if (out_seq != NULL) {
+        *out_seq = log->next_seq;
+    }
+    log->next_seq++;
+    return FLASH_LOG_OK;
+}
+
+int flash_log_read(flash_log_t *log, uint32_t seq, void *payload)
+{
+    int i = find_entry(log, seq);
+    if (i < 0) {
+        return FLASH_LOG_ERR_NOT_FOUND;
+    }
+
+    int ret = read_slot(log, log->index[i].offset, false);
+    if (ret == FLASH_LOG_OK) {
+        memcpy(payload, log->scratch + sizeof(record_header_t), log->payload_size);
+    }
+    return ret;
+}
+
+int flash_log_remove(flash_log_t *log, uint32_t seq)
+{
+    int i = find_entry(log, seq);
+    if (i < 0) {
+        return FLASH_LOG_ERR_NOT_FOUND;
+    }
+
+    int ret = tombstone(log, log->index[i].offset);
+    if (ret != FLASH_LOG_OK) {
+        return ret;
+    }
+
+    drop_entry(log, (uint32_t)i);
+    log->stats.removes++;
+    return FLASH_LOG_OK;
+}
+
+int flash_log_foreach(flash_log_t *log, flash_log_visit_fn_t visit, void *ctx)
+{
+    /* Index order is free: sort by seq (insertion sort, nearly sorted after mount) */
+    for (uint32_t i = 1; i < log->live; i++) {
+        flash_log_entry_t e = log->index[i];
+        uint32_t pos = i;
+        while (pos > 0 && log->index[pos - 1].seq > e.seq) {
+            log->index[pos] = log->index[pos - 1];
+            pos--;
+        }
+        log->index[pos] = e;
+    }
+
+    for (uint32_t i = 0; i < log->live; i++) {
+        int ret = read_slot(log, log->index[i].offset, false);
+        if (ret == FLASH_LOG_ERR_CORRUPT) {
+            continue;
+        } else if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+
+        if (!visit(log->index[i].seq, log->scratch + sizeof(record_header_t), ctx)) {
+            break;
+        }
+    }
+    return FLASH_LOG_OK;
+}
+
+uint32_t flash_log_count(const flash_log_t *log)
+{
+    return log->live;
+}
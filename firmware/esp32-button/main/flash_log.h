@@ -0,0 +1,150 @@
+#ifndef SAFESIGNAL_FLASH_LOG_H
+#define SAFESIGNAL_FLASH_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Append-Only Flash Log
+ *
+ * Record store for raw NOR flash (ESP-IDF partition or a file-backed image on
+ * the host). Portable C: all flash access goes through flash_log_io_t.
+ *
+ * Layout:
+ * - The area is a ring of 4 KB sectors, written strictly in order (wear is
+ *   spread evenly over every sector)
+ * - Each sector starts with a header {magic, version, slot size, sector seq, CRC32};
+ *   the highest sector seq is the write head
+ * - Records are fixed-size slots {state, magic, seq, len, CRC32, payload};
+ *   append is O(1) at the head
+ * - Deleting a record programs its state word to 0 in place (tombstone, no
+ *   erase; NOR flash only clears bits)
+ *
+ * Compaction: the sector after the head is always kept erased. When the head
+ * moves into a new sector, live records of the following (oldest) sector are
+ * copied to the head with their original seq, then that sector is erased.
+ * One slot per sector is held back so a compaction cut short by a reset can
+ * always be finished at mount; capacity is (sectors - 2) * (slots per sector - 1).
+ *
+ * Recovery: mount reads every sector and record once, rebuilds the live index
+ * in RAM, skips torn or corrupt records (CRC mismatch), tombstones duplicates
+ * left by an interrupted compaction and erases half-erased sectors.
+ *
+ * Not thread-safe: callers serialize access.
+ */
+
+#define FLASH_LOG_SECTOR_SIZE 4096
+#define FLASH_LOG_MAX_SECTORS 64
+#define FLASH_LOG_MAX_SLOT_SIZE 512     /* Record header + payload, 16-byte aligned */
+
+typedef enum {
+    FLASH_LOG_OK = 0,
+    FLASH_LOG_ERR_IO = -1,          /* io callback failed */
+    FLASH_LOG_ERR_INVALID = -2,     /* Bad argument or geometry */
+    FLASH_LOG_ERR_FULL = -3,        /* Capacity reached */
+    FLASH_LOG_ERR_NOT_FOUND = -4,   /* No live record with this seq */
+    FLASH_LOG_ERR_CORRUPT = -5,     /* Record failed its CRC check on read */
+} flash_log_err_t;
+
+/**
+ * Flash access (offsets relative to the start of the log area)
+ * Each callback returns 0 on success.
+ */
+typedef struct {
+    void *ctx;
+    uint32_t size;      /* Area size in bytes, multiple of FLASH_LOG_SECTOR_SIZE */
+    int (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    int (*erase)(void *ctx, uint32_t offset, size_t len);   /* Whole sectors */
+} flash_log_io_t;
+
+/**
+ * Live record index entry (RAM)
+ */
+typedef struct {
+    uint32_t seq;
+    uint32_t offset;
+} flash_log_entry_t;
+
+/**
+ * Counters since mount
+ */
+typedef struct {
+    uint32_t appends;
+    uint32_t removes;
+    uint32_t relocations;   /* Records copied by compaction */
+    uint32_t erases;        /* Sector erases */
+    uint32_t corrupt;       /* Torn/corrupt records skipped at mount */
+    uint32_t bytes_written;
+} flash_log_stats_t;
+
+/**
+ * Log state (treat as opaque)
+ */
+typedef struct {
+    const flash_log_io_t *io;
+    uint32_t payload_size;
+    uint32_t slot_size;
+    uint32_t slots_per_sector;
+    uint32_t sector_count;
+    uint32_t capacity;
+    uint32_t head_sector;
+    uint32_t head_slot;         /* Next free slot in the head sector */
+    uint32_t sector_seq;        /* Seq of the head sector */
+    uint32_t next_seq;          /* Seq of the next appended record */
+    flash_log_entry_t *index;
+    uint32_t live;
+    flash_log_stats_t stats;
+    uint8_t scratch[FLASH_LOG_MAX_SLOT_SIZE];
+} flash_log_t;
+
+/**
+ * Callback for flash_log_foreach()
+ * @return true to continue, false to stop
+ */
+typedef bool (*flash_log_visit_fn_t)(uint32_t seq, const void *payload, void *ctx);
+
+/**
+ * Mount the log, formatting it if no valid sector is found
+ * @param log Log state (output)
+ * @param io Flash access; must outlive the log
+ * @param payload_size Fixed payload size of every record
+ * @param index Live index storage (caller-owned, no heap use)
+ * @param index_len Entries in index; caps capacity
+ * @return FLASH_LOG_OK or a flash_log_err_t
+ */
+int flash_log_mount(flash_log_t *log, const flash_log_io_t *io, uint32_t payload_size,
+                    flash_log_entry_t *index, uint32_t index_len);
+
+/**
+ * Append a record
+ * @param payload payload_size bytes
+ * @param out_seq Record seq (output, may be NULL)
+ * @return FLASH_LOG_OK, FLASH_LOG_ERR_FULL or FLASH_LOG_ERR_IO
+ */
+int flash_log_append(flash_log_t *log, const void *payload, uint32_t *out_seq);
+
+/**
+ * Read a live record (CRC verified)
+ * @param payload payload_size bytes (output)
+ */
+int flash_log_read(flash_log_t *log, uint32_t seq, void *payload);
+
+/**
+ * Delete a live record (in-place tombstone)
+ */
+int flash_log_remove(flash_log_t *log, uint32_t seq);
+
+/**
+ * Visit every live record, oldest (lowest seq) first
+ * The visitor must not call back into the log.
+ */
+int flash_log_foreach(flash_log_t *log, flash_log_visit_fn_t visit, void *ctx);
+
+/**
+ * Number of live records
+ */
+uint32_t flash_log_count(const flash_log_t *log);
+
+#endif /* SAFESIGNAL_FLASH_LOG_H */
@@ -0,0 +1,283 @@
+#include "flash_stats.h"
+#include "config.h"
+#include "log_ring.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+static const char *TAG = "FLASH_STATS";
+
+#define NVS_NAMESPACE "flash_stats"
+#define NVS_KEY_LIFETIME "lifetime"
+#define LIFETIME_VERSION 1
+
+#define NVS_ENTRY_SIZE 32
+#define HOURS_PER_YEAR 8766
+#define WEAR_MIN_HOURS 24           /* Don't project from first-day provisioning writes */
+#define FLUSH_MAX_AGE_US (24LL * 3600 * 1000000)   /* Persist uptime at least daily */
+
+/* Persisted lifetime counters */
+typedef struct {
+    uint32_t version;
+    uint32_t uptime_s;              /* Accumulated up to the last flush */
+    uint32_t nvs_programmed;        /* Estimated bytes programmed into nvs pages */
+    flash_subsys_stats_t subsys[FLASH_SUBSYS_COUNT];
+} lifetime_t;
+
+static const char *subsys_names[FLASH_SUBSYS_COUNT] = {
+    [FLASH_SUBSYS_ALERT_LOG] = "alert_log",
+    [FLASH_SUBSYS_ALERT_NVS] = "alert_nvs",
+    [FLASH_SUBSYS_QUEUE_STATS] = "queue_stats",
+    [FLASH_SUBSYS_PROVISIONING] = "provisioning",
+    [FLASH_SUBSYS_FLASH_STATS] = "flash_stats",
+};
+
+static lifetime_t lifetime;
+static bool dirty = false;
+static int64_t flushed_us = 0;      /* Uptime is accounted in lifetime up to here */
+static uint32_t partition_sectors[FLASH_SUBSYS_COUNT];
+static flash_warn_t last_warn = FLASH_WARN_OK;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Helper: Bytes an NVS write programs (data entries plus the item header entry) */
+static uint32_t nvs_program_bytes(uint32_t bytes)
+{
+    if (bytes == 0) {
+        return 0;   /* Key erase: entry state bits only */
+    }
+    return ((bytes + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE + 1) * NVS_ENTRY_SIZE;
+}
+
+/* Helper: Apply one write to the counters (caller holds stats_lock) */
+static void account_write(flash_subsys_t subsys, uint32_t bytes)
+{
+    lifetime.subsys[subsys].bytes += bytes;
+    lifetime.subsys[subsys].writes++;
+    if (subsys != FLASH_SUBSYS_ALERT_LOG) {
+        lifetime.nvs_programmed += nvs_program_bytes(bytes);
+    }
+}
+
+/* Helper: Years until used reaches budget at the lifetime average rate */
+static uint32_t project_years(uint64_t budget, uint64_t used, uint32_t hours)
+{
+    if (used == 0 || hours < WEAR_MIN_HOURS) {
+        return UINT32_MAX;
+    }
+    if (used >= budget) {
+        return 0;
+    }
+
+    uint64_t years = (budget - used) * hours / (used * HOURS_PER_YEAR);
+    return years > UINT32_MAX ? UINT32_MAX : (uint32_t)years;
+}
+
+esp_err_t flash_stats_init(void)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+
+    memset(&lifetime, 0, sizeof(lifetime));
+    lifetime.version = LIFETIME_VERSION;
+    flushed_us = esp_timer_get_time();
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;  /* First boot */
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[FLASH] Failed to open NVS: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    lifetime_t stored;
+    size_t size = sizeof(stored);
+    ret = nvs_get_blob(handle, NVS_KEY_LIFETIME, &stored, &size);
+    nvs_close(handle);
+
+    if (ret == ESP_OK && size == sizeof(stored) && stored.version == LIFETIME_VERSION) {
+        memcpy(&lifetime, &stored, sizeof(lifetime));
+        ESP_LOGI(TAG, "[FLASH] Lifetime: %lu h, ~%lu KB programmed into nvs",
+                 lifetime.uptime_s / 3600, lifetime.nvs_programmed / 1024);
+    } else if (ret != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "[FLASH] Lifetime counters unreadable, starting over");
+    }
+
+    return ESP_OK;
+}
+
+void flash_stats_record_write(flash_subsys_t subsys, uint32_t bytes, esp_err_t result)
+{
+    if (subsys >= FLASH_SUBSYS_COUNT) {
+        return;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    if (result == ESP_OK) {
+        account_write(subsys, bytes);
+    } else {
+        lifetime.subsys[subsys].failures++;
+    }
+    dirty = true;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void flash_stats_record_erase(flash_subsys_t subsys, uint32_t sectors)
+{
+    if (subsys >= FLASH_SUBSYS_COUNT) {
+        return;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    lifetime.subsys[subsys].erases += sectors;
+    dirty = true;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void flash_stats_set_partition_sectors(flash_subsys_t subsys, uint32_t sectors)
+{
+    if (subsys < FLASH_SUBSYS_COUNT) {
+        partition_sectors[subsys] = sectors;
+    }
+}
+
+void flash_stats_get(flash_subsys_t subsys, flash_subsys_stats_t *out)
+{
+    if (subsys >= FLASH_SUBSYS_COUNT || out == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    *out = lifetime.subsys[subsys];
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+const char *flash_stats_subsys_name(flash_subsys_t subsys)
+{
+    return subsys < FLASH_SUBSYS_COUNT ? subsys_names[subsys] : "unknown";
+}
+
+esp_err_t flash_stats_get_health(flash_health_t *out)
+{
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_stats_t nvs;
+    esp_err_t ret = nvs_get_stats(NULL, &nvs);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint32_t nvs_programmed;
+    uint32_t log_erases;
+    uint32_t uptime_s;
+    portENTER_CRITICAL(&stats_lock);
+    nvs_programmed = lifetime.nvs_programmed;
+    log_erases = lifetime.subsys[FLASH_SUBSYS_ALERT_LOG].erases;
+    uptime_s = lifetime.uptime_s + (uint32_t)((esp_timer_get_time() - flushed_us) / 1000000);
+    portEXIT_CRITICAL(&stats_lock);
+
+    memset(out, 0, sizeof(*out));
+    out->nvs_used_entries = nvs.used_entries;
+    out->nvs_free_entries = nvs.free_entries;
+    out->nvs_total_entries = nvs.total_entries;
+    out->nvs_used_pct = nvs.total_entries > 0 ? (uint8_t)(nvs.used_entries * 100 / nvs.total_entries) : 0;
+    out->uptime_hours = uptime_s / 3600;
+
+    /* nvs: programmed bytes spread over every page; alert_log: exact erases */
+    uint64_t nvs_capacity = (uint64_t)nvs.total_entries * NVS_ENTRY_SIZE;
+    uint32_t log_sectors = partition_sectors[FLASH_SUBSYS_ALERT_LOG];
+
+    out->nvs_cycles = nvs_capacity > 0 ? (uint32_t)(nvs_programmed / nvs_capacity) : 0;
+    out->log_cycles = log_sectors > 0 ? log_erases / log_sectors : 0;
+
+    out->years_left = project_years((uint64_t)FLASH_ENDURANCE_CYCLES * nvs_capacity,
+                                    nvs_programmed, out->uptime_hours);
+    if (log_sectors > 0) {
+        uint32_t log_years = project_years((uint64_t)FLASH_ENDURANCE_CYCLES * log_sectors,
+                                           log_erases, out->uptime_hours);
+        if (log_years < out->years_left) {
+            out->years_left = log_years;
+        }
+    }
+
+    if (out->nvs_used_pct >= FLASH_NVS_CRITICAL_PCT || out->years_left < 1) {
+        out->warn = FLASH_WARN_CRITICAL;
+    } else if (out->nvs_used_pct >= FLASH_NVS_WARN_PCT ||
+               out->years_left < FLASH_LIFETIME_TARGET_YEARS) {
+        out->warn = FLASH_WARN_LOW;
+    } else {
+        out->warn = FLASH_WARN_OK;
+    }
+
+    last_warn = out->warn;
+    return ESP_OK;
+}
+
+uint32_t flash_stats_namespace_entries(const char *ns)
+{
+    nvs_handle_t handle;
+    size_t used = 0;
+
+    if (nvs_open(ns, NVS_READONLY, &handle) != ESP_OK) {
+        return 0;
+    }
+    nvs_get_used_entry_count(handle, &used);
+    nvs_close(handle);
+
+    return (uint32_t)used;
+}
+
+flash_warn_t flash_stats_get_warning(void)
+{
+    return last_warn;
+}
+
+esp_err_t flash_stats_flush(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    lifetime_t snapshot;
+
+    portENTER_CRITICAL(&stats_lock);
+    bool due = dirty || now_us - flushed_us >= FLUSH_MAX_AGE_US;
+    if (due) {
+        lifetime.uptime_s += (uint32_t)((now_us - flushed_us) / 1000000);
+        flushed_us = now_us;
+        account_write(FLASH_SUBSYS_FLASH_STATS, sizeof(lifetime));  /* This write */
+        snapshot = lifetime;
+        dirty = false;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    esp_err_t ret = ESP_OK;
+    if (due) {
+        nvs_handle_t handle;
+        ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+        if (ret == ESP_OK) {
+            ret = nvs_set_blob(handle, NVS_KEY_LIFETIME, &snapshot, sizeof(snapshot));
+            if (ret == ESP_OK) {
+                ret = nvs_commit(handle);
+            }
+            nvs_close(handle);
+        }
+
+        if (ret != ESP_OK) {
+            flash_stats_record_write(FLASH_SUBSYS_FLASH_STATS, 0, ret);
+            ESP_LOGW(TAG, "[FLASH] Failed to persist counters: %s", esp_err_to_name(ret));
+        }
+    }
+
+    /* Refresh the status warning */
+    flash_health_t health;
+    flash_warn_t previous = last_warn;
+    if (flash_stats_get_health(&health) == ESP_OK && health.warn != previous) {
+        LOGR_W(TAG, "[FLASH] Warning level %d: nvs %u%% used, ~%lu years to wear-out",
+                 health.warn, health.nvs_used_pct, health.years_left);
+    }
+
+    return ret;
+}
@@ -0,0 +1,127 @@
+/**
+ * SafeSignal Flash Wear Statistics
+ *
+ * Counts flash writes per subsystem and estimates wear, so deployments can be
+ * sized for their expected lifetime:
+ * - Lifetime bytes, writes, sector erases and failed writes per subsystem
+ *   (persisted with the accumulated uptime in the "flash_stats" namespace)
+ * - nvs partition usage (nvs_get_stats) and entries per namespace
+ * - Erase cycles used so far per partition and projected years to
+ *   FLASH_ENDURANCE_CYCLES at the lifetime average rate
+ * - A warning level published in the status keyframe (flashWarn)
+ *
+ * NVS wear is estimated: each write is counted as the 32-byte entries it
+ * programs, spread evenly over the partition's pages. alert_log erases are
+ * counted exactly.
+ *
+ * Record calls are cheap (spinlock, no I/O) and safe from any task.
+ */
+
+#ifndef SAFESIGNAL_FLASH_STATS_H
+#define SAFESIGNAL_FLASH_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef enum {
+    FLASH_SUBSYS_ALERT_LOG = 0,     /* alert_log partition (flash log store) */
+    FLASH_SUBSYS_ALERT_NVS,         /* NVS alert store */
+    FLASH_SUBSYS_QUEUE_STATS,       /* Alert queue statistics blob */
+    FLASH_SUBSYS_PROVISIONING,      /* Credentials, IDs, certificates */
+    FLASH_SUBSYS_FLASH_STATS,       /* This module's own counters */
+    FLASH_SUBSYS_COUNT
+} flash_subsys_t;
+
+typedef struct {
+    uint32_t bytes;         /* Payload bytes written */
+    uint32_t writes;        /* Committed writes (erase_key counts as a write) */
+    uint32_t erases;        /* Sector erases (raw partitions only) */
+    uint32_t failures;      /* Writes that returned an error */
+} flash_subsys_stats_t;
+
+typedef enum {
+    FLASH_WARN_OK = 0,
+    FLASH_WARN_LOW = 1,         /* nvs >= FLASH_NVS_WARN_PCT or wear-out within the target lifetime */
+    FLASH_WARN_CRITICAL = 2,    /* nvs >= FLASH_NVS_CRITICAL_PCT or wear-out within a year */
+} flash_warn_t;
+
+typedef struct {
+    uint32_t nvs_used_entries;
+    uint32_t nvs_free_entries;
+    uint32_t nvs_total_entries;
+    uint8_t nvs_used_pct;
+    uint32_t nvs_cycles;        /* Estimated erase cycles per nvs sector so far */
+    uint32_t log_cycles;        /* Erase cycles per alert_log sector so far */
+    uint32_t uptime_hours;      /* Lifetime, across reboots */
+    uint32_t years_left;        /* Projected, worst partition; UINT32_MAX if no wear yet */
+    flash_warn_t warn;
+} flash_health_t;
+
+/**
+ * @brief Load lifetime counters
+ *
+ * Call after nvs_flash_init() and before any subsystem that writes flash.
+ *
+ * @return ESP_OK on success (also on first boot)
+ */
+esp_err_t flash_stats_init(void);
+
+/**
+ * @brief Record one write
+ *
+ * @param subsys Writing subsystem
+ * @param bytes Payload bytes (0 for erases of NVS keys)
+ * @param result Result of the write/commit; failures are counted separately
+ */
+void flash_stats_record_write(flash_subsys_t subsys, uint32_t bytes, esp_err_t result);
+
+/**
+ * @brief Record sector erases on a raw partition
+ */
+void flash_stats_record_erase(flash_subsys_t subsys, uint32_t sectors);
+
+/**
+ * @brief Register the size of a raw partition used by a subsystem (for cycle estimates)
+ */
+void flash_stats_set_partition_sectors(flash_subsys_t subsys, uint32_t sectors);
+
+/**
+ * @brief Copy lifetime counters of one subsystem
+ */
+void flash_stats_get(flash_subsys_t subsys, flash_subsys_stats_t *out);
+
+/**
+ * @brief Subsystem name for reports
+ */
+const char *flash_stats_subsys_name(flash_subsys_t subsys);
+
+/**
+ * @brief Compute partition usage, wear estimate and warning level
+ *
+ * Reads NVS page statistics; call from a task, not from an ISR.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t flash_stats_get_health(flash_health_t *out);
+
+/**
+ * @brief Entries used by an NVS namespace (0 if it does not exist)
+ */
+uint32_t flash_stats_namespace_entries(const char *ns);
+
+/**
+ * @brief Last computed warning level (no I/O; safe from the MQTT task)
+ */
+flash_warn_t flash_stats_get_warning(void);
+
+/**
+ * @brief Persist lifetime counters if they changed (or daily, for uptime)
+ *
+ * Run from the periodic metrics flush; also refreshes the warning level.
+ *
+ * @return ESP_OK on success (also when nothing changed)
+ */
+esp_err_t flash_stats_flush(void);
+
+#endif /* SAFESIGNAL_FLASH_STATS_H */
@@ -0,0 +1,160 @@
+/**
+ * SafeSignal Deferred Log Ring Implementation
+ */
+
+#include "log_ring.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#define RING_MASK (LOG_RING_ENTRIES - 1)
+
+_Static_assert((LOG_RING_ENTRIES & RING_MASK) == 0, "LOG_RING_ENTRIES must be a power of two");
+
+volatile esp_log_level_t log_ring_level = ESP_LOG_INFO;
+
+static log_ring_entry_t ring[LOG_RING_ENTRIES];
+static uint32_t head = 0;           /* Next sequence number to write */
+static uint32_t tail = 0;           /* Oldest sequence number not yet dumped */
+static uint32_t overwritten = 0;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char level_chars[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+static const char *level_names[] = { "none", "error", "warn", "info", "debug", "verbose" };
+
+void log_ring_write(esp_log_level_t level, const char *tag, const char *fmt, int nargs, ...)
+{
+    uint32_t args[LOG_RING_MAX_ARGS] = {0};
+    uint32_t timestamp = (uint32_t)esp_timer_get_time();
+
+    if (nargs > LOG_RING_MAX_ARGS) {
+        nargs = LOG_RING_MAX_ARGS;
+    }
+
+    va_list ap;
+    va_start(ap, nargs);
+    for (int i = 0; i < nargs; i++) {
+        args[i] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+
+    portENTER_CRITICAL(&ring_lock);
+
+    log_ring_entry_t *e = &ring[head & RING_MASK];
+    e->seq = head;
+    e->timestamp_us = timestamp;
+    e->tag = tag;
+    e->fmt = fmt;
+    e->level = (uint8_t)level;
+    e->nargs = (uint8_t)nargs;
+    memcpy(e->args, args, sizeof(e->args));
+
+    head++;
+    if (head - tail > LOG_RING_ENTRIES) {
+        tail++;
+        overwritten++;
+    }
+
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+void log_ring_set_level(esp_log_level_t level)
+{
+    if (level > ESP_LOG_VERBOSE) {
+        level = ESP_LOG_VERBOSE;
+    }
+
+    log_ring_level = level;
+    esp_log_level_set("*", level);
+}
+
+esp_log_level_t log_ring_get_level(void)
+{
+    return log_ring_level;
+}
+
+const char *log_ring_level_name(esp_log_level_t level)
+{
+    if (level > ESP_LOG_VERBOSE) {
+        level = ESP_LOG_VERBOSE;
+    }
+    return level_names[level];
+}
+
+bool log_ring_parse_level(const char *name, size_t len, esp_log_level_t *level)
+{
+    for (int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+        if (strlen(level_names[i]) == len && strncmp(name, level_names[i], len) == 0) {
+            *level = (esp_log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+int log_ring_dump(bool raw, bool clear)
+{
+    log_ring_entry_t e;
+    int printed = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    uint32_t seq = tail;
+    uint32_t end = head;
+    portEXIT_CRITICAL(&ring_lock);
+
+    for (; seq != end; seq++) {
+        portENTER_CRITICAL(&ring_lock);
+        bool valid = (head - seq) <= LOG_RING_ENTRIES;
+        if (valid) {
+            e = ring[seq & RING_MASK];
+        }
+        portEXIT_CRITICAL(&ring_lock);
+
+        if (!valid) {
+            continue;  /* Overwritten while dumping */
+        }
+
+        char level_char = level_chars[e.level < sizeof(level_chars) ? e.level : 0];
+
+        if (raw) {
+            /* LR1 seq ts level tag fmt nargs a0 a1 a2 a3 */
+            printf("LR1 %lu %lu %c %08lx %08lx %u %08lx %08lx %08lx %08lx\n",
+                   (unsigned long)e.seq, (unsigned long)e.timestamp_us, level_char,
+                   (unsigned long)(uintptr_t)e.tag, (unsigned long)(uintptr_t)e.fmt,
+                   e.nargs,
+                   (unsigned long)e.args[0], (unsigned long)e.args[1],
+                   (unsigned long)e.args[2], (unsigned long)e.args[3]);
+        } else {
+            printf("%c (%lu) %s: ", level_char,
+                   (unsigned long)(e.timestamp_us / 1000), e.tag);
+            printf(e.fmt, e.args[0], e.args[1], e.args[2], e.args[3]);
+            printf("\n");
+        }
+        printed++;
+    }
+
+    if (clear) {
+        portENTER_CRITICAL(&ring_lock);
+        if (end - tail <= LOG_RING_ENTRIES) {
+            tail = end;
+        }
+        portEXIT_CRITICAL(&ring_lock);
+    }
+
+    return printed;
+}
+
+void log_ring_get_stats(uint32_t *written, uint32_t *lost)
+{
+    portENTER_CRITICAL(&ring_lock);
+    if (written != NULL) {
+        *written = head;
+    }
+    if (lost != NULL) {
+        *lost = overwritten;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+}
@@ -0,0 +1,124 @@
+/**
+ * SafeSignal Deferred Log Ring
+ *
+ * Binary logging backend for hot paths (button press, rate limiting, alert
+ * publish). A log call stores only the format string pointer, the tag
+ * pointer and up to LOG_RING_MAX_ARGS raw 32-bit arguments in a RAM ring
+ * buffer - no vsnprintf and no UART write on the calling task.
+ *
+ * Formatting happens later: on the device through the `log_dump` console
+ * command, or on the host with scripts/decode_log.py, which resolves the
+ * format/tag addresses against the firmware ELF.
+ *
+ * Restrictions (arguments are captured as raw 32-bit words):
+ * - At most LOG_RING_MAX_ARGS arguments
+ * - Only 32-bit conversions: %d %i %u %x %c %p %ld %lu %lx
+ * - %s arguments must point to storage that outlives the entry
+ *   (string literals, static buffers) - never stack buffers
+ */
+
+#ifndef SAFESIGNAL_LOG_RING_H
+#define SAFESIGNAL_LOG_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define LOG_RING_ENTRIES 256        /* Must be a power of two */
+#define LOG_RING_MAX_ARGS 4
+
+/**
+ * Ring entry (32 bytes)
+ */
+typedef struct {
+    uint32_t seq;               /* Monotonic sequence number */
+    uint32_t timestamp_us;      /* Low 32 bits of esp_timer_get_time() */
+    const char *tag;            /* Tag string (static storage) */
+    const char *fmt;            /* Format string (static storage), acts as message id */
+    uint8_t level;              /* esp_log_level_t */
+    uint8_t nargs;
+    uint16_t reserved;
+    uint32_t args[LOG_RING_MAX_ARGS];
+} log_ring_entry_t;
+
+/* Current ring level; entries above it are dropped at the call site */
+extern volatile esp_log_level_t log_ring_level;
+
+/**
+ * @brief Store a log entry without formatting it
+ *
+ * Use the LOGR_* macros instead of calling this directly.
+ */
+void log_ring_write(esp_log_level_t level, const char *tag, const char *fmt, int nargs, ...)
+    __attribute__((format(printf, 3, 5)));
+
+/**
+ * @brief Set the runtime log level
+ *
+ * Applies to the ring and to ESP_LOG output for all tags, so production
+ * devices can drop verbose logs without a rebuild.
+ *
+ * @param level New level (ESP_LOG_NONE .. ESP_LOG_VERBOSE)
+ */
+void log_ring_set_level(esp_log_level_t level);
+
+/**
+ * @brief Get the runtime log level
+ */
+esp_log_level_t log_ring_get_level(void);
+
+/**
+ * @brief Get the name of a log level ("none" .. "verbose")
+ */
+const char *log_ring_level_name(esp_log_level_t level);
+
+/**
+ * @brief Parse a log level name
+ *
+ * @param name Level name (need not be NUL-terminated)
+ * @param len Length of name
+ * @param level Parsed level (output)
+ * @return true if the name is a valid level
+ */
+bool log_ring_parse_level(const char *name, size_t len, esp_log_level_t *level);
+
+/**
+ * @brief Format and print buffered entries to the console (oldest first)
+ *
+ * @param raw Print undecoded entries for scripts/decode_log.py instead
+ * @param clear Discard entries after printing
+ * @return Number of entries printed
+ */
+int log_ring_dump(bool raw, bool clear);
+
+/**
+ * @brief Get ring counters
+ *
+ * @param written Entries written since boot (output, may be NULL)
+ * @param overwritten Entries lost to wrap-around before a dump (output, may be NULL)
+ */
+void log_ring_get_stats(uint32_t *written, uint32_t *overwritten);
+
+/* Argument counter (0..8; more arguments leave a non-constant here, which
+ * fails the static assertion in LOGR as well) */
+#define LOG_RING_NARGS(...) LOG_RING_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_RING_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+/* More than LOG_RING_MAX_ARGS arguments is a compile error, not a silent drop */
+#define LOGR(level, tag, fmt, ...) do {                                         \
+        _Static_assert(LOG_RING_NARGS(__VA_ARGS__) <= LOG_RING_MAX_ARGS,        \
+                       "LOGR_*: more than LOG_RING_MAX_ARGS arguments");        \
+        if ((level) <= log_ring_level) {                                        \
+            log_ring_write((level), (tag), (fmt),                               \
+                           LOG_RING_NARGS(__VA_ARGS__), ##__VA_ARGS__);         \
+        }                                                                       \
+    } while (0)
+
+#define LOGR_E(tag, fmt, ...) LOGR(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define LOGR_W(tag, fmt, ...) LOGR(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define LOGR_I(tag, fmt, ...) LOGR(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define LOGR_D(tag, fmt, ...) LOGR(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+#endif /* SAFESIGNAL_LOG_RING_H */
@@ -48,6 +48,14 @@
 #include "cmd_provision.h"
 #include "rate_limit.h"
 #include "runtime_config.h"
+#include "coredump_upload.h"
+#include "log_ring.h"
+#include "cmd_diag.h"
+#include "scheduler.h"
+#include "flash_stats.h"
+#include "prov_uart.h"
+#include "ota.h"
+#include "ota_health.h"
 
 static const char *TAG = "MAIN";
 
@@ -58,12 +66,16 @@ static EventGroupHandle_t system_events;
 #define MQTT_CONNECTED_BIT  BIT1
 #define BUTTON_PRESSED_BIT  BIT2
 
+/* Software supervisor deadlines (see watchdog.h) */
+#define BUTTON_TASK_DEADLINE_MS  15000  /* 5s wait + LED feedback + publish */
+#define STATUS_TASK_DEADLINE_MS  20000  /* Max scheduler sleep + longest job */
+
 /* Forward declarations */
 static void button_task(void *pvParameters);
 static void status_task(void *pvParameters);
 static void console_task(void *pvParameters);
 static void setup_gpio(void);
-static void setup_console(void);
+static void setup_console(bool provisioning);
 
 /**
  * Application entry point
@@ -89,6 +101,9 @@ void app_main(void)
     /* Initialize provisioning system */
     ESP_ERROR_CHECK(provision_init());
 
+    /* Lifetime flash write counters (before anything writes flash) */
+    flash_stats_init();
+
     /* Check provisioning status */
     if (!provision_is_provisioned()) {
         ESP_LOGW(TAG, "");
@@ -99,12 +114,13 @@ void app_main(void)
         ESP_LOGW(TAG, "Device requires provisioning. Use one of:");
         ESP_LOGW(TAG, "  1. Serial console commands (provision_set_wifi, etc.)");
         ESP_LOGW(TAG, "  2. Python provisioning tool: scripts/provision_device.py");
+        ESP_LOGW(TAG, "  3. Factory station (binary protocol): scripts/provision_factory.py");
         ESP_LOGW(TAG, "");
         ESP_LOGW(TAG, "Starting console for manual provisioning...");
         ESP_LOGW(TAG, "");
 
         /* Initialize console for provisioning */
-        setup_console();
+        setup_console(true);
 
         /* Console runs in background, but warn that normal operation won't start */
         ESP_LOGW(TAG, "Note: Normal device operation disabled until provisioned");
@@ -132,6 +148,15 @@ void app_main(void)
     /* Initialize watchdog */
     ESP_ERROR_CHECK(watchdog_init());
 
+    /* Check for a core dump from a previous crash */
+    coredump_upload_init();
+
+    /* Update partition and an interrupted download, if any */
+    ota_init();
+
+    /* First boot of an update: arm the rollback deadline before WiFi starts */
+    ota_health_init();
+
     /* Initialize rate limiting */
     ESP_ERROR_CHECK(rate_limit_init());
 
@@ -145,13 +170,21 @@ void app_main(void)
     mqtt_init();
 
     /* Create tasks */
-    TaskHandle_t button_task_handle, status_task_handle;
+    TaskHandle_t button_task_handle, status_task_handle, delivery_task_handle;
     xTaskCreate(button_task, "button_task", 4096, NULL, 5, &button_task_handle);
     xTaskCreate(status_task, "status_task", 4096, NULL, 3, &status_task_handle);
+    ESP_ERROR_CHECK(alert_queue_start_delivery(&delivery_task_handle));
 
     /* Register tasks with watchdog */
     ESP_ERROR_CHECK(watchdog_add_task(button_task_handle, "button_task"));
     ESP_ERROR_CHECK(watchdog_add_task(status_task_handle, "status_task"));
+    ESP_ERROR_CHECK(watchdog_add_task(delivery_task_handle, "delivery_task"));
+
+#if DIAG_CONSOLE_ENABLED
+    /* Diagnostic console (log_dump, log_level) during normal operation;
+     * provisioning commands are not registered once provisioned */
+    setup_console(false);
+#endif
 
     ESP_LOGI(TAG, "[READY] System initialized");
     ESP_LOGI(TAG, "[READY] Press button to trigger alert");
@@ -198,14 +231,17 @@ static void button_task(void *pvParameters)
 {
     static uint32_t alerts_sent = 0;
     static uint32_t alerts_failed = 0;
+    watchdog_task_id_t wdt_id;
 
     button_init(system_events, BUTTON_PRESSED_BIT);
+    watchdog_supervise(BUTTON_TASK_DEADLINE_MS, &wdt_id);
 
     ESP_LOGI(TAG, "[BUTTON] Task started");
 
     while (1) {
         /* Feed watchdog */
         watchdog_feed();
+        watchdog_checkpoint(wdt_id, "wait_press");
 
         /* Wait for button press event */
         EventBits_t bits = xEventGroupWaitBits(
@@ -217,19 +253,21 @@ static void button_task(void *pvParameters)
         );
 
         if (bits & BUTTON_PRESSED_BIT) {
-            ESP_LOGW(TAG, "");
-            ESP_LOGW(TAG, "[BUTTON] *** PANIC BUTTON PRESSED ***");
+            LOGR_W(TAG, "[BUTTON] *** PANIC BUTTON PRESSED ***");
+
+            /* Firmware download yields the link and flash to the alert */
+            ota_hold_for_alert();
 
             /* Check minimum interval (prevents accidental double-presses) */
             if (!rate_limit_check_min_interval()) {
-                ESP_LOGW(TAG, "[RATE_LIMIT] Alert throttled (too soon after last press)");
-                ESP_LOGW(TAG, "");
+                LOGR_W(TAG, "[RATE_LIMIT] Alert throttled (too soon after last press)");
                 continue;
             }
 
             /* Check rate limit (prevents DoS attacks) */
+            watchdog_checkpoint(wdt_id, "rate_limit");
             if (!rate_limit_check_alert()) {
-                ESP_LOGW(TAG, "[RATE_LIMIT] Alert blocked (rate limit exceeded)");
+                LOGR_W(TAG, "[RATE_LIMIT] Alert blocked (rate limit exceeded)");
 
                 /* Visual feedback: rapid red blink to indicate blocked */
                 for (int i = 0; i < 10; i++) {
@@ -239,7 +277,6 @@ static void button_task(void *pvParameters)
                     vTaskDelay(pdMS_TO_TICKS(50));
                 }
 
-                ESP_LOGW(TAG, "");
                 continue;
             }
 
@@ -252,26 +289,103 @@ static void button_task(void *pvParameters)
             }
 
             /* Publish alert */
+            watchdog_checkpoint(wdt_id, "publish");
             if (mqtt_publish_alert()) {
                 alerts_sent++;
                 rate_limit_record_alert();  /* Record successful alert */
-                ESP_LOGI(TAG, "[ALERT] ✓ Alert sent (total: %lu)", alerts_sent);
+                LOGR_I(TAG, "[ALERT] Alert sent (total: %lu)", alerts_sent);
             } else {
                 alerts_failed++;
-                ESP_LOGE(TAG, "[ALERT] ✗ Alert failed (total failures: %lu)", alerts_failed);
+                LOGR_E(TAG, "[ALERT] Alert failed (total failures: %lu)", alerts_failed);
             }
 
             /* LED solid on */
             gpio_set_level(LED_PIN, LED_ACTIVE_HIGH ? 1 : 0);
-
-            ESP_LOGW(TAG, "");
         }
     }
 }
 
+/* Scheduled jobs (run on status_task, see scheduler.h) */
+static scheduler_job_id_t coredump_job = SCHEDULER_JOB_ID_INVALID;
+static scheduler_job_id_t heartbeat_job = SCHEDULER_JOB_ID_INVALID;
+static scheduler_job_id_t ota_job = SCHEDULER_JOB_ID_INVALID;
+static scheduler_job_id_t ota_health_job = SCHEDULER_JOB_ID_INVALID;
+static uint32_t config_generation = 0;
+static uint32_t heartbeat_period_ms = 0;
+
+/* Pick up tunables changed by config_set (rate limits are read on each alert) */
+static void apply_runtime_tunables(void)
+{
+    uint32_t gen = runtime_config_generation();
+    if (gen == config_generation) {
+        return;
+    }
+    config_generation = gen;
+
+    /* A newer update may already be in the snapshot; the next check re-applies it */
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    if (cfg.heartbeat_interval_ms != heartbeat_period_ms) {
+        heartbeat_period_ms = cfg.heartbeat_interval_ms;
+        scheduler_set_period(heartbeat_job, heartbeat_period_ms);
+    }
+    wifi_set_power_profile(cfg.power_profile);
+}
+
+static void job_status_delta(void)
+{
+    apply_runtime_tunables();
+
+    /* Keyframe on request (reconnect, edge), otherwise a compact delta when
+     * something changed */
+    if (mqtt_status_keyframe_requested()) {
+        mqtt_publish_status();
+    } else {
+        mqtt_publish_status_delta();
+    }
+}
+
+static void job_status_keyframe(void)
+{
+    mqtt_publish_status();
+}
+
+static void job_heartbeat(void)
+{
+    mqtt_publish_heartbeat();
+}
+
+static void job_metrics_flush(void)
+{
+    alert_queue_flush_stats();
+    flash_stats_flush();
+}
+
+static void job_coredump_upload(void)
+{
+    /* Upload a pending core dump, one chunk per run, only when idle */
+    coredump_upload_step();
+
+    if (!coredump_upload_pending()) {
+        scheduler_set_enabled(coredump_job, false);
+    }
+}
+
+static void job_ota(void)
+{
+    /* One chunk per run at most; disables itself when no update is active */
+    ota_step();
+}
+
+static void job_ota_health(void)
+{
+    /* Test publish and confirmation; disables itself once the image is confirmed */
+    ota_health_step();
+}
+
 /**
  * Status reporting task
- * Periodically publishes device status and heartbeat
+ * Runs periodic status, heartbeat and queue maintenance jobs
  */
 static void status_task(void *pvParameters)
 {
@@ -280,42 +394,41 @@ static void status_task(void *pvParameters)
     /* Wait for MQTT connection */
     xEventGroupWaitBits(system_events, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
 
-    uint32_t status_counter = 0;
-    uint32_t heartbeat_counter = 0;
-
-    while (1) {
-        /* Feed watchdog */
-        watchdog_feed();
-
-        /* Status report every 60 seconds */
-        if ((status_counter++ * 1000) >= STATUS_REPORT_INTERVAL_MS) {
-            mqtt_publish_status();
-            status_counter = 0;
-        }
-
-        /* Heartbeat every 30 seconds */
-        if ((heartbeat_counter++ * 1000) >= HEARTBEAT_INTERVAL_MS) {
-            mqtt_publish_heartbeat();
-            heartbeat_counter = 0;
-        }
-
-        /* Process queued alerts periodically */
-        if ((status_counter % 10) == 0) {  /* Every 10 seconds */
-            int pending = alert_queue_get_count();
-            if (pending > 0) {
-                ESP_LOGI(TAG, "[STATUS] Processing %d queued alerts", pending);
-                alert_queue_process();
-            }
-        }
-
-        vTaskDelay(pdMS_TO_TICKS(1000));
-    }
+    /* Supervise only once connected: the initial wait is unbounded by design */
+    watchdog_task_id_t wdt_id;
+    watchdog_supervise(STATUS_TASK_DEADLINE_MS, &wdt_id);
+
+    scheduler_add_job("status_delta", job_status_delta,
+                      STATUS_DELTA_CHECK_INTERVAL_MS, 0, SCHEDULER_PRIO_NORMAL, NULL);
+    scheduler_add_job("status_keyframe", job_status_keyframe,
+                      STATUS_REPORT_INTERVAL_MS, STATUS_REPORT_JITTER_MS, SCHEDULER_PRIO_NORMAL, NULL);
+    runtime_config_t cfg;
+    config_generation = runtime_config_generation();
+    runtime_config_snapshot(&cfg);
+    heartbeat_period_ms = cfg.heartbeat_interval_ms;
+    scheduler_add_job("heartbeat", job_heartbeat,
+                      heartbeat_period_ms, HEARTBEAT_JITTER_MS, SCHEDULER_PRIO_NORMAL,
+                      &heartbeat_job);
+    scheduler_add_job("metrics_flush", job_metrics_flush,
+                      METRICS_FLUSH_INTERVAL_MS, 0, SCHEDULER_PRIO_LOW, NULL);
+    scheduler_add_job("coredump_upload", job_coredump_upload,
+                      COREDUMP_UPLOAD_INTERVAL_MS, 0, SCHEDULER_PRIO_LOW, &coredump_job);
+    scheduler_set_enabled(coredump_job, coredump_upload_pending());
+    scheduler_add_job("ota", job_ota, OTA_STEP_INTERVAL_MS, 0, SCHEDULER_PRIO_LOW, &ota_job);
+    ota_attach_job(ota_job);
+    scheduler_add_job("ota_health", job_ota_health, OTA_HEALTH_STEP_INTERVAL_MS, 0,
+                      SCHEDULER_PRIO_NORMAL, &ota_health_job);
+    ota_health_attach_job(ota_health_job);
+
+    scheduler_run(wdt_id);
 }
 
 /**
- * Setup console for interactive provisioning
+ * Setup console for interactive provisioning or field diagnostics
+ * @param provisioning Register the provisioning commands (unprovisioned
+ *                     device only); otherwise only the diagnostic ones
  */
-static void setup_console(void)
+static void setup_console(bool provisioning)
 {
     /* Disable buffering on stdin */
     setvbuf(stdin, NULL, _IONBF, 0);
@@ -334,8 +447,9 @@ static void setup_console(void)
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_DEFAULT,
     };
+    /* RX buffer holds full binary provisioning frames (prov_uart.h) */
     ESP_ERROR_CHECK(uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM,
-                                         256, 0, 0, NULL, 0));
+                                         PROV_UART_RX_BUFFER_SIZE, 0, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_param_config(CONFIG_ESP_CONSOLE_UART_NUM, &uart_config));
 
     /* Tell VFS to use UART driver */
@@ -358,15 +472,19 @@ static void setup_console(void)
     linenoiseHistorySetMaxLen(10);
     linenoiseAllowEmpty(false);
 
-    /* Register provisioning commands */
-    register_provision_commands();
+    /* Provisioning commands rewrite credentials and certificates: not
+     * reachable from the UART of a deployed device */
+    if (provisioning) {
+        register_provision_commands();
+    }
+    register_diag_commands();
 
     /* Create console task */
     xTaskCreate(console_task, "console_task", 4096, NULL, 2, NULL);
 
     ESP_LOGI(TAG, "[CONSOLE] Interactive console started");
     printf("\n");
-    printf("SafeSignal Provisioning Console\n");
+    printf(provisioning ? "SafeSignal Provisioning Console\n" : "SafeSignal Diagnostic Console\n");
     printf("Type 'help' for list of commands\n");
     printf("\n");
 }
@@ -4,6 +4,13 @@
 #include "alert_queue.h"
 #include "provisioning.h"
 #include "runtime_config.h"
+#include "watchdog.h"
+#include "coredump_upload.h"
+#include "log_ring.h"
+#include "mqtt_cmd.h"
+#include "flash_stats.h"
+#include "ota.h"
+#include "ota_health.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -12,7 +19,9 @@
 #include "freertos/event_groups.h"
 
 #include "esp_log.h"
+#include "esp_tls.h"
 #include "mqtt_client.h"
+#include "mbedtls/x509_crt.h"
 
 static const char *TAG = "MQTT";
 
@@ -24,7 +33,44 @@ extern const int MQTT_CONNECTED_BIT;
 static esp_mqtt_client_handle_t client = NULL;
 static bool connected = false;
 
-/* Certificate storage (loaded from NVS or fallback to embedded) */
+/* Command topic currently subscribed (rebuilt if runtime config changes) */
+static char cmd_topic[TOPIC_BUFFER_SIZE] = {0};
+
+/* OTA data topic, subscribed while an update downloads (see ota.h) */
+static char ota_topic[TOPIC_BUFFER_SIZE] = {0};
+static volatile bool ota_subscribed = false;
+
+/* Target of the current MQTT_EVENT_DATA message (topic is on the first fragment only) */
+static enum { DATA_NONE, DATA_CMD, DATA_OTA } data_target = DATA_NONE;
+
+/* Presence: retained "online" birth message, Last Will "offline" */
+static char presence_topic[TOPIC_BUFFER_SIZE] = {0};
+static char presence_offline[128] = {0};
+
+/* Last published status (delta reference); written by the status task only */
+static struct {
+    int8_t rssi;
+    uint32_t free_heap;
+    uint32_t queue_depth;
+    uint8_t flash_warn;
+    uint32_t seq;
+    bool valid;
+} status_ref = {0};
+static volatile bool status_keyframe_requested = false;
+
+/* Recently acknowledged message IDs: a PUBACK can be dispatched before
+ * esp_mqtt_client_publish() returns its msg_id to the publishing task */
+#define PUBACK_RECENT 8
+static portMUX_TYPE puback_lock = portMUX_INITIALIZER_UNLOCKED;
+static int puback_recent[PUBACK_RECENT] = {0};
+static uint8_t puback_next = 0;
+
+/* Watchdog diagnostic awaiting PUBACK (record is kept until then) */
+static volatile int diag_msg_id = -1;
+
+/* Certificate storage (loaded from NVS or fallback to embedded). The CA is
+ * parsed once into the esp-tls global store; client cert and key stay as DER
+ * buffers referenced by the client config. */
 static device_certs_t nvs_certs = {0};
 static bool certs_from_nvs = false;
 
@@ -36,6 +82,72 @@ extern const uint8_t client_cert_end[] asm("_binary_client_crt_end");
 extern const uint8_t client_key_start[] asm("_binary_client_key_start");
 extern const uint8_t client_key_end[] asm("_binary_client_key_end");
 
+static void build_cmd_topic(char *buf, size_t len)
+{
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    snprintf(buf, len, "safesignal/%s/%s/device/%s/cmd",
+             cfg.tenant_id, cfg.building_id, cfg.device_id);
+}
+
+static void subscribe_cmd_topic(void)
+{
+    build_cmd_topic(cmd_topic, sizeof(cmd_topic));
+
+    int msg_id = esp_mqtt_client_subscribe(client, cmd_topic, MQTT_QOS);
+    if (msg_id < 0) {
+        ESP_LOGE(TAG, "[MQTT] Failed to subscribe to %s", cmd_topic);
+    } else {
+        ESP_LOGI(TAG, "[MQTT] Subscribing to %s", cmd_topic);
+    }
+}
+
+static void build_ota_topic(char *buf, size_t len)
+{
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    snprintf(buf, len, "safesignal/%s/%s/device/%s/ota/data",
+             cfg.tenant_id, cfg.building_id, cfg.device_id);
+}
+
+static void subscribe_ota_topic(void)
+{
+    build_ota_topic(ota_topic, sizeof(ota_topic));
+
+    /* QoS 1: a lost chunk costs a request timeout */
+    if (esp_mqtt_client_subscribe(client, ota_topic, MQTT_QOS) < 0) {
+        ESP_LOGE(TAG, "[MQTT] Failed to subscribe to %s", ota_topic);
+    }
+}
+
+static void build_presence(char *topic, size_t topic_len, char *offline, size_t offline_len)
+{
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    snprintf(topic, topic_len, "safesignal/%s/%s/device/%s/presence",
+             cfg.tenant_id, cfg.building_id, cfg.device_id);
+    snprintf(offline, offline_len,
+             "{\"deviceId\":\"%s\",\"state\":\"offline\"}", cfg.device_id);
+}
+
+static bool publish_presence_online(void)
+{
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    char payload[PAYLOAD_BUFFER_SIZE];
+    int len = snprintf(payload, sizeof(payload),
+        "{\"deviceId\":\"%s\",\"state\":\"online\",\"version\":\"%s\",\"timestamp\":%lu}",
+        cfg.device_id, SAFESIGNAL_VERSION, (unsigned long)time(NULL));
+
+    if (len < 0 || len >= sizeof(payload)) {
+        return false;
+    }
+
+    /* Retained so the edge learns presence on subscribe; replaced by the Will on loss */
+    int msg_id = esp_mqtt_client_publish(client, presence_topic, payload, len, MQTT_QOS, 1);
+    return (msg_id >= 0);
+}
+
 /* Event handler */
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
                                 int32_t event_id, void *event_data)
@@ -48,17 +160,35 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
             connected = true;
             xEventGroupSetBits(system_events, MQTT_CONNECTED_BIT);
 
-            /* Process any pending alerts from queue */
-            int delivered = alert_queue_process();
-            if (delivered > 0) {
-                ESP_LOGI(TAG, "[MQTT] Delivered %d queued alerts on reconnect", delivered);
+            /* Presence birth message, then command channel (clean session) */
+            publish_presence_online();
+            subscribe_cmd_topic();
+            if (ota_subscribed) {
+                subscribe_ota_topic();
             }
+
+            /* Full status keyframe once per connection (sent by the status task) */
+            mqtt_request_status_keyframe();
+
+            /* Report hang attribution from a supervisor reset, if any */
+            mqtt_publish_diagnostic();
+
+            /* Wake the delivery task: queued alerts go out immediately */
+            alert_queue_on_connected();
+
+            /* First boot of an update: test publish for the health gate */
+            ota_health_on_connected();
             break;
 
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGW(TAG, "[MQTT] Disconnected from broker");
             connected = false;
             xEventGroupClearBits(system_events, MQTT_CONNECTED_BIT);
+            diag_msg_id = -1;
+            coredump_upload_on_disconnect();
+            ota_on_disconnect();
+            ota_health_on_disconnect();
+            alert_queue_on_disconnected();
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
@@ -67,12 +197,45 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
 
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGD(TAG, "[MQTT] Published, msg_id=%d", event->msg_id);
+            portENTER_CRITICAL(&puback_lock);
+            puback_recent[puback_next] = event->msg_id;
+            puback_next = (puback_next + 1) % PUBACK_RECENT;
+            portEXIT_CRITICAL(&puback_lock);
+            if (event->msg_id == diag_msg_id) {
+                /* Broker has the record; resent on every connect until then */
+                diag_msg_id = -1;
+                watchdog_clear_last_diag();
+                ESP_LOGI(TAG, "[MQTT] Watchdog diagnostic acknowledged");
+            }
+            coredump_upload_on_published(event->msg_id);
+            mqtt_cmd_on_published(event->msg_id);
+            alert_queue_on_published(event->msg_id);
+            ota_health_on_published(event->msg_id);
             break;
 
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "[MQTT] Data received on topic: %.*s",
-                     event->topic_len, event->topic);
-            /* Handle incoming messages (future: OTA commands, config updates) */
+            /* Topic is only present on the first fragment of a message */
+            if (event->current_data_offset == 0) {
+                if (event->topic_len == strlen(cmd_topic) &&
+                    strncmp(event->topic, cmd_topic, event->topic_len) == 0) {
+                    data_target = DATA_CMD;
+                } else if (ota_subscribed && event->topic_len == strlen(ota_topic) &&
+                           strncmp(event->topic, ota_topic, event->topic_len) == 0) {
+                    data_target = DATA_OTA;
+                } else {
+                    data_target = DATA_NONE;
+                    ESP_LOGW(TAG, "[MQTT] Data on unexpected topic: %.*s",
+                             event->topic_len, event->topic);
+                }
+            }
+
+            if (data_target == DATA_CMD) {
+                mqtt_cmd_handle_data(event->data, event->data_len,
+                                     event->current_data_offset, event->total_data_len);
+            } else if (data_target == DATA_OTA) {
+                ota_handle_data(event->data, event->data_len,
+                                event->current_data_offset, event->total_data_len);
+            }
             break;
 
         case MQTT_EVENT_ERROR:
@@ -84,6 +247,74 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
     }
 }
 
+/* Helper: Parse the CA certificate(s) into the esp-tls global store, once */
+static esp_err_t load_ca_store(void)
+{
+    if (!certs_from_nvs) {
+        return esp_tls_set_global_ca_store(ca_cert_start, ca_cert_end - ca_cert_start);
+    }
+
+    esp_err_t ret = esp_tls_init_global_ca_store();
+    mbedtls_x509_crt *store = esp_tls_get_global_ca_store();
+    if (ret != ESP_OK || store == NULL) {
+        return ret != ESP_OK ? ret : ESP_FAIL;
+    }
+
+    /* Concatenated DER: each parse appends one certificate to the chain */
+    size_t offset = 0;
+    while (offset < nvs_certs.ca_cert_len) {
+        int rc = mbedtls_x509_crt_parse_der(store, nvs_certs.ca_cert + offset,
+                                            nvs_certs.ca_cert_len - offset);
+        if (rc != 0) {
+            ESP_LOGE(TAG, "[MQTT] CA certificate parse failed: -0x%04x", (unsigned)-rc);
+            esp_tls_free_global_ca_store();
+            return ESP_FAIL;
+        }
+
+        const mbedtls_x509_crt *last = store;
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        offset += last->raw.len;
+    }
+
+    /* Parsed copy lives in the store; the DER buffer is no longer needed */
+    free(nvs_certs.ca_cert);
+    nvs_certs.ca_cert = NULL;
+    nvs_certs.ca_cert_len = 0;
+    return ESP_OK;
+}
+
+/* MQTT configuration with mTLS (DER needs an explicit length, PEM is NUL-terminated) */
+static void fill_client_config(esp_mqtt_client_config_t *cfg)
+{
+    *cfg = (esp_mqtt_client_config_t) {
+        .broker.address.uri = MQTT_BROKER_URI,
+        .broker.verification.use_global_ca_store = true,
+        .credentials = {
+            .authentication = {
+                .certificate = certs_from_nvs ?
+                    (const char *)nvs_certs.client_cert : (const char *)client_cert_start,
+                .certificate_len = certs_from_nvs ? nvs_certs.client_cert_len : 0,
+                .key = certs_from_nvs ?
+                    (const char *)nvs_certs.client_key : (const char *)client_key_start,
+                .key_len = certs_from_nvs ? nvs_certs.client_key_len : 0,
+            },
+        },
+        .session = {
+            .keepalive = MQTT_KEEPALIVE_SECONDS,
+            .last_will = {
+                .topic = presence_topic,
+                .msg = presence_offline,
+                .msg_len = strlen(presence_offline),
+                .qos = MQTT_QOS,
+                .retain = 1,
+            },
+        },
+        .network.reconnect_timeout_ms = MQTT_RECONNECT_INTERVAL_MS,
+    };
+}
+
 void mqtt_init(void)
 {
     ESP_LOGI(TAG, "[MQTT] Initializing...");
@@ -106,22 +337,18 @@ void mqtt_init(void)
         certs_from_nvs = false;
     }
 
-    /* MQTT configuration with mTLS */
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = MQTT_BROKER_URI,
-        .broker.verification.certificate = certs_from_nvs ?
-            nvs_certs.ca_cert : (const char *)ca_cert_start,
-        .credentials = {
-            .authentication = {
-                .certificate = certs_from_nvs ?
-                    nvs_certs.client_cert : (const char *)client_cert_start,
-                .key = certs_from_nvs ?
-                    nvs_certs.client_key : (const char *)client_key_start,
-            },
-        },
-        .session.keepalive = MQTT_KEEPALIVE_SECONDS,
-        .network.reconnect_timeout_ms = MQTT_RECONNECT_INTERVAL_MS,
-    };
+    /* Presence topic and Last Will (published by the broker when keepalive lapses) */
+    build_presence(presence_topic, sizeof(presence_topic),
+                   presence_offline, sizeof(presence_offline));
+
+    err = load_ca_store();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "[MQTT] Failed to load CA certificate: %s", esp_err_to_name(err));
+        return;
+    }
+
+    esp_mqtt_client_config_t mqtt_cfg;
+    fill_client_config(&mqtt_cfg);
 
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL) {
@@ -155,46 +382,34 @@ bool mqtt_publish_alert(void)
         .mode = DEFAULT_ALERT_MODE,
     };
 
-    /* Use runtime config (loaded from NVS or defaults) */
-    strncpy(queued_alert.device_id, runtime_config_get_device_id(), sizeof(queued_alert.device_id) - 1);
-    strncpy(queued_alert.tenant_id, runtime_config_get_tenant_id(), sizeof(queued_alert.tenant_id) - 1);
-    strncpy(queued_alert.building_id, runtime_config_get_building_id(), sizeof(queued_alert.building_id) - 1);
-    strncpy(queued_alert.room_id, runtime_config_get_room_id(), sizeof(queued_alert.room_id) - 1);
+    /* One snapshot: all IDs from the same configuration */
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    strncpy(queued_alert.device_id, cfg.device_id, sizeof(queued_alert.device_id) - 1);
+    strncpy(queued_alert.tenant_id, cfg.tenant_id, sizeof(queued_alert.tenant_id) - 1);
+    strncpy(queued_alert.building_id, cfg.building_id, sizeof(queued_alert.building_id) - 1);
+    strncpy(queued_alert.room_id, cfg.room_id, sizeof(queued_alert.room_id) - 1);
     strncpy(queued_alert.version, SAFESIGNAL_VERSION, sizeof(queued_alert.version) - 1);
 
-    /* Enqueue alert for persistence */
+    /* Hand off to the delivery task (publishes immediately when connected, persists later) */
     esp_err_t ret = alert_queue_enqueue(&queued_alert);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "[MQTT] Failed to enqueue alert: %s", esp_err_to_name(ret));
         return false;
     }
 
-    /* Attempt immediate publish if connected */
-    if (connected && client != NULL) {
-        if (mqtt_publish_alert_from_queue(&queued_alert)) {
-            ESP_LOGI(TAG, "[MQTT] Alert published immediately");
-            /* Note: alert_queue will remove from NVS on next process() call */
-            alert_queue_process();  /* Clean up successful alert */
-            return true;
-        } else {
-            ESP_LOGW(TAG, "[MQTT] Immediate publish failed, alert queued for retry");
-            return false;
-        }
-    } else {
-        ESP_LOGW(TAG, "[MQTT] Not connected, alert queued for delivery");
+    if (!connected || client == NULL) {
+        LOGR_W(TAG, "[MQTT] Not connected, alert queued for delivery");
         return false;
     }
+
+    return true;
 }
 
-bool mqtt_publish_alert_from_queue(const queued_alert_t *alert)
+/* Helper: Alert JSON object; returns its length, or -1 if it does not fit */
+static int format_alert(const queued_alert_t *alert, char *buf, size_t buf_len)
 {
-    if (!connected || client == NULL || alert == NULL) {
-        return false;
-    }
-
-    /* Build JSON payload */
-    char payload[PAYLOAD_BUFFER_SIZE];
-    int len = snprintf(payload, sizeof(payload),
+    int len = snprintf(buf, buf_len,
         "{"
         "\"alertId\":\"ESP32-%s-%lu\","
         "\"deviceId\":\"%s\","
@@ -218,9 +433,24 @@ bool mqtt_publish_alert_from_queue(const queued_alert_t *alert)
         alert->version
     );
 
-    if (len < 0 || len >= sizeof(payload)) {
+    if (len < 0 || len >= buf_len) {
+        return -1;
+    }
+    return len;
+}
+
+int mqtt_publish_alert_from_queue(const queued_alert_t *alert)
+{
+    if (!connected || client == NULL || alert == NULL) {
+        return -1;
+    }
+
+    /* Build JSON payload */
+    char payload[PAYLOAD_BUFFER_SIZE];
+    int len = format_alert(alert, payload, sizeof(payload));
+    if (len < 0) {
         ESP_LOGE(TAG, "[MQTT] Payload buffer overflow");
-        return false;
+        return -1;
     }
 
     /* Build topic: safesignal/{tenant}/{building}/alerts/trigger */
@@ -232,12 +462,51 @@ bool mqtt_publish_alert_from_queue(const queued_alert_t *alert)
     int msg_id = esp_mqtt_client_publish(client, topic, payload, len, MQTT_QOS, 0);
 
     if (msg_id >= 0) {
-        ESP_LOGI(TAG, "[MQTT] Alert %lu published (msg_id=%d)", alert->alert_id, msg_id);
-        return true;
+        LOGR_I(TAG, "[MQTT] Alert %lu published (msg_id=%d)", alert->alert_id, msg_id);
     } else {
-        ESP_LOGE(TAG, "[MQTT] Failed to publish alert %lu", alert->alert_id);
-        return false;
+        LOGR_E(TAG, "[MQTT] Failed to publish alert %lu", alert->alert_id);
+    }
+    return msg_id;
+}
+
+int mqtt_publish_alert_batch(const queued_alert_t *alerts, int count)
+{
+    /* Delivery task only: one batch is built at a time */
+    static char payload[ALERT_BATCH_MAX * PAYLOAD_BUFFER_SIZE];
+
+    if (!connected || client == NULL || alerts == NULL || count <= 0 || count > ALERT_BATCH_MAX) {
+        return -1;
     }
+
+    /* Build JSON array: [{alert},{alert},...] */
+    int len = 0;
+    payload[len++] = '[';
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            payload[len++] = ',';
+        }
+        int n = format_alert(&alerts[i], payload + len, sizeof(payload) - len - 1);
+        if (n < 0) {
+            ESP_LOGE(TAG, "[MQTT] Batch payload buffer overflow");
+            return -1;
+        }
+        len += n;
+    }
+    payload[len++] = ']';
+
+    /* Build topic: safesignal/{tenant}/{building}/alerts/batch */
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "safesignal/%s/%s/alerts/batch",
+             alerts[0].tenant_id, alerts[0].building_id);
+
+    int msg_id = esp_mqtt_client_publish(client, topic, payload, len, MQTT_QOS, 0);
+
+    if (msg_id >= 0) {
+        LOGR_I(TAG, "[MQTT] Batch of %d alerts published (%d bytes, msg_id=%d)", count, len, msg_id);
+    } else {
+        LOGR_E(TAG, "[MQTT] Failed to publish batch of %d alerts", count);
+    }
+    return msg_id;
 }
 
 bool mqtt_publish_status(void)
@@ -249,6 +518,12 @@ bool mqtt_publish_status(void)
     uint32_t uptime = xTaskGetTickCount() * portTICK_PERIOD_MS / 1000;
     int8_t rssi = wifi_get_rssi();
     uint32_t free_heap = esp_get_free_heap_size();
+    uint32_t queue_depth = alert_queue_get_count();
+    uint8_t flash_warn = flash_stats_get_warning();
+    uint32_t seq = status_ref.seq + 1;
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
 
     char payload[PAYLOAD_BUFFER_SIZE];
     int len = snprintf(payload, sizeof(payload),
@@ -258,20 +533,26 @@ bool mqtt_publish_status(void)
         "\"buildingId\":\"%s\","
         "\"roomId\":\"%s\","
         "\"type\":\"STATUS\","
+        "\"seq\":%lu,"
         "\"timestamp\":%lu,"
         "\"rssi\":%d,"
         "\"uptime\":%lu,"
         "\"freeHeap\":%lu,"
+        "\"queueDepth\":%lu,"
+        "\"flashWarn\":%u,"
         "\"version\":\"%s\""
         "}",
-        runtime_config_get_device_id(),
-        runtime_config_get_tenant_id(),
-        runtime_config_get_building_id(),
-        runtime_config_get_room_id(),
+        cfg.device_id,
+        cfg.tenant_id,
+        cfg.building_id,
+        cfg.room_id,
+        seq,
         xTaskGetTickCount() * portTICK_PERIOD_MS,
         rssi,
         uptime,
         free_heap,
+        queue_depth,
+        flash_warn,
         SAFESIGNAL_VERSION
     );
 
@@ -281,49 +562,361 @@ bool mqtt_publish_status(void)
 
     char topic[TOPIC_BUFFER_SIZE];
     snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/status",
-             runtime_config_get_tenant_id(), runtime_config_get_building_id());
+             cfg.tenant_id, cfg.building_id);
+
+    int msg_id = esp_mqtt_client_publish(client, topic, payload, len, 0, 0);
+
+    if (msg_id >= 0) {
+        status_ref.rssi = rssi;
+        status_ref.free_heap = free_heap;
+        status_ref.queue_depth = queue_depth;
+        status_ref.flash_warn = flash_warn;
+        status_ref.seq = seq;
+        status_ref.valid = true;
+        status_keyframe_requested = false;
+
+        ESP_LOGI(TAG, "[STATUS] Keyframe %lu published (RSSI: %d dBm, Uptime: %lu s)",
+                 seq, rssi, uptime);
+        return true;
+    }
+
+    return false;
+}
+
+bool mqtt_publish_status_delta(void)
+{
+    if (!connected || client == NULL || !status_ref.valid) {
+        return false;
+    }
+
+    int8_t rssi = wifi_get_rssi();
+    uint32_t free_heap = esp_get_free_heap_size();
+    uint32_t queue_depth = alert_queue_get_count();
+    uint8_t flash_warn = flash_stats_get_warning();
+
+    int rssi_diff = rssi - status_ref.rssi;
+    int64_t heap_diff = (int64_t)free_heap - status_ref.free_heap;
+
+    bool rssi_changed = rssi_diff >= STATUS_DELTA_RSSI_DB || rssi_diff <= -STATUS_DELTA_RSSI_DB;
+    bool heap_changed = heap_diff >= STATUS_DELTA_HEAP_BYTES || heap_diff <= -STATUS_DELTA_HEAP_BYTES;
+    bool queue_changed = queue_depth != status_ref.queue_depth;
+    bool flash_changed = flash_warn != status_ref.flash_warn;
+
+    if (!rssi_changed && !heap_changed && !queue_changed && !flash_changed) {
+        return false;
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    /* Only changed fields; seq lets the edge detect a lost delta and ask for a keyframe */
+    uint32_t seq = status_ref.seq + 1;
+    char payload[PAYLOAD_BUFFER_SIZE];
+    int len = snprintf(payload, sizeof(payload),
+        "{\"deviceId\":\"%s\",\"type\":\"STATUS_DELTA\",\"seq\":%lu",
+        cfg.device_id, seq);
+
+    if (rssi_changed) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"rssi\":%d", rssi);
+    }
+    if (heap_changed) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"freeHeap\":%lu", free_heap);
+    }
+    if (queue_changed) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"queueDepth\":%lu", queue_depth);
+    }
+    if (flash_changed) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"flashWarn\":%u", flash_warn);
+    }
+    len += snprintf(payload + len, sizeof(payload) - len, "}");
+
+    if (len < 0 || len >= sizeof(payload)) {
+        return false;
+    }
+
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/status",
+             cfg.tenant_id, cfg.building_id);
 
     int msg_id = esp_mqtt_client_publish(client, topic, payload, len, 0, 0);
 
     if (msg_id >= 0) {
-        ESP_LOGI(TAG, "[STATUS] Published (RSSI: %d dBm, Uptime: %lu s)", rssi, uptime);
+        /* Unchanged fields keep their reference so slow drift still crosses the threshold */
+        if (rssi_changed) {
+            status_ref.rssi = rssi;
+        }
+        if (heap_changed) {
+            status_ref.free_heap = free_heap;
+        }
+        status_ref.queue_depth = queue_depth;
+        status_ref.flash_warn = flash_warn;
+        status_ref.seq = seq;
+
+        ESP_LOGD(TAG, "[STATUS] Delta %lu published", seq);
         return true;
     }
 
     return false;
 }
 
+void mqtt_request_status_keyframe(void)
+{
+    status_keyframe_requested = true;
+}
+
+bool mqtt_status_keyframe_requested(void)
+{
+    return status_keyframe_requested;
+}
+
 bool mqtt_publish_heartbeat(void)
 {
     if (!connected || client == NULL) {
         return false;
     }
 
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
     char payload[128];
     int len = snprintf(payload, sizeof(payload),
         "{\"deviceId\":\"%s\",\"type\":\"HEARTBEAT\",\"timestamp\":%lu}",
-        runtime_config_get_device_id(),
+        cfg.device_id,
         xTaskGetTickCount() * portTICK_PERIOD_MS
     );
 
     char topic[TOPIC_BUFFER_SIZE];
     snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/heartbeat",
-             runtime_config_get_tenant_id(), runtime_config_get_building_id());
+             cfg.tenant_id, cfg.building_id);
 
     int msg_id = esp_mqtt_client_publish(client, topic, payload, len, 0, 0);
 
     return (msg_id >= 0);
 }
 
+bool mqtt_publish_diagnostic(void)
+{
+    if (!connected || client == NULL) {
+        return false;
+    }
+
+    watchdog_diag_t diag;
+    if (!watchdog_get_last_diag(&diag)) {
+        return false;
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    char payload[PAYLOAD_BUFFER_SIZE];
+    int len = snprintf(payload, sizeof(payload),
+        "{"
+        "\"deviceId\":\"%s\","
+        "\"type\":\"WATCHDOG\","
+        "\"task\":\"%s\","
+        "\"checkpoint\":\"%s\","
+        "\"progress\":%lu,"
+        "\"deadlineMs\":%lu,"
+        "\"silentMs\":%lu,"
+        "\"uptime\":%lu,"
+        "\"freeHeap\":%lu,"
+        "\"minFreeHeap\":%lu,"
+        "\"queueDepth\":%lu,"
+        "\"version\":\"%s\""
+        "}",
+        cfg.device_id,
+        diag.task_name,
+        diag.checkpoint,
+        diag.progress,
+        diag.deadline_ms,
+        diag.silent_ms,
+        diag.uptime_s,
+        diag.free_heap,
+        diag.min_free_heap,
+        diag.queue_depth,
+        SAFESIGNAL_VERSION
+    );
+
+    if (len < 0 || len >= sizeof(payload)) {
+        return false;
+    }
+
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/diag",
+             cfg.tenant_id, cfg.building_id);
+
+    /* Called from MQTT_EVENT_CONNECTED: the PUBACK is dispatched on the same
+     * task, so it cannot be handled before msg_id is recorded */
+    int msg_id = esp_mqtt_client_publish(client, topic, payload, len, MQTT_QOS, 0);
+    diag_msg_id = msg_id;
+
+    if (msg_id >= 0) {
+        ESP_LOGW(TAG, "[MQTT] Watchdog diagnostic published (task: %s, checkpoint: %s)",
+                 diag.task_name, diag.checkpoint);
+        return true;
+    }
+
+    return false;
+}
+
+int mqtt_publish_coredump_chunk(const uint8_t *data, size_t len)
+{
+    if (!connected || client == NULL || data == NULL) {
+        return -1;
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/%s/coredump",
+             cfg.tenant_id, cfg.building_id, cfg.device_id);
+
+    return esp_mqtt_client_publish(client, topic, (const char *)data, len, MQTT_QOS, 0);
+}
+
+int mqtt_publish_ota(const char *leaf, const char *payload, int len, int qos)
+{
+    if (!connected || client == NULL || payload == NULL) {
+        return -1;
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "safesignal/%s/%s/device/%s/ota/%s",
+             cfg.tenant_id, cfg.building_id, cfg.device_id, leaf);
+
+    return esp_mqtt_client_publish(client, topic, payload, len, qos, 0);
+}
+
+void mqtt_set_ota_subscription(bool enabled)
+{
+    if (enabled == ota_subscribed) {
+        return;
+    }
+    ota_subscribed = enabled;
+
+    if (client == NULL || !connected) {
+        return;     /* Applied on connect */
+    }
+    if (enabled) {
+        subscribe_ota_topic();
+    } else {
+        esp_mqtt_client_unsubscribe(client, ota_topic);
+    }
+}
+
+int mqtt_publish_cmd_response(const char *payload, int len, int qos)
+{
+    if (!connected || client == NULL || payload == NULL) {
+        return -1;
+    }
+
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "%s/resp", cmd_topic);
+
+    return esp_mqtt_client_publish(client, topic, payload, len, qos, 0);
+}
+
+void mqtt_refresh_topics(void)
+{
+    if (client == NULL) {
+        return;
+    }
+
+    char topic[TOPIC_BUFFER_SIZE];
+    char offline[sizeof(presence_offline)];
+    build_presence(topic, sizeof(topic), offline, sizeof(offline));
+    if (strcmp(topic, presence_topic) != 0 || strcmp(offline, presence_offline) != 0) {
+        /* Retained offline on the old topic, or the edge keeps a ghost device */
+        if (connected) {
+            esp_mqtt_client_publish(client, presence_topic, presence_offline,
+                                    strlen(presence_offline), MQTT_QOS, 1);
+        }
+        ESP_LOGI(TAG, "[MQTT] Presence moved to %s", topic);
+
+        strcpy(presence_topic, topic);
+        strcpy(presence_offline, offline);
+
+        /* New Will for the next connect (the client copies the strings) */
+        esp_mqtt_client_config_t mqtt_cfg;
+        fill_client_config(&mqtt_cfg);
+        esp_mqtt_set_config(client, &mqtt_cfg);
+
+        if (connected) {
+            publish_presence_online();
+        }
+    }
+
+    if (!connected) {
+        return;     /* Subscribed with the new topic on connect */
+    }
+
+    build_ota_topic(topic, sizeof(topic));
+    if (ota_subscribed && strcmp(topic, ota_topic) != 0) {
+        esp_mqtt_client_unsubscribe(client, ota_topic);
+        subscribe_ota_topic();
+    }
+
+    build_cmd_topic(topic, sizeof(topic));
+    if (strcmp(topic, cmd_topic) == 0) {
+        return;
+    }
+
+    esp_mqtt_client_unsubscribe(client, cmd_topic);
+    subscribe_cmd_topic();
+}
+
+esp_err_t mqtt_verify_ca_signature(const uint8_t hash[32], const uint8_t *sig, size_t sig_len)
+{
+    mbedtls_x509_crt *crt = esp_tls_get_global_ca_store();
+    if (crt == NULL || crt->raw.len == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (; crt != NULL && crt->raw.len > 0; crt = crt->next) {
+        if (mbedtls_pk_verify(&crt->pk, MBEDTLS_MD_SHA256, hash, 32, sig, sig_len) == 0) {
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_ALLOWED;
+}
+
 bool mqtt_is_connected(void)
 {
     return connected;
 }
 
+bool mqtt_puback_seen(int msg_id)
+{
+    bool seen = false;
+    if (msg_id <= 0) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&puback_lock);
+    for (int i = 0; i < PUBACK_RECENT; i++) {
+        if (puback_recent[i] == msg_id) {
+            seen = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&puback_lock);
+    return seen;
+}
+
 void mqtt_cleanup(void)
 {
     /* Stop MQTT client */
     if (client != NULL) {
+        /* A clean disconnect does not trigger the Will: mark offline explicitly */
+        if (connected) {
+            esp_mqtt_client_publish(client, presence_topic, presence_offline,
+                                    strlen(presence_offline), MQTT_QOS, 1);
+        }
+
         esp_mqtt_client_stop(client);
         esp_mqtt_client_destroy(client);
         client = NULL;
@@ -335,6 +928,7 @@ void mqtt_cleanup(void)
         certs_from_nvs = false;
         ESP_LOGI(TAG, "[MQTT] NVS certificates freed");
     }
+    esp_tls_free_global_ca_store();
 
     connected = false;
 }
@@ -2,6 +2,8 @@
 #define SAFESIGNAL_MQTT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "esp_err.h"
 #include "alert_queue.h"
 
@@ -11,36 +13,146 @@
 void mqtt_init(void);
 
 /**
- * Publish alert to MQTT broker
- * @return true if published successfully, false otherwise
+ * Raise an alert: persist it and wake the delivery task
+ * @return true if queued while connected (published immediately), false if
+ *         queueing failed or the alert waits for reconnect
  */
 bool mqtt_publish_alert(void);
 
 /**
- * Publish alert from queue (used by alert_queue.c)
+ * Publish alert from queue (used by the alert_queue delivery task)
  * @param alert Queued alert data
- * @return true if published successfully, false otherwise
+ * @return MQTT msg_id to match against MQTT_EVENT_PUBLISHED (0 for QoS 0),
+ *         -1 on failure
+ */
+int mqtt_publish_alert_from_queue(const queued_alert_t *alert);
+
+/**
+ * Publish queued alerts as one JSON array on the alerts/batch topic
+ * (used by the alert_queue delivery task; see ALERT_BATCH_ENABLED)
+ * All alerts must share tenant and building. One PUBACK covers the batch.
+ * @param alerts Queued alerts, in delivery order
+ * @param count Number of alerts (1..ALERT_BATCH_MAX)
+ * @return MQTT msg_id to match against MQTT_EVENT_PUBLISHED (0 for QoS 0),
+ *         -1 on failure
  */
-bool mqtt_publish_alert_from_queue(const queued_alert_t *alert);
+int mqtt_publish_alert_batch(const queued_alert_t *alerts, int count);
 
 /**
- * Publish device status to MQTT broker
+ * Publish a full device status keyframe to MQTT broker
+ * Becomes the reference for subsequent deltas. Call from the status task only.
  * @return true if published successfully, false otherwise
  */
 bool mqtt_publish_status(void);
 
+/**
+ * Publish a status delta if a field crossed its change threshold
+ * (RSSI, free heap, queue depth; see STATUS_DELTA_* in config.h).
+ * Call from the status task only.
+ * @return true if a delta was published, false if nothing changed or on failure
+ */
+bool mqtt_publish_status_delta(void);
+
+/**
+ * Ask the status task to send a keyframe on its next tick
+ * Safe from the MQTT task (reconnect, edge "status" command).
+ */
+void mqtt_request_status_keyframe(void);
+
+/**
+ * Check if a status keyframe has been requested
+ * @return true if pending
+ */
+bool mqtt_status_keyframe_requested(void);
+
 /**
  * Publish heartbeat to MQTT broker
  * @return true if published successfully, false otherwise
  */
 bool mqtt_publish_heartbeat(void);
 
+/**
+ * Publish the watchdog diagnostic record left by the previous boot
+ * The record is cleared when the PUBACK arrives (MQTT_EVENT_PUBLISHED) and
+ * published again after the next connect until then. Call from the MQTT task.
+ * @return true if a record was published, false if none or on failure
+ */
+bool mqtt_publish_diagnostic(void);
+
+/**
+ * Publish one core dump chunk (used by coredump_upload.c)
+ * Sent with QoS 1 on the device's low-priority coredump topic.
+ * @param data Chunk header and payload
+ * @param len Length of data in bytes
+ * @return MQTT message ID, or -1 on failure
+ */
+int mqtt_publish_coredump_chunk(const uint8_t *data, size_t len);
+
+/**
+ * Publish on the device's OTA topics (used by ota.c, ota_health.c)
+ * @param leaf Topic leaf under safesignal/{t}/{b}/device/{id}/ota/ ("req", "status")
+ * @param payload JSON payload
+ * @param len Length of payload in bytes
+ * @param qos MQTT QoS (requests are retried on timeout and go out with 0)
+ * @return MQTT message ID (0 for QoS 0), or -1 on failure
+ */
+int mqtt_publish_ota(const char *leaf, const char *payload, int len, int qos);
+
+/**
+ * Subscribe to or leave the device's ota/data topic (used by ota.c)
+ * Kept across reconnects; data is routed to ota_handle_data().
+ * @param enabled true while an update downloads
+ */
+void mqtt_set_ota_subscription(bool enabled);
+
+/**
+ * Publish a command response on the device's cmd/resp topic (used by mqtt_cmd.c)
+ * Responses go out with QoS 0 (the edge retries commands that go unanswered),
+ * ping responses with QoS 1 for the device-side RTT.
+ * @param payload JSON response
+ * @param len Length of payload in bytes
+ * @param qos MQTT QoS
+ * @return MQTT message ID (0 for QoS 0), or -1 on failure
+ */
+int mqtt_publish_cmd_response(const char *payload, int len, int qos);
+
+/**
+ * Rebuild cached topics after device ID, tenant or building changed
+ * Re-subscribes the command topic and moves presence: offline on the old
+ * topic, online on the new one. The broker keeps the Last Will registered
+ * at connect time; the new Will takes effect on the next reconnect.
+ * Call after reloading runtime configuration (MQTT task).
+ */
+void mqtt_refresh_topics(void);
+
+/**
+ * Verify a signature against the CA certificates in the global store
+ * Used to authenticate configuration pushed over the command channel: only
+ * the holder of the provisioned CA key can produce it.
+ * @param hash SHA-256 of the signed data
+ * @param sig Signature (DER ECDSA or PKCS#1 v1.5 RSA)
+ * @param sig_len Signature length
+ * @return ESP_OK if any CA key verifies it, ESP_ERR_NOT_ALLOWED otherwise,
+ *         ESP_ERR_INVALID_STATE if no CA is loaded
+ */
+esp_err_t mqtt_verify_ca_signature(const uint8_t hash[32], const uint8_t *sig, size_t sig_len);
+
 /**
  * Check if MQTT client is connected
  * @return true if connected, false otherwise
  */
 bool mqtt_is_connected(void);
 
+/**
+ * Check if a PUBACK for a message was among the last few received
+ * For publishers that match MQTT_EVENT_PUBLISHED against the msg_id returned
+ * by esp_mqtt_client_publish(): record the msg_id, then call this to catch an
+ * acknowledgement that was dispatched before the publish call returned.
+ * @param msg_id Message ID returned by the publish call
+ * @return true if acknowledged
+ */
+bool mqtt_puback_seen(int msg_id);
+
 /**
  * Cleanup MQTT client and free resources
  * Stops the client, destroys it, and frees NVS certificates if loaded
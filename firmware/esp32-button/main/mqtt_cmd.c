@@ -0,0 +1,1024 @@
+/**
+ * SafeSignal MQTT Command Channel Implementation
+ */
+
+#include "mqtt_cmd.h"
+#include "mqtt.h"
+#include "config.h"
+#include "wifi.h"
+#include "alert_queue.h"
+#include "runtime_config.h"
+#include "log_ring.h"
+#include "time_sync.h"
+#include "flash_stats.h"
+#include "provisioning.h"
+#include "ota.h"
+#include "ota_health.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/sha256.h"
+
+static const char *TAG = "MQTT_CMD";
+
+#define CMD_ID_MAX_LEN 32
+#define IDENTIFY_DEFAULT_BLINKS 10
+#define IDENTIFY_MAX_BLINKS 60
+#define IDENTIFY_PERIOD_US (250 * 1000)
+
+/**
+ * Key/value slice pointing into the payload (not NUL-terminated)
+ */
+typedef struct {
+    const char *key;
+    const char *val;
+    uint16_t key_len;
+    uint16_t val_len;
+    bool is_string;
+} cmd_token_t;
+
+typedef struct {
+    cmd_token_t tokens[MQTT_CMD_MAX_TOKENS];
+    int count;
+} cmd_args_t;
+
+/**
+ * Command handler
+ * Writes extra response fields (JSON members without braces, may be empty)
+ * into out. A non-ESP_OK return produces an error response.
+ */
+typedef esp_err_t (*cmd_handler_t)(const cmd_args_t *args, char *out, size_t out_len);
+
+typedef struct {
+    const char *name;
+    cmd_handler_t handler;
+} cmd_entry_t;
+
+/* Reassembly state for fragmented payloads (MQTT task only) */
+static char rx_buf[MQTT_CMD_MAX_PAYLOAD];
+static int rx_expected = 0;
+static int rx_received = 0;
+static bool rx_assembling = false;
+
+/* Response buffers (MQTT task only) */
+static char resp_fields[MQTT_CMD_MAX_RESPONSE - 96];
+static char resp_buf[MQTT_CMD_MAX_RESPONSE];
+
+/* Receive timestamps of the command being dispatched (latency probe) */
+static int64_t rx_time_us = 0;
+static int64_t rx_epoch_ms = 0;
+
+/* Latency probe histograms; the ping response awaiting its PUBACK */
+static const int32_t rtt_bounds_ms[MQTT_CMD_RTT_BUCKETS - 1] = {
+    5, 10, 20, 40, 80, 160, 320, 640, 1280, 2560, 5120
+};
+static const int32_t skew_bounds_ms[MQTT_CMD_SKEW_BUCKETS - 1] = {
+    -5000, -2000, -1000, -500, -250, -100, 0, 100, 250, 500, 1000, 2000, 5000
+};
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_cmd_latency_t latency = {0};
+static int ping_msg_id = -1;
+static int64_t ping_sent_us = 0;
+
+static uint32_t cmds_handled = 0;
+static uint32_t cmds_rejected = 0;
+
+/* Decoded config_set / ota_begin signature (MQTT task only) */
+static uint8_t sig_buf[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+
+/* LED identify */
+static esp_timer_handle_t identify_timer = NULL;
+static volatile uint32_t identify_toggles = 0;
+
+/* ========================================================================== */
+/* Token scanner                                                              */
+/* ========================================================================== */
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+/* Scan a JSON string starting after the opening quote; returns closing quote or NULL */
+static const char *scan_string(const char *p, const char *end)
+{
+    while (p < end) {
+        if (*p == '\\') {
+            p += 2;
+            continue;
+        }
+        if (*p == '"') {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * Tokenize a flat JSON object into key/value slices
+ * Nested objects and arrays are rejected.
+ */
+static bool scan_object(const char *data, int len, cmd_args_t *args)
+{
+    const char *p = data;
+    const char *end = data + len;
+
+    args->count = 0;
+
+    p = skip_ws(p, end);
+    if (p >= end || *p++ != '{') {
+        return false;
+    }
+
+    p = skip_ws(p, end);
+    if (p < end && *p == '}') {
+        return true;
+    }
+
+    while (p < end) {
+        if (args->count >= MQTT_CMD_MAX_TOKENS) {
+            return false;
+        }
+        cmd_token_t *tok = &args->tokens[args->count];
+
+        /* Key */
+        p = skip_ws(p, end);
+        if (p >= end || *p++ != '"') {
+            return false;
+        }
+        const char *key_end = scan_string(p, end);
+        if (key_end == NULL) {
+            return false;
+        }
+        tok->key = p;
+        tok->key_len = key_end - p;
+        p = skip_ws(key_end + 1, end);
+        if (p >= end || *p++ != ':') {
+            return false;
+        }
+
+        /* Value: string or bare scalar (number, true, false, null) */
+        p = skip_ws(p, end);
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '"') {
+            const char *val_end = scan_string(p + 1, end);
+            if (val_end == NULL) {
+                return false;
+            }
+            tok->val = p + 1;
+            tok->val_len = val_end - (p + 1);
+            tok->is_string = true;
+            p = val_end + 1;
+        } else {
+            if (*p == '{' || *p == '[') {
+                return false;
+            }
+            tok->val = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' &&
+                   *p != '\t' && *p != '\r' && *p != '\n') {
+                p++;
+            }
+            tok->val_len = p - tok->val;
+            tok->is_string = false;
+        }
+        args->count++;
+
+        p = skip_ws(p, end);
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '}') {
+            return true;
+        }
+        if (*p++ != ',') {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static const cmd_token_t *find_token(const cmd_args_t *args, const char *key)
+{
+    size_t key_len = strlen(key);
+    for (int i = 0; i < args->count; i++) {
+        const cmd_token_t *tok = &args->tokens[i];
+        if (tok->key_len == key_len && memcmp(tok->key, key, key_len) == 0) {
+            return tok;
+        }
+    }
+    return NULL;
+}
+
+static bool token_key_equals(const cmd_token_t *tok, const char *key)
+{
+    size_t len = strlen(key);
+    return tok->key_len == len && memcmp(tok->key, key, len) == 0;
+}
+
+static bool token_equals(const cmd_token_t *tok, const char *str)
+{
+    size_t len = strlen(str);
+    return tok != NULL && tok->val_len == len && memcmp(tok->val, str, len) == 0;
+}
+
+/* Parse an unsigned integer argument; returns def if absent or invalid */
+static uint64_t get_u64(const cmd_args_t *args, const char *key, uint64_t def)
+{
+    const cmd_token_t *tok = find_token(args, key);
+    if (tok == NULL || tok->val_len == 0 || tok->val_len > 20) {
+        return def;
+    }
+
+    uint64_t value = 0;
+    for (int i = 0; i < tok->val_len; i++) {
+        char c = tok->val[i];
+        if (c < '0' || c > '9') {
+            return def;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return value;
+}
+
+/* Parse an unsigned integer token within [min, max] */
+static bool token_u32(const cmd_token_t *tok, uint32_t min, uint32_t max, uint32_t *out)
+{
+    if (tok->is_string || tok->val_len == 0 || tok->val_len > 10) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (int i = 0; i < tok->val_len; i++) {
+        char c = tok->val[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    if (value < min || value > max) {
+        return false;
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+/* Copy an ID token; IDs become topic levels, so only [A-Za-z0-9._-] */
+static bool token_id(const cmd_token_t *tok, char *out, size_t out_size)
+{
+    if (!tok->is_string || tok->val_len == 0 || tok->val_len >= out_size) {
+        return false;
+    }
+
+    for (int i = 0; i < tok->val_len; i++) {
+        char c = tok->val[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '.' || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    memcpy(out, tok->val, tok->val_len);
+    out[tok->val_len] = '\0';
+    return true;
+}
+
+/* Decode a hex string token into exactly out_len bytes */
+static bool token_hex(const cmd_token_t *tok, uint8_t *out, size_t out_len)
+{
+    if (!tok->is_string || tok->val_len != out_len * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < out_len * 2; i++) {
+        char c = tok->val[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        out[i / 2] = (i & 1) ? (out[i / 2] | nibble) : (nibble << 4);
+    }
+    return true;
+}
+
+/* SHA-256 over "key=value\n" of every member except cmd, id and sig */
+static void hash_signed_members(const cmd_args_t *args, uint8_t hash[32])
+{
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+
+    for (int i = 0; i < args->count; i++) {
+        const cmd_token_t *tok = &args->tokens[i];
+        if (token_key_equals(tok, "cmd") || token_key_equals(tok, "id") ||
+            token_key_equals(tok, "sig")) {
+            continue;
+        }
+        mbedtls_sha256_update(&ctx, (const unsigned char *)tok->key, tok->key_len);
+        mbedtls_sha256_update(&ctx, (const unsigned char *)"=", 1);
+        mbedtls_sha256_update(&ctx, (const unsigned char *)tok->val, tok->val_len);
+        mbedtls_sha256_update(&ctx, (const unsigned char *)"\n", 1);
+    }
+
+    mbedtls_sha256_finish(&ctx, hash);
+    mbedtls_sha256_free(&ctx);
+}
+
+/* Decode sig and check it against the provisioned CA */
+static esp_err_t verify_signed_members(const cmd_args_t *args, const cmd_token_t *sig)
+{
+    size_t sig_len = 0;
+    if (mbedtls_base64_decode(sig_buf, sizeof(sig_buf), &sig_len,
+                              (const unsigned char *)sig->val, sig->val_len) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t hash[32];
+    hash_signed_members(args, hash);
+    return mqtt_verify_ca_signature(hash, sig_buf, sig_len);
+}
+
+/* ========================================================================== */
+/* Command handlers                                                           */
+/* ========================================================================== */
+
+/**
+ * Latency probe: echo the edge send time (t0) with device receive/send times
+ * RTT at the edge = (t3 - t0) - (txUs - rxUs); epochMs (0 if not synced)
+ * gives the clock offset estimate epochMs - (t0 + RTT / 2).
+ */
+static int bucket_of(const int32_t *bounds, int count, int64_t value)
+{
+    int i = 0;
+    while (i < count && value > bounds[i]) {
+        i++;
+    }
+    return i;
+}
+
+static esp_err_t cmd_ping(const cmd_args_t *args, char *out, size_t out_len)
+{
+    uint64_t t0 = get_u64(args, "t0", 0);
+
+    if (t0 > 0 && rx_epoch_ms > 0) {
+        int64_t skew_ms = rx_epoch_ms - (int64_t)t0;
+        int b = bucket_of(skew_bounds_ms, MQTT_CMD_SKEW_BUCKETS - 1, skew_ms);
+        portENTER_CRITICAL(&latency_lock);
+        latency.skew[b]++;
+        latency.skew_last_ms = (int32_t)skew_ms;
+        portEXIT_CRITICAL(&latency_lock);
+    }
+
+    snprintf(out, out_len, "\"t0\":%llu,\"rxUs\":%lld,\"epochMs\":%lld,\"txUs\":%lld",
+             (unsigned long long)t0, (long long)rx_time_us, (long long)rx_epoch_ms,
+             (long long)esp_timer_get_time());
+    return ESP_OK;
+}
+
+static int format_counts(char *out, size_t out_len, const uint32_t *counts, int n)
+{
+    int len = 0;
+    for (int i = 0; i < n && len < out_len; i++) {
+        len += snprintf(out + len, out_len - len, "%s%lu", i ? "," : "", (unsigned long)counts[i]);
+    }
+    return len;
+}
+
+/**
+ * Device-side latency histograms (bounds in mqtt_cmd.h)
+ */
+static esp_err_t cmd_latency(const cmd_args_t *args, char *out, size_t out_len)
+{
+    mqtt_cmd_latency_t lat;
+    mqtt_cmd_get_latency(&lat);
+
+    int len = snprintf(out, out_len, "\"rttLastMs\":%lu,\"rttLost\":%lu,\"skewLastMs\":%ld,\"rtt\":[",
+                       (unsigned long)lat.rtt_last_ms, (unsigned long)lat.rtt_lost,
+                       (long)lat.skew_last_ms);
+    if (len > 0 && len < out_len) {
+        len += format_counts(out + len, out_len - len, lat.rtt, MQTT_CMD_RTT_BUCKETS);
+    }
+    if (len > 0 && len < out_len) {
+        len += snprintf(out + len, out_len - len, "],\"skew\":[");
+    }
+    if (len > 0 && len < out_len) {
+        len += format_counts(out + len, out_len - len, lat.skew, MQTT_CMD_SKEW_BUCKETS);
+    }
+    if (len > 0 && len < out_len) {
+        len += snprintf(out + len, out_len - len, "]");
+    }
+    return (len > 0 && len < out_len) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t cmd_config_reload(const cmd_args_t *args, char *out, size_t out_len)
+{
+    esp_err_t ret = runtime_config_load();
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+        return ret;
+    }
+
+    /* Device ID, tenant or building may have changed */
+    mqtt_refresh_topics();
+
+    snprintf(out, out_len, "\"provisioned\":%s", ret == ESP_OK ? "true" : "false");
+    return ESP_OK;
+}
+
+/**
+ * Versioned configuration push (see mqtt_cmd.h)
+ * Verified against the CA that issued this device's identity, persisted,
+ * then published to readers with one pointer swap; topics are rebuilt here,
+ * heartbeat and power profile are picked up by the status task.
+ * The signature check and NVS commit hold the MQTT task for tens of ms;
+ * acceptable for a rare command, and stale versions are rejected before.
+ */
+static esp_err_t cmd_config_set(const cmd_args_t *args, char *out, size_t out_len)
+{
+    runtime_config_update_t update;
+    const cmd_token_t *device = NULL;
+    const cmd_token_t *sig = NULL;
+    bool has_version = false;
+    uint32_t value;
+
+    memset(&update, 0, sizeof(update));
+
+    for (int i = 0; i < args->count; i++) {
+        const cmd_token_t *tok = &args->tokens[i];
+        bool ok = true;
+
+        if (token_key_equals(tok, "cmd") || token_key_equals(tok, "id")) {
+            continue;
+        } else if (token_key_equals(tok, "device")) {
+            device = tok;
+        } else if (token_key_equals(tok, "sig")) {
+            sig = tok;
+        } else if (token_key_equals(tok, "version")) {
+            ok = has_version = token_u32(tok, 1, UINT32_MAX, &update.version);
+        } else if (token_key_equals(tok, "tenant")) {
+            ok = token_id(tok, update.tenant_id, sizeof(update.tenant_id));
+            update.fields |= RUNTIME_CONFIG_SET_TENANT;
+        } else if (token_key_equals(tok, "building")) {
+            ok = token_id(tok, update.building_id, sizeof(update.building_id));
+            update.fields |= RUNTIME_CONFIG_SET_BUILDING;
+        } else if (token_key_equals(tok, "room")) {
+            ok = token_id(tok, update.room_id, sizeof(update.room_id));
+            update.fields |= RUNTIME_CONFIG_SET_ROOM;
+        } else if (token_key_equals(tok, "heartbeatSec")) {
+            ok = token_u32(tok, REMOTE_HEARTBEAT_MIN_S, REMOTE_HEARTBEAT_MAX_S, &value);
+            update.heartbeat_interval_ms = value * 1000;
+            update.fields |= RUNTIME_CONFIG_SET_HEARTBEAT;
+        } else if (token_key_equals(tok, "rateMax")) {
+            ok = token_u32(tok, 1, RATE_LIMIT_MAX_ALERTS, &value);
+            update.rate_limit_max_alerts = (uint16_t)value;
+            update.fields |= RUNTIME_CONFIG_SET_RATE_MAX;
+        } else if (token_key_equals(tok, "rateWindowSec")) {
+            ok = token_u32(tok, 1, REMOTE_RATE_WINDOW_MAX_S, &value);
+            update.rate_limit_window_s = (uint16_t)value;
+            update.fields |= RUNTIME_CONFIG_SET_RATE_WINDOW;
+        } else if (token_key_equals(tok, "cooldownSec")) {
+            ok = token_u32(tok, 0, REMOTE_COOLDOWN_MAX_S, &update.rate_limit_cooldown_s);
+            update.fields |= RUNTIME_CONFIG_SET_COOLDOWN;
+        } else if (token_key_equals(tok, "power")) {
+            ok = tok->is_string &&
+                 runtime_config_parse_power_profile(tok->val, tok->val_len, &update.power_profile);
+            update.fields |= RUNTIME_CONFIG_SET_POWER;
+        } else {
+            ok = false;     /* Unknown member: a typo must not be silently ignored */
+        }
+
+        if (!ok) {
+            ESP_LOGW(TAG, "[CMD] config_set: invalid %.*s", tok->key_len, tok->key);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    if (!has_version || sig == NULL || !sig->is_string ||
+        device == NULL || !device->is_string || !token_equals(device, cfg.device_id)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Cheap checks before the signature: stale versions are replays */
+    if (update.version <= cfg.version) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    esp_err_t ret = verify_signed_members(args, sig);
+    if (ret != ESP_OK) {
+        LOGR_W(TAG, "[CMD] config_set v%lu: signature rejected", (unsigned long)update.version);
+        return ret;
+    }
+
+    ret = runtime_config_apply(&update);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (update.fields & RUNTIME_CONFIG_SET_IDS) {
+        mqtt_refresh_topics();
+    }
+
+    runtime_config_snapshot(&cfg);
+    snprintf(out, out_len,
+        "\"version\":%lu,\"room\":\"%s\",\"heartbeatSec\":%lu,\"rateMax\":%u,"
+        "\"rateWindowSec\":%u,\"cooldownSec\":%lu,\"power\":\"%s\"",
+        (unsigned long)cfg.version, cfg.room_id,
+        (unsigned long)(cfg.heartbeat_interval_ms / 1000),
+        cfg.rate_limit_max_alerts, cfg.rate_limit_window_s,
+        (unsigned long)cfg.rate_limit_cooldown_s,
+        runtime_config_power_profile_name(cfg.power_profile));
+    return ESP_OK;
+}
+
+/**
+ * Start or resume a firmware update (see ota.h)
+ * The manifest is signed like config_set; the image digest it carries is
+ * checked before the boot partition is switched. With patch and base the
+ * download is a delta against the running build.
+ */
+static esp_err_t cmd_ota_begin(const cmd_args_t *args, char *out, size_t out_len)
+{
+    ota_manifest_t manifest = { .rate_bps = OTA_DEFAULT_RATE_BPS };
+    const cmd_token_t *device = NULL;
+    const cmd_token_t *sig = NULL;
+    bool has_version = false;
+    bool has_size = false;
+    bool has_sha = false;
+    bool has_base = false;
+
+    for (int i = 0; i < args->count; i++) {
+        const cmd_token_t *tok = &args->tokens[i];
+        bool ok = true;
+
+        if (token_key_equals(tok, "cmd") || token_key_equals(tok, "id")) {
+            continue;
+        } else if (token_key_equals(tok, "device")) {
+            device = tok;
+        } else if (token_key_equals(tok, "sig")) {
+            sig = tok;
+        } else if (token_key_equals(tok, "version")) {
+            ok = has_version = token_id(tok, manifest.version, sizeof(manifest.version));
+        } else if (token_key_equals(tok, "size")) {
+            ok = has_size = token_u32(tok, 1, UINT32_MAX, &manifest.size);
+        } else if (token_key_equals(tok, "sha256")) {
+            ok = has_sha = token_hex(tok, manifest.sha256, sizeof(manifest.sha256));
+        } else if (token_key_equals(tok, "rate")) {
+            ok = token_u32(tok, OTA_MIN_RATE_BPS, OTA_MAX_RATE_BPS, &manifest.rate_bps);
+        } else if (token_key_equals(tok, "patch")) {
+            ok = token_u32(tok, 1, UINT32_MAX, &manifest.patch_size);
+        } else if (token_key_equals(tok, "base")) {
+            ok = has_base = token_hex(tok, manifest.base_sha256, sizeof(manifest.base_sha256));
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            ESP_LOGW(TAG, "[CMD] ota_begin: invalid %.*s", tok->key_len, tok->key);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    if (!has_version || !has_size || !has_sha || sig == NULL || !sig->is_string ||
+        device == NULL || !device->is_string || !token_equals(device, cfg.device_id) ||
+        (manifest.patch_size > 0) != has_base) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = verify_signed_members(args, sig);
+    if (ret != ESP_OK) {
+        /* ESP_LOGW: manifest is on this stack, the log ring would keep only the pointer */
+        ESP_LOGW(TAG, "[CMD] ota_begin %s: signature rejected", manifest.version);
+        return ret;
+    }
+
+    ret = ota_begin(&manifest);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    snprintf(out, out_len, "\"version\":\"%s\",\"size\":%lu,\"patch\":%lu,\"rate\":%lu",
+             manifest.version, (unsigned long)manifest.size,
+             (unsigned long)manifest.patch_size, (unsigned long)manifest.rate_bps);
+    return ESP_OK;
+}
+
+static esp_err_t cmd_ota_status(const cmd_args_t *args, char *out, size_t out_len)
+{
+    ota_progress_t progress;
+    ota_get_progress(&progress);
+
+    snprintf(out, out_len,
+        "\"state\":\"%s\",\"version\":\"%s\",\"offset\":%lu,\"size\":%lu,"
+        "\"written\":%lu,\"delta\":%s,\"held\":%s,\"running\":\"%s\",\"error\":\"%s\"",
+        ota_state_name(progress.state), progress.version,
+        (unsigned long)progress.offset, (unsigned long)progress.size,
+        (unsigned long)progress.written, progress.delta ? "true" : "false",
+        progress.held ? "true" : "false", SAFESIGNAL_VERSION,
+        esp_err_to_name(progress.error));
+    return ESP_OK;
+}
+
+static esp_err_t cmd_ota_abort(const cmd_args_t *args, char *out, size_t out_len)
+{
+    return ota_abort();
+}
+
+static esp_err_t cmd_metrics(const cmd_args_t *args, char *out, size_t out_len)
+{
+    alert_queue_stats_t stats = {0};
+    alert_queue_get_stats(&stats);
+
+    uint32_t log_written = 0;
+    uint32_t log_lost = 0;
+    log_ring_get_stats(&log_written, &log_lost);
+
+    ota_health_t health;
+    ota_health_get(&health);
+
+    int len = snprintf(out, out_len,
+        "\"uptime\":%lu,"
+        "\"freeHeap\":%lu,"
+        "\"minFreeHeap\":%lu,"
+        "\"rssi\":%d,"
+        "\"queueDepth\":%lu,"
+        "\"queueCapacity\":%lu,"
+        "\"enqueued\":%lu,"
+        "\"delivered\":%lu,"
+        "\"expired\":%lu,"
+        "\"failed\":%lu,"
+        "\"evicted\":%lu,"
+        "\"logWritten\":%lu,"
+        "\"logLost\":%lu,"
+        "\"cmdHandled\":%lu,"
+        "\"cmdRejected\":%lu,"
+        "\"otaHealth\":\"%s\","
+        "\"healthWifiMs\":%lu,"
+        "\"healthMqttMs\":%lu,"
+        "\"healthPubackMs\":%lu,"
+        "\"healthValidMs\":%lu",
+        (unsigned long)(esp_timer_get_time() / 1000000),
+        (unsigned long)esp_get_free_heap_size(),
+        (unsigned long)esp_get_minimum_free_heap_size(),
+        wifi_get_rssi(),
+        (unsigned long)stats.pending_count,
+        (unsigned long)alert_queue_capacity(),
+        (unsigned long)stats.total_enqueued,
+        (unsigned long)stats.total_delivered,
+        (unsigned long)stats.total_expired,
+        (unsigned long)stats.total_failed,
+        (unsigned long)stats.total_evicted,
+        (unsigned long)log_written,
+        (unsigned long)log_lost,
+        (unsigned long)cmds_handled,
+        (unsigned long)cmds_rejected,
+        ota_health_state_name(health.state),
+        (unsigned long)health.wifi_ms,
+        (unsigned long)health.mqtt_ms,
+        (unsigned long)health.puback_ms,
+        (unsigned long)health.valid_ms);
+    if (health.rolled_back[0] != '\0' && len > 0 && len < out_len) {
+        snprintf(out + len, out_len - len, ",\"rolledBack\":\"%s\"", health.rolled_back);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t cmd_status(const cmd_args_t *args, char *out, size_t out_len)
+{
+    /* Published by the status task; the MQTT task must not block on it */
+    mqtt_request_status_keyframe();
+    return ESP_OK;
+}
+
+static esp_err_t cmd_queue_flush(const cmd_args_t *args, char *out, size_t out_len)
+{
+    /* Delivery task retries everything now; acks arrive asynchronously */
+    snprintf(out, out_len, "\"pending\":%d", alert_queue_retry_now());
+    return ESP_OK;
+}
+
+static void identify_timer_cb(void *arg)
+{
+    uint32_t remaining = identify_toggles;
+    if (remaining == 0) {
+        esp_timer_stop(identify_timer);
+        gpio_set_level(LED_PIN, LED_ACTIVE_HIGH ? 0 : 1);
+        return;
+    }
+
+    /* Odd count: LED on, even count: LED off */
+    bool on = (remaining & 1) != 0;
+    gpio_set_level(LED_PIN, (on == LED_ACTIVE_HIGH) ? 1 : 0);
+    identify_toggles = remaining - 1;
+}
+
+static esp_err_t cmd_identify(const cmd_args_t *args, char *out, size_t out_len)
+{
+    uint64_t blinks = get_u64(args, "count", IDENTIFY_DEFAULT_BLINKS);
+    if (blinks == 0 || blinks > IDENTIFY_MAX_BLINKS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (identify_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = identify_timer_cb,
+            .name = "led_identify"
+        };
+        esp_err_t ret = esp_timer_create(&timer_args, &identify_timer);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    /* Restart if an identify sequence is already running */
+    esp_timer_stop(identify_timer);
+    identify_toggles = (uint32_t)blinks * 2;
+    esp_timer_start_periodic(identify_timer, IDENTIFY_PERIOD_US);
+
+    snprintf(out, out_len, "\"blinks\":%lu", (unsigned long)blinks);
+    return ESP_OK;
+}
+
+static esp_err_t cmd_log_level(const cmd_args_t *args, char *out, size_t out_len)
+{
+    const cmd_token_t *tok = find_token(args, "level");
+    if (tok != NULL) {
+        esp_log_level_t level;
+        if (!tok->is_string || !log_ring_parse_level(tok->val, tok->val_len, &level)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        log_ring_set_level(level);
+    }
+
+    snprintf(out, out_len, "\"level\":\"%s\"", log_ring_level_name(log_ring_get_level()));
+    return ESP_OK;
+}
+
+static esp_err_t cmd_flash(const cmd_args_t *args, char *out, size_t out_len)
+{
+    /* Per-subsystem counters on request; the full breakdown does not fit one response */
+    const cmd_token_t *tok = find_token(args, "subsys");
+    if (tok != NULL) {
+        for (int i = 0; i < FLASH_SUBSYS_COUNT; i++) {
+            if (tok->is_string && token_equals(tok, flash_stats_subsys_name(i))) {
+                flash_subsys_stats_t st;
+                flash_stats_get(i, &st);
+                snprintf(out, out_len,
+                    "\"subsys\":\"%s\",\"bytes\":%lu,\"writes\":%lu,\"erases\":%lu,\"failures\":%lu",
+                    flash_stats_subsys_name(i), (unsigned long)st.bytes,
+                    (unsigned long)st.writes, (unsigned long)st.erases,
+                    (unsigned long)st.failures);
+                return ESP_OK;
+            }
+        }
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    flash_health_t health;
+    esp_err_t ret = flash_stats_get_health(&health);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    snprintf(out, out_len,
+        "\"nvsUsed\":%lu,"
+        "\"nvsFree\":%lu,"
+        "\"nvsTotal\":%lu,"
+        "\"nvsQueue\":%lu,"
+        "\"nvsProvision\":%lu,"
+        "\"nvsCycles\":%lu,"
+        "\"logCycles\":%lu,"
+        "\"hours\":%lu,"
+        "\"yearsLeft\":%ld,"
+        "\"flashWarn\":%d",
+        (unsigned long)health.nvs_used_entries,
+        (unsigned long)health.nvs_free_entries,
+        (unsigned long)health.nvs_total_entries,
+        (unsigned long)flash_stats_namespace_entries("alert_queue"),
+        (unsigned long)(flash_stats_namespace_entries(PROVISION_NAMESPACE) +
+                        flash_stats_namespace_entries(PROVISION_BANK_A) +
+                        flash_stats_namespace_entries(PROVISION_BANK_B)),
+        (unsigned long)health.nvs_cycles,
+        (unsigned long)health.log_cycles,
+        (unsigned long)health.uptime_hours,
+        health.years_left == UINT32_MAX ? -1L : (long)health.years_left,
+        health.warn);
+    return ESP_OK;
+}
+
+static const cmd_entry_t commands[] = {
+    { "ping",          cmd_ping },
+    { "latency",       cmd_latency },
+    { "config_reload", cmd_config_reload },
+    { "config_set",    cmd_config_set },
+    { "metrics",       cmd_metrics },
+    { "status",        cmd_status },
+    { "queue_flush",   cmd_queue_flush },
+    { "identify",      cmd_identify },
+    { "log_level",     cmd_log_level },
+    { "flash",         cmd_flash },
+    { "ota_begin",     cmd_ota_begin },
+    { "ota_status",    cmd_ota_status },
+    { "ota_abort",     cmd_ota_abort },
+};
+
+/* ========================================================================== */
+/* Dispatcher                                                                 */
+/* ========================================================================== */
+
+static int send_response(const cmd_token_t *cmd, const cmd_token_t *id,
+                         esp_err_t ret, const char *fields, int qos)
+{
+    int len;
+
+    if (ret == ESP_OK) {
+        len = snprintf(resp_buf, sizeof(resp_buf),
+                       "{\"cmd\":\"%.*s\",\"id\":\"%.*s\",\"status\":\"ok\"%s%s}",
+                       cmd->val_len, cmd->val,
+                       id ? id->val_len : 0, id ? id->val : "",
+                       fields[0] ? "," : "", fields);
+    } else {
+        len = snprintf(resp_buf, sizeof(resp_buf),
+                       "{\"cmd\":\"%.*s\",\"id\":\"%.*s\",\"status\":\"error\",\"error\":\"%s\"}",
+                       cmd->val_len, cmd->val,
+                       id ? id->val_len : 0, id ? id->val : "",
+                       esp_err_to_name(ret));
+    }
+
+    if (len < 0 || len >= sizeof(resp_buf)) {
+        ESP_LOGE(TAG, "[CMD] Response buffer overflow");
+        return -1;
+    }
+
+    return mqtt_publish_cmd_response(resp_buf, len, qos);
+}
+
+/* Ping response out with QoS 1: its PUBACK closes the device-side RTT sample.
+ * Published from the MQTT task, so the PUBACK cannot be handled first. */
+static void send_ping_response(const cmd_token_t *cmd, const cmd_token_t *id,
+                               esp_err_t ret, const char *fields)
+{
+    int64_t now = esp_timer_get_time();
+    int msg_id = send_response(cmd, id, ret, fields, 1);
+
+    portENTER_CRITICAL(&latency_lock);
+    if (ping_msg_id >= 0) {
+        latency.rtt_lost++;
+    }
+    ping_msg_id = msg_id > 0 ? msg_id : -1;
+    ping_sent_us = now;
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+static void dispatch(const char *data, int len)
+{
+    cmd_args_t args;
+
+    if (!scan_object(data, len, &args)) {
+        ESP_LOGW(TAG, "[CMD] Malformed command (%d bytes)", len);
+        cmds_rejected++;
+        return;
+    }
+
+    const cmd_token_t *cmd = find_token(&args, "cmd");
+    const cmd_token_t *id = find_token(&args, "id");
+
+    /* cmd and id are echoed into the response, keep them short strings */
+    if (cmd == NULL || !cmd->is_string || cmd->val_len > CMD_ID_MAX_LEN ||
+        (id != NULL && (!id->is_string || id->val_len > CMD_ID_MAX_LEN))) {
+        ESP_LOGW(TAG, "[CMD] Missing or invalid cmd/id");
+        cmds_rejected++;
+        return;
+    }
+
+    for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (token_equals(cmd, commands[i].name)) {
+            resp_fields[0] = '\0';
+            esp_err_t ret = commands[i].handler(&args, resp_fields, sizeof(resp_fields));
+            cmds_handled++;
+
+            ESP_LOGI(TAG, "[CMD] %s: %s", commands[i].name, esp_err_to_name(ret));
+            if (commands[i].handler == cmd_ping) {
+                send_ping_response(cmd, id, ret, resp_fields);
+            } else {
+                send_response(cmd, id, ret, resp_fields, 0);
+            }
+            return;
+        }
+    }
+
+    ESP_LOGW(TAG, "[CMD] Unknown command: %.*s", cmd->val_len, cmd->val);
+    cmds_rejected++;
+    send_response(cmd, id, ESP_ERR_NOT_SUPPORTED, "", 0);
+}
+
+void mqtt_cmd_handle_data(const char *data, int data_len, int offset, int total_len)
+{
+    if (total_len > MQTT_CMD_MAX_PAYLOAD) {
+        if (offset == 0) {
+            ESP_LOGW(TAG, "[CMD] Command too large (%d bytes), dropped", total_len);
+            cmds_rejected++;
+        }
+        rx_assembling = false;
+        return;
+    }
+
+    if (offset == 0) {
+        rx_time_us = esp_timer_get_time();
+        rx_epoch_ms = 0;
+        if (time_is_synchronized()) {
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            rx_epoch_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        }
+
+        /* Complete in a single event: parse in place */
+        if (data_len == total_len) {
+            rx_assembling = false;
+            dispatch(data, data_len);
+            return;
+        }
+        rx_assembling = true;
+        rx_expected = total_len;
+        rx_received = 0;
+    } else if (!rx_assembling || total_len != rx_expected || offset != rx_received) {
+        /* Fragment without a matching start (lost or out of order) */
+        rx_assembling = false;
+        return;
+    }
+
+    if (offset + data_len > rx_expected) {
+        rx_assembling = false;
+        return;
+    }
+
+    memcpy(rx_buf + offset, data, data_len);
+    rx_received += data_len;
+
+    if (rx_received == rx_expected) {
+        rx_assembling = false;
+        dispatch(rx_buf, rx_expected);
+    }
+}
+
+void mqtt_cmd_get_stats(uint32_t *handled, uint32_t *rejected)
+{
+    if (handled != NULL) {
+        *handled = cmds_handled;
+    }
+    if (rejected != NULL) {
+        *rejected = cmds_rejected;
+    }
+}
+
+void mqtt_cmd_on_published(int msg_id)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&latency_lock);
+    if (msg_id == ping_msg_id) {
+        uint32_t rtt_ms = (uint32_t)((now - ping_sent_us) / 1000);
+        latency.rtt[bucket_of(rtt_bounds_ms, MQTT_CMD_RTT_BUCKETS - 1, rtt_ms)]++;
+        latency.rtt_last_ms = rtt_ms;
+        ping_msg_id = -1;
+    }
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+void mqtt_cmd_get_latency(mqtt_cmd_latency_t *out)
+{
+    portENTER_CRITICAL(&latency_lock);
+    memcpy(out, &latency, sizeof(*out));
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+int32_t mqtt_cmd_latency_bound(bool skew, int bucket)
+{
+    if (skew) {
+        return bucket < MQTT_CMD_SKEW_BUCKETS - 1 ? skew_bounds_ms[bucket] : INT32_MAX;
+    }
+    return bucket < MQTT_CMD_RTT_BUCKETS - 1 ? rtt_bounds_ms[bucket] : INT32_MAX;
+}
@@ -0,0 +1,110 @@
+#ifndef SAFESIGNAL_MQTT_CMD_H
+#define SAFESIGNAL_MQTT_CMD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * MQTT Command Channel
+ *
+ * Remote control plane on safesignal/{tenant}/{building}/device/{deviceId}/cmd.
+ * Commands are flat JSON objects, e.g.
+ *     {"cmd":"log_level","id":"42","level":"warn"}
+ *
+ * - Parsed in place with a fixed-size token scanner, no heap allocation
+ * - Fragmented payloads (current_data_offset > 0) are reassembled into a
+ *   static buffer; unfragmented payloads are parsed straight from event->data
+ * - Runs on the MQTT task; handlers must not block
+ * - Every command is answered on .../cmd/resp with {"cmd","id","status",...}
+ *
+ * Commands: ping, latency, config_reload, config_set, metrics, status,
+ * queue_flush, identify, log_level, flash, ota_begin, ota_status, ota_abort
+ *
+ * ping is the edge latency probe: the response echoes t0 with the device's
+ * receive/send times and goes out with QoS 1, so the device builds its own
+ * histograms alongside the edge's (latency command, log console):
+ * - RTT: ping response publish to PUBACK (device to broker and back, the
+ *   leg an alert takes)
+ * - One-way: device receive time minus edge t0 (forward delay plus clock
+ *   offset; only while SNTP is synchronized)
+ * Bucket bounds follow the edge histograms device_rtt_seconds and
+ * device_clock_skew_seconds.
+ *
+ * config_set pushes a versioned configuration document:
+ *     {"cmd":"config_set","id":"7","version":12,"device":"ESP32-A1",
+ *      "room":"R-204","heartbeatSec":300,"power":"balanced","sig":"MEUCIQ..."}
+ * - device must match this device; version must exceed the applied version
+ * - Optional: tenant, building, room, heartbeatSec, rateMax, rateWindowSec,
+ *   cooldownSec, power (performance, balanced, low)
+ * - sig: base64 signature by the CA key over SHA-256 of every member except
+ *   cmd, id and sig, as "key=value\n" in payload order (raw JSON text of the
+ *   value, without quotes) - see scripts/sign_config.py
+ *
+ * ota_begin starts or resumes a firmware update (see ota.h), signed the same way:
+ *     {"cmd":"ota_begin","id":"8","device":"ESP32-A1","version":"1.3.0",
+ *      "size":1183744,"sha256":"9f86d0...","rate":8192,"sig":"MEUCIQ..."}
+ * - rate (bytes/s) is optional, OTA_MIN_RATE_BPS..OTA_MAX_RATE_BPS
+ * - Delta update: "patch" (patch size) and "base" (app_elf_sha256 of the
+ *   running build, hex) - see scripts/ota_delta.py
+ * - Progress is reported on .../ota/status and by ota_status; see
+ *   scripts/ota_push.py
+ */
+
+#define MQTT_CMD_MAX_PAYLOAD 1024   /* Larger commands are rejected (RSA-4096 signed config fits) */
+#define MQTT_CMD_MAX_RESPONSE 512   /* Response document, envelope included */
+#define MQTT_CMD_MAX_TOKENS 16      /* Max key/value pairs per command */
+
+#define MQTT_CMD_RTT_BUCKETS 12     /* <= 5, 10, .. 5120 ms, then overflow */
+#define MQTT_CMD_SKEW_BUCKETS 14    /* <= -5000, -2000, .. 5000 ms, then overflow */
+
+/**
+ * Latency probe histograms (counts per bucket, not cumulative)
+ */
+typedef struct {
+    uint32_t rtt[MQTT_CMD_RTT_BUCKETS];
+    uint32_t skew[MQTT_CMD_SKEW_BUCKETS];
+    uint32_t rtt_last_ms;
+    int32_t skew_last_ms;
+    uint32_t rtt_lost;          /* Ping responses never acknowledged */
+} mqtt_cmd_latency_t;
+
+/**
+ * Handle an MQTT_EVENT_DATA fragment received on the command topic
+ * Dispatches the command once the payload is complete.
+ * @param data Fragment data (event->data, not NUL-terminated)
+ * @param data_len Fragment length (event->data_len)
+ * @param offset Fragment offset within the payload (event->current_data_offset)
+ * @param total_len Total payload length (event->total_data_len)
+ */
+void mqtt_cmd_handle_data(const char *data, int data_len, int offset, int total_len);
+
+/**
+ * Get command channel counters
+ * @param handled Commands dispatched since boot (output, may be NULL)
+ * @param rejected Oversized, malformed or unknown commands (output, may be NULL)
+ */
+void mqtt_cmd_get_stats(uint32_t *handled, uint32_t *rejected);
+
+/**
+ * Notify that MQTT acknowledged a message (MQTT_EVENT_PUBLISHED)
+ * Completes the RTT sample of the last ping response.
+ * @param msg_id Acknowledged message ID
+ */
+void mqtt_cmd_on_published(int msg_id);
+
+/**
+ * Get the latency probe histograms
+ * @param out Histograms (output)
+ */
+void mqtt_cmd_get_latency(mqtt_cmd_latency_t *out);
+
+/**
+ * Get the upper bound of a latency histogram bucket
+ * @param skew false for RTT buckets, true for one-way buckets
+ * @param bucket Bucket index
+ * @return Bound in ms (INT32_MAX for the overflow bucket)
+ */
+int32_t mqtt_cmd_latency_bound(bool skew, int bucket);
+
+#endif /* SAFESIGNAL_MQTT_CMD_H */
@@ -0,0 +1,992 @@
+#include "ota.h"
+#include "config.h"
+#include "mqtt.h"
+#include "alert_queue.h"
+#include "flash_stats.h"
+#include "runtime_config.h"
+#include "log_ring.h"
+#include "ota_health.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+static const char *TAG = "OTA";
+
+#define NVS_NAMESPACE "ota"
+#define NVS_KEY_CHECKPOINT "checkpoint"
+#define CHECKPOINT_FORMAT 1
+
+#define OTA_SECTOR_SIZE 4096
+#define RESUME_HASH_STEP (64 * 1024)    /* Bytes re-hashed per step while resuming */
+
+/* Patch stream (scripts/ota_delta.py) */
+#define DELTA_FORMAT 1
+#define DELTA_HEADER_SIZE 12            /* magic u32, format u8, reserved 3, size u32 */
+#define DELTA_OP_END 0x00
+#define DELTA_OP_COPY 0x01              /* src u32, len u32 */
+#define DELTA_OP_ADD 0x02               /* src u32, len u32, len difference bytes */
+#define DELTA_OP_INSERT 0x03            /* len u32, len bytes */
+
+/* Persisted session progress (written at OTA_CHECKPOINT_BYTES boundaries) */
+typedef struct {
+    uint32_t format;
+    uint32_t partition_addr;    /* Update partition the image is written to */
+    uint32_t size;
+    uint32_t offset;            /* Bytes written and verified, sector aligned */
+    uint8_t sha256[32];
+    char version[OTA_VERSION_MAX_LEN];
+} ota_checkpoint_t;
+
+typedef enum {
+    CHUNK_NONE = 0,
+    CHUNK_REQUESTED,            /* Request sent, MQTT task may fill chunk_buf */
+    CHUNK_READY,                /* chunk_buf holds the verified answer */
+} chunk_state_t;
+
+typedef enum {
+    DELTA_HEADER = 0,
+    DELTA_OP,
+    DELTA_ARGS,
+    DELTA_COPY,                 /* Base bytes, no patch input needed */
+    DELTA_ADD,
+    DELTA_INSERT,
+    DELTA_END,
+} delta_phase_t;
+
+/* Patch applier (heap, only during a delta session) */
+typedef struct {
+    tinfl_decompressor inflator;
+    uint8_t dict[1 << OTA_DELTA_WINDOW_BITS];   /* Wrapping inflate output */
+    size_t dict_ofs;
+    const uint8_t *out;         /* Inflated bytes not parsed yet (in dict) */
+    size_t out_len;
+    bool more_output;           /* Current input has more to inflate */
+    bool inflate_done;
+    size_t in_used;             /* Payload bytes of the current chunk inflated */
+
+    delta_phase_t phase;
+    uint8_t field[DELTA_HEADER_SIZE];
+    size_t field_len;
+    size_t field_need;
+    uint8_t op;
+    uint32_t src;               /* Base offset of the next COPY/ADD byte */
+    uint32_t remaining;         /* Bytes left in the current operation */
+
+    uint8_t stage[512];         /* Output gathered into flash-sized writes */
+    size_t stage_len;
+    uint8_t base_buf[256];
+} delta_ctx_t;
+
+/* Session (status task; state fields read by the MQTT task) */
+static const esp_partition_t *target = NULL;
+static const esp_partition_t *running = NULL;
+static volatile ota_state_t state = OTA_STATE_IDLE;
+static ota_manifest_t manifest;
+static volatile uint32_t written = 0;      /* Image bytes in flash, verified */
+static volatile uint32_t received = 0;     /* Download bytes consumed (patch in delta mode) */
+static delta_ctx_t *delta = NULL;
+static uint32_t erased_end = 0;
+static uint32_t hashed = 0;
+static mbedtls_sha256_context sha;
+static bool sha_active = false;
+static volatile esp_err_t last_error = ESP_OK;
+static int64_t restart_at_us = 0;
+static scheduler_job_id_t ota_job = SCHEDULER_JOB_ID_INVALID;
+
+/* Checkpoint of an interrupted session (resumed by a matching ota_begin) */
+static ota_checkpoint_t checkpoint;
+static bool checkpoint_valid = false;
+
+/* Requests from the MQTT task, picked up by ota_step() */
+static portMUX_TYPE ota_lock = portMUX_INITIALIZER_UNLOCKED;
+static ota_manifest_t pending_manifest;
+static volatile bool begin_pending = false;
+static volatile bool abort_pending = false;
+
+/* Chunk in flight: header followed by payload */
+static uint8_t chunk_buf[sizeof(ota_chunk_header_t) + OTA_CHUNK_SIZE];
+static volatile chunk_state_t chunk_state = CHUNK_NONE;
+static volatile uint32_t req_offset = 0;
+static volatile uint16_t req_len = 0;
+static int64_t req_at_us = 0;
+static int64_t next_req_us = 0;
+static volatile int64_t hold_until_us = 0;
+
+/* Reassembly of fragmented data messages (MQTT task only) */
+static int rx_expected = 0;
+static int rx_received = 0;
+static bool rx_assembling = false;
+
+/* Read-back buffer (status task only) */
+static uint8_t verify_buf[512];
+
+static bool same_image(const ota_manifest_t *a, const ota_manifest_t *b)
+{
+    return a->size == b->size && memcmp(a->sha256, b->sha256, sizeof(a->sha256)) == 0 &&
+           strcmp(a->version, b->version) == 0 && a->patch_size == b->patch_size;
+}
+
+static uint32_t transfer_size(void)
+{
+    return manifest.patch_size > 0 ? manifest.patch_size : manifest.size;
+}
+
+static bool session_running(void)
+{
+    return state == OTA_STATE_RESUMING || state == OTA_STATE_DOWNLOADING;
+}
+
+/* ========================================================================== */
+/* Checkpoint                                                                 */
+/* ========================================================================== */
+
+static void save_checkpoint(void)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[OTA] Checkpoint not saved: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    checkpoint = (ota_checkpoint_t) {
+        .format = CHECKPOINT_FORMAT,
+        .partition_addr = target->address,
+        .size = manifest.size,
+        .offset = written,
+    };
+    memcpy(checkpoint.sha256, manifest.sha256, sizeof(checkpoint.sha256));
+    strncpy(checkpoint.version, manifest.version, sizeof(checkpoint.version) - 1);
+
+    ret = nvs_set_blob(handle, NVS_KEY_CHECKPOINT, &checkpoint, sizeof(checkpoint));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    checkpoint_valid = (ret == ESP_OK);
+    ESP_LOGD(TAG, "[OTA] Checkpoint at %lu bytes: %s",
+             (unsigned long)written, esp_err_to_name(ret));
+}
+
+static void clear_checkpoint(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_erase_key(handle, NVS_KEY_CHECKPOINT) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    checkpoint_valid = false;
+}
+
+static void load_checkpoint(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;     /* Never written */
+    }
+
+    size_t size = sizeof(checkpoint);
+    esp_err_t ret = nvs_get_blob(handle, NVS_KEY_CHECKPOINT, &checkpoint, &size);
+    nvs_close(handle);
+    if (ret != ESP_OK) {
+        return;
+    }
+
+    /* After an update the other slot is the target: the checkpoint is stale */
+    checkpoint.version[sizeof(checkpoint.version) - 1] = '\0';
+    if (size != sizeof(checkpoint) || checkpoint.format != CHECKPOINT_FORMAT ||
+        checkpoint.partition_addr != target->address ||
+        checkpoint.offset > checkpoint.size || checkpoint.size > target->size ||
+        checkpoint.offset % OTA_SECTOR_SIZE != 0) {
+        ESP_LOGI(TAG, "[OTA] Discarding stale checkpoint");
+        clear_checkpoint();
+        return;
+    }
+
+    checkpoint_valid = true;
+    ESP_LOGI(TAG, "[OTA] Interrupted update to %s at %lu/%lu bytes, resumes on ota_begin",
+             checkpoint.version, (unsigned long)checkpoint.offset,
+             (unsigned long)checkpoint.size);
+}
+
+/* ========================================================================== */
+/* Session                                                                    */
+/* ========================================================================== */
+
+static void publish_status(void)
+{
+    ota_progress_t progress;
+    ota_get_progress(&progress);
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    char payload[320];
+    int len = snprintf(payload, sizeof(payload),
+        "{\"deviceId\":\"%s\",\"state\":\"%s\",\"version\":\"%s\",\"offset\":%lu,"
+        "\"size\":%lu,\"written\":%lu,\"delta\":%s,\"held\":%s,\"running\":\"%s\"",
+        cfg.device_id, ota_state_name(progress.state), progress.version,
+        (unsigned long)progress.offset, (unsigned long)progress.size,
+        (unsigned long)progress.written, progress.delta ? "true" : "false",
+        progress.held ? "true" : "false", SAFESIGNAL_VERSION);
+    if (progress.state == OTA_STATE_FAILED) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"error\":\"%s\"",
+                        esp_err_to_name(progress.error));
+    }
+    len += snprintf(payload + len, sizeof(payload) - len, "}");
+
+    if (len > 0 && len < sizeof(payload)) {
+        mqtt_publish_ota("status", payload, len, 1);
+    }
+}
+
+static void end_session(void)
+{
+    if (sha_active) {
+        mbedtls_sha256_free(&sha);
+        sha_active = false;
+    }
+    free(delta);
+    delta = NULL;
+    chunk_state = CHUNK_NONE;
+    mqtt_set_ota_subscription(false);
+}
+
+static void fail(esp_err_t err)
+{
+    LOGR_E(TAG, "[OTA] Update to %s failed at %lu/%lu bytes: %s", manifest.version,
+           (unsigned long)written, (unsigned long)manifest.size, esp_err_to_name(err));
+
+    last_error = err;
+    state = OTA_STATE_FAILED;
+    end_session();
+    clear_checkpoint();
+    publish_status();
+}
+
+static void start_session(void)
+{
+    ota_manifest_t m;
+    portENTER_CRITICAL(&ota_lock);
+    m = pending_manifest;
+    begin_pending = false;
+    portEXIT_CRITICAL(&ota_lock);
+
+    if (session_running() || state == OTA_STATE_READY) {
+        if (same_image(&manifest, &m)) {
+            /* Repeated begin: the edge may change the pace mid-transfer */
+            manifest.rate_bps = m.rate_bps;
+            publish_status();
+        }
+        return;
+    }
+
+    manifest = m;
+    written = 0;
+    hashed = 0;
+    last_error = ESP_OK;
+
+    /* Delta sessions are not checkpointed: the inflate state is in RAM only */
+    if (m.patch_size == 0 && checkpoint_valid && checkpoint.size == m.size &&
+        memcmp(checkpoint.sha256, m.sha256, sizeof(m.sha256)) == 0 &&
+        strcmp(checkpoint.version, m.version) == 0) {
+        written = checkpoint.offset;
+    } else if (checkpoint_valid) {
+        clear_checkpoint();
+    }
+
+    /* Sectors past the verified prefix are erased again before use */
+    erased_end = written;
+    received = written;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    sha_active = true;
+
+    if (m.patch_size > 0) {
+        delta = calloc(1, sizeof(*delta));
+        if (delta == NULL) {
+            fail(ESP_ERR_NO_MEM);
+            return;
+        }
+        tinfl_init(&delta->inflator);
+        delta->phase = DELTA_HEADER;
+        delta->field_need = DELTA_HEADER_SIZE;
+    }
+
+    chunk_state = CHUNK_NONE;
+    next_req_us = esp_timer_get_time();
+    state = written > 0 ? OTA_STATE_RESUMING : OTA_STATE_DOWNLOADING;
+    mqtt_set_ota_subscription(true);
+
+    if (delta != NULL) {
+        LOGR_I(TAG, "[OTA] Delta update to %s: %lu byte patch for %lu bytes, %lu B/s",
+               manifest.version, (unsigned long)manifest.patch_size,
+               (unsigned long)manifest.size, (unsigned long)manifest.rate_bps);
+    } else {
+        LOGR_I(TAG, "[OTA] Update to %s: %lu bytes from %lu, %lu B/s",
+               manifest.version, (unsigned long)manifest.size,
+               (unsigned long)written, (unsigned long)manifest.rate_bps);
+    }
+    ESP_LOGI(TAG, "[OTA] Writing to %s", target->label);
+    publish_status();
+}
+
+static void abort_session(void)
+{
+    abort_pending = false;
+
+    if (state == OTA_STATE_READY) {
+        /* Not restarted yet: keep booting the running image */
+        esp_err_t ret = esp_ota_set_boot_partition(esp_ota_get_running_partition());
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "[OTA] Failed to revert boot partition: %s", esp_err_to_name(ret));
+        }
+    }
+
+    if (session_running() || state == OTA_STATE_READY || checkpoint_valid) {
+        LOGR_W(TAG, "[OTA] Update to %s aborted at %lu bytes",
+               manifest.version, (unsigned long)written);
+    }
+
+    end_session();
+    clear_checkpoint();
+    state = OTA_STATE_IDLE;
+    publish_status();
+}
+
+/* Re-hash the checkpointed prefix: the digest state is not persisted */
+static void resume_step(void)
+{
+    uint32_t end = hashed + RESUME_HASH_STEP;
+    if (end > written) {
+        end = written;
+    }
+
+    while (hashed < end) {
+        size_t n = end - hashed;
+        if (n > sizeof(verify_buf)) {
+            n = sizeof(verify_buf);
+        }
+        esp_err_t ret = esp_partition_read(target, hashed, verify_buf, n);
+        if (ret != ESP_OK) {
+            fail(ret);
+            return;
+        }
+        mbedtls_sha256_update(&sha, verify_buf, n);
+        hashed += n;
+    }
+
+    if (hashed == written) {
+        ESP_LOGI(TAG, "[OTA] Resuming %s at %lu bytes", manifest.version, (unsigned long)written);
+        state = OTA_STATE_DOWNLOADING;
+    }
+}
+
+/**
+ * Append image bytes at the write offset
+ * Erases sectors ahead of the data, reads back what was programmed and
+ * hashes the read-back bytes, so the digest covers what is in flash.
+ */
+static esp_err_t write_output(const uint8_t *data, size_t len)
+{
+    esp_err_t ret;
+
+    while (written + len > erased_end) {
+        ret = esp_partition_erase_range(target, erased_end, OTA_SECTOR_SIZE);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        erased_end += OTA_SECTOR_SIZE;
+    }
+
+    ret = esp_partition_write(target, written, data, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (size_t off = 0; off < len; ) {
+        size_t n = len - off;
+        if (n > sizeof(verify_buf)) {
+            n = sizeof(verify_buf);
+        }
+        ret = esp_partition_read(target, written + off, verify_buf, n);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (memcmp(verify_buf, data + off, n) != 0) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        mbedtls_sha256_update(&sha, verify_buf, n);
+        off += n;
+    }
+
+    written += len;
+    return ESP_OK;
+}
+
+/* ========================================================================== */
+/* Delta                                                                      */
+/* ========================================================================== */
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Gather reconstructed bytes into 512-byte writes (the last one may be short) */
+static esp_err_t delta_output(const uint8_t *data, size_t len)
+{
+    if (written + delta->stage_len + len > manifest.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (len > 0) {
+        size_t n = sizeof(delta->stage) - delta->stage_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(delta->stage + delta->stage_len, data, n);
+        delta->stage_len += n;
+        data += n;
+        len -= n;
+
+        if (delta->stage_len == sizeof(delta->stage)) {
+            esp_err_t ret = write_output(delta->stage, delta->stage_len);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+            delta->stage_len = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+/* Start the operation whose opcode and arguments are in delta->field */
+static esp_err_t delta_start_op(void)
+{
+    if (delta->op == DELTA_OP_INSERT) {
+        delta->remaining = get_le32(delta->field);
+        delta->phase = DELTA_INSERT;
+    } else {
+        delta->src = get_le32(delta->field);
+        delta->remaining = get_le32(delta->field + 4);
+        if (delta->src > running->size || delta->remaining > running->size - delta->src) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        delta->phase = delta->op == DELTA_OP_COPY ? DELTA_COPY : DELTA_ADD;
+    }
+
+    /* Every operation produces output, so a step's work is bounded by its budget */
+    return delta->remaining > 0 ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
+
+/* Parse inflated bytes; returns how many were used */
+static esp_err_t delta_parse(const uint8_t *data, size_t len, size_t *used)
+{
+    esp_err_t ret = ESP_OK;
+    size_t n = 0;
+
+    switch (delta->phase) {
+        case DELTA_HEADER:
+        case DELTA_ARGS:
+            n = delta->field_need - delta->field_len;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(delta->field + delta->field_len, data, n);
+            delta->field_len += n;
+            if (delta->field_len < delta->field_need) {
+                break;
+            }
+
+            if (delta->phase == DELTA_ARGS) {
+                ret = delta_start_op();
+            } else if (get_le32(delta->field) != OTA_DELTA_MAGIC ||
+                       delta->field[4] != DELTA_FORMAT ||
+                       get_le32(delta->field + 8) != manifest.size) {
+                ret = ESP_ERR_INVALID_VERSION;
+            } else {
+                delta->phase = DELTA_OP;
+            }
+            break;
+
+        case DELTA_OP:
+            n = 1;
+            delta->op = data[0];
+            delta->field_len = 0;
+            if (delta->op == DELTA_OP_END) {
+                delta->phase = DELTA_END;
+                if (delta->stage_len > 0) {
+                    ret = write_output(delta->stage, delta->stage_len);
+                    delta->stage_len = 0;
+                }
+            } else if (delta->op == DELTA_OP_COPY || delta->op == DELTA_OP_ADD) {
+                delta->field_need = 8;
+                delta->phase = DELTA_ARGS;
+            } else if (delta->op == DELTA_OP_INSERT) {
+                delta->field_need = 4;
+                delta->phase = DELTA_ARGS;
+            } else {
+                ret = ESP_ERR_INVALID_RESPONSE;
+            }
+            break;
+
+        case DELTA_ADD:
+            /* Base bytes plus the difference bytes from the patch */
+            n = len < sizeof(delta->base_buf) ? len : sizeof(delta->base_buf);
+            if (n > delta->remaining) {
+                n = delta->remaining;
+            }
+            ret = esp_partition_read(running, delta->src, delta->base_buf, n);
+            if (ret != ESP_OK) {
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                delta->base_buf[i] += data[i];
+            }
+            ret = delta_output(delta->base_buf, n);
+            delta->src += n;
+            delta->remaining -= n;
+            if (delta->remaining == 0) {
+                delta->phase = DELTA_OP;
+            }
+            break;
+
+        case DELTA_INSERT:
+            n = len < delta->remaining ? len : delta->remaining;
+            ret = delta_output(data, n);
+            delta->remaining -= n;
+            if (delta->remaining == 0) {
+                delta->phase = DELTA_OP;
+            }
+            break;
+
+        default:
+            ret = ESP_ERR_INVALID_SIZE;     /* Data after END */
+            break;
+    }
+
+    *used = n;
+    return ret;
+}
+
+/**
+ * Apply the patch bytes of the current chunk
+ * Works through at most OTA_DELTA_STEP_BYTES of output per call and stops
+ * for alert traffic; the chunk stays READY until all of it is applied.
+ * @param consumed Set when the chunk is fully applied
+ */
+static esp_err_t delta_run(const uint8_t *in, size_t in_len, bool last, bool *consumed)
+{
+    uint32_t start = written + delta->stage_len;
+    esp_err_t ret = ESP_OK;
+
+    while (ret == ESP_OK && written + delta->stage_len - start < OTA_DELTA_STEP_BYTES &&
+           esp_timer_get_time() >= hold_until_us) {
+        if (delta->phase == DELTA_COPY) {
+            size_t n = delta->remaining < sizeof(delta->base_buf) ?
+                       delta->remaining : sizeof(delta->base_buf);
+            ret = esp_partition_read(running, delta->src, delta->base_buf, n);
+            if (ret == ESP_OK) {
+                ret = delta_output(delta->base_buf, n);
+            }
+            delta->src += n;
+            delta->remaining -= n;
+            if (delta->remaining == 0) {
+                delta->phase = DELTA_OP;
+            }
+            continue;
+        }
+
+        if (delta->out_len > 0) {
+            size_t used;
+            ret = delta_parse(delta->out, delta->out_len, &used);
+            delta->out += used;
+            delta->out_len -= used;
+            continue;
+        }
+
+        if (delta->inflate_done) {
+            if (delta->phase != DELTA_END || delta->in_used < in_len) {
+                ret = ESP_ERR_INVALID_SIZE;     /* Truncated, or data after the stream */
+            }
+            break;
+        }
+        if (delta->in_used == in_len && !delta->more_output) {
+            break;
+        }
+
+        /* Inflate into the free part of the wrapping dictionary */
+        size_t in_size = in_len - delta->in_used;
+        size_t out_size = sizeof(delta->dict) - delta->dict_ofs;
+        tinfl_status status = tinfl_decompress(&delta->inflator, in + delta->in_used, &in_size,
+            delta->dict, delta->dict + delta->dict_ofs, &out_size,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | (last ? 0 : TINFL_FLAG_HAS_MORE_INPUT));
+        if (status < TINFL_STATUS_DONE) {
+            ret = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+
+        delta->in_used += in_size;
+        delta->out = delta->dict + delta->dict_ofs;
+        delta->out_len = out_size;
+        delta->dict_ofs = (delta->dict_ofs + out_size) & (sizeof(delta->dict) - 1);
+        delta->more_output = (status == TINFL_STATUS_HAS_MORE_OUTPUT);
+        delta->inflate_done = (status == TINFL_STATUS_DONE);
+    }
+
+    *consumed = ret == ESP_OK && delta->in_used == in_len && !delta->more_output &&
+                delta->out_len == 0 && delta->phase != DELTA_COPY;
+    return ret;
+}
+
+static void finish(void)
+{
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    sha_active = false;
+
+    if (memcmp(digest, manifest.sha256, sizeof(digest)) != 0) {
+        fail(ESP_ERR_INVALID_CRC);
+        return;
+    }
+
+    /* Also runs the bootloader's image check (header, segments, appended hash) */
+    esp_err_t ret = esp_ota_set_boot_partition(target);
+    if (ret != ESP_OK) {
+        fail(ret);
+        return;
+    }
+
+    end_session();
+    clear_checkpoint();
+    state = OTA_STATE_READY;
+    restart_at_us = esp_timer_get_time() + (int64_t)OTA_RESTART_DELAY_MS * 1000;
+
+    LOGR_I(TAG, "[OTA] %s verified, boots from %s after restart",
+           manifest.version, target->label);
+    publish_status();
+}
+
+static void request_chunk(int64_t now)
+{
+    uint32_t remaining = transfer_size() - received;
+
+    req_offset = received;
+    req_len = remaining < OTA_CHUNK_SIZE ? remaining : OTA_CHUNK_SIZE;
+
+    char payload[96];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"version\":\"%s\",\"offset\":%lu,\"len\":%u}",
+                       manifest.version, (unsigned long)req_offset, req_len);
+
+    /* Armed before publishing: the answer can arrive before publish returns */
+    req_at_us = now;
+    chunk_state = CHUNK_REQUESTED;
+    if (mqtt_publish_ota("req", payload, len, 0) < 0) {
+        chunk_state = CHUNK_NONE;
+        return;
+    }
+
+    /* Pace the average rate, not the burst: one chunk per len / rate */
+    next_req_us = now + (int64_t)req_len * 1000000 / manifest.rate_bps;
+}
+
+static void download_step(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    /* Alert traffic: drop the request in flight, no flash operations; a
+     * received chunk is kept and applied after the hold */
+    if (now < hold_until_us) {
+        if (chunk_state == CHUNK_REQUESTED) {
+            chunk_state = CHUNK_NONE;
+        }
+        return;
+    }
+
+    if (chunk_state == CHUNK_READY) {
+        const uint8_t *payload = chunk_buf + sizeof(ota_chunk_header_t);
+        esp_err_t ret;
+
+        if (delta != NULL) {
+            bool consumed = false;
+            ret = delta_run(payload, req_len, received + req_len == transfer_size(), &consumed);
+            if (ret == ESP_OK && !consumed) {
+                scheduler_trigger(ota_job);     /* More output, or held */
+                return;
+            }
+            delta->in_used = 0;
+        } else {
+            ret = write_output(payload, req_len);
+        }
+        chunk_state = CHUNK_NONE;
+        if (ret != ESP_OK) {
+            fail(ret);
+            return;
+        }
+        received += req_len;
+
+        if (received == transfer_size()) {
+            if (delta != NULL && (delta->phase != DELTA_END || !delta->inflate_done ||
+                                  written != manifest.size)) {
+                fail(ESP_ERR_INVALID_SIZE);
+                return;
+            }
+            finish();
+            return;
+        }
+        if (delta == NULL && written % OTA_CHECKPOINT_BYTES == 0) {
+            save_checkpoint();
+        }
+    } else if (chunk_state == CHUNK_REQUESTED) {
+        if ((now - req_at_us) / 1000 < OTA_CHUNK_TIMEOUT_MS) {
+            return;
+        }
+        ESP_LOGW(TAG, "[OTA] Chunk at %lu not received, requesting again",
+                 (unsigned long)req_offset);
+        chunk_state = CHUNK_NONE;
+    }
+
+    /* Alerts always take the link first */
+    if (now >= next_req_us && mqtt_is_connected() && alert_queue_get_count() == 0) {
+        request_chunk(now);
+    }
+}
+
+static void restart_when_idle(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (now < restart_at_us || now < hold_until_us || alert_queue_get_count() > 0) {
+        return;
+    }
+
+    LOGR_W(TAG, "[OTA] Restarting into %s", manifest.version);
+    alert_queue_flush_stats();
+    flash_stats_flush();
+    mqtt_cleanup();     /* Clean offline presence instead of the Will */
+    esp_restart();
+}
+
+/* ========================================================================== */
+/* Public API                                                                 */
+/* ========================================================================== */
+
+esp_err_t ota_init(void)
+{
+    target = esp_ota_get_next_update_partition(NULL);
+    if (target == NULL) {
+        ESP_LOGW(TAG, "[OTA] No update partition, OTA disabled");
+        return ESP_OK;
+    }
+
+    running = esp_ota_get_running_partition();
+    ESP_LOGI(TAG, "[OTA] Running from %s, updates go to %s (%lu KB)",
+             running != NULL ? running->label : "?", target->label,
+             (unsigned long)(target->size / 1024));
+
+    load_checkpoint();
+    return ESP_OK;
+}
+
+void ota_attach_job(scheduler_job_id_t job)
+{
+    ota_job = job;
+    scheduler_set_enabled(ota_job, begin_pending || abort_pending || ota_is_active());
+}
+
+esp_err_t ota_begin(const ota_manifest_t *m)
+{
+    if (target == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (ota_health_pending()) {
+        return ESP_ERR_INVALID_STATE;     /* The update slot holds the fallback image */
+    }
+    if (m->size == 0 || m->size > target->size || m->rate_bps == 0 ||
+        m->patch_size > target->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (m->patch_size > 0 && (running == NULL ||
+        memcmp(m->base_sha256, esp_app_get_description()->app_elf_sha256,
+               sizeof(m->base_sha256)) != 0)) {
+        return ESP_ERR_INVALID_VERSION;     /* Patch is for another build */
+    }
+    if ((session_running() || state == OTA_STATE_READY) && !same_image(&manifest, m)) {
+        return ESP_ERR_INVALID_STATE;     /* ota_abort first */
+    }
+
+    portENTER_CRITICAL(&ota_lock);
+    pending_manifest = *m;
+    begin_pending = true;
+    portEXIT_CRITICAL(&ota_lock);
+
+    scheduler_set_enabled(ota_job, true);
+    scheduler_trigger(ota_job);
+    return ESP_OK;
+}
+
+esp_err_t ota_abort(void)
+{
+    if (!ota_is_active() && !begin_pending && !checkpoint_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    abort_pending = true;
+    scheduler_set_enabled(ota_job, true);
+    scheduler_trigger(ota_job);
+    return ESP_OK;
+}
+
+void ota_step(void)
+{
+    if (abort_pending) {
+        abort_session();
+    }
+    if (begin_pending) {
+        start_session();
+    }
+
+    switch (state) {
+        case OTA_STATE_RESUMING:
+            resume_step();
+            break;
+        case OTA_STATE_DOWNLOADING:
+            download_step();
+            break;
+        case OTA_STATE_READY:
+            restart_when_idle();
+            break;
+        default:
+            break;
+    }
+
+    if (!ota_is_active() && !begin_pending && !abort_pending) {
+        scheduler_set_enabled(ota_job, false);
+
+        /* ota_begin()/ota_abort() on the MQTT task set their flag before enabling
+         * the job: one that landed since the check would be lost to the disable */
+        if (begin_pending || abort_pending) {
+            scheduler_set_enabled(ota_job, true);
+            scheduler_trigger(ota_job);
+        }
+    }
+}
+
+bool ota_is_active(void)
+{
+    return session_running() || state == OTA_STATE_READY;
+}
+
+void ota_get_progress(ota_progress_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->state = state;
+    if (state != OTA_STATE_IDLE) {
+        strncpy(out->version, manifest.version, sizeof(out->version) - 1);
+        out->size = transfer_size();
+        out->offset = received;
+        out->written = written;
+        out->delta = manifest.patch_size > 0;
+    } else if (checkpoint_valid) {
+        strncpy(out->version, checkpoint.version, sizeof(out->version) - 1);
+        out->size = checkpoint.size;
+        out->offset = checkpoint.offset;
+        out->written = checkpoint.offset;
+    }
+    out->held = esp_timer_get_time() < hold_until_us;
+    out->error = last_error;
+}
+
+const char *ota_state_name(ota_state_t s)
+{
+    switch (s) {
+        case OTA_STATE_IDLE:        return "idle";
+        case OTA_STATE_RESUMING:    return "resuming";
+        case OTA_STATE_DOWNLOADING: return "downloading";
+        case OTA_STATE_READY:       return "ready";
+        case OTA_STATE_FAILED:      return "failed";
+        default:                    return "unknown";
+    }
+}
+
+void ota_hold_for_alert(void)
+{
+    hold_until_us = esp_timer_get_time() + (int64_t)OTA_ALERT_HOLDOFF_MS * 1000;
+
+    /* Late data for the dropped request is ignored by ota_handle_data */
+    if (chunk_state == CHUNK_REQUESTED) {
+        chunk_state = CHUNK_NONE;
+    }
+}
+
+void ota_handle_data(const char *data, int data_len, int offset, int total_len)
+{
+    if (offset == 0) {
+        rx_assembling = false;
+
+        /* Unrequested, late or oversized: dropped (the request times out) */
+        if (chunk_state != CHUNK_REQUESTED ||
+            total_len <= sizeof(ota_chunk_header_t) || total_len > sizeof(chunk_buf)) {
+            return;
+        }
+        rx_assembling = true;
+        rx_expected = total_len;
+        rx_received = 0;
+    } else if (!rx_assembling || total_len != rx_expected || offset != rx_received) {
+        rx_assembling = false;
+        return;
+    }
+
+    if (offset + data_len > rx_expected) {
+        rx_assembling = false;
+        return;
+    }
+
+    memcpy(chunk_buf + offset, data, data_len);
+    rx_received += data_len;
+    if (rx_received < rx_expected) {
+        return;
+    }
+    rx_assembling = false;
+
+    const ota_chunk_header_t *hdr = (const ota_chunk_header_t *)chunk_buf;
+    const uint8_t *payload = chunk_buf + sizeof(ota_chunk_header_t);
+    if (hdr->magic != OTA_CHUNK_MAGIC || hdr->offset != req_offset || hdr->length != req_len ||
+        rx_expected != sizeof(ota_chunk_header_t) + hdr->length ||
+        hdr->crc32 != esp_rom_crc32_le(0, payload, hdr->length)) {
+        ESP_LOGW(TAG, "[OTA] Invalid chunk for offset %lu dropped", (unsigned long)hdr->offset);
+        return;
+    }
+
+    if (chunk_state == CHUNK_REQUESTED) {
+        chunk_state = CHUNK_READY;
+        scheduler_trigger(ota_job);
+    }
+}
+
+void ota_on_disconnect(void)
+{
+    /* Requested again once reconnected (data topic is re-subscribed) */
+    if (chunk_state == CHUNK_REQUESTED) {
+        chunk_state = CHUNK_NONE;
+    }
+    rx_assembling = false;
+}
@@ -0,0 +1,176 @@
+#ifndef SAFESIGNAL_OTA_H
+#define SAFESIGNAL_OTA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "scheduler.h"
+
+/**
+ * Streaming OTA Update
+ *
+ * Pulls a firmware image from the edge over MQTT and writes it straight into
+ * the inactive OTA partition (ota_0/ota_1):
+ * - Started by the signed ota_begin command (mqtt_cmd.h): version, size and
+ *   SHA-256 of the image, signed by the CA key
+ * - The device requests one chunk at a time on .../device/{id}/ota/req
+ *   ({"offset":N,"len":M}); the edge answers on .../ota/data with an
+ *   ota_chunk_header_t followed by the payload
+ * - No image buffer: each chunk is written to its erased sector, read back,
+ *   and the read-back bytes feed the running SHA-256
+ * - Requests are paced to the manifest rate (bytes/s) and only sent while
+ *   the alert queue is empty; a button press drops the chunk in flight and
+ *   holds the transfer for OTA_ALERT_HOLDOFF_MS
+ * - Progress is checkpointed to NVS every OTA_CHECKPOINT_BYTES; a repeated
+ *   ota_begin for the same image resumes there, even after a reboot
+ * - The boot partition is switched only when the digest matches the signed
+ *   manifest (and the bootloader image check passes); the device restarts
+ *   once the alert queue is empty
+ *
+ * Delta mode (manifest with patch and base): the download is a patch
+ * against the running build (scripts/ota_delta.py), applied while it
+ * streams. The patch is a zlib stream of COPY (from the running partition),
+ * ADD (running partition plus difference bytes) and INSERT operations;
+ * inflation uses the ROM tinfl with an OTA_DELTA_WINDOW_BITS dictionary, so
+ * the session holds about 20 KB of heap. The reconstructed image goes
+ * through the same read-back hash and checks as a full one. Delta sessions
+ * are not checkpointed (the inflate state is not persisted): they survive
+ * reconnects, and start over after a reboot.
+ *
+ * State changes are published on .../ota/status. Edge side:
+ * scripts/ota_push.py.
+ */
+
+#define OTA_CHUNK_SIZE 4096             /* One flash sector per request */
+#define OTA_CHUNK_MAGIC 0x4341544F      /* "OTAC" */
+#define OTA_VERSION_MAX_LEN 32
+#define OTA_DELTA_MAGIC 0x50445353      /* "SSDP", patch stream header */
+#define OTA_DELTA_WINDOW_BITS 13        /* zlib window of patches (8 KB dictionary) */
+
+/**
+ * Chunk header prepended to every data message (little endian)
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;         /* OTA_CHUNK_MAGIC */
+    uint32_t offset;        /* Offset of this chunk within the image */
+    uint16_t length;        /* Payload bytes following the header */
+    uint16_t reserved;
+    uint32_t crc32;         /* CRC32 (little endian) of the payload */
+} ota_chunk_header_t;
+
+typedef enum {
+    OTA_STATE_IDLE = 0,
+    OTA_STATE_RESUMING,     /* Re-hashing the checkpointed prefix from flash */
+    OTA_STATE_DOWNLOADING,
+    OTA_STATE_READY,        /* Boot partition switched, restart pending */
+    OTA_STATE_FAILED,
+} ota_state_t;
+
+/**
+ * Update manifest (from the verified ota_begin command)
+ */
+typedef struct {
+    char version[OTA_VERSION_MAX_LEN];
+    uint32_t size;              /* Image size in bytes */
+    uint8_t sha256[32];         /* SHA-256 of the image */
+    uint32_t rate_bps;          /* Transfer rate limit, bytes per second */
+    uint32_t patch_size;        /* Delta: patch bytes to download (0: full image) */
+    uint8_t base_sha256[32];    /* Delta: app_elf_sha256 of the build the patch applies to */
+} ota_manifest_t;
+
+/**
+ * Progress snapshot (ota_status command, status topic)
+ */
+typedef struct {
+    ota_state_t state;
+    char version[OTA_VERSION_MAX_LEN];
+    uint32_t offset;            /* Download bytes received */
+    uint32_t size;              /* Download size (image, or patch in delta mode) */
+    uint32_t written;           /* Image bytes written and verified */
+    bool delta;
+    bool held;                  /* Paused for alert traffic */
+    esp_err_t error;            /* Reason for OTA_STATE_FAILED */
+} ota_progress_t;
+
+/**
+ * Locate the update partition and load a checkpoint left by a previous boot
+ * @return ESP_OK on success (also when OTA is unavailable)
+ */
+esp_err_t ota_init(void);
+
+/**
+ * Attach the scheduler job that runs ota_step()
+ * The job is enabled while a session is active and triggered when a chunk
+ * arrives.
+ * @param job Job handle (status task)
+ */
+void ota_attach_job(scheduler_job_id_t job);
+
+/**
+ * Start or resume an update (MQTT task, after the signature check)
+ * The session is set up by the next ota_step(). A manifest for the image of
+ * the current session or checkpoint resumes it.
+ * @param manifest Verified manifest
+ * @return
+ *  - ESP_OK if accepted
+ *  - ESP_ERR_NOT_SUPPORTED if there is no OTA partition
+ *  - ESP_ERR_INVALID_SIZE if the image does not fit the partition
+ *  - ESP_ERR_INVALID_VERSION if a patch is for another base build
+ *  - ESP_ERR_INVALID_STATE if another image is being downloaded, or the
+ *    running one is not confirmed yet (ota_health.h)
+ */
+esp_err_t ota_begin(const ota_manifest_t *manifest);
+
+/**
+ * Abort the session and discard its checkpoint (MQTT task)
+ * A READY update is reverted to the running partition.
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if no session exists
+ */
+esp_err_t ota_abort(void);
+
+/**
+ * Advance the session: set up, re-hash, request, write (status task)
+ */
+void ota_step(void);
+
+/**
+ * Check if a session is in progress (download, resume or restart pending)
+ * @return true if active
+ */
+bool ota_is_active(void);
+
+/**
+ * Get the session progress
+ * @param out Progress snapshot (output)
+ */
+void ota_get_progress(ota_progress_t *out);
+
+/**
+ * Get the state name used in status messages
+ * @param state State
+ * @return Static string
+ */
+const char *ota_state_name(ota_state_t state);
+
+/**
+ * Pause the transfer for alert traffic (button task, on every press)
+ * The chunk in flight is dropped and no flash operation starts until
+ * OTA_ALERT_HOLDOFF_MS after the last press.
+ */
+void ota_hold_for_alert(void);
+
+/**
+ * Handle an MQTT_EVENT_DATA fragment received on the ota/data topic
+ * @param data Fragment data (event->data)
+ * @param data_len Fragment length (event->data_len)
+ * @param offset Fragment offset within the message (event->current_data_offset)
+ * @param total_len Total message length (event->total_data_len)
+ */
+void ota_handle_data(const char *data, int data_len, int offset, int total_len);
+
+/**
+ * Notify that the MQTT link dropped; the chunk in flight is requested again
+ */
+void ota_on_disconnect(void);
+
+#endif /* SAFESIGNAL_OTA_H */
@@ -0,0 +1,273 @@
+#include "ota_health.h"
+#include "config.h"
+#include "mqtt.h"
+#include "runtime_config.h"
+#include "log_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static const char *TAG = "OTA_HEALTH";
+
+/* Gate state (written by the WiFi, MQTT and status tasks under health_lock) */
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile ota_health_state_t state = OTA_HEALTH_NONE;
+static uint32_t wifi_ms = 0;
+static uint32_t mqtt_ms = 0;
+static uint32_t puback_ms = 0;
+static uint32_t valid_ms = 0;
+
+/* Test publish in flight (matched and cleared under health_lock) */
+static volatile int inflight_msg_id = -1;
+static int64_t inflight_since_us = 0;
+
+static esp_timer_handle_t deadline_timer = NULL;
+static scheduler_job_id_t health_job = SCHEDULER_JOB_ID_INVALID;
+
+/* Image the bootloader reverted from, reported once per connection */
+static char rolled_back[OTA_VERSION_MAX_LEN];
+static volatile bool rollback_report_pending = false;
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static bool gate_open(void)
+{
+    return state != OTA_HEALTH_NONE && state != OTA_HEALTH_VALID;
+}
+
+/* Report on ota/status; the first one (verifying) is the test publish */
+static int publish_report(const char *health)
+{
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+
+    char payload[320];
+    int len = snprintf(payload, sizeof(payload),
+        "{\"deviceId\":\"%s\",\"health\":\"%s\",\"running\":\"%s\",\"wifiMs\":%lu,"
+        "\"mqttMs\":%lu,\"pubackMs\":%lu,\"validMs\":%lu",
+        cfg.device_id, health, SAFESIGNAL_VERSION, (unsigned long)wifi_ms,
+        (unsigned long)mqtt_ms, (unsigned long)puback_ms, (unsigned long)valid_ms);
+    if (rolled_back[0] != '\0') {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"failed\":\"%s\"", rolled_back);
+    }
+    len += snprintf(payload + len, sizeof(payload) - len, "}");
+
+    if (len <= 0 || len >= sizeof(payload)) {
+        return -1;
+    }
+    return mqtt_publish_ota("status", payload, len, 1);
+}
+
+/* esp_timer task: the gate was not passed in time */
+static void deadline_expired(void *arg)
+{
+    if (!gate_open()) {
+        return;
+    }
+
+    LOGR_E(TAG, "[HEALTH] %s not healthy %d s after boot (%s), rolling back",
+           SAFESIGNAL_VERSION, OTA_HEALTH_TIMEOUT_MS / 1000, ota_health_state_name(state));
+
+    esp_err_t ret = esp_ota_mark_app_invalid_rollback_and_reboot();
+
+    /* Only returns on failure; a reset while pending verify reverts as well */
+    ESP_LOGE(TAG, "[HEALTH] Failed to mark image invalid: %s", esp_err_to_name(ret));
+    esp_restart();
+}
+
+static void confirm(void)
+{
+    esp_err_t ret = esp_ota_mark_app_valid_cancel_rollback();
+    if (ret != ESP_OK) {
+        /* Retried on the next step; the deadline still applies */
+        ESP_LOGE(TAG, "[HEALTH] Failed to confirm image: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    esp_timer_stop(deadline_timer);
+    portENTER_CRITICAL(&health_lock);
+    valid_ms = now_ms();
+    state = OTA_HEALTH_VALID;
+    portEXIT_CRITICAL(&health_lock);
+
+    LOGR_I(TAG, "[HEALTH] Image confirmed (WiFi %lu ms, MQTT %lu ms, PUBACK %lu ms, valid %lu ms)",
+           (unsigned long)wifi_ms, (unsigned long)mqtt_ms,
+           (unsigned long)puback_ms, (unsigned long)valid_ms);
+    publish_report("valid");
+}
+
+esp_err_t ota_health_init(void)
+{
+    /* A previous update failed its gate (or crashed) and was reverted */
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t desc;
+    if (invalid != NULL && esp_ota_get_partition_description(invalid, &desc) == ESP_OK) {
+        strncpy(rolled_back, desc.version, sizeof(rolled_back) - 1);
+        LOGR_W(TAG, "[HEALTH] Rolled back from %s in %s, running %s",
+               rolled_back, invalid->label, SAFESIGNAL_VERSION);
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t img_state;
+    if (running == NULL || esp_ota_get_state_partition(running, &img_state) != ESP_OK ||
+        img_state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return ESP_OK;      /* Serial flash, or confirmed on an earlier boot */
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = deadline_expired,
+        .name = "ota_health",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &deadline_timer);
+    if (ret == ESP_OK) {
+        ret = esp_timer_start_once(deadline_timer, (uint64_t)OTA_HEALTH_TIMEOUT_MS * 1000);
+    }
+    if (ret != ESP_OK) {
+        /* Unconfirmed, the image is still reverted by its next reset */
+        ESP_LOGE(TAG, "[HEALTH] Failed to arm rollback deadline: %s", esp_err_to_name(ret));
+    }
+
+    state = OTA_HEALTH_WAIT_WIFI;
+    LOGR_W(TAG, "[HEALTH] %s on trial in %s: confirming within %d s",
+           SAFESIGNAL_VERSION, running->label, OTA_HEALTH_TIMEOUT_MS / 1000);
+    return ESP_OK;
+}
+
+void ota_health_attach_job(scheduler_job_id_t job)
+{
+    health_job = job;
+    scheduler_set_enabled(health_job, gate_open() || rollback_report_pending);
+}
+
+void ota_health_step(void)
+{
+    if (rollback_report_pending && mqtt_is_connected()) {
+        if (publish_report("rolled_back") >= 0) {
+            rollback_report_pending = false;
+        }
+    }
+
+    if (state == OTA_HEALTH_WAIT_PUBACK && mqtt_is_connected()) {
+        int64_t now = esp_timer_get_time();
+        if (inflight_msg_id < 0 ||
+            (now - inflight_since_us) / 1000 >= OTA_HEALTH_ACK_TIMEOUT_MS) {
+            inflight_since_us = now;
+            int msg_id = publish_report("verifying");
+
+            portENTER_CRITICAL(&health_lock);
+            inflight_msg_id = msg_id;
+            portEXIT_CRITICAL(&health_lock);
+
+            /* The PUBACK may have been dispatched before msg_id was recorded */
+            if (mqtt_puback_seen(msg_id)) {
+                ota_health_on_published(msg_id);
+            }
+        }
+    } else if (state == OTA_HEALTH_CLEAN && now_ms() - puback_ms >= OTA_HEALTH_CLEAN_MS) {
+        confirm();
+    }
+
+    if (!gate_open() && !rollback_report_pending) {
+        scheduler_set_enabled(health_job, false);
+    }
+}
+
+bool ota_health_pending(void)
+{
+    return gate_open();
+}
+
+void ota_health_get(ota_health_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    portENTER_CRITICAL(&health_lock);
+    out->state = state;
+    out->wifi_ms = wifi_ms;
+    out->mqtt_ms = mqtt_ms;
+    out->puback_ms = puback_ms;
+    out->valid_ms = valid_ms;
+    portEXIT_CRITICAL(&health_lock);
+    strncpy(out->rolled_back, rolled_back, sizeof(out->rolled_back) - 1);
+}
+
+const char *ota_health_state_name(ota_health_state_t s)
+{
+    switch (s) {
+        case OTA_HEALTH_NONE:        return "none";
+        case OTA_HEALTH_WAIT_WIFI:   return "wait_wifi";
+        case OTA_HEALTH_WAIT_MQTT:   return "wait_mqtt";
+        case OTA_HEALTH_WAIT_PUBACK: return "wait_puback";
+        case OTA_HEALTH_CLEAN:       return "clean_period";
+        case OTA_HEALTH_VALID:       return "valid";
+        default:                     return "unknown";
+    }
+}
+
+void ota_health_on_wifi(void)
+{
+    portENTER_CRITICAL(&health_lock);
+    if (state == OTA_HEALTH_WAIT_WIFI) {
+        wifi_ms = now_ms();
+        state = OTA_HEALTH_WAIT_MQTT;
+    }
+    portEXIT_CRITICAL(&health_lock);
+}
+
+void ota_health_on_connected(void)
+{
+    portENTER_CRITICAL(&health_lock);
+    if (state == OTA_HEALTH_WAIT_WIFI || state == OTA_HEALTH_WAIT_MQTT) {
+        mqtt_ms = now_ms();
+        if (wifi_ms == 0) {
+            wifi_ms = mqtt_ms;
+        }
+        state = OTA_HEALTH_WAIT_PUBACK;
+    }
+    portEXIT_CRITICAL(&health_lock);
+
+    if (rolled_back[0] != '\0') {
+        rollback_report_pending = true;
+    }
+    if (gate_open() || rollback_report_pending) {
+        /* The test publish goes out from the status task */
+        scheduler_set_enabled(health_job, true);
+        scheduler_trigger(health_job);
+    }
+}
+
+void ota_health_on_published(int msg_id)
+{
+    /* Called from both tasks for the same PUBACK (see ota_health_step): only
+     * the first one advances */
+    portENTER_CRITICAL(&health_lock);
+    bool match = state == OTA_HEALTH_WAIT_PUBACK && msg_id == inflight_msg_id;
+    if (match) {
+        inflight_msg_id = -1;
+        puback_ms = now_ms();
+        state = OTA_HEALTH_CLEAN;
+    }
+    portEXIT_CRITICAL(&health_lock);
+
+    if (!match) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "[HEALTH] Test publish acknowledged, confirming after %d s without a reset",
+             OTA_HEALTH_CLEAN_MS / 1000);
+}
+
+void ota_health_on_disconnect(void)
+{
+    /* Sent again once reconnected; the clean period is not interrupted */
+    portENTER_CRITICAL(&health_lock);
+    inflight_msg_id = -1;
+    portEXIT_CRITICAL(&health_lock);
+}
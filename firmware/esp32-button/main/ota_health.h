@@ -0,0 +1,114 @@
+#ifndef SAFESIGNAL_OTA_HEALTH_H
+#define SAFESIGNAL_OTA_HEALTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "scheduler.h"
+#include "ota.h"
+
+/**
+ * Health-Gated Boot Confirmation
+ *
+ * With app rollback enabled (CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE) the
+ * bootloader starts an updated image in the pending-verify state. This module
+ * only confirms it (esp_ota_mark_app_valid_cancel_rollback) once it has
+ * proven it can still deliver alerts:
+ * 1. WiFi connected (got IP)
+ * 2. MQTT connected
+ * 3. A QoS 1 test publish on .../ota/status acknowledged by PUBACK
+ * 4. OTA_HEALTH_CLEAN_MS without a reset after the PUBACK (the supervisor,
+ *    task watchdog and panic handler all reset; any reset of a pending
+ *    image makes the bootloader revert)
+ *
+ * If the gate is not passed within OTA_HEALTH_TIMEOUT_MS of boot the image is
+ * marked invalid and the device reboots into the previous one. Queued alerts
+ * are persisted and delivered by that image.
+ *
+ * Stage timings (ms since boot) are reported by the metrics command and in
+ * the final ota/status message. An image the device fell back from is
+ * reported as rolled back on every connection until the next update.
+ */
+
+typedef enum {
+    OTA_HEALTH_NONE = 0,        /* Not on trial (serial flash, or confirmed on an earlier boot) */
+    OTA_HEALTH_WAIT_WIFI,
+    OTA_HEALTH_WAIT_MQTT,
+    OTA_HEALTH_WAIT_PUBACK,
+    OTA_HEALTH_CLEAN,           /* Watchdog-clean period running */
+    OTA_HEALTH_VALID,           /* Confirmed on this boot */
+} ota_health_state_t;
+
+/**
+ * Health report (metrics command)
+ */
+typedef struct {
+    ota_health_state_t state;
+    uint32_t wifi_ms;           /* Stage reached, ms since boot (0: not yet) */
+    uint32_t mqtt_ms;
+    uint32_t puback_ms;
+    uint32_t valid_ms;
+    char rolled_back[OTA_VERSION_MAX_LEN];  /* Version reverted from ("" if none) */
+} ota_health_t;
+
+/**
+ * Check whether the running image is on trial and arm the rollback deadline
+ * Call early in boot, before WiFi starts, so stage timings are from boot.
+ * @return ESP_OK on success (also when the image is not on trial)
+ */
+esp_err_t ota_health_init(void);
+
+/**
+ * Attach the scheduler job that runs ota_health_step()
+ * The job is enabled while the gate is open or a rollback is unreported.
+ * @param job Job handle (status task)
+ */
+void ota_health_attach_job(scheduler_job_id_t job);
+
+/**
+ * Send the test publish and confirm the image after the clean period (status task)
+ */
+void ota_health_step(void);
+
+/**
+ * Check if the running image still awaits confirmation
+ * The other OTA slot holds the fallback image until then.
+ * @return true while on trial
+ */
+bool ota_health_pending(void);
+
+/**
+ * Get the health report
+ * @param out Report (output)
+ */
+void ota_health_get(ota_health_t *out);
+
+/**
+ * Get the state name used in reports
+ * @param state State
+ * @return Static string
+ */
+const char *ota_health_state_name(ota_health_state_t state);
+
+/**
+ * Notify that WiFi got an IP address (WiFi event handler)
+ */
+void ota_health_on_wifi(void);
+
+/**
+ * Notify that MQTT connected (MQTT task)
+ */
+void ota_health_on_connected(void);
+
+/**
+ * Notify that MQTT acknowledged a message (MQTT_EVENT_PUBLISHED)
+ * @param msg_id Acknowledged message ID
+ */
+void ota_health_on_published(int msg_id);
+
+/**
+ * Notify that the MQTT link dropped; the test publish is sent again
+ */
+void ota_health_on_disconnect(void);
+
+#endif /* SAFESIGNAL_OTA_HEALTH_H */
@@ -0,0 +1,505 @@
+#include "prov_uart.h"
+#include "config.h"
+#include "provisioning.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static const char *TAG = "PROV_UART";
+
+#define PROV_PORT CONFIG_ESP_CONSOLE_UART_NUM
+#define PROTOCOL_VERSION 1
+
+#define SYNC0 0xA5
+#define SYNC1 0x5A
+#define HEADER_LEN 4                /* type, seq, len */
+#define CRC_LEN 4
+#define STATUS_LEN 4
+#define MAX_PAYLOAD 1024
+#define REPLY_FLAG 0x80
+#define MIN_BAUD 9600
+
+#define FRAME_BYTE_TIMEOUT_MS 200   /* Gap allowed inside a frame */
+#define SYNC_POLL_MS 50
+
+#define COMMIT_FLAG_MARK 0x01
+#define EXIT_FLAG_REBOOT 0x01
+
+typedef enum {
+    FRAME_HELLO = 0x01,
+    FRAME_SET = 0x02,
+    FRAME_BEGIN = 0x03,
+    FRAME_DATA = 0x04,
+    FRAME_END = 0x05,
+    FRAME_COMMIT = 0x06,
+    FRAME_GET = 0x07,
+    FRAME_EXIT = 0x08,
+    FRAME_NAK = 0xFF,
+} frame_type_t;
+
+/* Configuration fields, in SET/GET field order */
+static const struct {
+    const char *key;
+    size_t offset;
+    size_t len;
+} fields[] = {
+    { PROVISION_KEY_WIFI_SSID,   offsetof(device_config_t, wifi_ssid),     MAX_WIFI_SSID_LEN },
+    { PROVISION_KEY_WIFI_PASS,   offsetof(device_config_t, wifi_password), MAX_WIFI_PASS_LEN },
+    { PROVISION_KEY_DEVICE_ID,   offsetof(device_config_t, device_id),     MAX_DEVICE_ID_LEN },
+    { PROVISION_KEY_TENANT_ID,   offsetof(device_config_t, tenant_id),     MAX_TENANT_ID_LEN },
+    { PROVISION_KEY_BUILDING_ID, offsetof(device_config_t, building_id),   MAX_BUILDING_ID_LEN },
+    { PROVISION_KEY_ROOM_ID,     offsetof(device_config_t, room_id),       MAX_ROOM_ID_LEN },
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+#define FIELD_WIFI_PASS 1
+#define FIELDS_ALL ((1u << FIELD_COUNT) - 1)
+
+typedef struct {
+    uint8_t type;
+    uint8_t seq;
+    uint16_t len;
+    uint8_t payload[MAX_PAYLOAD];
+} frame_t;
+
+/* Staged certificate or key (PEM, NUL-terminated once complete) */
+typedef struct {
+    char *data;
+    uint32_t size;
+    uint32_t received;
+    uint32_t crc;
+    bool complete;
+} blob_t;
+
+typedef struct {
+    frame_t rx;
+    uint8_t tx[2 + HEADER_LEN + STATUS_LEN + 64 + CRC_LEN];   /* Last reply, resent for duplicates */
+    size_t tx_len;
+    uint8_t out[64];            /* Reply data */
+    size_t out_len;
+    uint8_t last_type;
+    uint8_t last_seq;
+    bool has_last;
+    device_config_t config;
+    uint32_t staged;            /* Bit per configuration field */
+    blob_t blobs[PROVISION_CERT_COUNT];
+    uint32_t baud;
+    int64_t confirm_deadline_us;    /* Baud switch not yet confirmed when > 0 */
+    bool exit;
+    bool reboot;
+} session_t;
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static int mute_vprintf(const char *fmt, va_list args)
+{
+    return 0;
+}
+
+/* Helper: Free staged blobs, wiping the private key */
+static void clear_blobs(session_t *s)
+{
+    for (int i = 0; i < PROVISION_CERT_COUNT; i++) {
+        blob_t *blob = &s->blobs[i];
+        if (blob->data != NULL && i == PROVISION_CERT_KEY) {
+            memset(blob->data, 0, blob->size);
+        }
+        free(blob->data);
+        memset(blob, 0, sizeof(*blob));
+    }
+}
+
+static bool read_exact(uint8_t *buf, size_t len)
+{
+    return uart_read_bytes(PROV_PORT, buf, len, pdMS_TO_TICKS(FRAME_BYTE_TIMEOUT_MS)) == (int)len;
+}
+
+/* Helper: Receive one frame (ESP_ERR_INVALID_CRC/SIZE: frame damaged, send NAK) */
+static esp_err_t read_frame(frame_t *f, int64_t deadline_us)
+{
+    uint8_t prev = 0;
+    uint8_t byte = 0;
+
+    /* Console echo and line noise are skipped */
+    while (prev != SYNC0 || byte != SYNC1) {
+        if (esp_timer_get_time() >= deadline_us) {
+            return ESP_ERR_TIMEOUT;
+        }
+        prev = byte;
+        if (uart_read_bytes(PROV_PORT, &byte, 1, pdMS_TO_TICKS(SYNC_POLL_MS)) != 1) {
+            prev = 0;
+            byte = 0;
+        }
+    }
+
+    uint8_t header[HEADER_LEN];
+    uint8_t crc_buf[CRC_LEN];
+    if (!read_exact(header, sizeof(header))) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    f->type = header[0];
+    f->seq = header[1];
+    f->len = (uint16_t)(header[2] | header[3] << 8);
+    if (f->len > MAX_PAYLOAD || !read_exact(f->payload, f->len) || !read_exact(crc_buf, sizeof(crc_buf))) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, header, sizeof(header));
+    crc = esp_rom_crc32_le(crc, f->payload, f->len);
+    return crc == get_u32(crc_buf) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/* Helper: Send a reply (status + s->out) and keep it for duplicates */
+static void send_reply(session_t *s, uint8_t type, uint8_t seq, esp_err_t status)
+{
+    uint8_t *p = s->tx;
+    size_t len = STATUS_LEN + s->out_len;
+
+    p[0] = SYNC0;
+    p[1] = SYNC1;
+    p[2] = type;
+    p[3] = seq;
+    p[4] = len & 0xFF;
+    p[5] = (len >> 8) & 0xFF;
+    put_u32(&p[6], (uint32_t)status);
+    memcpy(&p[6 + STATUS_LEN], s->out, s->out_len);
+
+    uint32_t crc = esp_rom_crc32_le(0, &p[2], HEADER_LEN + len);
+    put_u32(&p[2 + HEADER_LEN + len], crc);
+    s->tx_len = 2 + HEADER_LEN + len + CRC_LEN;
+
+    uart_write_bytes(PROV_PORT, s->tx, s->tx_len);
+}
+
+static esp_err_t handle_hello(session_t *s, const frame_t *f, uint32_t *new_baud)
+{
+    uint8_t mac[6] = {0};
+    size_t version_len = strlen(SAFESIGNAL_VERSION);
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    if (version_len > sizeof(s->out) - 13) {
+        version_len = sizeof(s->out) - 13;
+    }
+
+    uint32_t baud = s->baud;
+    if (f->len >= 5) {
+        baud = get_u32(&f->payload[1]);
+        if (baud > PROV_UART_MAX_BAUD) {
+            baud = PROV_UART_MAX_BAUD;
+        } else if (baud < MIN_BAUD) {
+            baud = s->baud;
+        }
+    }
+
+    s->out[0] = PROTOCOL_VERSION;
+    s->out[1] = MAX_PAYLOAD & 0xFF;
+    s->out[2] = (MAX_PAYLOAD >> 8) & 0xFF;
+    put_u32(&s->out[3], baud);
+    memcpy(&s->out[7], mac, sizeof(mac));
+    memcpy(&s->out[13], SAFESIGNAL_VERSION, version_len);
+    s->out_len = 13 + version_len;
+
+    if (f->len < 1 || f->payload[0] != PROTOCOL_VERSION) {
+        put_u32(&s->out[3], s->baud);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    *new_baud = baud;
+    return ESP_OK;
+}
+
+static esp_err_t handle_set(session_t *s, const frame_t *f)
+{
+    if (f->len < 1 || f->payload[0] >= FIELD_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t index = f->payload[0];
+    size_t value_len = f->len - 1;
+    if (value_len >= fields[index].len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    char *field = (char *)&s->config + fields[index].offset;
+    memcpy(field, &f->payload[1], value_len);
+    field[value_len] = '\0';
+    s->staged |= 1u << index;
+    return ESP_OK;
+}
+
+static esp_err_t handle_begin(session_t *s, const frame_t *f)
+{
+    if (f->len < 9 || f->payload[0] >= PROVISION_CERT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t size = get_u32(&f->payload[1]);
+    if (size == 0 || size >= MAX_CERT_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    blob_t *blob = &s->blobs[f->payload[0]];
+    free(blob->data);
+    memset(blob, 0, sizeof(*blob));
+
+    blob->data = malloc(size + 1);
+    if (blob->data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    blob->size = size;
+    blob->crc = get_u32(&f->payload[5]);
+    return ESP_OK;
+}
+
+static esp_err_t handle_data(session_t *s, const frame_t *f)
+{
+    /* The slot is implied: one blob transfer at a time */
+    blob_t *blob = NULL;
+    for (int i = 0; i < PROVISION_CERT_COUNT; i++) {
+        if (s->blobs[i].data != NULL && !s->blobs[i].complete) {
+            blob = &s->blobs[i];
+            break;
+        }
+    }
+    if (blob == NULL || f->len < 4) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t offset = get_u32(f->payload);
+    uint32_t n = f->len - 4;
+    if (offset + n > blob->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (offset + n <= blob->received) {
+        return ESP_OK;      /* Resent chunk, already stored */
+    }
+    if (offset != blob->received) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(blob->data + offset, &f->payload[4], n);
+    blob->received += n;
+    return ESP_OK;
+}
+
+static esp_err_t handle_end(session_t *s, const frame_t *f)
+{
+    if (f->len < 1 || f->payload[0] >= PROVISION_CERT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    blob_t *blob = &s->blobs[f->payload[0]];
+    if (blob->data == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (blob->complete) {
+        return ESP_OK;
+    }
+    if (blob->received != blob->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (esp_rom_crc32_le(0, (const uint8_t *)blob->data, blob->size) != blob->crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    blob->data[blob->size] = '\0';
+    blob->complete = true;
+    return ESP_OK;
+}
+
+static esp_err_t handle_commit(session_t *s, const frame_t *f)
+{
+    if (s->staged != FIELDS_ALL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    provision_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    memcpy(&batch.config, &s->config, sizeof(batch.config));
+    batch.mark_provisioned = f->len >= 1 && (f->payload[0] & COMMIT_FLAG_MARK);
+
+    for (int i = 0; i < PROVISION_CERT_COUNT; i++) {
+        if (s->blobs[i].data != NULL && !s->blobs[i].complete) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        batch.certs[i] = s->blobs[i].data;
+    }
+
+    esp_err_t ret = provision_apply_batch(&batch);
+    if (ret == ESP_OK) {
+        clear_blobs(s);
+    }
+    return ret;
+}
+
+static esp_err_t handle_get(session_t *s, const frame_t *f)
+{
+    if (f->len < 1 || f->payload[0] >= FIELD_COUNT || f->payload[0] == FIELD_WIFI_PASS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char value[sizeof(s->out)];
+    esp_err_t ret = provision_get_string(fields[f->payload[0]].key, value, sizeof(value));
+    if (ret == ESP_OK) {
+        s->out_len = strlen(value);
+        memcpy(s->out, value, s->out_len);
+    }
+    return ret;
+}
+
+/* Helper: Handle one valid frame and reply */
+static void handle_frame(session_t *s)
+{
+    const frame_t *f = &s->rx;
+    uint32_t new_baud = 0;
+    esp_err_t status;
+
+    /* Reply lost: resend it, do not apply the request twice */
+    if (s->has_last && f->type == s->last_type && f->seq == s->last_seq) {
+        uart_write_bytes(PROV_PORT, s->tx, s->tx_len);
+        return;
+    }
+
+    s->out_len = 0;
+    switch (f->type) {
+    case FRAME_HELLO:
+        status = handle_hello(s, f, &new_baud);
+        break;
+    case FRAME_SET:
+        status = handle_set(s, f);
+        break;
+    case FRAME_BEGIN:
+        status = handle_begin(s, f);
+        break;
+    case FRAME_DATA:
+        status = handle_data(s, f);
+        break;
+    case FRAME_END:
+        status = handle_end(s, f);
+        break;
+    case FRAME_COMMIT:
+        status = handle_commit(s, f);
+        break;
+    case FRAME_GET:
+        status = handle_get(s, f);
+        break;
+    case FRAME_EXIT:
+        s->exit = true;
+        s->reboot = f->len >= 1 && (f->payload[0] & EXIT_FLAG_REBOOT);
+        status = ESP_OK;
+        break;
+    default:
+        status = ESP_ERR_NOT_SUPPORTED;
+        break;
+    }
+
+    send_reply(s, f->type | REPLY_FLAG, f->seq, status);
+    s->last_type = f->type;
+    s->last_seq = f->seq;
+    s->has_last = true;
+
+    /* Switch after the reply has left at the old rate */
+    if (new_baud != 0 && new_baud != s->baud) {
+        uart_wait_tx_done(PROV_PORT, pdMS_TO_TICKS(100));
+        uart_set_baudrate(PROV_PORT, new_baud);
+        s->baud = new_baud;
+        s->confirm_deadline_us = esp_timer_get_time() + (int64_t)PROV_UART_BAUD_CONFIRM_MS * 1000;
+        s->has_last = false;    /* The confirming HELLO must be answered at the new rate */
+    }
+}
+
+esp_err_t prov_uart_run(void)
+{
+    session_t *s = calloc(1, sizeof(session_t));
+    if (s == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "[PROV] Binary provisioning session started");
+    vprintf_like_t previous_vprintf = esp_log_set_vprintf(mute_vprintf);
+
+    s->baud = CONFIG_ESP_CONSOLE_UART_BAUDRATE;
+    uart_wait_tx_done(PROV_PORT, pdMS_TO_TICKS(100));
+    uart_flush_input(PROV_PORT);
+
+    esp_err_t ret = ESP_OK;
+    uint32_t frames = 0;
+    uint32_t bad_frames = 0;
+    int64_t idle_deadline_us = esp_timer_get_time() + (int64_t)PROV_UART_IDLE_TIMEOUT_MS * 1000;
+
+    while (!s->exit) {
+        int64_t deadline_us = idle_deadline_us;
+        if (s->confirm_deadline_us > 0 && s->confirm_deadline_us < deadline_us) {
+            deadline_us = s->confirm_deadline_us;
+        }
+
+        esp_err_t rx = read_frame(&s->rx, deadline_us);
+        if (rx == ESP_ERR_TIMEOUT) {
+            if (s->confirm_deadline_us > 0 && esp_timer_get_time() < idle_deadline_us) {
+                /* Host never arrived at the new rate: back to the console rate */
+                uart_set_baudrate(PROV_PORT, CONFIG_ESP_CONSOLE_UART_BAUDRATE);
+                s->baud = CONFIG_ESP_CONSOLE_UART_BAUDRATE;
+                s->confirm_deadline_us = 0;
+                continue;
+            }
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+
+        if (rx != ESP_OK) {
+            bad_frames++;
+            s->out_len = 0;
+            send_reply(s, FRAME_NAK, 0, rx);
+            s->has_last = false;
+            continue;
+        }
+
+        frames++;
+        s->confirm_deadline_us = 0;
+        idle_deadline_us = esp_timer_get_time() + (int64_t)PROV_UART_IDLE_TIMEOUT_MS * 1000;
+        handle_frame(s);
+    }
+
+    uart_wait_tx_done(PROV_PORT, pdMS_TO_TICKS(100));
+    if (s->baud != CONFIG_ESP_CONSOLE_UART_BAUDRATE) {
+        uart_set_baudrate(PROV_PORT, CONFIG_ESP_CONSOLE_UART_BAUDRATE);
+    }
+
+    esp_log_set_vprintf(previous_vprintf);
+    ESP_LOGI(TAG, "[PROV] Session ended: %s (%lu frames, %lu damaged)",
+             esp_err_to_name(ret), frames, bad_frames);
+
+    bool reboot = s->reboot;
+    clear_blobs(s);
+    free(s);
+
+    if (reboot) {
+        ESP_LOGI(TAG, "[PROV] Rebooting");
+        vTaskDelay(pdMS_TO_TICKS(100));
+        esp_restart();
+    }
+
+    return ret;
+}
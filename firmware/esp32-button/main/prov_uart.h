@@ -0,0 +1,53 @@
+/**
+ * SafeSignal Binary UART Provisioning
+ *
+ * Framed protocol for factory provisioning over the console UART, entered
+ * with the `provision_binary` console command (scripts/provision_factory.py):
+ *
+ *   frame:   0xA5 0x5A | type u8 | seq u8 | len u16 | payload | crc32
+ *   crc32:   IEEE (zlib.crc32) over type..payload; all integers little endian
+ *   reply:   type | 0x80, same seq, payload = status i32 (esp_err_t) + data
+ *
+ * Requests:
+ *   HELLO  version u8, baud u32    -> version u8, max payload u16, baud u32,
+ *                                     MAC 6 bytes, firmware version
+ *   SET    field u8, value         -> stage a configuration field
+ *   BEGIN  slot u8, size u32, crc32 of the whole blob (PEM certificate or key)
+ *   DATA   offset u32, bytes       -> sequential chunks; resent chunks are acked
+ *   END    slot u8                 -> size and crc checked
+ *   COMMIT flags u8                -> provision_apply_batch(), one bank switch
+ *   GET    field u8                -> stored value (not the WiFi password)
+ *   EXIT   flags u8                -> back to the console (bit 0: reboot)
+ *
+ * A frame that fails its CRC is answered with NAK (0xFF); the host resends.
+ * A resent frame (same type and seq) gets the previous reply again without
+ * being re-applied. HELLO switches to the requested baud rate (capped at
+ * PROV_UART_MAX_BAUD) after replying; without a valid frame at the new rate
+ * within PROV_UART_BAUD_CONFIRM_MS the device falls back to the console rate.
+ * Logging is muted while the session runs. Nothing is written to NVS before
+ * COMMIT.
+ */
+
+#ifndef SAFESIGNAL_PROV_UART_H
+#define SAFESIGNAL_PROV_UART_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define PROV_UART_RX_BUFFER_SIZE 2048   /* Console UART driver: two full frames */
+
+/**
+ * @brief Run a binary provisioning session on the console UART
+ *
+ * Blocks the calling (console) task until EXIT, or until no frame arrived
+ * for PROV_UART_IDLE_TIMEOUT_MS. Staged values that were not committed are
+ * discarded. The console baud rate and logging are restored on return.
+ *
+ * @return
+ *  - ESP_OK after EXIT
+ *  - ESP_ERR_TIMEOUT if the host went silent
+ *  - ESP_ERR_NO_MEM if the session buffers could not be allocated
+ */
+esp_err_t prov_uart_run(void);
+
+#endif /* SAFESIGNAL_PROV_UART_H */
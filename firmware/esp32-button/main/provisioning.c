@@ -1,15 +1,723 @@
 #include "provisioning.h"
+#include "config.h"
+#include "flash_stats.h"
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
 
 static const char *TAG = "PROVISION";
 
-/* NVS handle for provisioning namespace */
+/* NVS handles (opened once in provision_init): root_handle holds the bank
+ * pointer, nvs_handle the active bank. Devices provisioned before banks
+ * existed keep their data in the root namespace until the first commit. */
+static nvs_handle_t root_handle;
 static nvs_handle_t nvs_handle;
+static int active_bank = -1;                   /* -1: legacy layout in root_handle */
 static bool nvs_initialized = false;
 
+static const char *bank_names[2] = { PROVISION_BANK_A, PROVISION_BANK_B };
+
+/* Snapshot keys: configuration strings are cached, certificates only sized
+ * (read on demand rather than holding them in RAM) */
+typedef struct {
+    const char *key;
+    size_t offset;              /* In device_config_t */
+    size_t len;                 /* Cached buffer size, 0 for size only */
+    bool blob;                  /* Stored with nvs_set_blob */
+} snap_key_t;
+
+static const snap_key_t snap_keys[] = {
+    { PROVISION_KEY_WIFI_SSID,   offsetof(device_config_t, wifi_ssid),     MAX_WIFI_SSID_LEN },
+    { PROVISION_KEY_WIFI_PASS,   offsetof(device_config_t, wifi_password), MAX_WIFI_PASS_LEN },
+    { PROVISION_KEY_DEVICE_ID,   offsetof(device_config_t, device_id),     MAX_DEVICE_ID_LEN },
+    { PROVISION_KEY_TENANT_ID,   offsetof(device_config_t, tenant_id),     MAX_TENANT_ID_LEN },
+    { PROVISION_KEY_BUILDING_ID, offsetof(device_config_t, building_id),   MAX_BUILDING_ID_LEN },
+    { PROVISION_KEY_ROOM_ID,     offsetof(device_config_t, room_id),       MAX_ROOM_ID_LEN },
+    { PROVISION_KEY_CA_DER,      0, 0, true },
+    { PROVISION_KEY_CLIENT_DER,  0, 0, true },
+    { PROVISION_KEY_KEY_DER,     0, 0, true },
+};
+
+/* Certificate slots: DER blob, and the PEM string older firmware stored */
+static const char *cert_der_keys[PROVISION_CERT_COUNT] = {
+    PROVISION_KEY_CA_DER, PROVISION_KEY_CLIENT_DER, PROVISION_KEY_KEY_DER
+};
+static const char *cert_pem_keys[PROVISION_CERT_COUNT] = {
+    PROVISION_KEY_CA_CERT, PROVISION_KEY_CLIENT_CERT, PROVISION_KEY_CLIENT_KEY
+};
+
+#define SNAP_KEY_COUNT (sizeof(snap_keys) / sizeof(snap_keys[0]))
+#define CONFIG_KEY_COUNT 6      /* Leading snap_keys: the device_config_t fields */
+
+/* Decrypted copy of the namespace. Every write bumps generation; the
+ * snapshot is re-read on the next access when it no longer matches. */
+typedef struct {
+    uint32_t generation;
+    bool provisioned;
+    size_t sizes[SNAP_KEY_COUNT];   /* Stored size incl. NUL, 0 if absent */
+    device_config_t config;
+} snapshot_t;
+
+static SemaphoreHandle_t prov_lock = NULL;     /* Owns snapshot, generation and stage */
+static snapshot_t snapshot;
+static uint32_t generation = 1;                /* snapshot.generation 0: never loaded */
+
+/* Staging session: values go to the inactive bank, which becomes active
+ * with one pointer write at commit */
+typedef struct {
+    bool open;
+    int bank;
+    nvs_handle_t handle;
+    uint32_t staged;            /* Bit per snap_keys entry written this session */
+    size_t bytes;
+} stage_t;
+
+static stage_t stage;
+
+/* Helper: Re-read the snapshot if a write invalidated it (caller holds prov_lock) */
+static esp_err_t snapshot_refresh_locked(void)
+{
+    if (snapshot.generation == generation) {
+        return ESP_OK;
+    }
+
+    snapshot_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+
+    uint8_t provisioned = 0;
+    esp_err_t ret = nvs_get_u8(nvs_handle, PROVISION_KEY_PROVISIONED, &provisioned);
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+        return ret;
+    }
+    fresh.provisioned = (provisioned == 1);
+
+    for (size_t i = 0; i < SNAP_KEY_COUNT; i++) {
+        size_t size = 0;
+
+        ret = snap_keys[i].blob ? nvs_get_blob(nvs_handle, snap_keys[i].key, NULL, &size)
+                                : nvs_get_str(nvs_handle, snap_keys[i].key, NULL, &size);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            continue;
+        }
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        fresh.sizes[i] = size;
+
+        /* Values longer than the config field are read on demand */
+        if (snap_keys[i].len > 0 && size <= snap_keys[i].len) {
+            char *field = (char *)&fresh.config + snap_keys[i].offset;
+            ret = nvs_get_str(nvs_handle, snap_keys[i].key, field, &size);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+    }
+
+    fresh.generation = generation;
+    memcpy(&snapshot, &fresh, sizeof(snapshot));
+    return ESP_OK;
+}
+
+/* Helper: Snapshot index of a key, -1 if not cached */
+static int snapshot_index(const char *key)
+{
+    for (size_t i = 0; i < SNAP_KEY_COUNT; i++) {
+        if (strcmp(snap_keys[i].key, key) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Helper: Read a string straight from NVS (caller holds prov_lock) */
+static esp_err_t read_string_locked(const char *key, char *value, size_t max_len)
+{
+    size_t required_size = 0;
+
+    /* Get required size first */
+    esp_err_t ret = nvs_get_str(nvs_handle, key, NULL, &required_size);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (required_size > max_len) {
+        ESP_LOGE(TAG, "Buffer too small for %s: need %zu, have %zu", key, required_size, max_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t actual_size = max_len;
+    return nvs_get_str(nvs_handle, key, value, &actual_size);
+}
+
+/* Helper: Read a string into a new heap buffer (caller holds prov_lock) */
+static esp_err_t read_alloc_locked(nvs_handle_t handle, const char *key, char **out)
+{
+    size_t required_size = 0;
+
+    esp_err_t ret = nvs_get_str(handle, key, NULL, &required_size);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    *out = malloc(required_size);
+    if (*out == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ret = nvs_get_str(handle, key, *out, &required_size);
+    if (ret != ESP_OK) {
+        free(*out);
+        *out = NULL;
+    }
+    return ret;
+}
+
+/* Helper: Read a blob into a new heap buffer (caller holds prov_lock) */
+static esp_err_t read_blob_alloc_locked(nvs_handle_t handle, const char *key, uint8_t **out, size_t *out_len)
+{
+    size_t required_size = 0;
+
+    esp_err_t ret = nvs_get_blob(handle, key, NULL, &required_size);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    *out = malloc(required_size);
+    if (*out == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ret = nvs_get_blob(handle, key, *out, &required_size);
+    if (ret != ESP_OK) {
+        free(*out);
+        *out = NULL;
+        return ret;
+    }
+
+    *out_len = required_size;
+    return ESP_OK;
+}
+
+/* Helper: RNG for mbedTLS key parsing */
+static int pem_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+/* Helper: Maximum PEM input for a slot */
+static size_t pem_limit(provision_cert_t which)
+{
+    switch (which) {
+    case PROVISION_CERT_CLIENT:
+        return PROVISION_ALLOW_RSA_KEYS ? MAX_CERT_LEN : MAX_CLIENT_CERT_LEN;
+    case PROVISION_CERT_KEY:
+        return PROVISION_ALLOW_RSA_KEYS ? MAX_KEY_LEN_RSA : MAX_KEY_LEN;
+    default:
+        return MAX_CERT_LEN;
+    }
+}
+
+/* Helper: Check a client key against the device identity profile (ECDSA P-256) */
+static esp_err_t check_key_profile(const mbedtls_pk_context *pk, const char *what)
+{
+    mbedtls_pk_type_t type = mbedtls_pk_get_type(pk);
+
+    if (type == MBEDTLS_PK_ECKEY || type == MBEDTLS_PK_ECDSA) {
+        if (mbedtls_pk_ec(*pk)->MBEDTLS_PRIVATE(grp).id == MBEDTLS_ECP_DP_SECP256R1) {
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "%s: unsupported curve (use P-256)", what);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (type == MBEDTLS_PK_RSA && PROVISION_ALLOW_RSA_KEYS) {
+        ESP_LOGW(TAG, "%s: RSA-%u, handshakes will be slow (reissue as P-256)",
+                 what, (unsigned)mbedtls_pk_get_bitlen(pk));
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "%s: %s keys not accepted (use P-256)", what, mbedtls_pk_get_name(pk));
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+/* Helper: Parse PEM and return its DER encoding in a new heap buffer
+ * (check_profile: reject client keys outside the identity profile) */
+static esp_err_t pem_to_der(provision_cert_t which, const char *pem, bool check_profile,
+                            uint8_t **out, size_t *out_len)
+{
+    size_t pem_len = strlen(pem) + 1;   /* mbedTLS recognizes PEM by the terminating NUL */
+    uint8_t *der = NULL;
+    size_t der_len = 0;
+    esp_err_t profile = ESP_OK;
+    int rc;
+
+    if (which == PROVISION_CERT_KEY) {
+        mbedtls_pk_context pk;
+        mbedtls_pk_init(&pk);
+
+        rc = mbedtls_pk_parse_key(&pk, (const unsigned char *)pem, pem_len, NULL, 0, pem_rng, NULL);
+        if (rc == 0 && check_profile && (profile = check_key_profile(&pk, "Client key")) != ESP_OK) {
+            mbedtls_pk_free(&pk);
+            return profile;
+        }
+
+        /* P-256 DER is ~120 bytes; legacy RSA keys need the larger buffer */
+        size_t buf_len = mbedtls_pk_get_type(&pk) == MBEDTLS_PK_RSA ? MAX_KEY_LEN_RSA : MAX_KEY_LEN;
+        if (rc == 0 && (der = malloc(buf_len)) != NULL) {
+            /* Written at the end of the buffer */
+            rc = mbedtls_pk_write_key_der(&pk, der, buf_len);
+            if (rc > 0) {
+                der_len = (size_t)rc;
+                memmove(der, der + buf_len - der_len, der_len);
+                rc = 0;
+            }
+        }
+        mbedtls_pk_free(&pk);
+    } else {
+        mbedtls_x509_crt crt;
+        mbedtls_x509_crt_init(&crt);
+
+        /* > 0: some certificates of the bundle did not parse */
+        rc = mbedtls_x509_crt_parse(&crt, (const unsigned char *)pem, pem_len);
+        if (rc == 0 && which == PROVISION_CERT_CLIENT && check_profile) {
+            profile = check_key_profile(&crt.pk, "Client certificate");
+        }
+        if (rc == 0 && profile == ESP_OK) {
+            for (const mbedtls_x509_crt *c = &crt; c != NULL && c->raw.len > 0; c = c->next) {
+                der_len += c->raw.len;
+                if (which == PROVISION_CERT_CLIENT) {
+                    if (c->next != NULL && c->next->raw.len > 0) {
+                        ESP_LOGW(TAG, "Client certificate chain: keeping the leaf only");
+                    }
+                    break;
+                }
+            }
+
+            der = malloc(der_len);
+            size_t offset = 0;
+            for (const mbedtls_x509_crt *c = &crt; der != NULL && offset < der_len; c = c->next) {
+                memcpy(der + offset, c->raw.p, c->raw.len);
+                offset += c->raw.len;
+            }
+        }
+        mbedtls_x509_crt_free(&crt);
+        if (profile != ESP_OK) {
+            return profile;
+        }
+    }
+
+    if (rc != 0) {
+        free(der);
+        ESP_LOGE(TAG, "Failed to parse %s: mbedTLS error -0x%04x", cert_pem_keys[which], (unsigned)-rc);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (der == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    *out = der;
+    *out_len = der_len;
+    return ESP_OK;
+}
+
+/* Helper: Set DER for a slot and drop its legacy PEM value, no commit (caller holds prov_lock) */
+static esp_err_t set_der_locked(provision_cert_t which, const uint8_t *der, size_t der_len)
+{
+    esp_err_t ret = nvs_set_blob(nvs_handle, cert_der_keys[which], der, der_len);
+    if (ret == ESP_OK) {
+        ret = nvs_erase_key(nvs_handle, cert_pem_keys[which]);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            ret = ESP_OK;
+        }
+    }
+    return ret;
+}
+
+/* Helper: Store DER for a slot and commit (caller holds prov_lock) */
+static esp_err_t write_der_locked(provision_cert_t which, const uint8_t *der, size_t der_len)
+{
+    esp_err_t ret = set_der_locked(which, der, der_len);
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs_handle);
+    }
+    generation++;
+    flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, der_len, ret);
+    return ret;
+}
+
+/* Helper: Read DER for a slot from the active bank, converting a legacy PEM
+ * value (caller holds prov_lock; *converted is set when it came from PEM) */
+static esp_err_t read_der_locked(provision_cert_t which, uint8_t **out, size_t *out_len, bool *converted)
+{
+    *converted = false;
+
+    esp_err_t ret = read_blob_alloc_locked(nvs_handle, cert_der_keys[which], out, out_len);
+    if (ret != ESP_ERR_NVS_NOT_FOUND) {
+        return ret;
+    }
+
+    char *pem = NULL;
+    ret = read_alloc_locked(nvs_handle, cert_pem_keys[which], &pem);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Stored by older firmware: keep whatever key type it is */
+    ret = pem_to_der(which, pem, false, out, out_len);
+    free(pem);
+    *converted = (ret == ESP_OK);
+    return ret;
+}
+
+/* Helper: Load DER for a slot, converting a legacy PEM value on the way (caller holds prov_lock) */
+static esp_err_t load_der_locked(provision_cert_t which, uint8_t **out, size_t *out_len)
+{
+    bool converted = false;
+
+    esp_err_t ret = read_der_locked(which, out, out_len, &converted);
+    if (ret == ESP_OK && converted && write_der_locked(which, *out, *out_len) == ESP_OK) {
+        ESP_LOGI(TAG, "Migrated %s to DER (%zu bytes)", cert_pem_keys[which], *out_len);
+    }
+    return ret;
+}
+
+/* Helper: Free DER buffers, wiping the private key */
+static void free_der(uint8_t *der[PROVISION_CERT_COUNT], const size_t der_len[PROVISION_CERT_COUNT])
+{
+    for (int i = 0; i < PROVISION_CERT_COUNT; i++) {
+        if (der[i] != NULL && i == PROVISION_CERT_KEY) {
+            memset(der[i], 0, der_len[i]);
+        }
+        free(der[i]);
+        der[i] = NULL;
+    }
+}
+
+/* Helper: Parse every non-NULL PEM input before anything is staged */
+static esp_err_t parse_pems(const char *const pem[PROVISION_CERT_COUNT],
+                            uint8_t *der[PROVISION_CERT_COUNT], size_t der_len[PROVISION_CERT_COUNT])
+{
+    esp_err_t ret = ESP_OK;
+
+    for (int i = 0; ret == ESP_OK && i < PROVISION_CERT_COUNT; i++) {
+        if (pem[i] == NULL) {
+            continue;
+        }
+        if (strlen(pem[i]) >= pem_limit(i)) {
+            ESP_LOGE(TAG, "%s exceeds maximum length (%zu bytes)", cert_der_keys[i], pem_limit(i));
+            ret = ESP_ERR_INVALID_SIZE;
+        } else {
+            ret = pem_to_der(i, pem[i], true, &der[i], &der_len[i]);
+        }
+    }
+
+    if (ret != ESP_OK) {
+        free_der(der, der_len);
+    }
+    return ret;
+}
+
+/* Helper: Drop data keys the legacy layout left in the root namespace (caller holds prov_lock) */
+static void erase_legacy_locked(void)
+{
+    bool erased = false;
+
+    for (size_t i = 0; i < SNAP_KEY_COUNT; i++) {
+        erased |= nvs_erase_key(root_handle, snap_keys[i].key) == ESP_OK;
+    }
+    for (int i = 0; i < PROVISION_CERT_COUNT; i++) {
+        erased |= nvs_erase_key(root_handle, cert_pem_keys[i]) == ESP_OK;
+    }
+    erased |= nvs_erase_key(root_handle, PROVISION_KEY_PROVISIONED) == ESP_OK;
+
+    if (erased) {
+        esp_err_t ret = nvs_commit(root_handle);
+        flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, 0, ret);
+        ESP_LOGI(TAG, "Removed legacy provisioning keys from '%s'", PROVISION_NAMESPACE);
+    }
+}
+
+/* Helper: Open a session on the inactive bank (caller holds prov_lock) */
+static esp_err_t stage_begin_locked(void)
+{
+    if (stage.open) {
+        ESP_LOGE(TAG, "A staging session is already open");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int bank = (active_bank == 0) ? 1 : 0;
+    nvs_handle_t handle;
+
+    esp_err_t ret = nvs_open(bank_names[bank], NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open %s: %s", bank_names[bank], esp_err_to_name(ret));
+        return ret;
+    }
+
+    /* Leftovers of a session that was aborted or cut off by a reset */
+    ret = nvs_erase_all(handle);
+    if (ret != ESP_OK) {
+        nvs_close(handle);
+        return ret;
+    }
+
+    memset(&stage, 0, sizeof(stage));
+    stage.open = true;
+    stage.bank = bank;
+    stage.handle = handle;
+    return ESP_OK;
+}
+
+/* Helper: Discard the session; the active bank was never touched (caller holds prov_lock) */
+static void stage_abort_locked(void)
+{
+    if (!stage.open) {
+        return;
+    }
+
+    if (nvs_erase_all(stage.handle) == ESP_OK) {
+        nvs_commit(stage.handle);
+    }
+    nvs_close(stage.handle);
+    memset(&stage, 0, sizeof(stage));
+}
+
+/* Helper: Stage one configuration string (caller holds prov_lock) */
+static esp_err_t stage_string_locked(const char *key, const char *value)
+{
+    int index = snapshot_index(key);
+
+    if (index < 0 || index >= CONFIG_KEY_COUNT) {
+        ESP_LOGE(TAG, "%s is not a configuration key", key);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(value) >= snap_keys[index].len) {
+        ESP_LOGE(TAG, "%s exceeds maximum length (%zu bytes)", key, snap_keys[index].len - 1);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t ret = nvs_set_str(stage.handle, key, value);
+    flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, strlen(value) + 1, ret);
+    if (ret == ESP_OK) {
+        stage.staged |= 1u << index;
+        stage.bytes += strlen(value) + 1;
+    }
+    return ret;
+}
+
+/* Helper: Stage one DER blob (caller holds prov_lock) */
+static esp_err_t stage_der_locked(provision_cert_t which, const uint8_t *der, size_t der_len)
+{
+    esp_err_t ret = nvs_set_blob(stage.handle, cert_der_keys[which], der, der_len);
+    flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, der_len, ret);
+    if (ret == ESP_OK) {
+        stage.staged |= 1u << (CONFIG_KEY_COUNT + which);
+        stage.bytes += der_len;
+    }
+    return ret;
+}
+
+/* Helper: Copy a value this session did not stage from the active bank (caller holds prov_lock) */
+static esp_err_t stage_carry_over_locked(size_t index)
+{
+    esp_err_t ret;
+
+    if (!snap_keys[index].blob) {
+        char *value = NULL;
+        ret = read_alloc_locked(nvs_handle, snap_keys[index].key, &value);
+        if (ret == ESP_OK) {
+            ret = nvs_set_str(stage.handle, snap_keys[index].key, value);
+            flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, strlen(value) + 1, ret);
+            stage.bytes += strlen(value) + 1;
+            memset(value, 0, strlen(value));        /* May be the WiFi password */
+            free(value);
+        }
+    } else {
+        provision_cert_t which = (provision_cert_t)(index - CONFIG_KEY_COUNT);
+        uint8_t *der = NULL;
+        size_t der_len = 0;
+        bool converted = false;
+
+        /* A legacy PEM value is carried over as DER */
+        ret = read_der_locked(which, &der, &der_len, &converted);
+        if (ret == ESP_OK) {
+            ret = nvs_set_blob(stage.handle, cert_der_keys[which], der, der_len);
+            flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, der_len, ret);
+            stage.bytes += der_len;
+            memset(der, 0, der_len);
+            free(der);
+        }
+    }
+
+    return ret == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : ret;
+}
+
+/* Helper: Check that a staged client certificate and key belong together (caller holds prov_lock) */
+static esp_err_t stage_check_pair_locked(void)
+{
+    uint8_t *der[PROVISION_CERT_COUNT] = {0};
+    size_t der_len[PROVISION_CERT_COUNT] = {0};
+    esp_err_t ret;
+
+    esp_err_t crt_ret = read_blob_alloc_locked(stage.handle, PROVISION_KEY_CLIENT_DER,
+                                               &der[PROVISION_CERT_CLIENT], &der_len[PROVISION_CERT_CLIENT]);
+    esp_err_t key_ret = read_blob_alloc_locked(stage.handle, PROVISION_KEY_KEY_DER,
+                                               &der[PROVISION_CERT_KEY], &der_len[PROVISION_CERT_KEY]);
+
+    if (crt_ret == ESP_ERR_NVS_NOT_FOUND && key_ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = ESP_OK;       /* No device identity: the embedded one is used */
+    } else if (crt_ret != ESP_OK && crt_ret != ESP_ERR_NVS_NOT_FOUND) {
+        ret = crt_ret;
+    } else if (key_ret != ESP_OK && key_ret != ESP_ERR_NVS_NOT_FOUND) {
+        ret = key_ret;
+    } else if (crt_ret != ESP_OK || key_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Client certificate and key must be provisioned together");
+        ret = ESP_ERR_INVALID_ARG;
+    } else {
+        mbedtls_x509_crt crt;
+        mbedtls_pk_context key;
+        mbedtls_x509_crt_init(&crt);
+        mbedtls_pk_init(&key);
+
+        int rc = mbedtls_x509_crt_parse_der(&crt, der[PROVISION_CERT_CLIENT], der_len[PROVISION_CERT_CLIENT]);
+        if (rc == 0) {
+            rc = mbedtls_pk_parse_key(&key, der[PROVISION_CERT_KEY], der_len[PROVISION_CERT_KEY],
+                                      NULL, 0, pem_rng, NULL);
+        }
+        if (rc == 0) {
+            rc = mbedtls_pk_check_pair(&crt.pk, &key, pem_rng, NULL);
+        }
+        mbedtls_pk_free(&key);
+        mbedtls_x509_crt_free(&crt);
+
+        if (rc != 0) {
+            ESP_LOGE(TAG, "Client certificate does not match the key: mbedTLS error -0x%04x", (unsigned)-rc);
+            ret = ESP_ERR_INVALID_ARG;
+        } else {
+            ret = ESP_OK;
+        }
+    }
+
+    free_der(der, der_len);
+    return ret;
+}
+
+/* Helper: Validate the staged bank and make it the active one (caller holds prov_lock) */
+static esp_err_t stage_commit_locked(bool mark_provisioned)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t provisioned = mark_provisioned ? 1 : 0;
+
+    if (!stage.open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (size_t i = 0; ret == ESP_OK && i < SNAP_KEY_COUNT; i++) {
+        if ((stage.staged & (1u << i)) == 0) {
+            ret = stage_carry_over_locked(i);
+        }
+    }
+    if (ret == ESP_OK && !mark_provisioned) {
+        ret = nvs_get_u8(nvs_handle, PROVISION_KEY_PROVISIONED, &provisioned);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            ret = ESP_OK;
+        }
+    }
+
+    /* A provisioned device needs WiFi and an identity */
+    if (ret == ESP_OK && provisioned == 1) {
+        size_t ssid_size = 0;
+        size_t id_size = 0;
+        nvs_get_str(stage.handle, PROVISION_KEY_WIFI_SSID, NULL, &ssid_size);
+        nvs_get_str(stage.handle, PROVISION_KEY_DEVICE_ID, NULL, &id_size);
+        if (ssid_size <= 1 || id_size <= 1) {
+            ESP_LOGE(TAG, "WiFi SSID and Device ID are required");
+            ret = ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = stage_check_pair_locked();
+    }
+    if (ret == ESP_OK && provisioned == 1) {
+        ret = nvs_set_u8(stage.handle, PROVISION_KEY_PROVISIONED, 1);
+        flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, 1, ret);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(stage.handle);
+    }
+
+    /* The switch itself: a single u8 entry, written whole or not at all */
+    if (ret == ESP_OK) {
+        ret = nvs_set_u8(root_handle, PROVISION_KEY_BANK, (uint8_t)stage.bank);
+        if (ret == ESP_OK) {
+            ret = nvs_commit(root_handle);
+        }
+        flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, 1, ret);
+    }
+
+    if (ret != ESP_OK) {
+        stage_abort_locked();
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Switched to %s (%zu bytes written)", bank_names[stage.bank], stage.bytes);
+
+    nvs_handle_t old_handle = nvs_handle;
+    int old_bank = active_bank;
+
+    nvs_handle = stage.handle;
+    active_bank = stage.bank;
+    memset(&stage, 0, sizeof(stage));
+    generation++;
+
+    /* The old copy is unreachable now; drop it so the credentials do not linger */
+    if (old_bank < 0) {
+        erase_legacy_locked();
+    } else {
+        if (nvs_erase_all(old_handle) == ESP_OK) {
+            nvs_commit(old_handle);
+        }
+        nvs_close(old_handle);
+    }
+
+    return ESP_OK;
+}
+
+/* Helper: Stage the given values and commit them as one transaction (caller holds prov_lock) */
+static esp_err_t apply_locked(const device_config_t *config, uint8_t *const der[PROVISION_CERT_COUNT],
+                              const size_t der_len[PROVISION_CERT_COUNT], bool mark_provisioned)
+{
+    esp_err_t ret = stage_begin_locked();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (size_t i = 0; ret == ESP_OK && config != NULL && i < CONFIG_KEY_COUNT; i++) {
+        ret = stage_string_locked(snap_keys[i].key, (const char *)config + snap_keys[i].offset);
+    }
+    for (int i = 0; ret == ESP_OK && der != NULL && i < PROVISION_CERT_COUNT; i++) {
+        if (der[i] != NULL) {
+            ret = stage_der_locked(i, der[i], der_len[i]);
+        }
+    }
+
+    if (ret != ESP_OK) {
+        stage_abort_locked();
+        return ret;
+    }
+    return stage_commit_locked(mark_provisioned);
+}
+
 esp_err_t provision_init(void)
 {
     esp_err_t ret;
@@ -62,57 +770,113 @@ esp_err_t provision_init(void)
         return ret;
     }
 
+    ret = nvs_open(PROVISION_NAMESPACE, NVS_READWRITE, &root_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    /* Follow the bank pointer; without one the data is in the root namespace */
+    uint8_t bank = 0;
+    nvs_handle = root_handle;
+    ret = nvs_get_u8(root_handle, PROVISION_KEY_BANK, &bank);
+    if (ret == ESP_OK && bank < 2) {
+        ret = nvs_open(bank_names[bank], NVS_READWRITE, &nvs_handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open %s: %s", bank_names[bank], esp_err_to_name(ret));
+            nvs_close(root_handle);
+            return ret;
+        }
+        active_bank = bank;
+    } else if (ret == ESP_OK) {
+        ESP_LOGW(TAG, "Invalid bank pointer %u, using the root namespace", bank);
+    }
+
+    prov_lock = xSemaphoreCreateMutex();
+    if (prov_lock == NULL) {
+        if (active_bank >= 0) {
+            nvs_close(nvs_handle);
+        }
+        nvs_close(root_handle);
+        return ESP_ERR_NO_MEM;
+    }
+
     nvs_initialized = true;
-    ESP_LOGI(TAG, "Provisioning system initialized (NVS encryption ENABLED via secure API)");
+    ESP_LOGI(TAG, "Provisioning system initialized (NVS encryption ENABLED via secure API, bank %s)",
+             active_bank >= 0 ? bank_names[active_bank] : PROVISION_NAMESPACE);
+
+    /* Decrypt everything once; later reads are served from RAM */
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    if (active_bank >= 0) {
+        erase_legacy_locked();      /* A reset right after the first bank switch */
+    }
+    esp_err_t snap_ret = snapshot_refresh_locked();
+    xSemaphoreGive(prov_lock);
+    if (snap_ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to load provisioning snapshot: %s", esp_err_to_name(snap_ret));
+    }
 
     return ESP_OK;
 }
 
 bool provision_is_provisioned(void)
 {
-    nvs_handle_t handle;
-    esp_err_t ret;
-    uint8_t provisioned = 0;
+    bool provisioned = false;
 
     if (!nvs_initialized) {
         ESP_LOGE(TAG, "Provisioning not initialized");
         return false;
     }
 
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READONLY, &handle);
-    if (ret != ESP_OK) {
-        return false;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    if (snapshot_refresh_locked() == ESP_OK) {
+        provisioned = snapshot.provisioned;
     }
+    xSemaphoreGive(prov_lock);
 
-    ret = nvs_get_u8(handle, PROVISION_KEY_PROVISIONED, &provisioned);
-    nvs_close(handle);
-
-    return (ret == ESP_OK && provisioned == 1);
+    return provisioned;
 }
 
-esp_err_t provision_mark_provisioned(void)
+bool provision_has_key(const char *key)
 {
-    nvs_handle_t handle;
-    esp_err_t ret;
-    uint8_t provisioned = 1;
+    bool present = false;
 
-    if (!nvs_initialized) {
-        ESP_LOGE(TAG, "Provisioning not initialized");
-        return ESP_ERR_INVALID_STATE;
+    if (key == NULL || !nvs_initialized) {
+        return false;
     }
 
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READWRITE, &handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
-        return ret;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    int index = snapshot_index(key);
+    if (index >= 0 && snapshot_refresh_locked() == ESP_OK) {
+        present = snapshot.sizes[index] > 0;
+    } else {
+        size_t size = 0;
+        present = nvs_get_str(nvs_handle, key, NULL, &size) == ESP_OK ||
+                  nvs_get_blob(nvs_handle, key, NULL, &size) == ESP_OK;
     }
+    xSemaphoreGive(prov_lock);
+
+    return present;
+}
+
+uint32_t provision_get_generation(void)
+{
+    return generation;
+}
+
+esp_err_t provision_mark_provisioned(void)
+{
+    esp_err_t ret;
 
-    ret = nvs_set_u8(handle, PROVISION_KEY_PROVISIONED, provisioned);
-    if (ret == ESP_OK) {
-        ret = nvs_commit(handle);
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    nvs_close(handle);
+    /* Same checks as any commit: required fields, certificate and key pairing */
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = apply_locked(NULL, NULL, NULL, true);
+    xSemaphoreGive(prov_lock);
 
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Device marked as provisioned");
@@ -125,7 +889,6 @@ esp_err_t provision_mark_provisioned(void)
 
 esp_err_t provision_set_string(const char *key, const char *value)
 {
-    nvs_handle_t handle;
     esp_err_t ret;
 
     if (key == NULL || value == NULL) {
@@ -137,18 +900,17 @@ esp_err_t provision_set_string(const char *key, const char *value)
         return ESP_ERR_INVALID_STATE;
     }
 
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READWRITE, &handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
-        return ret;
-    }
-
-    ret = nvs_set_str(handle, key, value);
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = stage_begin_locked();
     if (ret == ESP_OK) {
-        ret = nvs_commit(handle);
+        ret = stage_string_locked(key, value);
+        if (ret == ESP_OK) {
+            ret = stage_commit_locked(false);
+        } else {
+            stage_abort_locked();
+        }
     }
-
-    nvs_close(handle);
+    xSemaphoreGive(prov_lock);
 
     if (ret == ESP_OK) {
         ESP_LOGD(TAG, "Saved: %s", key);
@@ -161,9 +923,7 @@ esp_err_t provision_set_string(const char *key, const char *value)
 
 esp_err_t provision_get_string(const char *key, char *value, size_t max_len)
 {
-    nvs_handle_t handle;
     esp_err_t ret;
-    size_t required_size = 0;
 
     if (key == NULL || value == NULL) {
         return ESP_ERR_INVALID_ARG;
@@ -174,28 +934,23 @@ esp_err_t provision_get_string(const char *key, char *value, size_t max_len)
         return ESP_ERR_INVALID_STATE;
     }
 
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READONLY, &handle);
-    if (ret != ESP_OK) {
-        return ret;
-    }
-
-    /* Get required size first */
-    ret = nvs_get_str(handle, key, NULL, &required_size);
-    if (ret != ESP_OK) {
-        nvs_close(handle);
-        return ret;
-    }
-
-    if (required_size > max_len) {
-        nvs_close(handle);
-        ESP_LOGE(TAG, "Buffer too small for %s: need %zu, have %zu", key, required_size, max_len);
-        return ESP_ERR_INVALID_SIZE;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    int index = snapshot_index(key);
+
+    if (index < 0 || snapshot_refresh_locked() != ESP_OK) {
+        ret = read_string_locked(key, value, max_len);
+    } else if (snapshot.sizes[index] == 0) {
+        ret = ESP_ERR_NVS_NOT_FOUND;
+    } else if (snapshot.sizes[index] > max_len) {
+        ESP_LOGE(TAG, "Buffer too small for %s: need %zu, have %zu", key, snapshot.sizes[index], max_len);
+        ret = ESP_ERR_INVALID_SIZE;
+    } else if (snapshot.sizes[index] <= snap_keys[index].len) {
+        memcpy(value, (const char *)&snapshot.config + snap_keys[index].offset, snapshot.sizes[index]);
+        ret = ESP_OK;
+    } else {
+        ret = read_string_locked(key, value, max_len);     /* Certificate or oversized value */
     }
-
-    /* Read value */
-    size_t actual_size = max_len;
-    ret = nvs_get_str(handle, key, value, &actual_size);
-    nvs_close(handle);
+    xSemaphoreGive(prov_lock);
 
     if (ret == ESP_OK) {
         ESP_LOGD(TAG, "Loaded: %s", key);
@@ -220,24 +975,20 @@ esp_err_t provision_save_config(const device_config_t *config)
         return ESP_ERR_INVALID_ARG;
     }
 
-    /* Save each field */
-    ret = provision_set_string(PROVISION_KEY_WIFI_SSID, config->wifi_ssid);
-    if (ret != ESP_OK) return ret;
-
-    ret = provision_set_string(PROVISION_KEY_WIFI_PASS, config->wifi_password);
-    if (ret != ESP_OK) return ret;
-
-    ret = provision_set_string(PROVISION_KEY_DEVICE_ID, config->device_id);
-    if (ret != ESP_OK) return ret;
-
-    ret = provision_set_string(PROVISION_KEY_TENANT_ID, config->tenant_id);
-    if (ret != ESP_OK) return ret;
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    ret = provision_set_string(PROVISION_KEY_BUILDING_ID, config->building_id);
-    if (ret != ESP_OK) return ret;
+    /* All six fields switch over together */
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = apply_locked(config, NULL, NULL, false);
+    xSemaphoreGive(prov_lock);
 
-    ret = provision_set_string(PROVISION_KEY_ROOM_ID, config->room_id);
-    if (ret != ESP_OK) return ret;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save device configuration: %s", esp_err_to_name(ret));
+        return ret;
+    }
 
     ESP_LOGI(TAG, "Device configuration saved successfully");
     ESP_LOGI(TAG, "  Device ID: %s", config->device_id);
@@ -250,6 +1001,9 @@ esp_err_t provision_save_config(const device_config_t *config)
 
 esp_err_t provision_load_config(device_config_t *config)
 {
+    static const char *names[] = {
+        "WiFi SSID", "WiFi password", "Device ID", "Tenant ID", "Building ID", "Room ID"
+    };
     esp_err_t ret;
 
     if (config == NULL) {
@@ -258,82 +1012,159 @@ esp_err_t provision_load_config(device_config_t *config)
 
     memset(config, 0, sizeof(device_config_t));
 
-    ESP_LOGI(TAG, "Loading device configuration...");
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    /* Load each field */
-    ret = provision_get_string(PROVISION_KEY_WIFI_SSID, config->wifi_ssid, MAX_WIFI_SSID_LEN);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load WiFi SSID");
-        return ret;
+    /* All configuration keys come from the snapshot (first six snap_keys) */
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = snapshot_refresh_locked();
+    for (size_t i = 0; ret == ESP_OK && i < sizeof(names) / sizeof(names[0]); i++) {
+        if (snapshot.sizes[i] == 0) {
+            ret = ESP_ERR_NVS_NOT_FOUND;
+        } else if (snapshot.sizes[i] > snap_keys[i].len) {
+            ret = ESP_ERR_INVALID_SIZE;
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to load %s", names[i]);
+        }
     }
+    if (ret == ESP_OK) {
+        memcpy(config, &snapshot.config, sizeof(*config));
+    }
+    xSemaphoreGive(prov_lock);
 
-    ret = provision_get_string(PROVISION_KEY_WIFI_PASS, config->wifi_password, MAX_WIFI_PASS_LEN);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load WiFi password");
         return ret;
     }
 
-    ret = provision_get_string(PROVISION_KEY_DEVICE_ID, config->device_id, MAX_DEVICE_ID_LEN);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load Device ID");
-        return ret;
+    ESP_LOGI(TAG, "Device configuration loaded successfully");
+    ESP_LOGI(TAG, "  Device ID: %s", config->device_id);
+    ESP_LOGI(TAG, "  Tenant: %s", config->tenant_id);
+    ESP_LOGI(TAG, "  Building: %s", config->building_id);
+    ESP_LOGI(TAG, "  Room: %s", config->room_id);
+
+    return ESP_OK;
+}
+
+esp_err_t provision_set_certificate(provision_cert_t which, const char *pem)
+{
+    const char *pems[PROVISION_CERT_COUNT] = {0};
+    uint8_t *der[PROVISION_CERT_COUNT] = {0};
+    size_t der_len[PROVISION_CERT_COUNT] = {0};
+
+    if (which >= PROVISION_CERT_COUNT || pem == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    ret = provision_get_string(PROVISION_KEY_TENANT_ID, config->tenant_id, MAX_TENANT_ID_LEN);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load Tenant ID");
-        return ret;
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    ret = provision_get_string(PROVISION_KEY_BUILDING_ID, config->building_id, MAX_BUILDING_ID_LEN);
+    pems[which] = pem;
+    esp_err_t ret = parse_pems(pems, der, der_len);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load Building ID");
         return ret;
     }
 
-    ret = provision_get_string(PROVISION_KEY_ROOM_ID, config->room_id, MAX_ROOM_ID_LEN);
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = apply_locked(NULL, der, der_len, false);
+    xSemaphoreGive(prov_lock);
+    free_der(der, der_len);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Saved %s: %zu bytes DER (%zu bytes PEM)", cert_der_keys[which], der_len[which], strlen(pem));
+    } else {
+        ESP_LOGE(TAG, "Failed to save %s: %s", cert_der_keys[which], esp_err_to_name(ret));
+    }
+
+    return ret;
+}
+
+esp_err_t provision_apply_batch(const provision_batch_t *batch)
+{
+    uint8_t *der[PROVISION_CERT_COUNT] = {0};
+    size_t der_len[PROVISION_CERT_COUNT] = {0};
+    esp_err_t ret;
+
+    if (batch == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (strlen(batch->config.wifi_ssid) == 0 || strlen(batch->config.device_id) == 0) {
+        ESP_LOGE(TAG, "WiFi SSID and Device ID are required");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Parse everything before staging anything */
+    ret = parse_pems(batch->certs, der, der_len);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to load Room ID");
         return ret;
     }
 
-    ESP_LOGI(TAG, "Device configuration loaded successfully");
-    ESP_LOGI(TAG, "  Device ID: %s", config->device_id);
-    ESP_LOGI(TAG, "  Tenant: %s", config->tenant_id);
-    ESP_LOGI(TAG, "  Building: %s", config->building_id);
-    ESP_LOGI(TAG, "  Room: %s", config->room_id);
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = apply_locked(&batch->config, der, der_len, batch->mark_provisioned);
+    xSemaphoreGive(prov_lock);
+    free_der(der, der_len);
 
-    return ESP_OK;
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Batch applied for %s", batch->config.device_id);
+    } else {
+        ESP_LOGE(TAG, "Batch failed: %s", esp_err_to_name(ret));
+    }
+
+    return ret;
+}
+
+bool provision_has_certificate(provision_cert_t which)
+{
+    if (which >= PROVISION_CERT_COUNT) {
+        return false;
+    }
+    return provision_has_key(cert_der_keys[which]) || provision_has_key(cert_pem_keys[which]);
 }
 
 esp_err_t provision_save_certificates(const char *ca_cert,
                                        const char *client_cert,
                                        const char *client_key)
 {
+    const char *pems[PROVISION_CERT_COUNT] = { ca_cert, client_cert, client_key };
+    uint8_t *der[PROVISION_CERT_COUNT] = {0};
+    size_t der_len[PROVISION_CERT_COUNT] = {0};
     esp_err_t ret;
 
     if (ca_cert == NULL || client_cert == NULL || client_key == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    /* Validate certificate sizes */
-    if (strlen(ca_cert) >= MAX_CERT_LEN ||
-        strlen(client_cert) >= MAX_CERT_LEN ||
-        strlen(client_key) >= MAX_KEY_LEN) {
-        ESP_LOGE(TAG, "Certificate or key exceeds maximum length");
-        return ESP_ERR_INVALID_SIZE;
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
     ESP_LOGI(TAG, "Saving TLS certificates...");
 
-    ret = provision_set_string(PROVISION_KEY_CA_CERT, ca_cert);
-    if (ret != ESP_OK) return ret;
+    ret = parse_pems(pems, der, der_len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
 
-    ret = provision_set_string(PROVISION_KEY_CLIENT_CERT, client_cert);
-    if (ret != ESP_OK) return ret;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = apply_locked(NULL, der, der_len, false);
+    xSemaphoreGive(prov_lock);
+    free_der(der, der_len);
 
-    ret = provision_set_string(PROVISION_KEY_CLIENT_KEY, client_key);
-    if (ret != ESP_OK) return ret;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save TLS certificates: %s", esp_err_to_name(ret));
+        return ret;
+    }
 
     ESP_LOGI(TAG, "TLS certificates saved successfully");
 
@@ -343,8 +1174,6 @@ esp_err_t provision_save_certificates(const char *ca_cert,
 esp_err_t provision_load_certificates(device_certs_t *certs)
 {
     esp_err_t ret;
-    size_t required_size;
-    nvs_handle_t handle;
 
     if (certs == NULL) {
         return ESP_ERR_INVALID_ARG;
@@ -357,142 +1186,219 @@ esp_err_t provision_load_certificates(device_certs_t *certs)
         return ESP_ERR_INVALID_STATE;
     }
 
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READONLY, &handle);
-    if (ret != ESP_OK) {
-        return ret;
-    }
-
     ESP_LOGI(TAG, "Loading TLS certificates...");
 
-    /* Load CA certificate */
-    ret = nvs_get_str(handle, PROVISION_KEY_CA_CERT, NULL, &required_size);
-    if (ret != ESP_OK) {
-        nvs_close(handle);
-        return ret;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = load_der_locked(PROVISION_CERT_CA, &certs->ca_cert, &certs->ca_cert_len);
+    if (ret == ESP_OK) {
+        ret = load_der_locked(PROVISION_CERT_CLIENT, &certs->client_cert, &certs->client_cert_len);
     }
-
-    certs->ca_cert = malloc(required_size);
-    if (certs->ca_cert == NULL) {
-        nvs_close(handle);
-        return ESP_ERR_NO_MEM;
+    if (ret == ESP_OK) {
+        ret = load_der_locked(PROVISION_CERT_KEY, &certs->client_key, &certs->client_key_len);
     }
+    xSemaphoreGive(prov_lock);
 
-    ret = nvs_get_str(handle, PROVISION_KEY_CA_CERT, certs->ca_cert, &required_size);
     if (ret != ESP_OK) {
-        free(certs->ca_cert);
-        nvs_close(handle);
+        provision_free_certificates(certs);
         return ret;
     }
 
-    /* Load client certificate */
-    ret = nvs_get_str(handle, PROVISION_KEY_CLIENT_CERT, NULL, &required_size);
-    if (ret != ESP_OK) {
-        free(certs->ca_cert);
-        nvs_close(handle);
-        return ret;
+    ESP_LOGI(TAG, "TLS certificates loaded successfully");
+
+    return ESP_OK;
+}
+
+void provision_free_certificates(device_certs_t *certs)
+{
+    if (certs == NULL) {
+        return;
     }
 
-    certs->client_cert = malloc(required_size);
-    if (certs->client_cert == NULL) {
-        free(certs->ca_cert);
-        nvs_close(handle);
-        return ESP_ERR_NO_MEM;
+    free(certs->ca_cert);
+    free(certs->client_cert);
+    if (certs->client_key != NULL) {
+        memset(certs->client_key, 0, certs->client_key_len);    /* Private key */
+        free(certs->client_key);
     }
 
-    ret = nvs_get_str(handle, PROVISION_KEY_CLIENT_CERT, certs->client_cert, &required_size);
-    if (ret != ESP_OK) {
-        free(certs->ca_cert);
-        free(certs->client_cert);
-        nvs_close(handle);
-        return ret;
+    memset(certs, 0, sizeof(*certs));
+}
+
+esp_err_t provision_clear(void)
+{
+    esp_err_t ret;
+
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    /* Load client private key */
-    ret = nvs_get_str(handle, PROVISION_KEY_CLIENT_KEY, NULL, &required_size);
-    if (ret != ESP_OK) {
-        free(certs->ca_cert);
-        free(certs->client_cert);
-        nvs_close(handle);
-        return ret;
+    ESP_LOGW(TAG, "Clearing all provisioning data (factory reset)...");
+
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    stage_abort_locked();
+
+    /* Bank pointer and legacy keys first: from here on the device reads as blank */
+    ret = nvs_erase_all(root_handle);
+    if (ret == ESP_OK) {
+        ret = nvs_commit(root_handle);
+    }
+    if (ret == ESP_OK && active_bank >= 0) {
+        nvs_close(nvs_handle);
+        nvs_handle = root_handle;
+        active_bank = -1;
     }
 
-    certs->client_key = malloc(required_size);
-    if (certs->client_key == NULL) {
-        free(certs->ca_cert);
-        free(certs->client_cert);
-        nvs_close(handle);
-        return ESP_ERR_NO_MEM;
+    /* Both banks, whichever was active */
+    for (int i = 0; ret == ESP_OK && i < 2; i++) {
+        nvs_handle_t handle;
+        ret = nvs_open(bank_names[i], NVS_READWRITE, &handle);
+        if (ret == ESP_OK) {
+            ret = nvs_erase_all(handle);
+            if (ret == ESP_OK) {
+                ret = nvs_commit(handle);
+            }
+            nvs_close(handle);
+        }
     }
+    generation++;
+    xSemaphoreGive(prov_lock);
+    flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, 0, ret);
 
-    ret = nvs_get_str(handle, PROVISION_KEY_CLIENT_KEY, certs->client_key, &required_size);
-    if (ret != ESP_OK) {
-        free(certs->ca_cert);
-        free(certs->client_cert);
-        free(certs->client_key);
-        nvs_close(handle);
-        return ret;
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "All provisioning data cleared successfully");
+    } else {
+        ESP_LOGE(TAG, "Failed to clear provisioning data: %s", esp_err_to_name(ret));
     }
 
-    nvs_close(handle);
+    return ret;
+}
 
-    ESP_LOGI(TAG, "TLS certificates loaded successfully");
+esp_err_t provision_stage_begin(void)
+{
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    return ESP_OK;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    esp_err_t ret = stage_begin_locked();
+    int bank = stage.bank;
+    xSemaphoreGive(prov_lock);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Staging session opened (%s)", bank_names[bank]);
+    }
+
+    return ret;
 }
 
-void provision_free_certificates(device_certs_t *certs)
+bool provision_stage_active(void)
 {
-    if (certs == NULL) {
-        return;
+    bool open = false;
+
+    if (!nvs_initialized) {
+        return false;
     }
 
-    if (certs->ca_cert != NULL) {
-        free(certs->ca_cert);
-        certs->ca_cert = NULL;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    open = stage.open;
+    xSemaphoreGive(prov_lock);
+
+    return open;
+}
+
+esp_err_t provision_stage_string(const char *key, const char *value)
+{
+    esp_err_t ret;
+
+    if (key == NULL || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (certs->client_cert != NULL) {
-        free(certs->client_cert);
-        certs->client_cert = NULL;
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    if (certs->client_key != NULL) {
-        free(certs->client_key);
-        certs->client_key = NULL;
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = stage.open ? stage_string_locked(key, value) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(prov_lock);
+
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "Staged: %s", key);
+    } else {
+        ESP_LOGE(TAG, "Failed to stage %s: %s", key, esp_err_to_name(ret));
     }
+
+    return ret;
 }
 
-esp_err_t provision_clear(void)
+esp_err_t provision_stage_certificate(provision_cert_t which, const char *pem)
 {
-    nvs_handle_t handle;
-    esp_err_t ret;
+    const char *pems[PROVISION_CERT_COUNT] = {0};
+    uint8_t *der[PROVISION_CERT_COUNT] = {0};
+    size_t der_len[PROVISION_CERT_COUNT] = {0};
+
+    if (which >= PROVISION_CERT_COUNT || pem == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
     if (!nvs_initialized) {
         ESP_LOGE(TAG, "Provisioning not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    ESP_LOGW(TAG, "Clearing all provisioning data (factory reset)...");
-
-    ret = nvs_open(PROVISION_NAMESPACE, NVS_READWRITE, &handle);
+    pems[which] = pem;
+    esp_err_t ret = parse_pems(pems, der, der_len);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
         return ret;
     }
 
-    /* Erase all keys in namespace */
-    ret = nvs_erase_all(handle);
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    ret = stage.open ? stage_der_locked(which, der[which], der_len[which]) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(prov_lock);
+    free_der(der, der_len);
+
     if (ret == ESP_OK) {
-        ret = nvs_commit(handle);
+        ESP_LOGI(TAG, "Staged %s: %zu bytes DER", cert_der_keys[which], der_len[which]);
+    } else {
+        ESP_LOGE(TAG, "Failed to stage %s: %s", cert_der_keys[which], esp_err_to_name(ret));
     }
 
-    nvs_close(handle);
+    return ret;
+}
 
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "All provisioning data cleared successfully");
-    } else {
-        ESP_LOGE(TAG, "Failed to clear provisioning data: %s", esp_err_to_name(ret));
+esp_err_t provision_stage_commit(bool mark_provisioned)
+{
+    if (!nvs_initialized) {
+        ESP_LOGE(TAG, "Provisioning not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    esp_err_t ret = stage_commit_locked(mark_provisioned);
+    xSemaphoreGive(prov_lock);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Staged provisioning rejected, nothing changed: %s", esp_err_to_name(ret));
     }
 
     return ret;
 }
+
+void provision_stage_abort(void)
+{
+    if (!nvs_initialized) {
+        return;
+    }
+
+    xSemaphoreTake(prov_lock, portMAX_DELAY);
+    bool was_open = stage.open;
+    stage_abort_locked();
+    xSemaphoreGive(prov_lock);
+
+    if (was_open) {
+        ESP_LOGW(TAG, "Staging session discarded");
+    }
+}
@@ -16,18 +16,39 @@
  * - NVS encryption enabled (keys derived from eFuse)
  * - Credentials never hardcoded in firmware
  * - Factory reset capability for reprovisioning
+ *
+ * The namespace is opened once and decrypted into a RAM snapshot at
+ * provision_init(); reads are served from it. Every write or clear bumps a
+ * generation counter and the snapshot is re-read on the next access.
+ * Certificates are not cached (read on demand, see provision_load_certificates).
+ * All functions are thread safe.
+ *
+ * Writes are transactional. Data lives in one of two bank namespaces; the
+ * root namespace only holds a pointer to the active one. A staging session
+ * (provision_stage_begin()) writes into the inactive bank, and
+ * provision_stage_commit() copies over whatever was not staged, validates the
+ * result and flips the pointer: a reset at any point leaves either the old or
+ * the new configuration, never a mix. The single-call setters below are
+ * one-value sessions. Devices provisioned by older firmware keep their data in
+ * the root namespace until the first commit moves it into a bank.
  */
 
-#define PROVISION_NAMESPACE "safesignal"
+#define PROVISION_NAMESPACE "safesignal"        /* Bank pointer (and pre-bank data) */
+#define PROVISION_BANK_A "safesignal_a"
+#define PROVISION_BANK_B "safesignal_b"
+#define PROVISION_KEY_BANK "bank"               /* u8 in PROVISION_NAMESPACE: 0 = A, 1 = B */
 #define PROVISION_KEY_WIFI_SSID "wifi_ssid"
 #define PROVISION_KEY_WIFI_PASS "wifi_pass"
 #define PROVISION_KEY_DEVICE_ID "device_id"
 #define PROVISION_KEY_TENANT_ID "tenant_id"
 #define PROVISION_KEY_BUILDING_ID "building_id"
 #define PROVISION_KEY_ROOM_ID "room_id"
-#define PROVISION_KEY_CA_CERT "ca_cert"
+#define PROVISION_KEY_CA_CERT "ca_cert"          /* PEM, older firmware (migrated to DER) */
 #define PROVISION_KEY_CLIENT_CERT "client_cert"
 #define PROVISION_KEY_CLIENT_KEY "client_key"
+#define PROVISION_KEY_CA_DER "ca_der"           /* DER blobs, see provision_set_certificate() */
+#define PROVISION_KEY_CLIENT_DER "client_der"
+#define PROVISION_KEY_KEY_DER "key_der"
 #define PROVISION_KEY_PROVISIONED "provisioned"
 
 /* Maximum sizes for configuration fields */
@@ -37,8 +58,10 @@
 #define MAX_TENANT_ID_LEN 16
 #define MAX_BUILDING_ID_LEN 16
 #define MAX_ROOM_ID_LEN 16
-#define MAX_CERT_LEN 2048
-#define MAX_KEY_LEN 2048
+#define MAX_CERT_LEN 2048           /* PEM input (CA bundle); stored DER is about 3/4 of it */
+#define MAX_CLIENT_CERT_LEN 1024    /* PEM input; a P-256 leaf is ~750 bytes */
+#define MAX_KEY_LEN 512             /* PEM input; a P-256 key is ~240 bytes */
+#define MAX_KEY_LEN_RSA 2048        /* PROVISION_ALLOW_RSA_KEYS and legacy PEM migration */
 
 /**
  * @brief Device configuration structure
@@ -53,12 +76,34 @@ typedef struct {
 } device_config_t;
 
 /**
- * @brief TLS certificate bundle structure
+ * @brief Certificate slots
+ */
+typedef enum {
+    PROVISION_CERT_CA = 0,      /* CA certificate(s) for broker verification */
+    PROVISION_CERT_CLIENT,      /* Client certificate (leaf) */
+    PROVISION_CERT_KEY,         /* Client private key */
+    PROVISION_CERT_COUNT
+} provision_cert_t;
+
+/**
+ * @brief Everything a factory station writes, applied with provision_apply_batch()
  */
 typedef struct {
-    char *ca_cert;          /* CA certificate (PEM format) */
-    char *client_cert;      /* Client certificate (PEM format) */
-    char *client_key;       /* Client private key (PEM format) */
+    device_config_t config;                     /* All fields are written */
+    const char *certs[PROVISION_CERT_COUNT];    /* PEM; NULL keeps the stored value */
+    bool mark_provisioned;                      /* Set the provisioned flag last */
+} provision_batch_t;
+
+/**
+ * @brief TLS certificate bundle structure (DER, ready for esp-tls/mbedTLS)
+ */
+typedef struct {
+    uint8_t *ca_cert;           /* CA certificate(s), concatenated DER */
+    size_t ca_cert_len;
+    uint8_t *client_cert;       /* Client certificate (DER) */
+    size_t client_cert_len;
+    uint8_t *client_key;        /* Client private key (DER) */
+    size_t client_key_len;
 } device_certs_t;
 
 /**
@@ -81,13 +126,35 @@ esp_err_t provision_init(void);
  */
 bool provision_is_provisioned(void);
 
+/**
+ * @brief Check if a provisioning key is stored (no value copy, no allocation)
+ *
+ * @param key Configuration key (use PROVISION_KEY_* defines)
+ * @return true if present, false otherwise
+ */
+bool provision_has_key(const char *key);
+
+/**
+ * @brief Provisioning data generation
+ *
+ * Incremented by every set, mark or clear; compare with a stored value to
+ * detect that configuration changed.
+ *
+ * @return Current generation
+ */
+uint32_t provision_get_generation(void);
+
 /**
  * @brief Save device configuration to encrypted NVS
  *
+ * All six fields are committed together (one staging session).
+ *
  * @param config Pointer to device configuration structure
  * @return
  *  - ESP_OK on success
  *  - ESP_ERR_INVALID_ARG if config is NULL or invalid
+ *  - ESP_ERR_INVALID_SIZE if a field is not NUL-terminated within its buffer
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
  *  - ESP_ERR_NVS_* on NVS operation failure
  */
 esp_err_t provision_save_config(const device_config_t *config);
@@ -104,19 +171,55 @@ esp_err_t provision_save_config(const device_config_t *config);
  */
 esp_err_t provision_load_config(device_config_t *config);
 
+/**
+ * @brief Save one certificate or key to encrypted NVS
+ *
+ * Parses the PEM input with mbedTLS (rejecting anything that does not parse)
+ * and stores it as DER: no base64 decoding or PEM parsing at connect time.
+ * A CA bundle keeps every certificate; for the client certificate only the
+ * leaf is kept. Removes the PEM value older firmware stored for the slot.
+ *
+ * The client certificate and key must be ECDSA P-256 unless
+ * PROVISION_ALLOW_RSA_KEYS is set (the CA may be of either type).
+ *
+ * This is a one-value commit, so the client certificate and key must match
+ * once it is applied: to replace the identity, stage both in one session or
+ * use provision_save_certificates().
+ *
+ * @param which Certificate slot
+ * @param pem Certificate or key (PEM, null-terminated)
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_ARG if pem is NULL or does not parse, or the client
+ *    certificate and key would not match
+ *  - ESP_ERR_INVALID_SIZE if pem exceeds MAX_CERT_LEN / MAX_CLIENT_CERT_LEN / MAX_KEY_LEN
+ *  - ESP_ERR_NOT_SUPPORTED if the client certificate or key is not P-256
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
+ *  - ESP_ERR_NO_MEM if insufficient memory
+ *  - ESP_ERR_NVS_* on NVS operation failure
+ */
+esp_err_t provision_set_certificate(provision_cert_t which, const char *pem);
+
+/**
+ * @brief Check if a certificate or key is provisioned (DER, or PEM awaiting migration)
+ */
+bool provision_has_certificate(provision_cert_t which);
+
 /**
  * @brief Save TLS certificates to encrypted NVS
  *
- * Stores CA certificate, client certificate, and client private key.
- * Certificates must be in PEM format.
+ * Stores CA certificate, client certificate, and client private key
+ * (see provision_set_certificate()) in one commit, after checking that the
+ * certificate and key belong together. Input must be in PEM format.
  *
  * @param ca_cert CA certificate (PEM, null-terminated)
  * @param client_cert Client certificate (PEM, null-terminated)
  * @param client_key Client private key (PEM, null-terminated)
  * @return
  *  - ESP_OK on success
- *  - ESP_ERR_INVALID_ARG if any certificate is NULL or invalid
+ *  - ESP_ERR_INVALID_ARG if any certificate is NULL or invalid, or the key does not match
  *  - ESP_ERR_INVALID_SIZE if certificate exceeds maximum length
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
  *  - ESP_ERR_NVS_* on NVS operation failure
  */
 esp_err_t provision_save_certificates(const char *ca_cert,
@@ -126,8 +229,10 @@ esp_err_t provision_save_certificates(const char *ca_cert,
 /**
  * @brief Load TLS certificates from encrypted NVS
  *
- * Allocates memory for certificates. Caller must free using
- * provision_free_certificates().
+ * Returns DER buffers. PEM values stored by older firmware are converted and
+ * re-stored as DER on first load. Allocates memory for certificates. Caller
+ * must free using provision_free_certificates() (the CA buffer may be freed
+ * as soon as it has been parsed).
  *
  * @param certs Pointer to certificate bundle structure (output)
  * @return
@@ -148,21 +253,109 @@ esp_err_t provision_load_certificates(device_certs_t *certs);
  */
 void provision_free_certificates(device_certs_t *certs);
 
+/**
+ * @brief Apply configuration and certificates in one commit
+ *
+ * Validates the configuration and parses every certificate first (same rules
+ * as provision_save_config() and provision_set_certificate()), then stages
+ * all values and commits them with a single bank switch: a write that fails
+ * part way, or a reset, leaves the previous configuration in place.
+ *
+ * @param batch Values to write
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_ARG if batch is NULL, a required field is empty, a
+ *    certificate does not parse or the client certificate and key do not match
+ *  - ESP_ERR_INVALID_SIZE / ESP_ERR_NOT_SUPPORTED as for provision_set_certificate()
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
+ *  - ESP_ERR_NO_MEM if insufficient memory
+ *  - ESP_ERR_NVS_* on NVS operation failure
+ */
+esp_err_t provision_apply_batch(const provision_batch_t *batch);
+
 /**
  * @brief Mark device as provisioned
  *
  * Sets provisioned flag in NVS. Called after successful provisioning.
+ * Subject to the commit checks of provision_stage_commit().
  *
  * @return
  *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_ARG if WiFi SSID or device ID is missing, or the client
+ *    certificate and key do not match
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
  *  - ESP_ERR_NVS_* on NVS operation failure
  */
 esp_err_t provision_mark_provisioned(void);
 
+/**
+ * @brief Open a staging session
+ *
+ * Until provision_stage_commit() the active configuration is unchanged and
+ * all reads return it. One session at a time; a session still open at reset
+ * is discarded.
+ *
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_STATE if a session is already open
+ *  - ESP_ERR_NVS_* on NVS operation failure
+ */
+esp_err_t provision_stage_begin(void);
+
+/**
+ * @brief Check whether a staging session is open
+ */
+bool provision_stage_active(void);
+
+/**
+ * @brief Stage one configuration value (the six device_config_t keys only)
+ *
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_ARG if key is not a configuration key
+ *  - ESP_ERR_INVALID_SIZE if value does not fit the device_config_t field
+ *  - ESP_ERR_INVALID_STATE if no session is open
+ *  - ESP_ERR_NVS_* on NVS operation failure
+ */
+esp_err_t provision_stage_string(const char *key, const char *value);
+
+/**
+ * @brief Stage a certificate or key (parsed and checked as in provision_set_certificate())
+ *
+ * @return As provision_set_certificate(); ESP_ERR_INVALID_STATE if no session is open
+ */
+esp_err_t provision_stage_certificate(provision_cert_t which, const char *pem);
+
+/**
+ * @brief Validate the staged configuration and make it active
+ *
+ * Values not staged in this session are carried over from the active
+ * configuration. Before the switch: WiFi SSID and device ID must be present
+ * if the device is (or is being marked) provisioned, and a client
+ * certificate and key must both be present and form a key pair, or both be
+ * absent. The switch is one u8 write; the previous bank is erased afterwards.
+ * The session is closed whether or not the commit succeeds.
+ *
+ * @param mark_provisioned Set the provisioned flag in the new configuration
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_ARG if validation failed (nothing changed)
+ *  - ESP_ERR_INVALID_STATE if no session is open
+ *  - ESP_ERR_NO_MEM if insufficient memory
+ *  - ESP_ERR_NVS_* on NVS operation failure (nothing changed)
+ */
+esp_err_t provision_stage_commit(bool mark_provisioned);
+
+/**
+ * @brief Discard the staging session, if any
+ */
+void provision_stage_abort(void);
+
 /**
  * @brief Clear all provisioning data (factory reset)
  *
- * Erases all configuration and certificates from NVS.
+ * Erases all configuration and certificates from NVS (both banks and the
+ * pointer) and discards an open staging session.
  * Device will require reprovisioning on next boot.
  *
  * @return
@@ -190,13 +383,16 @@ esp_err_t provision_get_string(const char *key, char *value, size_t max_len);
 /**
  * @brief Set individual configuration value
  *
- * Helper function to set a single configuration parameter.
+ * Helper function to set a single configuration parameter (a one-value
+ * staging session). Prefer a session when setting several values.
  *
- * @param key Configuration key (use PROVISION_KEY_* defines)
+ * @param key Configuration key (one of the device_config_t PROVISION_KEY_* defines)
  * @param value Value to store (null-terminated string)
  * @return
  *  - ESP_OK on success
- *  - ESP_ERR_INVALID_ARG if key or value is NULL
+ *  - ESP_ERR_INVALID_ARG if key or value is NULL, or key is not a configuration key
+ *  - ESP_ERR_INVALID_SIZE if value does not fit the device_config_t field
+ *  - ESP_ERR_INVALID_STATE if a staging session is open
  *  - ESP_ERR_NVS_* on NVS operation failure
  */
 esp_err_t provision_set_string(const char *key, const char *value);
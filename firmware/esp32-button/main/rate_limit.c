@@ -6,6 +6,8 @@
 
 #include "rate_limit.h"
 #include "config.h"
+#include "log_ring.h"
+#include "runtime_config.h"
 
 #include <string.h>
 #include <time.h>
@@ -42,9 +44,11 @@ esp_err_t rate_limit_init(void)
     state.cooldown_until = 0;
 
     ESP_LOGI(TAG, "Rate limiting initialized:");
-    ESP_LOGI(TAG, "  Max alerts: %d per %d seconds",
-             RATE_LIMIT_MAX_ALERTS, RATE_LIMIT_WINDOW_SECONDS);
-    ESP_LOGI(TAG, "  Cooldown: %d seconds", RATE_LIMIT_COOLDOWN_SECONDS);
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    ESP_LOGI(TAG, "  Max alerts: %u per %u seconds",
+             cfg.rate_limit_max_alerts, cfg.rate_limit_window_s);
+    ESP_LOGI(TAG, "  Cooldown: %lu seconds", (unsigned long)cfg.rate_limit_cooldown_s);
     ESP_LOGI(TAG, "  Min interval: %d ms", ALERT_MIN_INTERVAL_MS);
 
     return ESP_OK;
@@ -67,17 +71,24 @@ bool rate_limit_check_alert(void)
     /* Get current time in seconds (uptime) */
     uint32_t now_seconds = xTaskGetTickCount() * portTICK_PERIOD_MS / 1000;
 
+    /* Limits can change at runtime (config_set) */
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    uint32_t max_alerts = cfg.rate_limit_max_alerts;
+    uint32_t window_s = cfg.rate_limit_window_s;
+    uint32_t cooldown_s = cfg.rate_limit_cooldown_s;
+
     /* Check if in cooldown period */
     if (state.cooldown_until > 0) {
         if (now_seconds < state.cooldown_until) {
             uint32_t remaining = state.cooldown_until - now_seconds;
-            ESP_LOGW(TAG, "⚠️  RATE LIMITED: In cooldown period (%lu seconds remaining)",
-                     remaining);
+            LOGR_W(TAG, "RATE LIMITED: In cooldown period (%lu seconds remaining)",
+                   remaining);
             xSemaphoreGive(state_mutex);
             return false;
         } else {
             /* Cooldown expired, reset */
-            ESP_LOGI(TAG, "Cooldown period expired, resetting rate limit");
+            LOGR_I(TAG, "Cooldown period expired, resetting rate limit");
             state.cooldown_until = 0;
             state.count = 0;
             state.window_start = now_seconds;
@@ -92,24 +103,18 @@ bool rate_limit_check_alert(void)
 
     /* Check if window has expired (sliding window) */
     uint32_t window_age = now_seconds - state.window_start;
-    if (window_age >= RATE_LIMIT_WINDOW_SECONDS) {
+    if (window_age >= window_s) {
         /* Start new window */
-        ESP_LOGD(TAG, "Rate limit window expired, starting new window");
+        LOGR_D(TAG, "Rate limit window expired, starting new window");
         state.window_start = now_seconds;
         state.count = 0;
     } else {
         /* Within window, check count */
-        if (state.count >= RATE_LIMIT_MAX_ALERTS) {
+        if (state.count >= max_alerts) {
             /* Limit exceeded, enter cooldown */
-            state.cooldown_until = now_seconds + RATE_LIMIT_COOLDOWN_SECONDS;
-            ESP_LOGW(TAG, "");
-            ESP_LOGW(TAG, "╔═══════════════════════════════════════════════════════════╗");
-            ESP_LOGW(TAG, "║   ⚠️  RATE LIMIT EXCEEDED - COOLDOWN ACTIVATED           ║");
-            ESP_LOGW(TAG, "╚═══════════════════════════════════════════════════════════╝");
-            ESP_LOGW(TAG, "Alerts: %lu in %lu seconds (limit: %d per %d seconds)",
-                     state.count, window_age, RATE_LIMIT_MAX_ALERTS, RATE_LIMIT_WINDOW_SECONDS);
-            ESP_LOGW(TAG, "Cooldown: %d seconds", RATE_LIMIT_COOLDOWN_SECONDS);
-            ESP_LOGW(TAG, "");
+            state.cooldown_until = now_seconds + cooldown_s;
+            LOGR_W(TAG, "RATE LIMIT EXCEEDED: %lu alerts (limit: %lu per %lu s), cooldown %lu s",
+                   state.count, max_alerts, window_s, cooldown_s);
             xSemaphoreGive(state_mutex);
             return false;
         }
@@ -136,9 +141,8 @@ void rate_limit_record_alert(void)
         state.count++;
     }
 
-    ESP_LOGD(TAG, "Alert recorded: %lu/%d in window (window age: %lu seconds)",
-             state.count, RATE_LIMIT_MAX_ALERTS,
-             now_seconds - state.window_start);
+    LOGR_D(TAG, "Alert recorded: %lu in window (window age: %lu seconds)",
+           state.count, now_seconds - state.window_start);
 
     xSemaphoreGive(state_mutex);
 }
@@ -158,8 +162,8 @@ bool rate_limit_check_min_interval(void)
         uint32_t elapsed = now_ms - state.last_alert_time_ms;
         if (elapsed < ALERT_MIN_INTERVAL_MS) {
             uint32_t remaining = ALERT_MIN_INTERVAL_MS - elapsed;
-            ESP_LOGD(TAG, "Alert throttled: %lu ms since last alert (min: %d ms, remaining: %lu ms)",
-                     elapsed, ALERT_MIN_INTERVAL_MS, remaining);
+            LOGR_D(TAG, "Alert throttled: %lu ms since last alert (min: %d ms, remaining: %lu ms)",
+                   elapsed, ALERT_MIN_INTERVAL_MS, remaining);
             xSemaphoreGive(state_mutex);
             return false;
         }
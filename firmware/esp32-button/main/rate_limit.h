@@ -3,6 +3,8 @@
  *
  * Firmware-level rate limiting to prevent DoS attacks and accidental spamming.
  * Implements sliding window algorithm with cooldown period.
+ * Limits are read from runtime_config on every check, so a config_set
+ * update takes effect on the next alert.
  */
 
 #ifndef SAFESIGNAL_RATE_LIMIT_H
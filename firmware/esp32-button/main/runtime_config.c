@@ -4,99 +4,369 @@
 
 #include "runtime_config.h"
 #include "provisioning.h"
+#include "flash_stats.h"
 #include "config.h"
 #include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
 #include "esp_log.h"
 
 static const char *TAG = "RUNTIME_CFG";
 
-/* Global runtime configuration */
-static runtime_config_t g_runtime_config = {
-    .device_id = DEVICE_ID,      /* Fallback to compile-time default */
-    .tenant_id = TENANT_ID,
-    .building_id = BUILDING_ID,
-    .room_id = ROOM_ID,
-    .loaded = false
+#define NVS_KEY_TUNABLES "tunables"
+#define TUNABLES_VERSION 1
+
+/* Tunables blob in RUNTIME_CONFIG_NAMESPACE, bound to the device ID it was pushed to */
+typedef struct {
+    uint8_t format;
+    uint8_t power_profile;
+    uint16_t rate_limit_max_alerts;
+    uint32_t version;
+    uint32_t heartbeat_interval_ms;
+    uint32_t rate_limit_cooldown_s;
+    uint16_t rate_limit_window_s;
+    char device_id[RUNTIME_CONFIG_DEVICE_ID_LEN];
+} tunables_t;
+
+/* Double buffer: buffers[generation & 1] is published, writers fill the other one */
+static runtime_config_t buffers[2] = {
+    [0] = {
+        .device_id = DEVICE_ID,      /* Fallback to compile-time default */
+        .tenant_id = TENANT_ID,
+        .building_id = BUILDING_ID,
+        .room_id = ROOM_ID,
+        .heartbeat_interval_ms = HEARTBEAT_INTERVAL_MS,
+        .rate_limit_max_alerts = RATE_LIMIT_MAX_ALERTS,
+        .rate_limit_window_s = RATE_LIMIT_WINDOW_SECONDS,
+        .rate_limit_cooldown_s = RATE_LIMIT_COOLDOWN_SECONDS,
+        .power_profile = POWER_PROFILE_DEFAULT,
+        .loaded = false
+    }
 };
+static atomic_uint generation = 0;
+
+/* Serializes writers (boot load, config_reload, config_set) */
+static SemaphoreHandle_t write_mutex = NULL;
+
+static const char *power_profile_names[] = { "performance", "balanced", "low" };
+
+static void lock(void)
+{
+    /* First call is runtime_config_load() from app_main, before other tasks */
+    if (write_mutex == NULL) {
+        write_mutex = xSemaphoreCreateMutex();
+        configASSERT(write_mutex != NULL);
+    }
+    xSemaphoreTake(write_mutex, portMAX_DELAY);
+}
+
+static void unlock(void)
+{
+    xSemaphoreGive(write_mutex);
+}
+
+static void copy_field(char *dst, const char *src, size_t size)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+/* Published buffer; only writers may read it without a snapshot (caller holds the lock) */
+static const runtime_config_t *published_locked(void)
+{
+    return &buffers[atomic_load_explicit(&generation, memory_order_relaxed) & 1];
+}
+
+/**
+ * Copy next into the unpublished buffer and switch readers to it (caller holds the lock)
+ *
+ * The spare buffer was published until the previous update, so a slow
+ * reader may still be copying it. The generation already moved past that
+ * reader's value; the fence orders these writes after it, so the reader
+ * sees the change when it re-checks the generation and retries.
+ */
+static void publish_locked(const runtime_config_t *next)
+{
+    unsigned gen = atomic_load_explicit(&generation, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_release);
+    memcpy(&buffers[(gen + 1) & 1], next, sizeof(buffers[0]));
+    atomic_store_explicit(&generation, gen + 1, memory_order_release);
+}
+
+static void set_default_tunables(runtime_config_t *cfg)
+{
+    cfg->heartbeat_interval_ms = HEARTBEAT_INTERVAL_MS;
+    cfg->rate_limit_max_alerts = RATE_LIMIT_MAX_ALERTS;
+    cfg->rate_limit_window_s = RATE_LIMIT_WINDOW_SECONDS;
+    cfg->rate_limit_cooldown_s = RATE_LIMIT_COOLDOWN_SECONDS;
+    cfg->power_profile = POWER_PROFILE_DEFAULT;
+    cfg->version = 0;
+}
+
+/* Overlay tunables pushed earlier to this device ID */
+static void load_tunables(runtime_config_t *cfg)
+{
+    nvs_handle_t handle;
+    if (nvs_open(RUNTIME_CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;     /* Nothing pushed yet */
+    }
+
+    tunables_t stored;
+    size_t size = sizeof(stored);
+    esp_err_t ret = nvs_get_blob(handle, NVS_KEY_TUNABLES, &stored, &size);
+    nvs_close(handle);
+
+    if (ret != ESP_OK || size != sizeof(stored) || stored.format != TUNABLES_VERSION) {
+        if (ret != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Stored tunables unreadable, using defaults");
+        }
+        return;
+    }
+    if (strncmp(stored.device_id, cfg->device_id, sizeof(stored.device_id)) != 0) {
+        ESP_LOGW(TAG, "Stored tunables belong to %.*s, ignored",
+                 (int)sizeof(stored.device_id), stored.device_id);
+        return;
+    }
+
+    cfg->heartbeat_interval_ms = stored.heartbeat_interval_ms;
+    cfg->rate_limit_max_alerts = stored.rate_limit_max_alerts;
+    cfg->rate_limit_window_s = stored.rate_limit_window_s;
+    cfg->rate_limit_cooldown_s = stored.rate_limit_cooldown_s;
+    cfg->power_profile = stored.power_profile;
+    cfg->version = stored.version;
+}
+
+static esp_err_t save_tunables(const runtime_config_t *cfg)
+{
+    tunables_t stored = {
+        .format = TUNABLES_VERSION,
+        .power_profile = (uint8_t)cfg->power_profile,
+        .rate_limit_max_alerts = cfg->rate_limit_max_alerts,
+        .version = cfg->version,
+        .heartbeat_interval_ms = cfg->heartbeat_interval_ms,
+        .rate_limit_cooldown_s = cfg->rate_limit_cooldown_s,
+        .rate_limit_window_s = cfg->rate_limit_window_s,
+    };
+    copy_field(stored.device_id, cfg->device_id, sizeof(stored.device_id));
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(RUNTIME_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(handle, NVS_KEY_TUNABLES, &stored, sizeof(stored));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    flash_stats_record_write(FLASH_SUBSYS_PROVISIONING, sizeof(stored), ret);
+    return ret;
+}
+
+/* Stage the changed IDs and switch provisioning banks once */
+static esp_err_t save_ids(const runtime_config_t *cfg, uint32_t fields)
+{
+    esp_err_t ret = provision_stage_begin();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (fields & RUNTIME_CONFIG_SET_TENANT) {
+        ret = provision_stage_string(PROVISION_KEY_TENANT_ID, cfg->tenant_id);
+    }
+    if (ret == ESP_OK && (fields & RUNTIME_CONFIG_SET_BUILDING)) {
+        ret = provision_stage_string(PROVISION_KEY_BUILDING_ID, cfg->building_id);
+    }
+    if (ret == ESP_OK && (fields & RUNTIME_CONFIG_SET_ROOM)) {
+        ret = provision_stage_string(PROVISION_KEY_ROOM_ID, cfg->room_id);
+    }
+    if (ret != ESP_OK) {
+        provision_stage_abort();
+        return ret;
+    }
+
+    return provision_stage_commit(false);
+}
 
 esp_err_t runtime_config_load(void)
 {
     device_config_t prov_config;
+    runtime_config_t next;
+
+    lock();
+    memcpy(&next, published_locked(), sizeof(next));
 
     /* Try to load from NVS provisioning */
     esp_err_t ret = provision_load_config(&prov_config);
 
     if (ret == ESP_OK) {
         /* Successfully loaded from NVS */
-        strncpy(g_runtime_config.device_id, prov_config.device_id,
-                sizeof(g_runtime_config.device_id) - 1);
-        g_runtime_config.device_id[sizeof(g_runtime_config.device_id) - 1] = '\0';
-
-        strncpy(g_runtime_config.tenant_id, prov_config.tenant_id,
-                sizeof(g_runtime_config.tenant_id) - 1);
-        g_runtime_config.tenant_id[sizeof(g_runtime_config.tenant_id) - 1] = '\0';
-
-        strncpy(g_runtime_config.building_id, prov_config.building_id,
-                sizeof(g_runtime_config.building_id) - 1);
-        g_runtime_config.building_id[sizeof(g_runtime_config.building_id) - 1] = '\0';
-
-        strncpy(g_runtime_config.room_id, prov_config.room_id,
-                sizeof(g_runtime_config.room_id) - 1);
-        g_runtime_config.room_id[sizeof(g_runtime_config.room_id) - 1] = '\0';
+        copy_field(next.device_id, prov_config.device_id, sizeof(next.device_id));
+        copy_field(next.tenant_id, prov_config.tenant_id, sizeof(next.tenant_id));
+        copy_field(next.building_id, prov_config.building_id, sizeof(next.building_id));
+        copy_field(next.room_id, prov_config.room_id, sizeof(next.room_id));
+        next.loaded = true;
+    } else {
+        next.loaded = false;
+    }
 
-        g_runtime_config.loaded = true;
+    set_default_tunables(&next);
+    load_tunables(&next);
+    publish_locked(&next);
+    unlock();
 
+    if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Runtime config loaded from NVS:");
-        ESP_LOGI(TAG, "  Device ID:   %s", g_runtime_config.device_id);
-        ESP_LOGI(TAG, "  Tenant ID:   %s", g_runtime_config.tenant_id);
-        ESP_LOGI(TAG, "  Building ID: %s", g_runtime_config.building_id);
-        ESP_LOGI(TAG, "  Room ID:     %s", g_runtime_config.room_id);
-
-        return ESP_OK;
+        ESP_LOGI(TAG, "  Device ID:   %s", next.device_id);
+        ESP_LOGI(TAG, "  Tenant ID:   %s", next.tenant_id);
+        ESP_LOGI(TAG, "  Building ID: %s", next.building_id);
+        ESP_LOGI(TAG, "  Room ID:     %s", next.room_id);
     }
-    else if (ret == ESP_ERR_NVS_NOT_FOUND) {
+    else if (ret == ESP_ERR_NVS_NOT_FOUND || ret == ESP_ERR_NOT_FOUND) {
         /* Not provisioned, use compile-time defaults */
         ESP_LOGW(TAG, "Device not provisioned, using compile-time defaults:");
-        ESP_LOGW(TAG, "  Device ID:   %s", g_runtime_config.device_id);
-        ESP_LOGW(TAG, "  Tenant ID:   %s", g_runtime_config.tenant_id);
-        ESP_LOGW(TAG, "  Building ID: %s", g_runtime_config.building_id);
-        ESP_LOGW(TAG, "  Room ID:     %s", g_runtime_config.room_id);
+        ESP_LOGW(TAG, "  Device ID:   %s", next.device_id);
+        ESP_LOGW(TAG, "  Tenant ID:   %s", next.tenant_id);
+        ESP_LOGW(TAG, "  Building ID: %s", next.building_id);
+        ESP_LOGW(TAG, "  Room ID:     %s", next.room_id);
         ESP_LOGW(TAG, "Note: Provision device for unique configuration");
-
-        g_runtime_config.loaded = false;
-        return ESP_ERR_NOT_FOUND;
+        ret = ESP_ERR_NOT_FOUND;
     }
     else {
         /* Error loading from NVS */
         ESP_LOGE(TAG, "Failed to load runtime config from NVS: %s", esp_err_to_name(ret));
         ESP_LOGW(TAG, "Using compile-time defaults");
+    }
 
-        g_runtime_config.loaded = false;
-        return ret;
+    if (next.version > 0) {
+        ESP_LOGI(TAG, "  Config v%lu: heartbeat %lu s, %u alerts/%u s, cooldown %lu s, %s",
+                 (unsigned long)next.version, (unsigned long)(next.heartbeat_interval_ms / 1000),
+                 next.rate_limit_max_alerts, next.rate_limit_window_s,
+                 (unsigned long)next.rate_limit_cooldown_s,
+                 runtime_config_power_profile_name(next.power_profile));
     }
+
+    return ret;
 }
 
-const runtime_config_t* runtime_config_get(void)
+esp_err_t runtime_config_apply(const runtime_config_update_t *update)
 {
-    return &g_runtime_config;
+    if (update == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    runtime_config_t next;
+    esp_err_t ret = ESP_OK;
+
+    lock();
+    memcpy(&next, published_locked(), sizeof(next));
+
+    if (update->version <= next.version) {
+        ESP_LOGW(TAG, "Config v%lu rejected, v%lu already applied",
+                 (unsigned long)update->version, (unsigned long)next.version);
+        unlock();
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    /* IDs live in provisioning; without it they would be lost on reboot */
+    uint32_t id_fields = update->fields & RUNTIME_CONFIG_SET_IDS;
+    if (id_fields != 0 && !next.loaded) {
+        unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (update->fields & RUNTIME_CONFIG_SET_TENANT) {
+        copy_field(next.tenant_id, update->tenant_id, sizeof(next.tenant_id));
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_BUILDING) {
+        copy_field(next.building_id, update->building_id, sizeof(next.building_id));
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_ROOM) {
+        copy_field(next.room_id, update->room_id, sizeof(next.room_id));
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_HEARTBEAT) {
+        next.heartbeat_interval_ms = update->heartbeat_interval_ms;
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_RATE_MAX) {
+        next.rate_limit_max_alerts = update->rate_limit_max_alerts;
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_RATE_WINDOW) {
+        next.rate_limit_window_s = update->rate_limit_window_s;
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_COOLDOWN) {
+        next.rate_limit_cooldown_s = update->rate_limit_cooldown_s;
+    }
+    if (update->fields & RUNTIME_CONFIG_SET_POWER) {
+        next.power_profile = update->power_profile;
+    }
+    next.version = update->version;
+
+    /* IDs first: if the tunables write fails the version is not advanced and
+     * the same document can simply be pushed again */
+    if (id_fields != 0) {
+        ret = save_ids(&next, id_fields);
+    }
+    if (ret == ESP_OK) {
+        ret = save_tunables(&next);
+    }
+
+    if (ret == ESP_OK) {
+        publish_locked(&next);
+    }
+    unlock();
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to persist config v%lu: %s",
+                 (unsigned long)update->version, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Config v%lu applied: %s/%s/%s, heartbeat %lu s, %u alerts/%u s, cooldown %lu s, %s",
+             (unsigned long)next.version, next.tenant_id, next.building_id, next.room_id,
+             (unsigned long)(next.heartbeat_interval_ms / 1000),
+             next.rate_limit_max_alerts, next.rate_limit_window_s,
+             (unsigned long)next.rate_limit_cooldown_s,
+             runtime_config_power_profile_name(next.power_profile));
+    return ESP_OK;
 }
 
-const char* runtime_config_get_device_id(void)
+uint32_t runtime_config_generation(void)
 {
-    return g_runtime_config.device_id;
+    return atomic_load_explicit(&generation, memory_order_relaxed);
 }
 
-const char* runtime_config_get_tenant_id(void)
+bool runtime_config_parse_power_profile(const char *name, size_t len, power_profile_t *out)
 {
-    return g_runtime_config.tenant_id;
+    for (int i = 0; i < sizeof(power_profile_names) / sizeof(power_profile_names[0]); i++) {
+        if (strlen(power_profile_names[i]) == len && memcmp(power_profile_names[i], name, len) == 0) {
+            *out = (power_profile_t)i;
+            return true;
+        }
+    }
+    return false;
 }
 
-const char* runtime_config_get_building_id(void)
+const char *runtime_config_power_profile_name(power_profile_t profile)
 {
-    return g_runtime_config.building_id;
+    if (profile > POWER_PROFILE_LOW) {
+        return "unknown";
+    }
+    return power_profile_names[profile];
 }
 
-const char* runtime_config_get_room_id(void)
+void runtime_config_snapshot(runtime_config_t *out)
 {
-    return g_runtime_config.room_id;
+    unsigned gen;
+    unsigned check;
+
+    /* Retries only if an update was published during the copy; a writer
+     * preempted mid-copy never blocks readers (it writes the other buffer) */
+    do {
+        gen = atomic_load_explicit(&generation, memory_order_acquire);
+        memcpy(out, &buffers[gen & 1], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        check = atomic_load_explicit(&generation, memory_order_relaxed);
+    } while (check != gen);
 }
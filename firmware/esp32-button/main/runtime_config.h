@@ -5,6 +5,14 @@
  * global access to runtime config values.
  *
  * Replaces compile-time constants with provisioned values.
+ *
+ * Remote updates (config_set command, see mqtt_cmd.h) overlay the
+ * provisioned IDs and the tunables below.
+ *
+ * Readers take a copy with runtime_config_snapshot(): no mutex, safe from
+ * any task. Writers are serialized, fill the unpublished one of two
+ * buffers and publish it by advancing a generation counter; a reader whose
+ * copy overlapped a publish retries. Readers never wait for a writer.
  */
 
 #ifndef SAFESIGNAL_RUNTIME_CONFIG_H
@@ -12,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "esp_err.h"
 
 /* Maximum field sizes */
@@ -20,6 +29,29 @@
 #define RUNTIME_CONFIG_BUILDING_ID_LEN 16
 #define RUNTIME_CONFIG_ROOM_ID_LEN 16
 
+#define RUNTIME_CONFIG_NAMESPACE "runtime_cfg"   /* Tunables pushed with config_set */
+
+/**
+ * WiFi power profile (esp_wifi_set_ps)
+ */
+typedef enum {
+    POWER_PROFILE_PERFORMANCE = 0,  /* WIFI_PS_NONE: lowest command latency */
+    POWER_PROFILE_BALANCED = 1,     /* WIFI_PS_MIN_MODEM: IDF default */
+    POWER_PROFILE_LOW = 2,          /* WIFI_PS_MAX_MODEM: longest sleep */
+} power_profile_t;
+
+/* runtime_config_update_t.fields */
+#define RUNTIME_CONFIG_SET_TENANT       (1u << 0)
+#define RUNTIME_CONFIG_SET_BUILDING     (1u << 1)
+#define RUNTIME_CONFIG_SET_ROOM         (1u << 2)
+#define RUNTIME_CONFIG_SET_HEARTBEAT    (1u << 3)
+#define RUNTIME_CONFIG_SET_RATE_MAX     (1u << 4)
+#define RUNTIME_CONFIG_SET_RATE_WINDOW  (1u << 5)
+#define RUNTIME_CONFIG_SET_COOLDOWN     (1u << 6)
+#define RUNTIME_CONFIG_SET_POWER        (1u << 7)
+#define RUNTIME_CONFIG_SET_IDS (RUNTIME_CONFIG_SET_TENANT | RUNTIME_CONFIG_SET_BUILDING | \
+                                RUNTIME_CONFIG_SET_ROOM)
+
 /**
  * Runtime configuration structure
  * Loaded from NVS on boot, used throughout application
@@ -29,9 +61,32 @@ typedef struct {
     char tenant_id[RUNTIME_CONFIG_TENANT_ID_LEN];
     char building_id[RUNTIME_CONFIG_BUILDING_ID_LEN];
     char room_id[RUNTIME_CONFIG_ROOM_ID_LEN];
+    uint32_t heartbeat_interval_ms;
+    uint16_t rate_limit_max_alerts;     /* 1..RATE_LIMIT_MAX_ALERTS */
+    uint16_t rate_limit_window_s;
+    uint32_t rate_limit_cooldown_s;
+    power_profile_t power_profile;
+    uint32_t version;   /* Last applied config_set document, 0 if none */
     bool loaded;  /* True if config was loaded from NVS */
 } runtime_config_t;
 
+/**
+ * Partial update from a config_set document
+ * Only the members flagged in fields are applied; strings are NUL-terminated.
+ */
+typedef struct {
+    uint32_t fields;    /* RUNTIME_CONFIG_SET_* */
+    uint32_t version;   /* Must be greater than the applied version */
+    char tenant_id[RUNTIME_CONFIG_TENANT_ID_LEN];
+    char building_id[RUNTIME_CONFIG_BUILDING_ID_LEN];
+    char room_id[RUNTIME_CONFIG_ROOM_ID_LEN];
+    uint32_t heartbeat_interval_ms;
+    uint16_t rate_limit_max_alerts;
+    uint16_t rate_limit_window_s;
+    uint32_t rate_limit_cooldown_s;
+    power_profile_t power_profile;
+} runtime_config_update_t;
+
 /**
  * @brief Load runtime configuration from NVS provisioning
  *
@@ -46,38 +101,61 @@ typedef struct {
 esp_err_t runtime_config_load(void);
 
 /**
- * @brief Get pointer to global runtime configuration
+ * @brief Apply and persist a config_set update
  *
- * @return Pointer to runtime config (never NULL)
+ * IDs are written to provisioning in one staging session (one bank switch),
+ * then the tunables and version to RUNTIME_CONFIG_NAMESPACE. Nothing is
+ * published if persisting fails. Callers must have authenticated the update.
+ *
+ * @param update Validated update
+ *
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_VERSION if update->version is not newer
+ *  - ESP_ERR_INVALID_STATE if IDs are set on an unprovisioned device, or a
+ *    provisioning session is open
+ *  - ESP_ERR_* on NVS failures
  */
-const runtime_config_t* runtime_config_get(void);
+esp_err_t runtime_config_apply(const runtime_config_update_t *update);
 
 /**
- * @brief Get device ID
+ * @brief Count of configurations published since boot
+ *
+ * Lets periodic jobs notice an update without a callback.
  *
- * @return Device ID string (never NULL)
+ * @return Generation, incremented by every load and apply
  */
-const char* runtime_config_get_device_id(void);
+uint32_t runtime_config_generation(void);
 
 /**
- * @brief Get tenant ID
+ * @brief Parse a power profile name ("performance", "balanced", "low")
+ *
+ * @param name Name (not NUL-terminated)
+ * @param len Name length
+ * @param out Profile (output)
  *
- * @return Tenant ID string (never NULL)
+ * @return true if the name is known
  */
-const char* runtime_config_get_tenant_id(void);
+bool runtime_config_parse_power_profile(const char *name, size_t len, power_profile_t *out);
 
 /**
- * @brief Get building ID
+ * @brief Get the name of a power profile
  *
- * @return Building ID string (never NULL)
+ * @param profile Profile
+ *
+ * @return Name (never NULL)
  */
-const char* runtime_config_get_building_id(void);
+const char *runtime_config_power_profile_name(power_profile_t profile);
 
 /**
- * @brief Get room ID
+ * @brief Copy the current configuration
+ *
+ * Lock-free: the copy is consistent (all fields from the same update) even
+ * while another task applies an update. Take one snapshot per message or
+ * decision rather than reading fields from separate calls.
  *
- * @return Room ID string (never NULL)
+ * @param out Configuration (output)
  */
-const char* runtime_config_get_room_id(void);
+void runtime_config_snapshot(runtime_config_t *out);
 
 #endif /* SAFESIGNAL_RUNTIME_CONFIG_H */
@@ -0,0 +1,189 @@
+#include "scheduler.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+
+static const char *TAG = "SCHEDULER";
+
+typedef struct {
+    const char *name;
+    scheduler_job_fn_t fn;
+    int64_t period_us;
+    uint32_t jitter_ms;
+    scheduler_prio_t priority;
+    volatile int64_t next_us;   /* Next deadline (esp_timer time) */
+    volatile bool enabled;
+} sched_job_t;
+
+static sched_job_t jobs[SCHEDULER_MAX_JOBS];
+static int job_count = 0;
+static TaskHandle_t scheduler_task = NULL;
+static portMUX_TYPE sched_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t jitter_us(const sched_job_t *job)
+{
+    if (job->jitter_ms == 0) {
+        return 0;
+    }
+    return (int64_t)(esp_random() % (job->jitter_ms + 1)) * 1000;
+}
+
+esp_err_t scheduler_add_job(const char *name, scheduler_job_fn_t fn, uint32_t period_ms,
+                            uint32_t jitter_ms, scheduler_prio_t priority,
+                            scheduler_job_id_t *out_id)
+{
+    if (fn == NULL || period_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (job_count >= SCHEDULER_MAX_JOBS) {
+        ESP_LOGE(TAG, "[SCHED] No job slot for %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    sched_job_t *job = &jobs[job_count];
+    job->name = name;
+    job->fn = fn;
+    job->period_us = (int64_t)period_ms * 1000;
+    job->jitter_ms = jitter_ms;
+    job->priority = priority;
+    job->next_us = esp_timer_get_time() + job->period_us + jitter_us(job);
+    job->enabled = true;
+
+    if (out_id != NULL) {
+        *out_id = job_count;
+    }
+    job_count++;
+
+    ESP_LOGI(TAG, "[SCHED] Job %s: every %lu ms (+%lu ms jitter), priority %d",
+             name, (unsigned long)period_ms, (unsigned long)jitter_ms, priority);
+    return ESP_OK;
+}
+
+void scheduler_set_enabled(scheduler_job_id_t id, bool enabled)
+{
+    if (id < 0 || id >= job_count) {
+        return;
+    }
+
+    portENTER_CRITICAL(&sched_lock);
+    if (enabled && !jobs[id].enabled) {
+        jobs[id].next_us = esp_timer_get_time() + jobs[id].period_us;
+    }
+    jobs[id].enabled = enabled;
+    portEXIT_CRITICAL(&sched_lock);
+}
+
+void scheduler_set_period(scheduler_job_id_t id, uint32_t period_ms)
+{
+    if (id < 0 || id >= job_count) {
+        return;
+    }
+
+    portENTER_CRITICAL(&sched_lock);
+    jobs[id].period_us = (int64_t)period_ms * 1000;
+    jobs[id].next_us = esp_timer_get_time() + jobs[id].period_us;
+    portEXIT_CRITICAL(&sched_lock);
+
+    /* A shorter period may move the earliest deadline forward */
+    if (scheduler_task != NULL) {
+        xTaskNotifyGive(scheduler_task);
+    }
+}
+
+void scheduler_trigger(scheduler_job_id_t id)
+{
+    if (id < 0 || id >= job_count) {
+        return;
+    }
+
+    portENTER_CRITICAL(&sched_lock);
+    jobs[id].next_us = 0;
+    portEXIT_CRITICAL(&sched_lock);
+
+    if (scheduler_task != NULL) {
+        xTaskNotifyGive(scheduler_task);
+    }
+}
+
+/* Pick the due job with the highest priority (earliest deadline on ties) */
+static sched_job_t *next_due_job(int64_t now, int64_t *next_deadline)
+{
+    sched_job_t *best = NULL;
+    int64_t earliest = now + (int64_t)SCHEDULER_MAX_SLEEP_MS * 1000;
+
+    portENTER_CRITICAL(&sched_lock);
+    for (int i = 0; i < job_count; i++) {
+        sched_job_t *job = &jobs[i];
+        if (!job->enabled) {
+            continue;
+        }
+
+        if (job->next_us <= now) {
+            if (best == NULL || job->priority > best->priority ||
+                (job->priority == best->priority && job->next_us < best->next_us)) {
+                best = job;
+            }
+        } else if (job->next_us < earliest) {
+            earliest = job->next_us;
+        }
+    }
+    portEXIT_CRITICAL(&sched_lock);
+
+    *next_deadline = earliest;
+    return best;
+}
+
+void scheduler_run(watchdog_task_id_t wdt_id)
+{
+    scheduler_task = xTaskGetCurrentTaskHandle();
+
+    ESP_LOGI(TAG, "[SCHED] Running %d jobs", job_count);
+
+    while (1) {
+        int64_t next_deadline;
+        int64_t now = esp_timer_get_time();
+        sched_job_t *job = next_due_job(now, &next_deadline);
+
+        if (job != NULL) {
+            /* Set the next deadline before the run, so a scheduler_trigger() or
+             * scheduler_set_period() during fn() is not overwritten. Advance from
+             * the old deadline to avoid drift; resync after a trigger or a stall. */
+            portENTER_CRITICAL(&sched_lock);
+            int64_t next = job->next_us + job->period_us;
+            if (job->next_us == 0 || next <= now) {
+                next = now + job->period_us;
+            }
+            job->next_us = next + jitter_us(job);
+            portEXIT_CRITICAL(&sched_lock);
+
+            watchdog_checkpoint(wdt_id, job->name);
+            job->fn();
+
+            /* A run longer than the period resyncs rather than running back to back */
+            portENTER_CRITICAL(&sched_lock);
+            now = esp_timer_get_time();
+            if (job->next_us != 0 && job->next_us <= now) {
+                job->next_us = now + job->period_us + jitter_us(job);
+            }
+            portEXIT_CRITICAL(&sched_lock);
+
+            watchdog_feed();
+            continue;
+        }
+
+        watchdog_feed();
+        watchdog_checkpoint(wdt_id, "sched_idle");
+
+        /* Sleep until the earliest deadline or an early trigger */
+        int64_t sleep_ms = (next_deadline - now + 999) / 1000;
+        if (sleep_ms < 1) {
+            sleep_ms = 1;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep_ms));
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef SAFESIGNAL_SCHEDULER_H
+#define SAFESIGNAL_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "watchdog.h"
+
+/**
+ * Periodic Job Scheduler
+ *
+ * Runs the device's periodic background work (status, heartbeat, queue
+ * drain, cleanup, metrics flush) from a single task:
+ * - Each job has its own period, random jitter and priority
+ * - Deadlines are tracked in esp_timer microseconds, not loop counts
+ * - The task sleeps until the earliest deadline instead of polling; sleep is
+ *   capped at SCHEDULER_MAX_SLEEP_MS so the watchdogs are still fed
+ * - When several jobs are due, higher priority runs first
+ * - scheduler_trigger() runs a job early and wakes the task from any task
+ */
+
+#define SCHEDULER_MAX_JOBS 8
+#define SCHEDULER_MAX_SLEEP_MS 10000  /* Below the supervised deadline of the running task */
+
+typedef void (*scheduler_job_fn_t)(void);
+
+/**
+ * Handle for a registered job
+ */
+typedef int scheduler_job_id_t;
+
+#define SCHEDULER_JOB_ID_INVALID (-1)
+
+/**
+ * Job priorities (higher runs first when several jobs are due)
+ */
+typedef enum {
+    SCHEDULER_PRIO_LOW = 0,
+    SCHEDULER_PRIO_NORMAL = 1,
+    SCHEDULER_PRIO_HIGH = 2,
+} scheduler_prio_t;
+
+/**
+ * Register a periodic job
+ * Must be called before scheduler_run(). The first run is one period
+ * (plus jitter) after registration.
+ * @param name Job name (static string, used as watchdog checkpoint label)
+ * @param fn Job function
+ * @param period_ms Period in milliseconds
+ * @param jitter_ms Random extra delay added to each period (0 = none)
+ * @param priority Job priority
+ * @param out_id Job handle (output, may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all job slots are used
+ */
+esp_err_t scheduler_add_job(const char *name, scheduler_job_fn_t fn, uint32_t period_ms,
+                            uint32_t jitter_ms, scheduler_prio_t priority,
+                            scheduler_job_id_t *out_id);
+
+/**
+ * Enable or disable a job
+ * A re-enabled job runs one period later.
+ * @param id Job handle
+ * @param enabled New state
+ */
+void scheduler_set_enabled(scheduler_job_id_t id, bool enabled);
+
+/**
+ * Change a job's period
+ * The next run is one new period from now. Safe to call from any task.
+ * @param id Job handle
+ * @param period_ms New period in milliseconds
+ */
+void scheduler_set_period(scheduler_job_id_t id, uint32_t period_ms);
+
+/**
+ * Run a job as soon as possible and wake the scheduler
+ * Safe to call from any task (not from ISRs).
+ * @param id Job handle
+ */
+void scheduler_trigger(scheduler_job_id_t id);
+
+/**
+ * Run the scheduler loop on the calling task (never returns)
+ * Feeds the task watchdog and reports each job as a supervisor checkpoint.
+ * @param wdt_id Supervisor handle of the calling task
+ */
+void scheduler_run(watchdog_task_id_t wdt_id) __attribute__((noreturn));
+
+#endif /* SAFESIGNAL_SCHEDULER_H */
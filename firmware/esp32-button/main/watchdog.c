@@ -1,13 +1,119 @@
 #include "watchdog.h"
 #include "config.h"
+#include "alert_queue.h"
 
+#include <string.h>
 #include "esp_log.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
 
 static const char *TAG = "WATCHDOG";
 
+#define DIAG_MAGIC 0x57444731  /* "WDG1" */
+
 static bool initialized = false;
 
+/* Supervised task table */
+typedef struct {
+    bool in_use;
+    TaskHandle_t task;
+    uint32_t deadline_ms;
+    uint32_t last_checkin_ms;
+    uint32_t progress;
+    const char *checkpoint;
+} supervised_task_t;
+
+static supervised_task_t supervised[WATCHDOG_MAX_SUPERVISED_TASKS];
+static portMUX_TYPE supervised_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t supervisor_timer = NULL;
+
+/* Diagnostic record preserved across the supervisor reset */
+typedef struct {
+    uint32_t magic;
+    watchdog_diag_t diag;
+    uint32_t crc;
+} rtc_diag_t;
+
+static RTC_NOINIT_ATTR rtc_diag_t rtc_diag;
+
+/* Diagnostic recovered at boot, waiting to be published */
+static watchdog_diag_t last_diag;
+static bool has_last_diag = false;
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static uint32_t diag_crc(const watchdog_diag_t *diag)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)diag, sizeof(*diag));
+}
+
+/* Helper: Move a valid RTC record into RAM and invalidate it */
+static void recover_rtc_diag(void)
+{
+    if (rtc_diag.magic == DIAG_MAGIC && rtc_diag.crc == diag_crc(&rtc_diag.diag)) {
+        memcpy(&last_diag, &rtc_diag.diag, sizeof(last_diag));
+        has_last_diag = true;
+
+        ESP_LOGW(TAG, "[WDT] Previous reset by supervisor: task '%s' silent %lu ms "
+                 "(deadline %lu ms, last checkpoint '%s')",
+                 last_diag.task_name, last_diag.silent_ms,
+                 last_diag.deadline_ms, last_diag.checkpoint);
+    }
+
+    memset(&rtc_diag, 0, sizeof(rtc_diag));
+}
+
+/* Supervisor: runs in the esp_timer task */
+static void supervisor_check(void *arg)
+{
+    uint32_t now = now_ms();
+    int missed = -1;
+    supervised_task_t snapshot;
+
+    portENTER_CRITICAL(&supervised_lock);
+    for (int i = 0; i < WATCHDOG_MAX_SUPERVISED_TASKS; i++) {
+        if (supervised[i].in_use &&
+            (now - supervised[i].last_checkin_ms) > supervised[i].deadline_ms) {
+            missed = i;
+            snapshot = supervised[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&supervised_lock);
+
+    if (missed < 0) {
+        return;
+    }
+
+    /* Build diagnostic record and persist it before resetting */
+    watchdog_diag_t *diag = &rtc_diag.diag;
+    memset(diag, 0, sizeof(*diag));
+    strncpy(diag->task_name, pcTaskGetName(snapshot.task), sizeof(diag->task_name) - 1);
+    strncpy(diag->checkpoint, snapshot.checkpoint ? snapshot.checkpoint : "none",
+            sizeof(diag->checkpoint) - 1);
+    diag->progress = snapshot.progress;
+    diag->deadline_ms = snapshot.deadline_ms;
+    diag->silent_ms = now - snapshot.last_checkin_ms;
+    diag->uptime_s = now / 1000;
+    diag->free_heap = esp_get_free_heap_size();
+    diag->min_free_heap = esp_get_minimum_free_heap_size();
+    diag->queue_depth = (uint32_t)alert_queue_get_count();
+    rtc_diag.crc = diag_crc(diag);
+    rtc_diag.magic = DIAG_MAGIC;
+
+    ESP_LOGE(TAG, "[WDT] Task '%s' missed deadline (%lu ms silent, deadline %lu ms, "
+             "checkpoint '%s') - resetting",
+             diag->task_name, diag->silent_ms, diag->deadline_ms, diag->checkpoint);
+
+    esp_restart();
+}
+
 esp_err_t watchdog_init(void)
 {
     if (initialized) {
@@ -15,6 +121,8 @@ esp_err_t watchdog_init(void)
         return ESP_OK;
     }
 
+    recover_rtc_diag();
+
     /* Configure Task Watchdog Timer */
     esp_task_wdt_config_t twdt_config = {
         .timeout_ms = WATCHDOG_TIMEOUT_SECONDS * 1000,
@@ -28,8 +136,25 @@ esp_err_t watchdog_init(void)
         return ret;
     }
 
+    /* Start software supervisor */
+    const esp_timer_create_args_t timer_args = {
+        .callback = supervisor_check,
+        .name = "wdt_supervisor",
+    };
+
+    ret = esp_timer_create(&timer_args, &supervisor_timer);
+    if (ret == ESP_OK) {
+        ret = esp_timer_start_periodic(supervisor_timer,
+                                       WATCHDOG_SUPERVISOR_PERIOD_MS * 1000ULL);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "[WDT] Failed to start supervisor: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
     initialized = true;
-    ESP_LOGI(TAG, "[WDT] Initialized (timeout: %d seconds)", WATCHDOG_TIMEOUT_SECONDS);
+    ESP_LOGI(TAG, "[WDT] Initialized (timeout: %d seconds, supervisor period: %d ms)",
+             WATCHDOG_TIMEOUT_SECONDS, WATCHDOG_SUPERVISOR_PERIOD_MS);
 
     return ESP_OK;
 }
@@ -67,5 +192,78 @@ esp_err_t watchdog_remove_task(TaskHandle_t task_handle)
         return ESP_ERR_INVALID_STATE;
     }
 
+    portENTER_CRITICAL(&supervised_lock);
+    for (int i = 0; i < WATCHDOG_MAX_SUPERVISED_TASKS; i++) {
+        if (supervised[i].in_use && supervised[i].task == task_handle) {
+            supervised[i].in_use = false;
+        }
+    }
+    portEXIT_CRITICAL(&supervised_lock);
+
     return esp_task_wdt_delete(task_handle);
 }
+
+esp_err_t watchdog_supervise(uint32_t deadline_ms, watchdog_task_id_t *out_id)
+{
+    if (out_id == NULL || deadline_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out_id = WATCHDOG_TASK_ID_INVALID;
+
+    portENTER_CRITICAL(&supervised_lock);
+    for (int i = 0; i < WATCHDOG_MAX_SUPERVISED_TASKS; i++) {
+        if (!supervised[i].in_use) {
+            supervised[i] = (supervised_task_t) {
+                .in_use = true,
+                .task = xTaskGetCurrentTaskHandle(),
+                .deadline_ms = deadline_ms,
+                .last_checkin_ms = now_ms(),
+                .progress = 0,
+                .checkpoint = "start",
+            };
+            *out_id = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&supervised_lock);
+
+    if (*out_id == WATCHDOG_TASK_ID_INVALID) {
+        ESP_LOGE(TAG, "[WDT] Supervisor table full (%d tasks)", WATCHDOG_MAX_SUPERVISED_TASKS);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "[WDT] Supervising task: %s (deadline: %lu ms)",
+             pcTaskGetName(NULL), deadline_ms);
+    return ESP_OK;
+}
+
+void watchdog_checkpoint(watchdog_task_id_t id, const char *label)
+{
+    if (id < 0 || id >= WATCHDOG_MAX_SUPERVISED_TASKS) {
+        return;
+    }
+
+    uint32_t now = now_ms();
+
+    portENTER_CRITICAL(&supervised_lock);
+    supervised[id].last_checkin_ms = now;
+    supervised[id].progress++;
+    supervised[id].checkpoint = label;
+    portEXIT_CRITICAL(&supervised_lock);
+}
+
+bool watchdog_get_last_diag(watchdog_diag_t *out_diag)
+{
+    if (!has_last_diag || out_diag == NULL) {
+        return false;
+    }
+
+    memcpy(out_diag, &last_diag, sizeof(last_diag));
+    return true;
+}
+
+void watchdog_clear_last_diag(void)
+{
+    has_last_diag = false;
+}
@@ -1,6 +1,8 @@
 #ifndef SAFESIGNAL_WATCHDOG_H
 #define SAFESIGNAL_WATCHDOG_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -12,14 +14,51 @@
  * - Detect task hangs and deadlocks
  * - Recover from interrupt handler failures
  * - Auto-reboot on critical failures
+ *
+ * A software supervisor runs on top of the hardware task watchdog (TWDT).
+ * Each supervised task declares its own liveness deadline and reports
+ * progress through checkpoints. When a task misses its deadline the
+ * supervisor saves a diagnostic record to RTC memory and resets the
+ * device; the record survives the reset and is published after reboot.
+ * The TWDT remains the backstop if the supervisor itself stops running.
  */
 
 #define WATCHDOG_TIMEOUT_SECONDS 30
 
+/* Software supervisor */
+#define WATCHDOG_MAX_SUPERVISED_TASKS 8
+#define WATCHDOG_SUPERVISOR_PERIOD_MS 1000
+#define WATCHDOG_CHECKPOINT_LABEL_LEN 16
+
+/**
+ * Handle for a task registered with the software supervisor
+ */
+typedef int watchdog_task_id_t;
+
+#define WATCHDOG_TASK_ID_INVALID (-1)
+
+/**
+ * Diagnostic record captured when a supervised task misses its deadline
+ * Stored in RTC memory so it survives the supervisor-triggered reset
+ */
+typedef struct {
+    char task_name[configMAX_TASK_NAME_LEN];
+    char checkpoint[WATCHDOG_CHECKPOINT_LABEL_LEN];  /* Last checkpoint reached */
+    uint32_t progress;          /* Checkpoints passed since registration */
+    uint32_t deadline_ms;       /* Declared liveness deadline */
+    uint32_t silent_ms;         /* Time since last checkpoint at detection */
+    uint32_t uptime_s;          /* Uptime when the miss was detected */
+    uint32_t free_heap;         /* Free heap at detection */
+    uint32_t min_free_heap;     /* Lowest free heap since boot */
+    uint32_t queue_depth;       /* Pending alerts in the persistent queue */
+} watchdog_diag_t;
+
 /**
  * Initialize watchdog subsystem
  * - Enables task watchdog timer (TWDT)
  * - Configures panic behavior on timeout
+ * - Recovers any diagnostic record left by a supervisor reset
+ * - Starts the software supervisor timer
  * @return ESP_OK on success
  */
 esp_err_t watchdog_init(void);
@@ -46,4 +85,34 @@ esp_err_t watchdog_feed(void);
  */
 esp_err_t watchdog_remove_task(TaskHandle_t task_handle);
 
+/**
+ * Register the calling task with the software supervisor
+ * The deadline clock starts immediately.
+ * @param deadline_ms Maximum time allowed between checkpoints
+ * @param out_id Supervisor handle used for checkpoints (output)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the table is full
+ */
+esp_err_t watchdog_supervise(uint32_t deadline_ms, watchdog_task_id_t *out_id);
+
+/**
+ * Report progress from a supervised task
+ * Restarts the task's deadline clock and records the checkpoint label.
+ * @param id Handle returned by watchdog_supervise()
+ * @param label Static string naming the point reached (not copied)
+ */
+void watchdog_checkpoint(watchdog_task_id_t id, const char *label);
+
+/**
+ * Get the diagnostic record from the previous boot, if any
+ * @param out_diag Diagnostic record (output)
+ * @return true if the last reset was caused by a missed deadline
+ */
+bool watchdog_get_last_diag(watchdog_diag_t *out_diag);
+
+/**
+ * Discard the diagnostic record from the previous boot
+ * Call once the record has been published.
+ */
+void watchdog_clear_last_diag(void);
+
 #endif /* SAFESIGNAL_WATCHDOG_H */
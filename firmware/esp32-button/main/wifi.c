@@ -1,6 +1,7 @@
 #include "wifi.h"
 #include "config.h"
 #include "provisioning.h"
+#include "ota_health.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -23,6 +24,7 @@ extern const int WIFI_CONNECTED_BIT;
 
 /* WiFi state */
 static bool connected = false;
+static bool started = false;
 static int8_t rssi = 0;
 
 /* Event handler */
@@ -57,6 +59,7 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                 ESP_LOGI(TAG, "[WIFI] Got IP address: " IPSTR, IP2STR(&event->ip_info.ip));
                 connected = true;
                 xEventGroupSetBits(system_events, WIFI_CONNECTED_BIT);
+                ota_health_on_wifi();
 
                 /* Get RSSI */
                 wifi_ap_record_t ap_info;
@@ -154,10 +157,37 @@ void wifi_init(void)
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
+    started = true;
+
+    runtime_config_t cfg;
+    runtime_config_snapshot(&cfg);
+    wifi_set_power_profile(cfg.power_profile);
 
     ESP_LOGI(TAG, "[WIFI] Connecting to '%s'...", wifi_ssid);
 }
 
+esp_err_t wifi_set_power_profile(power_profile_t profile)
+{
+    if (!started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    wifi_ps_type_t ps = WIFI_PS_MIN_MODEM;
+    if (profile == POWER_PROFILE_PERFORMANCE) {
+        ps = WIFI_PS_NONE;
+    } else if (profile == POWER_PROFILE_LOW) {
+        ps = WIFI_PS_MAX_MODEM;
+    }
+
+    esp_err_t ret = esp_wifi_set_ps(ps);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[WIFI] Failed to set power profile: %s", esp_err_to_name(ret));
+    } else {
+        ESP_LOGI(TAG, "[WIFI] Power profile: %s", runtime_config_power_profile_name(profile));
+    }
+    return ret;
+}
+
 bool wifi_is_connected(void)
 {
     return connected;
@@ -2,6 +2,7 @@
 #define SAFESIGNAL_WIFI_H
 
 #include "esp_err.h"
+#include "runtime_config.h"
 
 /**
  * Initialize WiFi subsystem and connect to configured network
@@ -20,4 +21,12 @@ bool wifi_is_connected(void);
  */
 int8_t wifi_get_rssi(void);
 
+/**
+ * Apply a power profile (modem sleep mode)
+ * wifi_init() applies the configured profile; call again after a change.
+ * @param profile Power profile
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE before WiFi is started
+ */
+esp_err_t wifi_set_power_profile(power_profile_t profile);
+
 #endif /* SAFESIGNAL_WIFI_H */
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+SafeSignal ESP32 Core Dump Collector and Decoder
+
+Reassembles core dumps uploaded by devices in chunks over MQTT and decodes
+them against the firmware ELF using the ESP-IDF esp-coredump tool.
+
+Chunk format (little endian, see main/coredump_upload.h):
+    magic u32 ("CDMP") | dump_size u32 | offset u32 | length u16 | reserved u16 | crc32 u32 | payload
+
+Usage:
+    # Collect dumps from the edge broker and decode each one as it completes
+    python decode_coredump.py --elf build/safesignal-button.elf \\
+        --mqtt-host edge-gateway.local \\
+        --ca ../../edge/certs/ca/ca.crt \\
+        --cert client.crt --key client.key
+
+    # Decode a dump that was already reassembled
+    python decode_coredump.py --elf build/safesignal-button.elf --core esp32-prod-001.core
+"""
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import time
+import zlib
+
+CHUNK_MAGIC = 0x504D4443
+HEADER = struct.Struct('<IIIHHI')
+TOPIC = 'safesignal/+/+/device/+/coredump'
+
+
+class DumpAssembler:
+    """Collects chunks for one device until the image is complete"""
+
+    def __init__(self, size):
+        self.size = size
+        self.data = bytearray(size)
+        self.received = set()
+        self.bytes = 0
+
+    def add(self, offset, payload):
+        if offset in self.received:
+            return
+        self.data[offset:offset + len(payload)] = payload
+        self.received.add(offset)
+        self.bytes += len(payload)
+
+    def complete(self):
+        return self.bytes >= self.size
+
+
+def parse_chunk(payload):
+    """Validate a chunk and return (dump_size, offset, data) or None"""
+    if len(payload) < HEADER.size:
+        return None
+
+    magic, dump_size, offset, length, _, crc = HEADER.unpack_from(payload)
+    data = payload[HEADER.size:HEADER.size + length]
+
+    if magic != CHUNK_MAGIC or len(data) != length:
+        return None
+    if offset + length > dump_size:
+        return None
+    if (zlib.crc32(data) & 0xFFFFFFFF) != crc:
+        return None
+
+    return dump_size, offset, data
+
+
+def decode(core_path, elf_path, chip):
+    """Run esp-coredump against the reassembled image"""
+    tool = shutil.which('esp-coredump')
+    cmd = [tool] if tool else [sys.executable, '-m', 'esp_coredump']
+    cmd += ['--chip', chip, 'info_corefile', '--core', core_path, '--core-format', 'raw', elf_path]
+
+    print(f"→ {' '.join(cmd)}")
+    try:
+        return subprocess.call(cmd)
+    except FileNotFoundError:
+        print("✗ esp-coredump not found. Run inside an ESP-IDF environment (. $IDF_PATH/export.sh)")
+        return 1
+
+
+def collect(args):
+    """Subscribe to the coredump topic and decode dumps as they complete"""
+    try:
+        import paho.mqtt.client as mqtt
+    except ImportError:
+        print("✗ paho-mqtt is required for collection: pip install paho-mqtt")
+        return 1
+
+    assemblers = {}
+    os.makedirs(args.output_dir, exist_ok=True)
+
+    def on_connect(client, userdata, flags, rc, *extra):
+        print(f"✓ Connected to {args.mqtt_host}:{args.mqtt_port}, waiting for dumps on {TOPIC}")
+        client.subscribe(TOPIC, qos=1)
+
+    def on_message(client, userdata, msg):
+        device_id = msg.topic.split('/')[4]
+        chunk = parse_chunk(msg.payload)
+        if chunk is None:
+            print(f"✗ {device_id}: invalid chunk ({len(msg.payload)} bytes), ignored")
+            return
+
+        dump_size, offset, data = chunk
+        asm = assemblers.get(device_id)
+        if asm is None or asm.size != dump_size:
+            asm = assemblers[device_id] = DumpAssembler(dump_size)
+            print(f"← {device_id}: new core dump ({dump_size} bytes)")
+
+        asm.add(offset, data)
+        print(f"← {device_id}: {asm.bytes}/{asm.size} bytes", end='\r')
+
+        if asm.complete():
+            path = os.path.join(args.output_dir, f"{device_id}-{int(time.time())}.core")
+            with open(path, 'wb') as f:
+                f.write(asm.data)
+            del assemblers[device_id]
+            print(f"\n✓ {device_id}: core dump saved to {path}")
+            decode(path, args.elf, args.chip)
+
+    client = mqtt.Client(client_id=args.client_id)
+    client.tls_set(ca_certs=args.ca, certfile=args.cert, keyfile=args.key)
+    client.on_connect = on_connect
+    client.on_message = on_message
+
+    try:
+        client.connect(args.mqtt_host, args.mqtt_port)
+        client.loop_forever()
+    except KeyboardInterrupt:
+        print("\nStopped")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Collect and decode SafeSignal ESP32 core dumps',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__
+    )
+
+    parser.add_argument('--elf', required=True,
+                        help='Firmware ELF matching the crashed build')
+    parser.add_argument('--chip', default='esp32s3',
+                        help='Target chip (default: esp32s3)')
+    parser.add_argument('--core',
+                        help='Decode an already reassembled core dump file')
+    parser.add_argument('--mqtt-host',
+                        help='Broker to collect dumps from')
+    parser.add_argument('--mqtt-port', type=int, default=8883,
+                        help='Broker TLS port (default: 8883)')
+    parser.add_argument('--ca', help='CA certificate (PEM)')
+    parser.add_argument('--cert', help='Client certificate (PEM)')
+    parser.add_argument('--key', help='Client private key (PEM)')
+    parser.add_argument('--client-id', default='coredump-collector',
+                        help='MQTT client ID')
+    parser.add_argument('--output-dir', default='coredumps',
+                        help='Where reassembled dumps are written')
+
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.elf):
+        print(f"✗ Error: ELF file not found: {args.elf}")
+        return 1
+
+    if args.core:
+        return decode(args.core, args.elf, args.chip)
+
+    if not args.mqtt_host:
+        print("✗ Error: specify --core or --mqtt-host")
+        return 1
+
+    return collect(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
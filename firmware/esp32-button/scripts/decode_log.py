@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""
+SafeSignal ESP32 Log Ring Decoder
+
+Formats raw log ring records captured with `log_dump --raw` on the device.
+The device stores only the tag/format string addresses and raw 32-bit
+arguments; this tool resolves the addresses against the firmware ELF and
+applies the format on the host.
+
+Record format (one per line, hex fields, see main/log_ring.c):
+    LR1 seq timestamp_us level tag_addr fmt_addr nargs a0 a1 a2 a3
+
+Usage:
+    # Decode a captured monitor log (other lines are ignored)
+    python decode_log.py --elf build/safesignal-button.elf monitor.txt
+
+    # Decode from a pipe
+    idf.py monitor | python decode_log.py --elf build/safesignal-button.elf -
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD = re.compile(
+    r'LR1 (\d+) (\d+) ([NEWIDV]) ([0-9a-fA-F]{8}) ([0-9a-fA-F]{8}) (\d+)'
+    r' ([0-9a-fA-F]{8}) ([0-9a-fA-F]{8}) ([0-9a-fA-F]{8}) ([0-9a-fA-F]{8})'
+)
+
+# printf conversion spec: flags, width, precision, length, conversion
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcspf%])')
+
+
+class ElfStrings:
+    """Reads NUL-terminated strings from the loaded sections of an ELF"""
+
+    def __init__(self, path):
+        try:
+            from elftools.elf.elffile import ELFFile
+        except ImportError:
+            raise SystemExit("✗ pyelftools is required: pip install pyelftools")
+
+        self.segments = []
+        with open(path, 'rb') as f:
+            elf = ELFFile(f)
+            for section in elf.iter_sections():
+                addr = section['sh_addr']
+                if addr == 0 or section['sh_type'] == 'SHT_NOBITS':
+                    continue
+                self.segments.append((addr, section.data()))
+
+    def read(self, addr):
+        for base, data in self.segments:
+            if base <= addr < base + len(data):
+                start = addr - base
+                end = data.find(b'\0', start)
+                if end < 0:
+                    end = len(data)
+                return data[start:end].decode('utf-8', errors='replace')
+        return None
+
+
+def format_entry(fmt, args, strings):
+    """Apply a C format string to raw 32-bit arguments"""
+    values = iter(args)
+
+    def convert(match):
+        flags, width, precision, _, conv = match.groups()
+        if conv == '%':
+            return '%'
+
+        raw = next(values, 0)
+        spec = '%' + flags + width + ('.' + precision if precision else '')
+
+        if conv in 'di':
+            return (spec + 'd') % struct.unpack('<i', struct.pack('<I', raw))[0]
+        if conv in 'ouxX':
+            return (spec + conv) % raw
+        if conv == 'c':
+            return (spec + 'c') % chr(raw & 0xFF)
+        if conv == 'p':
+            return '0x%08x' % raw
+        if conv == 's':
+            text = strings.read(raw)
+            return (spec + 's') % (text if text is not None else f'<0x{raw:08x}>')
+        return f'<%{conv}?>'
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode_line(line, strings):
+    """Decode one LR1 record, or return None if the line is not a record"""
+    match = RECORD.search(line)
+    if match is None:
+        return None
+
+    seq, ts, level = int(match.group(1)), int(match.group(2)), match.group(3)
+    tag_addr, fmt_addr = int(match.group(4), 16), int(match.group(5), 16)
+    nargs = int(match.group(6))
+    args = [int(match.group(i), 16) for i in range(7, 11)][:nargs]
+
+    tag = strings.read(tag_addr) or f'<0x{tag_addr:08x}>'
+    fmt = strings.read(fmt_addr)
+    if fmt is None:
+        text = f'<unknown format 0x{fmt_addr:08x}> ' + ' '.join(f'{a:#x}' for a in args)
+    else:
+        text = format_entry(fmt, args, strings)
+
+    return f'{level} ({ts // 1000}) {tag}: {text}  [#{seq}]'
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode SafeSignal ESP32 log ring dumps',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__
+    )
+
+    parser.add_argument('--elf', required=True,
+                        help='Firmware ELF matching the running build')
+    parser.add_argument('input', nargs='?', default='-',
+                        help='Captured log file, or - for stdin (default)')
+
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.elf):
+        print(f"✗ Error: ELF file not found: {args.elf}")
+        return 1
+
+    strings = ElfStrings(args.elf)
+    stream = sys.stdin if args.input == '-' else open(args.input, 'r', errors='replace')
+
+    decoded = 0
+    with stream:
+        for line in stream:
+            text = decode_line(line, strings)
+            if text is not None:
+                print(text)
+                decoded += 1
+
+    if decoded == 0:
+        print("✗ No LR1 records found (capture the output of 'log_dump --raw')")
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+SafeSignal ESP32 Alert Log Dump
+
+Decodes an image of the alert_log partition (append-only alert queue, see
+main/flash_log.c) and lists sectors and records, including tombstoned and
+corrupt ones.
+
+Layout (little endian):
+    sector header: magic "SLOG", version u16, slot_size u16, sector_seq u32, crc32
+    record slot:   state u32, magic "RCRD", seq u32, len u16, reserved u16, crc32, payload
+    state: 0x55AA55AA live, 0x00000000 deleted, 0xFFFFFFFF erased
+
+Usage:
+    # Read the partition (offset/size from partitions.csv)
+    esptool.py --port /dev/ttyUSB0 read_flash 0x5E2000 0x1E000 alert_log.bin
+
+    python dump_alert_log.py alert_log.bin
+    python dump_alert_log.py --all alert_log.bin     # include deleted records
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+SECTOR_SIZE = 4096
+SECTOR_HEADER = struct.Struct('<IHHII')
+RECORD_HEADER = struct.Struct('<IIIHHI')
+
+SECTOR_MAGIC = 0x474F4C53
+RECORD_MAGIC = 0x44524352
+FORMAT_VERSION = 1
+
+STATE_VALID = 0x55AA55AA
+STATE_DELETED = 0x00000000
+STATE_ERASED = 0xFFFFFFFF
+
+# queued_alert_t (main/alert_queue.h)
+ALERT = struct.Struct('<IIII32s32s32s32sB16s')
+
+MODES = {0: 'SILENT', 1: 'AUDIBLE', 2: 'LOCKDOWN', 3: 'EVACUATION'}
+
+
+def cstr(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', errors='replace')
+
+
+def decode_alert(payload):
+    if len(payload) < ALERT.size:
+        return '(payload too short: %d bytes)' % len(payload)
+    (alert_id, timestamp, _retry, _created, device, _tenant, building, room,
+     mode, version) = ALERT.unpack_from(payload)
+    return 'alert=%u ts=%u device=%s location=%s/%s mode=%s fw=%s' % (
+        alert_id, timestamp, cstr(device), cstr(building), cstr(room),
+        MODES.get(mode, str(mode)), cstr(version))
+
+
+def dump(image, show_all):
+    live = deleted = corrupt = 0
+
+    for sector in range(len(image) // SECTOR_SIZE):
+        base = sector * SECTOR_SIZE
+        data = image[base:base + SECTOR_SIZE]
+        magic, version, slot_size, sector_seq, crc = SECTOR_HEADER.unpack_from(data)
+
+        if data[:SECTOR_HEADER.size] == b'\xff' * SECTOR_HEADER.size:
+            print('sector %2d  erased' % sector)
+            continue
+        if (magic != SECTOR_MAGIC or version != FORMAT_VERSION or
+                crc != zlib.crc32(data[:12]) or slot_size < RECORD_HEADER.size):
+            print('sector %2d  BAD header' % sector)
+            continue
+
+        print('sector %2d  seq %u  slot %u' % (sector, sector_seq, slot_size))
+
+        for offset in range(SECTOR_HEADER.size, SECTOR_SIZE - slot_size + 1, slot_size):
+            slot = data[offset:offset + slot_size]
+            state, rmagic, seq, length, reserved, rcrc = RECORD_HEADER.unpack_from(slot)
+
+            if slot[:RECORD_HEADER.size] == b'\xff' * RECORD_HEADER.size:
+                break   # Write head: rest of the sector is unwritten
+
+            payload = slot[RECORD_HEADER.size:RECORD_HEADER.size + length]
+            valid = (rmagic == RECORD_MAGIC and
+                     RECORD_HEADER.size + length <= slot_size and
+                     rcrc == zlib.crc32(payload, zlib.crc32(slot[4:16])))
+
+            if not valid:
+                corrupt += 1
+                label = 'CORRUPT'
+            elif state == STATE_VALID:
+                live += 1
+                label = 'live'
+            elif state == STATE_DELETED:
+                deleted += 1
+                if not show_all:
+                    continue
+                label = 'deleted'
+            else:
+                corrupt += 1
+                label = 'state=%08x' % state
+
+            detail = decode_alert(payload) if valid else ''
+            print('  +%04x seq %-8u %-8s %s' % (offset, seq, label, detail))
+
+    print('\n%d live, %d deleted, %d corrupt' % (live, deleted, corrupt))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a SafeSignal alert_log partition image')
+    parser.add_argument('image', help='Partition image (esptool.py read_flash)')
+    parser.add_argument('--all', action='store_true', help='Include deleted records')
+    args = parser.parse_args()
+
+    try:
+        with open(args.image, 'rb') as f:
+            image = f.read()
+    except OSError as e:
+        print('Cannot read %s: %s' % (args.image, e), file=sys.stderr)
+        return 1
+
+    dump(image, args.all)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,304 @@
+#!/usr/bin/env python3
+"""
+SafeSignal Delta OTA Patches
+
+Builds a compressed binary patch that turns the image a device is running
+into a new one (main/ota.h, delta mode). The device applies it while it
+downloads: bytes are copied from its running partition or taken from the
+patch, and the reconstructed image is hashed and checked like a full one.
+
+Patch stream (zlib, OTA_DELTA_WINDOW_BITS window), little endian:
+    header  magic u32 ("SSDP") | format u8 | reserved 3 | target size u32
+    COPY    0x01 | src u32 | len u32              -> base[src:src+len]
+    ADD     0x02 | src u32 | len u32 | len bytes  -> base[src+i] + byte[i] (mod 256)
+    INSERT  0x03 | len u32 | len bytes            -> bytes
+    END     0x00
+
+ADD carries regions that match the base except for a few bytes (relocated
+addresses after code moved); its difference bytes are mostly zero and
+compress to almost nothing.
+
+The base is identified by its ELF SHA-256 (esp_app_desc_t.app_elf_sha256),
+which the device compares before accepting the patch.
+
+Usage:
+    # Patch from the running build to a new one
+    python ota_delta.py make --base v1.2.0.bin --target v1.3.0.bin -o v1.2.0-v1.3.0.patch
+
+    # Size/time report over a series of builds (each against its predecessor)
+    python ota_delta.py report build/v1.0.0.bin build/v1.1.0.bin build/v1.2.0.bin --rate 8192
+
+    # Every build against the last one (what a mixed fleet would download)
+    python ota_delta.py report --to-last build/*.bin
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+PATCH_MAGIC = 0x50445353        # "SSDP"
+PATCH_FORMAT = 1
+WINDOW_BITS = 13                # OTA_DELTA_WINDOW_BITS: device dictionary is 8 KB
+HEADER = struct.Struct('<IB3xI')
+
+OP_END, OP_COPY, OP_ADD, OP_INSERT = 0, 1, 2, 3
+
+BLOCK = 32          # Anchor length for exact matches
+STEP = 4            # Base is indexed every STEP bytes
+MIN_COPY = 24       # Shorter exact matches are cheaper as ADD/INSERT
+ADD_MIN_SCORE = 8   # Approximate extension must beat INSERT by this many matches
+
+APP_DESC_OFFSET = 32            # Image header (24) + first segment header (8)
+APP_DESC_MAGIC = 0xABCD5432
+
+
+def app_desc(image):
+    """Return (version, project, elf_sha256) from an application image"""
+    magic, = struct.unpack_from('<I', image, APP_DESC_OFFSET)
+    if image[0] != 0xE9 or magic != APP_DESC_MAGIC:
+        raise ValueError('not an ESP application image')
+    version = image[APP_DESC_OFFSET + 16:APP_DESC_OFFSET + 48].split(b'\0')[0].decode()
+    project = image[APP_DESC_OFFSET + 48:APP_DESC_OFFSET + 80].split(b'\0')[0].decode()
+    elf_sha = image[APP_DESC_OFFSET + 144:APP_DESC_OFFSET + 176]
+    return version, project, elf_sha
+
+
+def match_length(a, ai, b, bi, limit):
+    """Length of the common run of a[ai:] and b[bi:], at most limit"""
+    n = 0
+    while n < limit:
+        step = min(64, limit - n)
+        if a[ai + n:ai + n + step] == b[bi + n:bi + n + step]:
+            n += step
+            continue
+        while n < limit and a[ai + n] == b[bi + n]:
+            n += 1
+        break
+    return n
+
+
+def approx_prefix(base, src, target, start, end):
+    """Longest prefix of target[start:end] worth encoding as ADD from base[src:]"""
+    limit = min(end - start, len(base) - src, 4096)
+    score = best = best_len = 0
+    for i in range(limit):
+        score += 1 if base[src + i] == target[start + i] else -1
+        if score > best:
+            best, best_len = score, i + 1
+    return best_len if best >= ADD_MIN_SCORE or (best_len and best_len == end - start) else 0
+
+
+class PatchWriter:
+    def __init__(self, target_size):
+        self.out = bytearray(HEADER.pack(PATCH_MAGIC, PATCH_FORMAT, target_size))
+        self.ops = {'copy': 0, 'add': 0, 'insert': 0}
+        self.bytes = {'copy': 0, 'add': 0, 'insert': 0}
+
+    def copy(self, src, length):
+        self.out += struct.pack('<BII', OP_COPY, src, length)
+        self.ops['copy'] += 1
+        self.bytes['copy'] += length
+
+    def add(self, base, src, data):
+        diff = bytes((d - base[src + i]) & 0xFF for i, d in enumerate(data))
+        self.out += struct.pack('<BII', OP_ADD, src, len(data)) + diff
+        self.ops['add'] += 1
+        self.bytes['add'] += len(data)
+
+    def insert(self, data):
+        self.out += struct.pack('<BI', OP_INSERT, len(data)) + data
+        self.ops['insert'] += 1
+        self.bytes['insert'] += len(data)
+
+    def finish(self):
+        self.out.append(OP_END)
+        comp = zlib.compressobj(9, zlib.DEFLATED, WINDOW_BITS, 9)
+        return comp.compress(bytes(self.out)) + comp.flush()
+
+
+def make_patch(base, target):
+    """Return (patch bytes, PatchWriter with op statistics)"""
+    index = {}
+    for i in range(len(base) - BLOCK, -1, -STEP):
+        index[base[i:i + BLOCK]] = i        # Lowest offset wins
+
+    writer = PatchWriter(len(target))
+    pos = 0             # Target bytes already encoded
+    last_src = None     # Base offset following the previous COPY
+
+    def emit_gap(end):
+        nonlocal pos
+        while pos < end:
+            n = 0
+            if last_src is not None:
+                src = last_src + (pos - copy_end)
+                if 0 <= src < len(base):
+                    n = approx_prefix(base, src, target, pos, end)
+            if n:
+                writer.add(base, src, target[pos:pos + n])
+            else:
+                n = end - pos
+                writer.insert(target[pos:end])
+            pos += n
+
+    copy_end = 0
+    j = 0
+    n = len(target)
+    while j + BLOCK <= n:
+        # Same alignment as the previous copy first: code that did not move
+        src = None
+        if last_src is not None:
+            guess = last_src + (j - copy_end)
+            if 0 <= guess <= len(base) - BLOCK and base[guess:guess + BLOCK] == target[j:j + BLOCK]:
+                src = guess
+        if src is None:
+            src = index.get(target[j:j + BLOCK])
+        if src is None:
+            j += 1
+            continue
+
+        length = BLOCK + match_length(base, src + BLOCK, target, j + BLOCK,
+                                      min(len(base) - src, n - j) - BLOCK)
+        while j > pos and src > 0 and base[src - 1] == target[j - 1]:
+            j -= 1
+            src -= 1
+            length += 1
+        if length < MIN_COPY:
+            j += 1
+            continue
+
+        emit_gap(j)
+        writer.copy(src, length)
+        pos = j = j + length
+        last_src, copy_end = src + length, pos
+
+    emit_gap(n)
+    return writer.finish(), writer
+
+
+def apply_patch(base, patch):
+    """Reference implementation of the device side (main/ota.c)"""
+    data = zlib.decompress(patch, WINDOW_BITS)
+    magic, fmt, size = HEADER.unpack_from(data)
+    if magic != PATCH_MAGIC or fmt != PATCH_FORMAT:
+        raise ValueError('bad patch header')
+    out = bytearray()
+    p = HEADER.size
+    while True:
+        op = data[p]
+        if op == OP_END:
+            break
+        if op == OP_INSERT:
+            length, = struct.unpack_from('<I', data, p + 1)
+            out += data[p + 5:p + 5 + length]
+            p += 5 + length
+            continue
+        src, length = struct.unpack_from('<II', data, p + 1)
+        p += 9
+        if op == OP_COPY:
+            out += base[src:src + length]
+        elif op == OP_ADD:
+            out += bytes((base[src + i] + data[p + i]) & 0xFF for i in range(length))
+            p += length
+        else:
+            raise ValueError(f'bad op {op}')
+    if len(out) != size:
+        raise ValueError('size mismatch')
+    return bytes(out)
+
+
+def build(base, target):
+    """Make a patch and check it reconstructs the target"""
+    start = time.monotonic()
+    patch, writer = make_patch(base, target)
+    elapsed = time.monotonic() - start
+    if apply_patch(base, patch) != target:
+        raise RuntimeError('patch does not reproduce the target image')
+    return patch, writer, elapsed
+
+
+def read_image(path):
+    with open(path, 'rb') as f:
+        image = f.read()
+    try:
+        app_desc(image)
+    except (ValueError, struct.error):
+        sys.exit(f"{path}: not an ESP application image")
+    return image
+
+
+def cmd_make(args):
+    base = read_image(args.base)
+    target = read_image(args.target)
+    patch, writer, elapsed = build(base, target)
+    with open(args.output, 'wb') as f:
+        f.write(patch)
+
+    base_version, _, base_sha = app_desc(base)
+    target_version, _, _ = app_desc(target)
+    print(f"{base_version} -> {target_version}: {len(target)} bytes -> {len(patch)} byte patch "
+          f"({100 * len(patch) / len(target):.1f}%) in {elapsed:.1f} s")
+    print(f"  ops: {writer.ops}, bytes: {writer.bytes}")
+    print(f"  base ELF sha256: {base_sha.hex()}")
+    print(f"  target sha256:   {hashlib.sha256(target).hexdigest()}")
+    return 0
+
+
+def cmd_report(args):
+    images = [(path, read_image(path)) for path in args.builds]
+    if len(images) < 2:
+        sys.exit('report needs at least two builds')
+    if args.to_last:
+        pairs = [(images[i], images[-1]) for i in range(len(images) - 1)]
+    else:
+        pairs = list(zip(images, images[1:]))
+
+    print(f"Airtime at {args.rate} B/s per device; full = image as pushed by ota_push.py without --base")
+    print()
+    print(f"| Base | Target | Image | Deflated | Patch | Patch/Image | Full airtime | Delta airtime | Diff time |")
+    print(f"|------|--------|-------|----------|-------|-------------|--------------|---------------|-----------|")
+    total_full = total_patch = 0
+    for (base_path, base), (target_path, target) in pairs:
+        patch, _, elapsed = build(base, target)
+        deflated = len(zlib.compress(target, 9))
+        total_full += len(target)
+        total_patch += len(patch)
+        print(f"| {app_desc(base)[0]} | {app_desc(target)[0]} | {len(target) // 1024} KB "
+              f"| {deflated // 1024} KB | {len(patch) / 1024:.1f} KB "
+              f"| {100 * len(patch) / len(target):.1f}% "
+              f"| {len(target) / args.rate:.0f} s | {len(patch) / args.rate:.0f} s | {elapsed:.1f} s |")
+    print()
+    print(f"Total: {total_full // 1024} KB full, {total_patch // 1024} KB delta "
+          f"({total_full / max(total_patch, 1):.1f}x less airtime)")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Build SafeSignal delta OTA patches',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__
+    )
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    make = sub.add_parser('make', help='Build one patch')
+    make.add_argument('--base', required=True, help='Image the devices are running')
+    make.add_argument('--target', required=True, help='New image')
+    make.add_argument('-o', '--output', required=True, help='Patch file')
+
+    report = sub.add_parser('report', help='Patch sizes over a series of builds')
+    report.add_argument('builds', nargs='+', help='Application images, oldest first')
+    report.add_argument('--to-last', action='store_true',
+                        help='Diff every build against the last one instead of its successor')
+    report.add_argument('--rate', type=int, default=8192,
+                        help='Per-device rate for airtime (bytes/s, default: 8192)')
+
+    args = parser.parse_args()
+    return cmd_make(args) if args.command == 'make' else cmd_report(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
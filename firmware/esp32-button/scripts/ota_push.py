@@ -0,0 +1,293 @@
+#!/usr/bin/env python3
+"""
+SafeSignal OTA Push
+
+Rolls a firmware image out to buttons over MQTT (main/ota.h). For each
+device the tool sends a signed ota_begin command, then answers the device's
+chunk requests. Devices pull at the rate in the manifest and pause on their
+own while alerts are pending, so the edge only decides how many devices
+download at once.
+
+    device -> .../device/{id}/ota/req     {"version","offset","len"}
+    edge   -> .../device/{id}/ota/data    header + payload
+    device -> .../device/{id}/ota/status  {"state","version","offset","size",...}
+
+Chunk format (little endian):
+    magic u32 ("OTAC") | offset u32 | length u16 | reserved u16 | crc32 u32 | payload
+
+A device that goes quiet (reboot, power loss) gets ota_begin again and
+resumes from its last checkpoint (a delta starts over).
+
+A device is done only when the new image confirms itself: after the
+restart it must pass the health gate (ota_health.h) and report
+{"health":"valid"}. A rollback ({"health":"rolled_back"}) or no
+confirmation within CONFIRM_TIMEOUT_S counts as a failure, and new devices
+stop being started once --max-failed devices failed.
+
+With --base the devices download a patch against the image they run
+(ota_delta.py) instead of the image; offsets are then patch offsets. A
+device running another build rejects the patch (ESP_ERR_INVALID_VERSION).
+
+Usage:
+    python ota_push.py --image build/safesignal-button.bin --version 1.3.0 \\
+        --sign-key ../../edge/certs/ca/ca.key \\
+        --mqtt-host edge-gateway.local --ca ca.crt --cert admin.crt --key admin.key \\
+        --tenant tenant-a --building building-a \\
+        --devices esp32-dev-001 esp32-dev-002 --parallel 4 --rate 8192
+
+    # Delta from the build the devices run
+    python ota_push.py --image build/safesignal-button.bin --version 1.3.0 \\
+        --base releases/1.2.0.bin ...
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import struct
+import sys
+import threading
+import time
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from sign_config import check_id, sign  # noqa: E402
+from ota_delta import app_desc, build  # noqa: E402
+
+CHUNK_MAGIC = 0x4341544F
+HEADER = struct.Struct('<IIHHI')
+CHUNK_SIZE = 4096
+RATE_MIN, RATE_MAX = 1024, 65536
+QUIET_RESEND_S = 60     # ota_begin again when a device stops requesting
+CONFIRM_TIMEOUT_S = 420 # OTA_HEALTH_TIMEOUT_MS plus download-to-restart margin
+CMD_MAX_PAYLOAD = 1024  # MQTT_CMD_MAX_PAYLOAD
+
+
+class Rollout:
+    """Per-device state of one rollout"""
+
+    def __init__(self, args, image, patch=None, base_sha=None):
+        self.args = args
+        self.image = image
+        self.sha256 = hashlib.sha256(image).hexdigest()
+        self.patch = patch
+        self.base_sha = base_sha
+        self.payload = patch if patch is not None else image    # What devices download
+        self.waiting = list(args.devices)
+        self.active = {}        # device -> last activity (monotonic)
+        self.confirming = {}    # device -> ready time (monotonic), restarting into the image
+        self.done = []
+        self.failed = {}
+        self.started = {}
+
+    def topic(self, device, leaf):
+        return f"safesignal/{self.args.tenant}/{self.args.building}/device/{device}/{leaf}"
+
+    def begin_payload(self, device):
+        fields = [('device', device), ('version', self.args.version),
+                  ('size', len(self.image)), ('sha256', self.sha256)]
+        if self.patch is not None:
+            fields += [('patch', len(self.patch)), ('base', self.base_sha.hex())]
+        fields.append(('rate', self.args.rate))
+        signed = ''.join(f"{key}={value}\n" for key, value in fields).encode()
+        doc = {'cmd': 'ota_begin', 'id': 'ota'}
+        doc.update(fields)
+        doc['sig'] = sign(self.args.sign_key, signed)
+        return json.dumps(doc, separators=(',', ':'))
+
+    def send_begin(self, client, device):
+        client.publish(self.topic(device, 'cmd'), self.begin_payload(device), qos=1)
+        self.active[device] = time.monotonic()
+        self.started.setdefault(device, time.monotonic())
+
+    def fill(self, client):
+        if len(self.failed) >= self.args.max_failed:
+            return
+        # Devices still confirming hold their slot: a bad image stops the rollout early
+        while self.waiting and len(self.active) + len(self.confirming) < self.args.parallel:
+            device = self.waiting.pop(0)
+            print(f"→ {device}: ota_begin {self.args.version} ({len(self.payload)} bytes)")
+            self.send_begin(client, device)
+
+    def on_request(self, client, device, req):
+        if device not in self.active or req.get('version') != self.args.version:
+            return
+        offset, length = int(req['offset']), int(req['len'])
+        if offset < 0 or length <= 0 or length > CHUNK_SIZE or offset + length > len(self.payload):
+            print(f"✗ {device}: bad request {req}")
+            return
+
+        data = self.payload[offset:offset + length]
+        header = HEADER.pack(CHUNK_MAGIC, offset, length, 0, zlib.crc32(data) & 0xFFFFFFFF)
+        client.publish(self.topic(device, 'ota/data'), header + data, qos=1)
+        self.active[device] = time.monotonic()
+        print(f"  {device}: {offset + length}/{len(self.payload)}", end='\r')
+
+    def on_health(self, client, device, status):
+        if device not in self.confirming:
+            return
+        health = status.get('health')
+        if health == 'valid' and status.get('running') == self.args.version:
+            elapsed = time.monotonic() - self.started[device]
+            print(f"\n✓ {device}: {self.args.version} confirmed in {elapsed:.0f} s "
+                  f"(WiFi {status.get('wifiMs')} ms, MQTT {status.get('mqttMs')} ms, "
+                  f"PUBACK {status.get('pubackMs')} ms, valid {status.get('validMs')} ms)")
+            del self.confirming[device]
+            self.done.append(device)
+        elif health == 'rolled_back' and status.get('failed') == self.args.version:
+            print(f"\n✗ {device}: rolled back to {status.get('running')}")
+            del self.confirming[device]
+            self.failed[device] = 'rolled back'
+        else:
+            return
+        self.fill(client)
+
+    def on_status(self, client, device, status):
+        if 'health' in status:
+            self.on_health(client, device, status)
+            return
+        if device not in self.active:
+            return
+        state = status.get('state')
+        self.active[device] = time.monotonic()
+        print(f"\n← {device}: {state} {status.get('offset')}/{status.get('size')}"
+              f"{' held' if status.get('held') else ''}")
+
+        if state == 'ready' and status.get('version') == self.args.version:
+            elapsed = time.monotonic() - self.started[device]
+            print(f"… {device}: verified in {elapsed:.0f} s, restarting into {self.args.version}")
+            del self.active[device]
+            self.confirming[device] = time.monotonic()
+        elif state == 'failed':
+            print(f"✗ {device}: {status.get('error')}")
+            del self.active[device]
+            self.failed[device] = status.get('error')
+        self.fill(client)
+
+    def check_quiet(self, client):
+        now = time.monotonic()
+        for device, last in list(self.active.items()):
+            if now - last > QUIET_RESEND_S:
+                print(f"\n… {device}: no requests for {QUIET_RESEND_S} s, sending ota_begin again")
+                self.send_begin(client, device)
+        for device, since in list(self.confirming.items()):
+            if now - since > CONFIRM_TIMEOUT_S:
+                print(f"\n✗ {device}: no health confirmation after {CONFIRM_TIMEOUT_S} s")
+                del self.confirming[device]
+                self.failed[device] = 'not confirmed'
+        self.fill(client)
+
+    def finished(self):
+        stopped = len(self.failed) >= self.args.max_failed
+        return (not self.waiting or stopped) and not self.active and not self.confirming
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Push a firmware image to SafeSignal buttons over MQTT',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__
+    )
+    parser.add_argument('--image', required=True, help='Application binary (build/*.bin)')
+    parser.add_argument('--version', required=True, help='Version string of the image')
+    parser.add_argument('--sign-key', required=True, help='CA private key (PEM)')
+    parser.add_argument('--base', help='Image the devices run: push a delta patch against it')
+    parser.add_argument('--tenant', required=True)
+    parser.add_argument('--building', required=True)
+    parser.add_argument('--devices', required=True, nargs='+', help='Device IDs')
+    parser.add_argument('--parallel', type=int, default=4,
+                        help='Devices downloading at once (default: 4)')
+    parser.add_argument('--max-failed', type=int, default=1,
+                        help='Stop starting devices after this many failures (default: 1)')
+    parser.add_argument('--rate', type=int, default=8192,
+                        help=f'Bytes/s per device, {RATE_MIN}-{RATE_MAX} (default: 8192)')
+    parser.add_argument('--mqtt-host', required=True)
+    parser.add_argument('--mqtt-port', type=int, default=8883)
+    parser.add_argument('--ca', required=True, help='CA certificate (PEM)')
+    parser.add_argument('--cert', required=True, help='Client certificate (PEM)')
+    parser.add_argument('--key', required=True, help='Client private key (PEM)')
+    parser.add_argument('--client-id', default='ota-push')
+    args = parser.parse_args()
+
+    try:
+        import paho.mqtt.client as mqtt
+    except ImportError:
+        print("✗ paho-mqtt is required: pip install paho-mqtt")
+        return 1
+
+    check_id('version', args.version, 32)
+    for device in args.devices:
+        check_id('device', device, 32)
+    if not RATE_MIN <= args.rate <= RATE_MAX:
+        sys.exit(f"rate: {RATE_MIN}-{RATE_MAX} bytes/s")
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    if not image or image[0] != 0xE9:
+        sys.exit(f"{args.image} is not an ESP application image")
+
+    patch = base_sha = None
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+        try:
+            base_version, _, base_sha = app_desc(base)
+        except (ValueError, struct.error):
+            sys.exit(f"{args.base} is not an ESP application image")
+        patch, _, elapsed = build(base, image)
+        print(f"Patch from {base_version}: {len(patch)} bytes "
+              f"({100 * len(patch) / len(image):.1f}% of the image) in {elapsed:.1f} s")
+
+    rollout = Rollout(args, image, patch, base_sha)
+    if len(rollout.begin_payload(max(args.devices, key=len))) > CMD_MAX_PAYLOAD:
+        sys.exit(f"ota_begin exceeds {CMD_MAX_PAYLOAD} bytes with this signing key")
+    lock = threading.Lock()     # Callbacks run on the network thread
+    print(f"Image {args.version}: {len(image)} bytes, sha256 {rollout.sha256}")
+    print(f"{len(args.devices)} devices, {args.parallel} at a time, {args.rate} B/s each")
+
+    def on_connect(client, userdata, flags, rc, *extra):
+        base = f"safesignal/{args.tenant}/{args.building}/device/+/ota/"
+        client.subscribe([(base + 'req', 0), (base + 'status', 1)])
+        with lock:
+            rollout.fill(client)
+
+    def on_message(client, userdata, msg):
+        device = msg.topic.split('/')[4]
+        try:
+            body = json.loads(msg.payload)
+        except ValueError:
+            return
+        with lock:
+            if msg.topic.endswith('/ota/req'):
+                rollout.on_request(client, device, body)
+            else:
+                rollout.on_status(client, device, body)
+
+    client = mqtt.Client(client_id=args.client_id)
+    client.tls_set(ca_certs=args.ca, certfile=args.cert, keyfile=args.key)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.mqtt_host, args.mqtt_port)
+    client.loop_start()
+
+    try:
+        while True:
+            time.sleep(1)
+            with lock:
+                if rollout.finished():
+                    break
+                rollout.check_quiet(client)
+    except KeyboardInterrupt:
+        print("\nStopped (devices keep their checkpoint; run again to resume)")
+    finally:
+        client.loop_stop()
+
+    print(f"\n{len(rollout.done)} updated, {len(rollout.failed)} failed, "
+          f"{len(rollout.waiting)} not started")
+    for device, error in rollout.failed.items():
+        print(f"  ✗ {device}: {error}")
+    return 0 if not rollout.failed and not rollout.waiting else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
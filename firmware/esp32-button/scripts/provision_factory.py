@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""
+SafeSignal Factory Provisioning Station
+
+Provisions many ESP32 devices in parallel, one per serial port, using the
+binary provisioning protocol (main/prov_uart.h): CRC-framed requests at a
+negotiated baud rate, certificates sent in chunks, and everything written to
+NVS in one commit on the device. Prints per-device timings and a throughput
+summary.
+
+Manifest (CSV, header required; cert/key default to <cert-dir>/<device_id>.crt/.key):
+    port,device_id,tenant,building,room[,cert,key]
+    /dev/ttyUSB0,esp32-prod-001,tenant-a,building-a,room-1
+    /dev/ttyUSB1,esp32-prod-002,tenant-a,building-a,room-2
+
+Usage:
+    python provision_factory.py --manifest devices.csv \\
+        --wifi-ssid "SafeSignal-Edge" --wifi-pass "password123" \\
+        --ca ../../edge/certs/ca/ca.crt --cert-dir ../../edge/certs/devices
+
+    python provision_factory.py ... --baud 921600 --reboot
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import threading
+import time
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+
+import serial
+
+PROTOCOL_VERSION = 1
+CONSOLE_BAUD = 115200
+SYNC = b'\xa5\x5a'
+HEADER = struct.Struct('<BBH')
+REPLY_FLAG = 0x80
+
+HELLO, SET, BEGIN, DATA, END, COMMIT, GET, EXIT = range(1, 9)
+NAK = 0xFF
+
+# SET/GET field order (main/prov_uart.c)
+FIELD_WIFI_SSID, FIELD_WIFI_PASS, FIELD_DEVICE_ID, FIELD_TENANT, FIELD_BUILDING, FIELD_ROOM = range(6)
+SLOT_CA, SLOT_CLIENT, SLOT_KEY = range(3)
+
+COMMIT_FLAG_MARK = 0x01
+EXIT_FLAG_REBOOT = 0x01
+
+# esp_err_t values the device reports
+ERRORS = {
+    0x101: 'ESP_ERR_NO_MEM', 0x102: 'ESP_ERR_INVALID_ARG', 0x103: 'ESP_ERR_INVALID_STATE',
+    0x104: 'ESP_ERR_INVALID_SIZE', 0x105: 'ESP_ERR_NOT_FOUND', 0x106: 'ESP_ERR_NOT_SUPPORTED',
+    0x107: 'ESP_ERR_TIMEOUT', 0x109: 'ESP_ERR_INVALID_CRC',
+}
+
+RETRIES = 5
+REPLY_TIMEOUT = 1.0
+ENTER_TIMEOUT = 5.0
+
+print_lock = threading.Lock()
+
+
+def log(port, message):
+    with print_lock:
+        print('%-14s %s' % (port, message), flush=True)
+
+
+class ProvisionError(Exception):
+    pass
+
+
+def error_name(status):
+    return ERRORS.get(status, '0x%x' % status)
+
+
+class Link:
+    """Framed request/reply over one serial port"""
+
+    def __init__(self, port):
+        self.port = port
+        self.ser = serial.Serial(port, CONSOLE_BAUD, timeout=0.05)
+        self.seq = 0
+        self.rx = b''
+        self.bytes_sent = 0
+        self.retries = 0
+
+    def close(self):
+        self.ser.close()
+
+    def send(self, ftype, payload=b''):
+        self.seq = (self.seq + 1) & 0xFF
+        self.frame = self._encode(ftype, self.seq, payload)
+        self._write()
+
+    def _encode(self, ftype, seq, payload):
+        body = HEADER.pack(ftype, seq, len(payload)) + payload
+        return SYNC + body + struct.pack('<I', zlib.crc32(body))
+
+    def _write(self):
+        self.ser.write(self.frame)
+        self.bytes_sent += len(self.frame)
+
+    def _read_reply(self, timeout):
+        """Next valid frame, None on timeout (damaged bytes are skipped)"""
+        deadline = time.monotonic() + timeout
+        while True:
+            start = self.rx.find(SYNC)
+            if start >= 0:
+                self.rx = self.rx[start:]
+                if len(self.rx) >= 2 + HEADER.size:
+                    ftype, seq, length = HEADER.unpack_from(self.rx, 2)
+                    end = 2 + HEADER.size + length + 4
+                    if len(self.rx) >= end:
+                        body = self.rx[2:end - 4]
+                        (crc,) = struct.unpack_from('<I', self.rx, end - 4)
+                        if crc == zlib.crc32(body) and length >= 4:
+                            self.rx = self.rx[end:]
+                            (status,) = struct.unpack_from('<i', body, HEADER.size)
+                            return ftype, seq, status & 0xFFFFFFFF, body[HEADER.size + 4:]
+                        self.rx = self.rx[2:]   # False sync or damaged frame
+                        continue
+            elif len(self.rx) > 1:
+                self.rx = self.rx[-1:]
+
+            if time.monotonic() >= deadline:
+                return None
+            self.rx += self.ser.read(max(1, self.ser.in_waiting))
+
+    def request(self, ftype, payload=b'', timeout=REPLY_TIMEOUT):
+        """Send and wait for the reply; resends on NAK or timeout"""
+        self.send(ftype, payload)
+        for attempt in range(RETRIES):
+            if attempt > 0:
+                self.retries += 1
+                self._write()
+            deadline = time.monotonic() + timeout
+            while time.monotonic() < deadline:
+                reply = self._read_reply(deadline - time.monotonic())
+                if reply is None:
+                    break
+                rtype, seq, status, data = reply
+                if rtype == NAK:
+                    break
+                if rtype == ftype | REPLY_FLAG and seq == self.seq:
+                    return status, data
+        raise ProvisionError('no reply to frame type %d' % ftype)
+
+    def check(self, ftype, payload=b'', what=''):
+        status, data = self.request(ftype, payload)
+        if status != 0:
+            raise ProvisionError('%s failed: %s' % (what or 'frame %d' % ftype, error_name(status)))
+        return data
+
+
+def enter_binary_mode(link, baud):
+    """Start provision_binary on the console and negotiate the baud rate"""
+    link.ser.reset_input_buffer()
+    link.ser.write(b'\r\nprovision_binary\r\n')
+
+    hello = struct.pack('<BI', PROTOCOL_VERSION, baud)
+    deadline = time.monotonic() + ENTER_TIMEOUT
+    reply = None
+    while reply is None and time.monotonic() < deadline:
+        try:
+            reply = link.request(HELLO, hello, timeout=0.3)
+        except ProvisionError:
+            pass
+    if reply is None:
+        raise ProvisionError('device did not enter binary mode (firmware without provision_binary?)')
+
+    status, data = reply
+    if status != 0 or len(data) < 13:
+        raise ProvisionError('HELLO rejected: %s' % error_name(status))
+
+    version, max_payload, accepted = struct.unpack_from('<BHI', data)
+    mac = ':'.join('%02x' % b for b in data[7:13])
+    firmware = data[13:].decode('utf-8', errors='replace')
+
+    if accepted != CONSOLE_BAUD:
+        link.ser.flush()
+        link.ser.baudrate = accepted
+        try:
+            link.check(HELLO, struct.pack('<BI', PROTOCOL_VERSION, accepted), 'baud confirm')
+        except ProvisionError:
+            # Device falls back to the console rate on its own
+            link.ser.baudrate = CONSOLE_BAUD
+            time.sleep(1.2)
+            link.check(HELLO, struct.pack('<BI', PROTOCOL_VERSION, CONSOLE_BAUD), 'HELLO')
+            accepted = CONSOLE_BAUD
+
+    return max_payload, accepted, mac, firmware
+
+
+def send_blob(link, slot, data, max_payload):
+    link.check(BEGIN, struct.pack('<BII', slot, len(data), zlib.crc32(data)), 'blob begin')
+    chunk = max_payload - 4
+    for offset in range(0, len(data), chunk):
+        link.check(DATA, struct.pack('<I', offset) + data[offset:offset + chunk], 'blob data')
+    link.check(END, bytes([slot]), 'blob end')
+
+
+def provision(job, args):
+    port = job['port']
+    device_id = job['device_id']
+    link = None
+    start = time.monotonic()
+
+    try:
+        link = Link(port)
+        max_payload, baud, mac, firmware = enter_binary_mode(link, args.baud)
+        log(port, '%s  mac %s  fw %s  %d baud' % (device_id, mac, firmware, baud))
+
+        values = [
+            (FIELD_WIFI_SSID, args.wifi_ssid), (FIELD_WIFI_PASS, args.wifi_pass),
+            (FIELD_DEVICE_ID, device_id), (FIELD_TENANT, job['tenant']),
+            (FIELD_BUILDING, job['building']), (FIELD_ROOM, job['room']),
+        ]
+        for field, value in values:
+            link.check(SET, bytes([field]) + value.encode(), 'set field %d' % field)
+
+        for slot, data in ((SLOT_CA, job['ca']), (SLOT_CLIENT, job['cert']), (SLOT_KEY, job['key'])):
+            if data is not None:
+                send_blob(link, slot, data, max_payload)
+
+        link.check(COMMIT, bytes([0 if args.no_mark else COMMIT_FLAG_MARK]), 'commit')
+
+        stored = link.check(GET, bytes([FIELD_DEVICE_ID]), 'verify').decode()
+        if stored != device_id:
+            raise ProvisionError('verify: device reports id %r' % stored)
+
+        link.check(EXIT, bytes([EXIT_FLAG_REBOOT if args.reboot else 0]), 'exit')
+
+        elapsed = time.monotonic() - start
+        log(port, 'OK   %.2f s  %d bytes  %.1f kB/s  %d resent' % (
+            elapsed, link.bytes_sent, link.bytes_sent / elapsed / 1024, link.retries))
+        return {'ok': True, 'port': port, 'seconds': elapsed, 'bytes': link.bytes_sent}
+
+    except (ProvisionError, serial.SerialException, OSError) as e:
+        log(port, 'FAIL %s: %s' % (device_id, e))
+        try:
+            if link is not None:
+                link.request(EXIT, b'\x00')   # Staged values are discarded; back to the console
+        except (ProvisionError, serial.SerialException, OSError):
+            pass
+        return {'ok': False, 'port': port, 'seconds': time.monotonic() - start,
+                'bytes': link.bytes_sent if link else 0}
+    finally:
+        if link is not None:
+            link.close()
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def load_jobs(args):
+    ca = read_file(args.ca) if args.ca else None
+    jobs = []
+    with open(args.manifest, newline='') as f:
+        for row in csv.DictReader(f):
+            device_id = row['device_id'].strip()
+            cert = row.get('cert') or (os.path.join(args.cert_dir, device_id + '.crt') if args.cert_dir else None)
+            key = row.get('key') or (os.path.join(args.cert_dir, device_id + '.key') if args.cert_dir else None)
+            jobs.append({
+                'port': row['port'].strip(),
+                'device_id': device_id,
+                'tenant': row['tenant'].strip(),
+                'building': row['building'].strip(),
+                'room': row['room'].strip(),
+                'ca': ca,
+                'cert': read_file(cert) if cert else None,
+                'key': read_file(key) if key else None,
+            })
+    return jobs
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Provision SafeSignal ESP32 devices in parallel (binary protocol)',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog=__doc__.split('Usage:')[1])
+    parser.add_argument('--manifest', required=True, help='CSV: port,device_id,tenant,building,room[,cert,key]')
+    parser.add_argument('--wifi-ssid', required=True, help='WiFi SSID')
+    parser.add_argument('--wifi-pass', required=True, help='WiFi password')
+    parser.add_argument('--ca', help='CA certificate (PEM)')
+    parser.add_argument('--cert-dir', help='Directory with <device_id>.crt and <device_id>.key')
+    parser.add_argument('--baud', type=int, default=921600, help='Requested baud rate (default 921600)')
+    parser.add_argument('--jobs', type=int, default=0, help='Parallel ports (default: all)')
+    parser.add_argument('--no-mark', action='store_true', help='Do not mark devices provisioned')
+    parser.add_argument('--reboot', action='store_true', help='Reboot devices after provisioning')
+    args = parser.parse_args()
+
+    if len(args.wifi_ssid) > 31 or len(args.wifi_pass) > 63:
+        print('✗ Error: WiFi SSID must be ≤31 and password ≤63 characters')
+        return 1
+
+    try:
+        jobs = load_jobs(args)
+    except (OSError, KeyError) as e:
+        print('✗ Error reading manifest or certificates: %s' % e)
+        return 1
+    if not jobs:
+        print('✗ Error: manifest lists no devices')
+        return 1
+
+    workers = args.jobs if args.jobs > 0 else len(jobs)
+    print('Provisioning %d devices on %d ports in parallel at %d baud' % (len(jobs), workers, args.baud))
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=workers) as pool:
+        results = list(pool.map(lambda job: provision(job, args), jobs))
+    wall = time.monotonic() - start
+
+    ok = [r for r in results if r['ok']]
+    total_bytes = sum(r['bytes'] for r in results)
+    print('\n' + '=' * 60)
+    print('Devices:     %d ok, %d failed' % (len(ok), len(results) - len(ok)))
+    print('Wall time:   %.2f s' % wall)
+    if ok:
+        per_device = sum(r['seconds'] for r in ok) / len(ok)
+        print('Per device:  %.2f s average' % per_device)
+        print('Throughput:  %.1f kB/s aggregate, %.0f devices/hour at this parallelism' % (
+            total_bytes / wall / 1024, len(ok) / wall * 3600))
+    print('=' * 60)
+
+    return 0 if len(ok) == len(results) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
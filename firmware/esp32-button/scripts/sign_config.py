@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""
+SafeSignal Config Signer
+
+Builds a config_set command (main/mqtt_cmd.h) and signs it with the CA key
+that issued the device certificates. The device verifies the signature
+against its provisioned CA, checks that the document names it, and accepts
+it only if version is higher than the last applied one.
+
+Signed data: "key=value\\n" for every member except cmd, id and sig, in the
+order they appear in the payload; value is the raw JSON text (strings
+without quotes). Signature: SHA-256 with ECDSA or RSA (PKCS#1 v1.5),
+base64, in "sig".
+
+Usage:
+    python sign_config.py --key ../../edge/certs/ca/ca.key \\
+        --device esp32-dev-001 --version 12 --room room-204 --heartbeat 300
+
+    python sign_config.py ... | mosquitto_pub ... -t <cmd topic> -q 1 -s
+"""
+
+import argparse
+import base64
+import json
+import re
+import subprocess
+import sys
+
+ID_PATTERN = re.compile(r'^[A-Za-z0-9._-]+$')
+POWER_PROFILES = ('performance', 'balanced', 'low')
+
+
+def check_id(name, value, max_len):
+    if not ID_PATTERN.match(value) or len(value) >= max_len:
+        sys.exit(f"{name}: 1-{max_len - 1} characters of [A-Za-z0-9._-] required")
+    return value
+
+
+def sign(key_path, data):
+    result = subprocess.run(['openssl', 'dgst', '-sha256', '-sign', key_path],
+                            input=data, capture_output=True)
+    if result.returncode != 0:
+        sys.exit(f"openssl failed: {result.stderr.decode().strip()}")
+    return base64.b64encode(result.stdout).decode()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Sign a SafeSignal config_set command')
+    parser.add_argument('--key', required=True, help='CA private key (PEM)')
+    parser.add_argument('--device', required=True, help='Target device ID')
+    parser.add_argument('--version', required=True, type=int,
+                        help='Document version, higher than the last one applied')
+    parser.add_argument('--id', default='cfg', help='Command id echoed in the response')
+    parser.add_argument('--tenant')
+    parser.add_argument('--building')
+    parser.add_argument('--room')
+    parser.add_argument('--heartbeat', type=int, help='Heartbeat interval in seconds (60-86400)')
+    parser.add_argument('--rate-max', type=int, help='Alerts per window (1-RATE_LIMIT_MAX_ALERTS)')
+    parser.add_argument('--rate-window', type=int, help='Rate limit window in seconds (1-3600)')
+    parser.add_argument('--cooldown', type=int, help='Cooldown after the limit in seconds (0-86400)')
+    parser.add_argument('--power', choices=POWER_PROFILES, help='WiFi power profile')
+    args = parser.parse_args()
+
+    if not 0 < args.version < 2 ** 32:
+        sys.exit('version: 1-4294967295')
+
+    # Ordered: the device hashes members in payload order
+    fields = [('version', args.version), ('device', check_id('device', args.device, 32))]
+    if args.tenant is not None:
+        fields.append(('tenant', check_id('tenant', args.tenant, 16)))
+    if args.building is not None:
+        fields.append(('building', check_id('building', args.building, 16)))
+    if args.room is not None:
+        fields.append(('room', check_id('room', args.room, 16)))
+    if args.heartbeat is not None:
+        fields.append(('heartbeatSec', args.heartbeat))
+    if args.rate_max is not None:
+        fields.append(('rateMax', args.rate_max))
+    if args.rate_window is not None:
+        fields.append(('rateWindowSec', args.rate_window))
+    if args.cooldown is not None:
+        fields.append(('cooldownSec', args.cooldown))
+    if args.power is not None:
+        fields.append(('power', args.power))
+
+    signed = ''.join(f"{key}={value}\n" for key, value in fields).encode()
+
+    doc = {'cmd': 'config_set', 'id': args.id}
+    doc.update(fields)
+    doc['sig'] = sign(args.key, signed)
+
+    payload = json.dumps(doc, separators=(',', ':'))
+    if len(payload) > 1024:
+        sys.exit(f"payload is {len(payload)} bytes, the device accepts 1024")
+    print(payload)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,361 @@
+/**
+ * In-memory NVS for host tests (see fake_nvs.h)
+ */
+
+#include "fake_nvs.h"
+#include "nvs_flash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_NVS_ENTRIES 256
+#define FAKE_NVS_HANDLES 16
+#define FAKE_NVS_NAME_LEN 16    /* NVS limit: 15 characters + NUL */
+
+typedef enum {
+    ENTRY_U8,
+    ENTRY_U32,
+    ENTRY_STR,
+    ENTRY_BLOB,
+} entry_type_t;
+
+typedef struct {
+    bool used;
+    char ns[FAKE_NVS_NAME_LEN];
+    char key[FAKE_NVS_NAME_LEN];
+    entry_type_t type;
+    uint8_t *data;
+    size_t len;
+} entry_t;
+
+static entry_t entries[FAKE_NVS_ENTRIES];
+static char handles[FAKE_NVS_HANDLES][FAKE_NVS_NAME_LEN];   /* Namespace per open handle */
+static bool handle_open[FAKE_NVS_HANDLES];
+static long write_budget = -1;
+static long write_count = 0;
+
+static entry_t *find(const char *ns, const char *key)
+{
+    for (int i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        if (entries[i].used && strcmp(entries[i].ns, ns) == 0 && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void drop(entry_t *e)
+{
+    free(e->data);
+    memset(e, 0, sizeof(*e));
+}
+
+static esp_err_t put(const char *ns, const char *key, entry_type_t type, const void *value, size_t len)
+{
+    if (strlen(key) >= FAKE_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;     /* NVS_KEY_NAME_MAX_SIZE */
+    }
+
+    entry_t *e = find(ns, key);
+    if (e == NULL) {
+        for (int i = 0; i < FAKE_NVS_ENTRIES && e == NULL; i++) {
+            if (!entries[i].used) {
+                e = &entries[i];
+            }
+        }
+        if (e == NULL) {
+            return ESP_ERR_NVS_NO_FREE_PAGES;
+        }
+    }
+
+    uint8_t *data = malloc(len ? len : 1);
+    memcpy(data, value, len);
+    free(e->data);
+    e->used = true;
+    strcpy(e->ns, ns);
+    strcpy(e->key, key);
+    e->type = type;
+    e->data = data;
+    e->len = len;
+    return ESP_OK;
+}
+
+static const char *ns_of(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > FAKE_NVS_HANDLES || !handle_open[handle - 1]) {
+        return NULL;
+    }
+    return handles[handle - 1];
+}
+
+/* A write that fits the budget; false once power is "lost" */
+static bool take_write(void)
+{
+    if (write_budget == 0) {
+        return false;
+    }
+    if (write_budget > 0) {
+        write_budget--;
+    }
+    write_count++;
+    return true;
+}
+
+static esp_err_t set_typed(nvs_handle_t handle, const char *key, entry_type_t type,
+                           const void *value, size_t len)
+{
+    const char *ns = ns_of(handle);
+    if (ns == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!take_write()) {
+        return ESP_FAIL;
+    }
+    return put(ns, key, type, value, len);
+}
+
+static esp_err_t get_typed(nvs_handle_t handle, const char *key, entry_type_t type, const entry_t **out)
+{
+    const char *ns = ns_of(handle);
+    if (ns == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    const entry_t *e = find(ns, key);
+    if (e == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (e->type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    *out = e;
+    return ESP_OK;
+}
+
+/* Variable-length get: size query with out_value NULL, else copy */
+static esp_err_t get_var(nvs_handle_t handle, const char *key, entry_type_t type,
+                         void *out_value, size_t *length)
+{
+    const entry_t *e;
+    esp_err_t ret = get_typed(handle, key, type, &e);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (out_value == NULL) {
+        *length = e->len;
+        return ESP_OK;
+    }
+    if (*length < e->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, e->data, e->len);
+    *length = e->len;
+    return ESP_OK;
+}
+
+/* ========================================================================== */
+/* nvs.h                                                                      */
+/* ========================================================================== */
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    fake_nvs_reset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_read_security_cfg_v2(nvs_sec_cfg_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_generate_keys_v2(nvs_sec_cfg_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_secure_init_partition(const char *partition_label, nvs_sec_cfg_t *cfg)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase_partition(const char *partition_label)
+{
+    fake_nvs_reset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(namespace_name) >= FAKE_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < FAKE_NVS_HANDLES; i++) {
+        if (!handle_open[i]) {
+            handle_open[i] = true;
+            strcpy(handles[i], namespace_name);
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    if (ns_of(handle) != NULL) {
+        handle_open[handle - 1] = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ns_of(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    const char *ns = ns_of(handle);
+    if (ns == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    entry_t *e = find(ns, key);
+    if (e == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (!take_write()) {
+        return ESP_FAIL;
+    }
+    drop(e);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    const char *ns = ns_of(handle);
+    if (ns == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!take_write()) {
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        if (entries[i].used && strcmp(entries[i].ns, ns) == 0) {
+            drop(&entries[i]);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return get_var(handle, key, ENTRY_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return set_typed(handle, key, ENTRY_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return get_var(handle, key, ENTRY_STR, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return set_typed(handle, key, ENTRY_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    const entry_t *e;
+    esp_err_t ret = get_typed(handle, key, ENTRY_U8, &e);
+    if (ret == ESP_OK) {
+        memcpy(out_value, e->data, sizeof(*out_value));
+    }
+    return ret;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return set_typed(handle, key, ENTRY_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    const entry_t *e;
+    esp_err_t ret = get_typed(handle, key, ENTRY_U32, &e);
+    if (ret == ESP_OK) {
+        memcpy(out_value, e->data, sizeof(*out_value));
+    }
+    return ret;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return set_typed(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+/* ========================================================================== */
+/* Test access                                                                */
+/* ========================================================================== */
+
+void fake_nvs_reset(void)
+{
+    for (int i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        drop(&entries[i]);
+    }
+    write_budget = -1;
+    write_count = 0;
+}
+
+void fake_nvs_fail_after(long writes)
+{
+    write_budget = writes;
+}
+
+void fake_nvs_close_all(void)
+{
+    memset(handle_open, 0, sizeof(handle_open));
+}
+
+long fake_nvs_write_count(void)
+{
+    return write_count;
+}
+
+esp_err_t fake_nvs_put_blob(const char *ns, const char *key, const void *value, size_t len)
+{
+    return put(ns, key, ENTRY_BLOB, value, len);
+}
+
+bool fake_nvs_get_raw(const char *ns, const char *key, void *out, size_t *len)
+{
+    const entry_t *e = find(ns, key);
+    if (e == NULL || *len < e->len) {
+        return false;
+    }
+    memcpy(out, e->data, e->len);
+    *len = e->len;
+    return true;
+}
+
+bool fake_nvs_exists(const char *ns, const char *key)
+{
+    return find(ns, key) != NULL;
+}
+
+uint32_t fake_nvs_count(const char *ns)
+{
+    uint32_t n = 0;
+    for (int i = 0; i < FAKE_NVS_ENTRIES; i++) {
+        n += entries[i].used && strcmp(entries[i].ns, ns) == 0;
+    }
+    return n;
+}
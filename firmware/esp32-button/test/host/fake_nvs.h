@@ -0,0 +1,38 @@
+#ifndef SAFESIGNAL_FAKE_NVS_H
+#define SAFESIGNAL_FAKE_NVS_H
+
+/**
+ * In-memory NVS for host tests
+ *
+ * Implements the nvs.h subset the firmware uses over a flat table of
+ * {namespace, key, type, value} entries. Like NVS, every set/erase is atomic
+ * and durable on return (commit only checks the handle), so a reset between
+ * two calls is modelled by failing every write after a budget.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nvs.h"
+
+/* Drop every entry and clear the write budget (open handles stay valid:
+ * modules under test keep theirs in statics) */
+void fake_nvs_reset(void);
+
+/* Invalidate every handle (a reboot, for modules the test can re-init) */
+void fake_nvs_close_all(void);
+
+/* Let `writes` more sets/erases succeed, then fail all of them with ESP_FAIL
+ * without applying (power lost); -1 removes the budget */
+void fake_nvs_fail_after(long writes);
+
+/* Sets and erases applied so far */
+long fake_nvs_write_count(void);
+
+/* Direct access for arranging and checking state (ignores the budget) */
+esp_err_t fake_nvs_put_blob(const char *ns, const char *key, const void *value, size_t len);
+bool fake_nvs_get_raw(const char *ns, const char *key, void *out, size_t *len);
+bool fake_nvs_exists(const char *ns, const char *key);
+uint32_t fake_nvs_count(const char *ns);
+
+#endif /* SAFESIGNAL_FAKE_NVS_H */
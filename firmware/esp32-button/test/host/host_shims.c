@@ -0,0 +1,56 @@
+/**
+ * Host replacements for IDF/ROM functions and for firmware modules that are
+ * not under test (log ring, flash statistics)
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "flash_stats.h"
+#include "log_ring.h"
+
+volatile esp_log_level_t log_ring_level = ESP_LOG_WARN;
+
+/* Same result as the ROM routine: zlib CRC32, chainable */
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", code);
+    return buf;
+}
+
+/* Only the message is printed: IDF formats assume 32-bit long */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    if (level <= ESP_LOG_WARN) {
+        fprintf(stderr, "  [%s] %s\n", tag, fmt);
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+}
+
+void log_ring_write(esp_log_level_t level, const char *tag, const char *fmt, int nargs, ...)
+{
+    esp_log_write(level, tag, fmt);
+}
+
+void flash_stats_record_write(flash_subsys_t subsys, uint32_t bytes, esp_err_t result)
+{
+}
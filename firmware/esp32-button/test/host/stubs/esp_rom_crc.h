@@ -0,0 +1,6 @@
+/* Host stub: ROM CRC32 (little-endian, same polynomial and conventions) */
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
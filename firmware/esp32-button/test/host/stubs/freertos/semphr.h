@@ -0,0 +1,27 @@
+/* Host stub: FreeRTOS mutex on a pthread mutex */
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "FreeRTOS.h"
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+    if (mutex != NULL) {
+        pthread_mutex_init(mutex, NULL);
+    }
+    return mutex;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return pthread_mutex_lock(sem) == 0 ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return pthread_mutex_unlock(sem) == 0 ? pdTRUE : pdFALSE;
+}
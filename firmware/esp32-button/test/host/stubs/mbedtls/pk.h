@@ -0,0 +1,80 @@
+/* Host stub: no mbedTLS on the host. Every parse fails, so host tests
+ * provision strings only; certificate handling is covered on the device. */
+#pragma once
+
+#include <stddef.h>
+
+#define MBEDTLS_PRIVATE(member) member
+#define MBEDTLS_ERR_PK_FEATURE_UNAVAILABLE -0x3980
+
+typedef enum {
+    MBEDTLS_PK_NONE,
+    MBEDTLS_PK_RSA,
+    MBEDTLS_PK_ECKEY,
+    MBEDTLS_PK_ECKEY_DH,
+    MBEDTLS_PK_ECDSA,
+} mbedtls_pk_type_t;
+
+typedef enum {
+    MBEDTLS_ECP_DP_NONE,
+    MBEDTLS_ECP_DP_SECP256R1,
+} mbedtls_ecp_group_id;
+
+typedef struct {
+    struct {
+        mbedtls_ecp_group_id id;
+    } grp;
+} mbedtls_ecp_keypair;
+
+typedef struct {
+    mbedtls_pk_type_t type;
+    mbedtls_ecp_keypair ec;
+} mbedtls_pk_context;
+
+static inline void mbedtls_pk_init(mbedtls_pk_context *ctx)
+{
+    ctx->type = MBEDTLS_PK_NONE;
+}
+
+static inline void mbedtls_pk_free(mbedtls_pk_context *ctx)
+{
+}
+
+static inline mbedtls_pk_type_t mbedtls_pk_get_type(const mbedtls_pk_context *ctx)
+{
+    return ctx->type;
+}
+
+static inline mbedtls_ecp_keypair *mbedtls_pk_ec(mbedtls_pk_context pk)
+{
+    static mbedtls_ecp_keypair none;
+    return &none;
+}
+
+static inline size_t mbedtls_pk_get_bitlen(const mbedtls_pk_context *ctx)
+{
+    return 0;
+}
+
+static inline const char *mbedtls_pk_get_name(const mbedtls_pk_context *ctx)
+{
+    return "none";
+}
+
+static inline int mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen,
+                                       const unsigned char *pwd, size_t pwdlen,
+                                       int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+    return MBEDTLS_ERR_PK_FEATURE_UNAVAILABLE;
+}
+
+static inline int mbedtls_pk_write_key_der(const mbedtls_pk_context *ctx, unsigned char *buf, size_t size)
+{
+    return MBEDTLS_ERR_PK_FEATURE_UNAVAILABLE;
+}
+
+static inline int mbedtls_pk_check_pair(const mbedtls_pk_context *pub, const mbedtls_pk_context *prv,
+                                        int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+    return MBEDTLS_ERR_PK_FEATURE_UNAVAILABLE;
+}
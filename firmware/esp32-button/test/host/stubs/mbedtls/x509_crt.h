@@ -0,0 +1,40 @@
+/* Host stub: see pk.h */
+#pragma once
+
+#include <stddef.h>
+#include "pk.h"
+
+#define MBEDTLS_ERR_X509_FEATURE_UNAVAILABLE -0x2080
+
+typedef struct {
+    unsigned char *p;
+    size_t len;
+} mbedtls_x509_buf;
+
+typedef struct mbedtls_x509_crt {
+    mbedtls_x509_buf raw;
+    mbedtls_pk_context pk;
+    struct mbedtls_x509_crt *next;
+} mbedtls_x509_crt;
+
+static inline void mbedtls_x509_crt_init(mbedtls_x509_crt *crt)
+{
+    crt->raw.p = NULL;
+    crt->raw.len = 0;
+    crt->next = NULL;
+    mbedtls_pk_init(&crt->pk);
+}
+
+static inline void mbedtls_x509_crt_free(mbedtls_x509_crt *crt)
+{
+}
+
+static inline int mbedtls_x509_crt_parse(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen)
+{
+    return MBEDTLS_ERR_X509_FEATURE_UNAVAILABLE;
+}
+
+static inline int mbedtls_x509_crt_parse_der(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen)
+{
+    return MBEDTLS_ERR_X509_FEATURE_UNAVAILABLE;
+}
@@ -0,0 +1,17 @@
+/* Host stub: partition-level NVS calls (the fake has one unencrypted store) */
+#pragma once
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+typedef struct {
+    uint8_t eky[32];
+    uint8_t tky[32];
+} nvs_sec_cfg_t;
+
+esp_err_t nvs_flash_read_security_cfg_v2(nvs_sec_cfg_t *cfg);
+esp_err_t nvs_flash_generate_keys_v2(nvs_sec_cfg_t *cfg);
+esp_err_t nvs_flash_secure_init_partition(const char *partition_label, nvs_sec_cfg_t *cfg);
+esp_err_t nvs_flash_erase_partition(const char *partition_label);
@@ -0,0 +1,389 @@
+/**
+ * Host tests for main/alert_store_nvs.c
+ *
+ * Runs the NVS alert store against fake_nvs.c. Each test arranges the
+ * "alert_queue" namespace as a previous boot (or older firmware) left it,
+ * calls init as boot does and checks what load() recovers and what is left
+ * in NVS.
+ */
+
+#include "alert_store.h"
+#include "fake_nvs.h"
+#include "test_util.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NS "alert_queue"
+#define SLOTS 50
+
+/* Mirrors nvs_record_t in alert_store_nvs.c */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t crc;
+    queued_alert_t alert;
+} record_t;
+
+static const alert_store_t *store = &alert_store_nvs;
+
+static queued_alert_t make_alert(uint32_t id)
+{
+    queued_alert_t alert;
+    memset(&alert, 0, sizeof(alert));
+    alert.alert_id = id;
+    alert.timestamp = 1700000000 + id;
+    alert.mode = (uint8_t)(id % 4);
+    snprintf(alert.device_id, sizeof(alert.device_id), "esp32-%03u", (unsigned)id);
+    strcpy(alert.tenant_id, "tenant-a");
+    strcpy(alert.building_id, "building-a");
+    strcpy(alert.room_id, "room-1");
+    strcpy(alert.version, "1.0.0");
+    return alert;
+}
+
+static void key_for(uint32_t index, char *key)
+{
+    sprintf(key, "alert_%u", (unsigned)index);
+}
+
+/* Boot: init, then the ids load() visits in order */
+typedef struct {
+    uint32_t ids[SLOTS];
+    uint32_t refs[SLOTS];
+    uint32_t n;
+    bool payload_ok;
+} loaded_t;
+
+static bool load_visit(uint32_t ref, const queued_alert_t *alert, void *ctx)
+{
+    loaded_t *loaded = ctx;
+    queued_alert_t expect = make_alert(alert->alert_id);
+
+    if (memcmp(alert, &expect, sizeof(expect)) != 0) {
+        loaded->payload_ok = false;
+    }
+    loaded->ids[loaded->n] = alert->alert_id;
+    loaded->refs[loaded->n] = ref;
+    loaded->n++;
+    return true;
+}
+
+static void boot(loaded_t *loaded)
+{
+    uint32_t capacity = 0;
+
+    memset(loaded, 0, sizeof(*loaded));
+    loaded->payload_ok = true;
+    CHECK_EQ(store->init(&capacity), ESP_OK);
+    CHECK_EQ(capacity, SLOTS);
+    CHECK_EQ(store->load(load_visit, loaded), ESP_OK);
+    CHECK(loaded->payload_ok);
+}
+
+static uint32_t append(uint32_t id)
+{
+    queued_alert_t alert = make_alert(id);
+    uint32_t ref = UINT32_MAX;
+    CHECK_EQ(store->append(&alert, &ref), ESP_OK);
+    return ref;
+}
+
+/* Flip one byte of a stored blob in place */
+static void corrupt(uint32_t index, size_t offset)
+{
+    char key[16];
+    record_t rec;
+    size_t len = sizeof(rec);
+
+    key_for(index, key);
+    CHECK(fake_nvs_get_raw(NS, key, &rec, &len));
+    ((uint8_t *)&rec)[offset] ^= 0x40;
+    CHECK_EQ(fake_nvs_put_blob(NS, key, &rec, len), ESP_OK);
+}
+
+static uint32_t quarantine_next(void)
+{
+    uint32_t next = 0;
+    size_t len = sizeof(next);
+    fake_nvs_get_raw(NS, "bad_next", &next, &len);
+    return next;
+}
+
+/* ========================================================================== */
+/* Tests                                                                      */
+/* ========================================================================== */
+
+static void test_append_load_remove(void)
+{
+    loaded_t loaded;
+    queued_alert_t alert;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 0);
+
+    uint32_t ref[4];
+    for (uint32_t i = 0; i < 4; i++) {
+        ref[i] = append(10 + i);
+    }
+
+    CHECK_EQ(store->read(ref[2], &alert), ESP_OK);
+    CHECK_EQ(alert.alert_id, 12);
+
+    /* Slot 0 is reused for the next alert, which must still load last */
+    CHECK_EQ(store->remove(ref[0]), ESP_OK);
+    CHECK_EQ(store->read(ref[0], &alert), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(store->remove(ref[0]), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(append(14), ref[0]);
+
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 4);
+    CHECK_EQ(loaded.ids[0], 11);
+    CHECK_EQ(loaded.ids[1], 12);
+    CHECK_EQ(loaded.ids[2], 13);
+    CHECK_EQ(loaded.ids[3], 14);
+
+    /* Refs from load() are usable, and order keeps growing after a reboot */
+    CHECK_EQ(store->remove(loaded.refs[0]), ESP_OK);
+    append(15);
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 4);
+    CHECK_EQ(loaded.ids[0], 12);
+    CHECK_EQ(loaded.ids[3], 15);
+
+    CHECK_EQ(quarantine_next(), 0);
+}
+
+static void test_full(void)
+{
+    loaded_t loaded;
+    queued_alert_t alert = make_alert(999);
+    uint32_t ref;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    for (uint32_t i = 0; i < SLOTS; i++) {
+        append(i);
+    }
+    CHECK_EQ(store->append(&alert, &ref), ESP_ERR_NO_MEM);
+
+    boot(&loaded);
+    CHECK_EQ(loaded.n, SLOTS);
+    CHECK_EQ(loaded.ids[0], 0);
+    CHECK_EQ(loaded.ids[SLOTS - 1], SLOTS - 1);
+}
+
+static void test_crc_mismatch_quarantined(void)
+{
+    loaded_t loaded;
+    queued_alert_t alert;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    for (uint32_t i = 0; i < 4; i++) {
+        append(20 + i);
+    }
+
+    /* Bit rot in slot 2's room_id; keep the raw blob for comparison */
+    record_t before;
+    size_t len = sizeof(before);
+    corrupt(2, offsetof(record_t, alert) + offsetof(queued_alert_t, room_id));
+    CHECK(fake_nvs_get_raw(NS, "alert_2", &before, &len));
+
+    /* A live read already refuses it */
+    CHECK_EQ(store->read(2, &alert), ESP_ERR_INVALID_CRC);
+
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 3);
+    CHECK_EQ(loaded.ids[0], 20);
+    CHECK_EQ(loaded.ids[1], 21);
+    CHECK_EQ(loaded.ids[2], 23);
+    CHECK(!fake_nvs_exists(NS, "alert_2"));
+
+    /* Moved aside byte for byte */
+    record_t bad;
+    len = sizeof(bad);
+    CHECK(fake_nvs_get_raw(NS, "bad_0", &bad, &len));
+    CHECK_EQ(len, sizeof(bad));
+    CHECK(memcmp(&bad, &before, sizeof(bad)) == 0);
+    CHECK_EQ(quarantine_next(), 1);
+
+    /* Quarantined once: the next boot is clean */
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 3);
+    CHECK_EQ(quarantine_next(), 1);
+}
+
+static void test_bad_header_and_size_quarantined(void)
+{
+    loaded_t loaded;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    for (uint32_t i = 0; i < 4; i++) {
+        append(30 + i);
+    }
+
+    /* Another firmware's layout: CRC may be fine, magic is not */
+    corrupt(0, offsetof(record_t, magic));
+    /* Unknown version */
+    corrupt(1, offsetof(record_t, version));
+
+    /* Wrong size, neither a record nor a bare alert */
+    uint8_t odd[40] = {0};
+    CHECK_EQ(fake_nvs_put_blob(NS, "alert_9", odd, sizeof(odd)), ESP_OK);
+
+    /* Larger than a record: dropped without a copy */
+    uint8_t big[sizeof(record_t) + 16] = {0};
+    CHECK_EQ(fake_nvs_put_blob(NS, "alert_10", big, sizeof(big)), ESP_OK);
+
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 2);
+    CHECK_EQ(loaded.ids[0], 32);
+    CHECK_EQ(loaded.ids[1], 33);
+    CHECK(!fake_nvs_exists(NS, "alert_0"));
+    CHECK(!fake_nvs_exists(NS, "alert_1"));
+    CHECK(!fake_nvs_exists(NS, "alert_9"));
+    CHECK(!fake_nvs_exists(NS, "alert_10"));
+
+    CHECK_EQ(quarantine_next(), 3);
+    CHECK(fake_nvs_exists(NS, "bad_0"));
+    CHECK(fake_nvs_exists(NS, "bad_1"));
+    CHECK(fake_nvs_exists(NS, "bad_2"));
+    CHECK(!fake_nvs_exists(NS, "bad_3"));
+}
+
+static void test_quarantine_round_robin(void)
+{
+    loaded_t loaded;
+    uint32_t seq_of_last = 0;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    for (uint32_t i = 0; i < 6; i++) {
+        append(40 + i);
+    }
+    for (uint32_t i = 0; i < 6; i++) {
+        corrupt(i, offsetof(record_t, alert));
+    }
+
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 0);
+    CHECK_EQ(quarantine_next(), 6);
+
+    /* Four slots kept: the fifth and sixth overwrote bad_0 and bad_1 */
+    CHECK_EQ(fake_nvs_count(NS), 4 + 1);
+    record_t bad;
+    size_t len = sizeof(bad);
+    CHECK(fake_nvs_get_raw(NS, "bad_1", &bad, &len));
+    seq_of_last = bad.seq;
+    len = sizeof(bad);
+    CHECK(fake_nvs_get_raw(NS, "bad_2", &bad, &len));
+    CHECK(seq_of_last > bad.seq);
+}
+
+static void test_legacy_upgrade(void)
+{
+    loaded_t loaded;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    append(50);
+    append(51);
+
+    /* Older firmware: bare queued_alert_t blobs and a count key */
+    queued_alert_t legacy_a = make_alert(60);
+    queued_alert_t legacy_b = make_alert(61);
+    uint32_t legacy_count = 2;
+    CHECK_EQ(fake_nvs_put_blob(NS, "alert_7", &legacy_a, sizeof(legacy_a)), ESP_OK);
+    CHECK_EQ(fake_nvs_put_blob(NS, "alert_4", &legacy_b, sizeof(legacy_b)), ESP_OK);
+    nvs_handle_t handle;
+    CHECK_EQ(nvs_open(NS, NVS_READWRITE, &handle), ESP_OK);
+    CHECK_EQ(nvs_set_u32(handle, "count", legacy_count), ESP_OK);
+    nvs_close(handle);
+
+    /* Upgraded in place, after every current record (slot order among them) */
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 4);
+    CHECK_EQ(loaded.ids[0], 50);
+    CHECK_EQ(loaded.ids[1], 51);
+    CHECK_EQ(loaded.ids[2], 61);
+    CHECK_EQ(loaded.ids[3], 60);
+    CHECK_EQ(loaded.refs[3], 7);
+    CHECK(!fake_nvs_exists(NS, "count"));
+
+    record_t rec;
+    size_t len = sizeof(rec);
+    CHECK(fake_nvs_get_raw(NS, "alert_7", &rec, &len));
+    CHECK_EQ(len, sizeof(record_t));
+    CHECK_EQ(rec.len, sizeof(queued_alert_t));
+
+    /* The upgraded order is persisted, and new appends go after it */
+    append(52);
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 5);
+    CHECK_EQ(loaded.ids[0], 50);
+    CHECK_EQ(loaded.ids[1], 51);
+    CHECK_EQ(loaded.ids[2], 61);
+    CHECK_EQ(loaded.ids[3], 60);
+    CHECK_EQ(loaded.ids[4], 52);
+    CHECK_EQ(quarantine_next(), 0);
+}
+
+static void test_legacy_upgrade_write_fails(void)
+{
+    loaded_t loaded;
+
+    fake_nvs_reset();
+    queued_alert_t legacy = make_alert(70);
+    CHECK_EQ(fake_nvs_put_blob(NS, "alert_3", &legacy, sizeof(legacy)), ESP_OK);
+
+    /* NVS refuses every write: the alert is not loaded, but not lost either */
+    fake_nvs_fail_after(0);
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 0);
+    CHECK(fake_nvs_exists(NS, "alert_3"));
+
+    fake_nvs_fail_after(-1);
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 1);
+    CHECK_EQ(loaded.ids[0], 70);
+}
+
+static void test_append_write_fails(void)
+{
+    loaded_t loaded;
+    queued_alert_t alert = make_alert(80);
+    uint32_t ref;
+
+    fake_nvs_reset();
+    boot(&loaded);
+    append(79);
+
+    fake_nvs_fail_after(0);
+    CHECK(store->append(&alert, &ref) != ESP_OK);
+    fake_nvs_fail_after(-1);
+
+    /* The failed slot is still free */
+    CHECK_EQ(append(81), 1);
+    boot(&loaded);
+    CHECK_EQ(loaded.n, 2);
+    CHECK_EQ(loaded.ids[1], 81);
+}
+
+int main(void)
+{
+    RUN_TEST(test_append_load_remove);
+    RUN_TEST(test_full);
+    RUN_TEST(test_crc_mismatch_quarantined);
+    RUN_TEST(test_bad_header_and_size_quarantined);
+    RUN_TEST(test_quarantine_round_robin);
+    RUN_TEST(test_legacy_upgrade);
+    RUN_TEST(test_legacy_upgrade_write_fails);
+    RUN_TEST(test_append_write_fails);
+    return TEST_EXIT();
+}
@@ -0,0 +1,559 @@
+/**
+ * Host tests for main/flash_log.c
+ *
+ * The log runs against a RAM image with NOR semantics (programming only
+ * clears bits, erase sets a whole sector to 0xFF). Power cuts are injected by
+ * failing the Nth flash operation after applying part of it: half the bytes
+ * of a write, half a sector of an erase. After every cut the image is
+ * remounted and checked against what the caller was told.
+ */
+
+#include "flash_log.h"
+#include "test_util.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAYLOAD_SIZE 164            /* sizeof(queued_alert_t) on the device */
+#define MAX_SECTORS 16
+#define MAX_IDS 4096
+
+/* ========================================================================== */
+/* RAM flash                                                                  */
+/* ========================================================================== */
+
+typedef struct {
+    uint8_t mem[MAX_SECTORS * FLASH_LOG_SECTOR_SIZE];
+    uint32_t erase_count[MAX_SECTORS];
+    long ops;                       /* Flash operations so far */
+    long cut_at;                    /* Operation that loses power (-1: never) */
+    bool dead;                      /* Power lost: every later operation fails */
+} sim_flash_t;
+
+static int sim_op(sim_flash_t *f)
+{
+    if (f->dead) {
+        return -1;
+    }
+    if (f->cut_at >= 0 && f->ops++ == f->cut_at) {
+        f->dead = true;
+        return 1;                   /* Apply partially, then fail */
+    }
+    return 0;
+}
+
+static int sim_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    sim_flash_t *f = ctx;
+    if (f->dead) {
+        return -1;
+    }
+    memcpy(buf, f->mem + offset, len);
+    return 0;
+}
+
+static int sim_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    sim_flash_t *f = ctx;
+    int cut = sim_op(f);
+    if (cut < 0) {
+        return -1;
+    }
+
+    size_t n = cut ? len / 2 : len;
+    const uint8_t *src = buf;
+    for (size_t i = 0; i < n; i++) {
+        f->mem[offset + i] &= src[i];
+    }
+    return cut ? -1 : 0;
+}
+
+static int sim_erase(void *ctx, uint32_t offset, size_t len)
+{
+    sim_flash_t *f = ctx;
+    int cut = sim_op(f);
+    if (cut < 0) {
+        return -1;
+    }
+
+    memset(f->mem + offset, 0xFF, cut ? len / 2 : len);
+    for (size_t s = 0; s < len / FLASH_LOG_SECTOR_SIZE; s++) {
+        f->erase_count[offset / FLASH_LOG_SECTOR_SIZE + s]++;
+    }
+    return cut ? -1 : 0;
+}
+
+static sim_flash_t *sim_new(uint32_t sectors, flash_log_io_t *io)
+{
+    sim_flash_t *f = calloc(1, sizeof(*f));
+    memset(f->mem, 0xFF, sizeof(f->mem));
+    f->cut_at = -1;
+
+    io->ctx = f;
+    io->size = sectors * FLASH_LOG_SECTOR_SIZE;
+    io->read = sim_read;
+    io->write = sim_write;
+    io->erase = sim_erase;
+    return f;
+}
+
+/* Power back on: same image, no pending cut */
+static void sim_power_on(sim_flash_t *f)
+{
+    f->dead = false;
+    f->cut_at = -1;
+}
+
+/* ========================================================================== */
+/* Payloads and expected state                                                */
+/* ========================================================================== */
+
+static void make_payload(uint32_t id, uint8_t *out)
+{
+    memcpy(out, &id, sizeof(id));
+    for (int i = sizeof(id); i < PAYLOAD_SIZE; i++) {
+        out[i] = (uint8_t)(id * 31 + i);
+    }
+}
+
+static bool payload_ok(const uint8_t *payload, uint32_t *out_id)
+{
+    uint8_t expect[PAYLOAD_SIZE];
+    memcpy(out_id, payload, sizeof(*out_id));
+    make_payload(*out_id, expect);
+    return memcmp(payload, expect, PAYLOAD_SIZE) == 0;
+}
+
+/* What the caller was told: acknowledged ids, and the one operation a power
+ * cut may have left either way */
+typedef struct {
+    bool live[MAX_IDS];
+    uint32_t seq[MAX_IDS];
+    int32_t pending_add;
+    int32_t pending_remove;
+} model_t;
+
+typedef struct {
+    bool seen[MAX_IDS];
+    uint32_t seq[MAX_IDS];
+    uint32_t count;
+    uint32_t bad_payload;
+    uint32_t duplicates;
+    uint32_t last_seq;
+    bool ordered;
+} found_t;
+
+static bool collect_visit(uint32_t seq, const void *payload, void *ctx)
+{
+    found_t *found = ctx;
+    uint32_t id;
+
+    if (!payload_ok(payload, &id) || id >= MAX_IDS) {
+        found->bad_payload++;
+        return true;
+    }
+    if (found->seen[id]) {
+        found->duplicates++;
+    }
+    if (seq <= found->last_seq) {
+        found->ordered = false;
+    }
+    found->last_seq = seq;
+    found->seen[id] = true;
+    found->seq[id] = seq;
+    found->count++;
+    return true;
+}
+
+static void collect(flash_log_t *log, found_t *found)
+{
+    memset(found, 0, sizeof(*found));
+    found->ordered = true;
+    CHECK_EQ(flash_log_foreach(log, collect_visit, found), FLASH_LOG_OK);
+}
+
+/* Every acknowledged record survives, nothing unacknowledged appears; the
+ * operation in flight may have happened or not */
+static bool matches_model(flash_log_t *log, model_t *m)
+{
+    found_t found;
+    collect(log, &found);
+
+    bool ok = found.bad_payload == 0 && found.duplicates == 0 && found.ordered &&
+              found.count == flash_log_count(log);
+    for (uint32_t id = 0; id < MAX_IDS; id++) {
+        bool in_flight = (int32_t)id == m->pending_add || (int32_t)id == m->pending_remove;
+        if (!in_flight && found.seen[id] != m->live[id]) {
+            ok = false;
+        }
+        if (m->live[id] && found.seen[id] && found.seq[id] != m->seq[id]) {
+            ok = false;             /* Relocation must keep the seq */
+        }
+    }
+
+    /* Adopt the outcome of the operation in flight */
+    if (m->pending_add >= 0) {
+        m->live[m->pending_add] = found.seen[m->pending_add];
+        m->seq[m->pending_add] = found.seq[m->pending_add];
+    }
+    if (m->pending_remove >= 0) {
+        m->live[m->pending_remove] = found.seen[m->pending_remove];
+    }
+    m->pending_add = m->pending_remove = -1;
+    return ok;
+}
+
+/* ========================================================================== */
+/* Workload                                                                   */
+/* ========================================================================== */
+
+/* Queue-like churn: append, and delete the oldest once `keep` are live. Every
+ * seventh record among the last `pin_window` is pinned; a window longer than
+ * one lap of the ring leaves live records for compaction to carry forward.
+ * Stops at the first error (power cut). */
+typedef struct {
+    uint32_t next_id;
+    uint32_t steps;
+    uint32_t pin_window;
+} workload_t;
+
+static int oldest_live(const model_t *m, uint32_t pin_from)
+{
+    for (uint32_t id = 0; id < MAX_IDS; id++) {
+        bool pinned = id % 7 == 0 && id >= pin_from;
+        if (m->live[id] && !pinned) {
+            return (int)id;
+        }
+    }
+    return -1;
+}
+
+static int run_workload(flash_log_t *log, model_t *m, workload_t *w, uint32_t steps, uint32_t keep)
+{
+    uint8_t payload[PAYLOAD_SIZE];
+
+    for (uint32_t i = 0; i < steps; i++, w->steps++) {
+        if (flash_log_count(log) >= keep) {
+            uint32_t pin_from = w->next_id > w->pin_window ? w->next_id - w->pin_window : 0;
+            int victim = oldest_live(m, pin_from);
+            if (victim < 0) {
+                return FLASH_LOG_ERR_INVALID;
+            }
+            m->pending_remove = victim;
+            int ret = flash_log_remove(log, m->seq[victim]);
+            if (ret != FLASH_LOG_OK) {
+                return ret;
+            }
+            m->live[victim] = false;
+            m->pending_remove = -1;
+        }
+
+        uint32_t id = w->next_id++;
+        uint32_t seq;
+        make_payload(id, payload);
+        m->pending_add = (int32_t)id;
+        int ret = flash_log_append(log, payload, &seq);
+        if (ret != FLASH_LOG_OK) {
+            return ret;
+        }
+        m->live[id] = true;
+        m->seq[id] = seq;
+        m->pending_add = -1;
+    }
+    return FLASH_LOG_OK;
+}
+
+static void model_init(model_t *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->pending_add = m->pending_remove = -1;
+}
+
+/* ========================================================================== */
+/* Tests                                                                      */
+/* ========================================================================== */
+
+static flash_log_entry_t index_buf[1024];
+
+static void test_append_read_remove(void)
+{
+    flash_log_io_t io;
+    sim_flash_t *f = sim_new(4, &io);
+    flash_log_t log;
+    uint8_t payload[PAYLOAD_SIZE];
+    uint8_t out[PAYLOAD_SIZE];
+    uint32_t seq[3];
+
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_count(&log), 0);
+
+    for (uint32_t i = 0; i < 3; i++) {
+        make_payload(100 + i, payload);
+        CHECK_EQ(flash_log_append(&log, payload, &seq[i]), FLASH_LOG_OK);
+    }
+    CHECK(seq[0] < seq[1] && seq[1] < seq[2]);
+    CHECK_EQ(flash_log_count(&log), 3);
+
+    CHECK_EQ(flash_log_read(&log, seq[1], out), FLASH_LOG_OK);
+    make_payload(101, payload);
+    CHECK(memcmp(out, payload, PAYLOAD_SIZE) == 0);
+
+    CHECK_EQ(flash_log_remove(&log, seq[1]), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_remove(&log, seq[1]), FLASH_LOG_ERR_NOT_FOUND);
+    CHECK_EQ(flash_log_read(&log, seq[1], out), FLASH_LOG_ERR_NOT_FOUND);
+
+    /* Survives a remount; a deleted seq is never handed out again */
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_count(&log), 2);
+    CHECK_EQ(flash_log_read(&log, seq[2], out), FLASH_LOG_OK);
+    make_payload(102, payload);
+    CHECK(memcmp(out, payload, PAYLOAD_SIZE) == 0);
+
+    CHECK_EQ(flash_log_remove(&log, seq[2]), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    uint32_t next;
+    CHECK_EQ(flash_log_append(&log, payload, &next), FLASH_LOG_OK);
+    CHECK(next > seq[2]);
+
+    free(f);
+}
+
+static void test_capacity(void)
+{
+    flash_log_io_t io;
+    sim_flash_t *f = sim_new(4, &io);
+    flash_log_t log;
+    uint8_t payload[PAYLOAD_SIZE];
+    uint32_t first_seq = 0;
+    uint32_t seq;
+
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(log.capacity, (4 - 2) * (log.slots_per_sector - 1));
+
+    for (uint32_t i = 0; i < log.capacity; i++) {
+        make_payload(i, payload);
+        CHECK_EQ(flash_log_append(&log, payload, &seq), FLASH_LOG_OK);
+        if (i == 0) {
+            first_seq = seq;
+        }
+    }
+    CHECK_EQ(flash_log_append(&log, payload, NULL), FLASH_LOG_ERR_FULL);
+
+    /* Freeing one slot anywhere makes room again, through compaction */
+    CHECK_EQ(flash_log_remove(&log, first_seq), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_append(&log, payload, NULL), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_count(&log), log.capacity);
+
+    /* The index caps capacity below the geometry */
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 10), FLASH_LOG_OK);
+    CHECK_EQ(log.capacity, 10);
+
+    free(f);
+}
+
+static void test_relocation_and_wear(void)
+{
+    flash_log_io_t io;
+    sim_flash_t *f = sim_new(8, &io);
+    flash_log_t log;
+    model_t *m = calloc(1, sizeof(*m));
+    workload_t w = {.pin_window = 200};
+
+    model_init(m);
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    memset(f->erase_count, 0, sizeof(f->erase_count));
+
+    /* About 15 laps around the 8 sectors */
+    CHECK_EQ(run_workload(&log, m, &w, 2500, 60), FLASH_LOG_OK);
+    CHECK(log.stats.relocations > 0);
+    CHECK(matches_model(&log, m));
+
+    /* Wear is spread evenly: every sector erased, within one lap of each other */
+    uint32_t min = UINT32_MAX, max = 0;
+    for (int s = 0; s < 8; s++) {
+        min = f->erase_count[s] < min ? f->erase_count[s] : min;
+        max = f->erase_count[s] > max ? f->erase_count[s] : max;
+    }
+    CHECK(min > 10);
+    CHECK(max - min <= 1);
+
+    /* Relocated records keep their seq and payload across a remount */
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK(matches_model(&log, m));
+
+    free(m);
+    free(f);
+}
+
+static void test_corrupt_record_skipped(void)
+{
+    flash_log_io_t io;
+    sim_flash_t *f = sim_new(4, &io);
+    flash_log_t log;
+    uint8_t payload[PAYLOAD_SIZE];
+    uint32_t seq[3];
+
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    for (uint32_t i = 0; i < 3; i++) {
+        make_payload(i, payload);
+        CHECK_EQ(flash_log_append(&log, payload, &seq[i]), FLASH_LOG_OK);
+    }
+
+    /* Bit rot in the middle record's payload */
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < log.live; i++) {
+        if (log.index[i].seq == seq[1]) {
+            offset = log.index[i].offset;
+        }
+    }
+    f->mem[offset + 40] ^= 0x10;
+
+    uint8_t out[PAYLOAD_SIZE];
+    CHECK_EQ(flash_log_read(&log, seq[1], out), FLASH_LOG_ERR_CORRUPT);
+
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(log.stats.corrupt, 1);
+    CHECK_EQ(flash_log_count(&log), 2);
+    CHECK_EQ(flash_log_read(&log, seq[1], out), FLASH_LOG_ERR_NOT_FOUND);
+    CHECK_EQ(flash_log_read(&log, seq[2], out), FLASH_LOG_OK);
+
+    /* Tombstoned at mount: not counted again */
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(log.stats.corrupt, 0);
+
+    free(f);
+}
+
+static void test_foreign_data_formatted(void)
+{
+    flash_log_io_t io;
+    sim_flash_t *f = sim_new(4, &io);
+    flash_log_t log;
+
+    /* Leftover SPIFFS or random content: no valid sector header */
+    for (size_t i = 0; i < 4 * FLASH_LOG_SECTOR_SIZE; i++) {
+        f->mem[i] = (uint8_t)(i * 7);
+    }
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    CHECK_EQ(flash_log_count(&log), 0);
+    CHECK_EQ(flash_log_append(&log, f->mem, NULL), FLASH_LOG_OK);
+
+    free(f);
+}
+
+/* Cut power at every flash operation of a workload that wraps the area
+ * several times; after each cut the remount must match the model, and the
+ * log must keep working (and survive a second, clean remount) */
+static void test_power_cut_every_operation(void)
+{
+    const uint32_t sectors = 4;
+    const uint32_t steps = 150;
+    const uint32_t keep = 30;
+    flash_log_io_t io;
+    flash_log_t log;
+    model_t *m = calloc(1, sizeof(*m));
+
+    /* Count the operations of an uninterrupted run */
+    sim_flash_t *f = sim_new(sectors, &io);
+    workload_t w = {.pin_window = 100};
+    model_init(m);
+    CHECK_EQ(flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024), FLASH_LOG_OK);
+    f->cut_at = LONG_MAX;
+    f->ops = 0;
+    CHECK_EQ(run_workload(&log, m, &w, steps, keep), FLASH_LOG_OK);
+    long total_ops = f->ops;
+    free(f);
+    CHECK(total_ops > 300);
+
+    uint32_t failed_cuts = 0;
+    for (long cut = 0; cut < total_ops; cut++) {
+        f = sim_new(sectors, &io);
+        model_init(m);
+        w = (workload_t){.pin_window = 100};
+        flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024);
+
+        f->ops = 0;
+        f->cut_at = cut;
+        int ret = run_workload(&log, m, &w, steps, keep);
+
+        sim_power_on(f);
+        bool ok = ret != FLASH_LOG_OK &&
+                  flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024) == FLASH_LOG_OK &&
+                  matches_model(&log, m);
+
+        /* Keep going after recovery, then a clean remount */
+        ok = ok && run_workload(&log, m, &w, 60, keep) == FLASH_LOG_OK &&
+             flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024) == FLASH_LOG_OK &&
+             matches_model(&log, m);
+
+        if (!ok) {
+            if (failed_cuts++ < 5) {
+                fprintf(stderr, "power cut at operation %ld of %ld: bad recovery\n", cut, total_ops);
+            }
+        }
+        free(f);
+    }
+    CHECK_EQ(failed_cuts, 0);
+    printf("  %ld power cut points checked\n", total_ops);
+
+    free(m);
+}
+
+/* A second cut during the recovery itself (mount finishing a compaction) */
+static void test_power_cut_during_recovery(void)
+{
+    const uint32_t sectors = 4;
+    flash_log_io_t io;
+    flash_log_t log;
+    model_t *m = calloc(1, sizeof(*m));
+    uint32_t failed = 0;
+    uint32_t checked = 0;
+
+    for (long cut = 200; cut < 400; cut += 3) {
+        for (long cut2 = 0; cut2 < 12; cut2++) {
+            sim_flash_t *f = sim_new(sectors, &io);
+            workload_t w = {.pin_window = 100};
+            model_init(m);
+            flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024);
+
+            f->ops = 0;
+            f->cut_at = cut;
+            run_workload(&log, m, &w, 150, 30);
+
+            /* Power returns, mount is cut short */
+            sim_power_on(f);
+            f->ops = 0;
+            f->cut_at = cut2;
+            flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024);
+
+            sim_power_on(f);
+            bool ok = flash_log_mount(&log, &io, PAYLOAD_SIZE, index_buf, 1024) == FLASH_LOG_OK &&
+                      matches_model(&log, m) &&
+                      run_workload(&log, m, &w, 60, 30) == FLASH_LOG_OK &&
+                      matches_model(&log, m);
+            if (!ok && failed++ < 5) {
+                fprintf(stderr, "cut at %ld, then at mount operation %ld: bad recovery\n", cut, cut2);
+            }
+            checked++;
+            free(f);
+        }
+    }
+    CHECK_EQ(failed, 0);
+    printf("  %u double power cuts checked\n", checked);
+
+    free(m);
+}
+
+int main(void)
+{
+    RUN_TEST(test_append_read_remove);
+    RUN_TEST(test_capacity);
+    RUN_TEST(test_relocation_and_wear);
+    RUN_TEST(test_corrupt_record_skipped);
+    RUN_TEST(test_foreign_data_formatted);
+    RUN_TEST(test_power_cut_every_operation);
+    RUN_TEST(test_power_cut_during_recovery);
+    return TEST_EXIT();
+}
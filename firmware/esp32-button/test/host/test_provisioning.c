@@ -0,0 +1,312 @@
+/**
+ * Host tests for the provisioning bank swap (main/provisioning.c)
+ *
+ * provisioning.c is included directly so a simulated reboot can reset its
+ * statics before provision_init() runs again. NVS is fake_nvs.c; a reset
+ * mid-commit is a write budget that runs out. mbedTLS is stubbed out, so
+ * only configuration strings are provisioned here.
+ */
+
+#include "provisioning.c"
+
+#include "fake_nvs.h"
+#include "test_util.h"
+
+/* Power back on: handles gone, module state as after boot */
+static void reboot(void)
+{
+    fake_nvs_close_all();
+    fake_nvs_fail_after(-1);
+
+    active_bank = -1;
+    nvs_initialized = false;
+    memset(&snapshot, 0, sizeof(snapshot));
+    memset(&stage, 0, sizeof(stage));
+
+    CHECK_EQ(provision_init(), ESP_OK);
+}
+
+static device_config_t make_config(const char *tag)
+{
+    device_config_t config;
+    memset(&config, 0, sizeof(config));
+    snprintf(config.wifi_ssid, sizeof(config.wifi_ssid), "ssid-%s", tag);
+    snprintf(config.wifi_password, sizeof(config.wifi_password), "pass-%s", tag);
+    snprintf(config.device_id, sizeof(config.device_id), "esp32-%s", tag);
+    snprintf(config.tenant_id, sizeof(config.tenant_id), "tenant-%s", tag);
+    snprintf(config.building_id, sizeof(config.building_id), "bldg-%s", tag);
+    snprintf(config.room_id, sizeof(config.room_id), "room-%s", tag);
+    return config;
+}
+
+static bool config_is(const device_config_t *config, const char *tag)
+{
+    device_config_t expect = make_config(tag);
+    return memcmp(config, &expect, sizeof(expect)) == 0;
+}
+
+/* Blank device, then config `tag` committed and marked provisioned */
+static void provision_fresh(const char *tag)
+{
+    device_config_t config = make_config(tag);
+
+    fake_nvs_reset();
+    reboot();
+    CHECK(!provision_is_provisioned());
+    CHECK_EQ(provision_save_config(&config), ESP_OK);
+    CHECK_EQ(provision_mark_provisioned(), ESP_OK);
+}
+
+/* Device provisioned by firmware before banks: keys in the root namespace */
+static void provision_legacy(const char *tag)
+{
+    device_config_t config = make_config(tag);
+    nvs_handle_t handle;
+
+    fake_nvs_reset();
+    CHECK_EQ(nvs_open(PROVISION_NAMESPACE, NVS_READWRITE, &handle), ESP_OK);
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        CHECK_EQ(nvs_set_str(handle, snap_keys[i].key, (const char *)&config + snap_keys[i].offset), ESP_OK);
+    }
+    CHECK_EQ(nvs_set_u8(handle, PROVISION_KEY_PROVISIONED, 1), ESP_OK);
+    nvs_close(handle);
+    reboot();
+}
+
+static int bank_pointer(void)
+{
+    uint8_t bank;
+    size_t len = sizeof(bank);
+    return fake_nvs_get_raw(PROVISION_NAMESPACE, PROVISION_KEY_BANK, &bank, &len) ? bank : -1;
+}
+
+/* ========================================================================== */
+/* Tests                                                                      */
+/* ========================================================================== */
+
+static void test_commit_switches_bank(void)
+{
+    device_config_t config;
+
+    provision_fresh("a");
+    CHECK(provision_is_provisioned());
+    int first = bank_pointer();
+    CHECK(first == 0 || first == 1);
+
+    reboot();
+    CHECK(provision_is_provisioned());
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "a"));
+
+    /* Every commit lands in the other bank; the old one is emptied */
+    config = make_config("b");
+    CHECK_EQ(provision_save_config(&config), ESP_OK);
+    CHECK_EQ(bank_pointer(), 1 - first);
+    CHECK_EQ(fake_nvs_count(bank_names[first]), 0);
+    CHECK_EQ(fake_nvs_count(PROVISION_NAMESPACE), 1);     /* Only the pointer */
+
+    reboot();
+    CHECK(provision_is_provisioned());
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "b"));
+}
+
+static void test_partial_stage_carries_over(void)
+{
+    device_config_t config;
+    char value[MAX_WIFI_SSID_LEN];
+
+    provision_fresh("a");
+    CHECK_EQ(provision_stage_begin(), ESP_OK);
+    CHECK(provision_stage_active());
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_WIFI_SSID, "ssid-new"), ESP_OK);
+
+    /* Not visible before commit */
+    CHECK_EQ(provision_get_string(PROVISION_KEY_WIFI_SSID, value, sizeof(value)), ESP_OK);
+    CHECK(strcmp(value, "ssid-a") == 0);
+
+    CHECK_EQ(provision_stage_commit(false), ESP_OK);
+    CHECK(!provision_stage_active());
+
+    reboot();
+    CHECK(provision_is_provisioned());
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(strcmp(config.wifi_ssid, "ssid-new") == 0);
+    memset(config.wifi_ssid, 0, sizeof(config.wifi_ssid));
+    strcpy(config.wifi_ssid, "ssid-a");
+    CHECK(config_is(&config, "a"));
+}
+
+static void test_rejected_and_aborted_sessions(void)
+{
+    device_config_t config;
+
+    provision_fresh("a");
+    int active = bank_pointer();
+
+    /* A provisioned device needs an SSID: rejected, nothing changes */
+    CHECK_EQ(provision_stage_begin(), ESP_OK);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_WIFI_SSID, ""), ESP_OK);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_ROOM_ID, "room-x"), ESP_OK);
+    CHECK_EQ(provision_stage_commit(false), ESP_ERR_INVALID_ARG);
+    CHECK(!provision_stage_active());
+    CHECK_EQ(bank_pointer(), active);
+    CHECK_EQ(fake_nvs_count(bank_names[1 - active]), 0);
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "a"));
+
+    /* Oversized value: refused at stage time, session stays open */
+    CHECK_EQ(provision_stage_begin(), ESP_OK);
+    CHECK_EQ(provision_stage_begin(), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_ROOM_ID, "a-room-name-too-long"), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_DEVICE_ID, "esp32-x"), ESP_OK);
+    provision_stage_abort();
+    CHECK(!provision_stage_active());
+    CHECK_EQ(fake_nvs_count(bank_names[1 - active]), 0);
+
+    reboot();
+    CHECK_EQ(bank_pointer(), active);
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "a"));
+}
+
+static void test_stale_stage_after_reset(void)
+{
+    device_config_t config;
+
+    provision_fresh("a");
+    int active = bank_pointer();
+
+    /* Reset with a session open: leftovers in the inactive bank, including
+     * a client key whose certificate was never staged */
+    static const uint8_t stale_key[] = { 0x30, 0x77, 0x02, 0x01 };
+    CHECK_EQ(provision_stage_begin(), ESP_OK);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_DEVICE_ID, "esp32-stale"), ESP_OK);
+    CHECK_EQ(fake_nvs_put_blob(bank_names[1 - active], PROVISION_KEY_KEY_DER, stale_key, sizeof(stale_key)),
+             ESP_OK);
+    reboot();
+    CHECK(fake_nvs_exists(bank_names[1 - active], PROVISION_KEY_DEVICE_ID));
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "a"));
+
+    /* The next session starts clean: nothing stale is committed (an unpaired
+     * key would get the commit rejected) */
+    CHECK_EQ(provision_stage_begin(), ESP_OK);
+    CHECK_EQ(provision_stage_string(PROVISION_KEY_ROOM_ID, "room-b"), ESP_OK);
+    CHECK_EQ(provision_stage_commit(false), ESP_OK);
+    CHECK(!fake_nvs_exists(bank_names[1 - active], PROVISION_KEY_KEY_DER));
+
+    reboot();
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(strcmp(config.room_id, "room-b") == 0);
+    CHECK(strcmp(config.device_id, "esp32-a") == 0);
+}
+
+static void test_legacy_layout_moves_to_bank(void)
+{
+    device_config_t config;
+
+    provision_legacy("old");
+    CHECK_EQ(bank_pointer(), -1);
+    CHECK(provision_is_provisioned());
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "old"));
+
+    config = make_config("new");
+    CHECK_EQ(provision_save_config(&config), ESP_OK);
+    CHECK(bank_pointer() >= 0);
+    CHECK_EQ(fake_nvs_count(PROVISION_NAMESPACE), 1);     /* Legacy keys dropped */
+
+    reboot();
+    CHECK(provision_is_provisioned());
+    CHECK_EQ(provision_load_config(&config), ESP_OK);
+    CHECK(config_is(&config, "new"));
+}
+
+/* Reset at every NVS write of a commit: after reboot the device has the old
+ * or the new configuration, whole, and stays provisioned */
+static void sweep_power_cuts(void (*setup)(const char *), const char *old_tag, const char *what)
+{
+    device_config_t config = make_config("new");
+
+    setup(old_tag);
+    long before = fake_nvs_write_count();
+    CHECK_EQ(provision_save_config(&config), ESP_OK);
+    long writes = fake_nvs_write_count() - before;
+    CHECK(writes > CONFIG_KEY_COUNT);
+
+    uint32_t bad = 0;
+    uint32_t saw_old = 0;
+    uint32_t saw_new = 0;
+    for (long cut = 0; cut <= writes; cut++) {
+        setup(old_tag);
+        config = make_config("new");
+        fake_nvs_fail_after(cut);
+        esp_err_t ret = provision_save_config(&config);
+
+        reboot();
+        device_config_t loaded;
+        bool ok = provision_is_provisioned() && provision_load_config(&loaded) == ESP_OK;
+        bool is_old = ok && config_is(&loaded, old_tag);
+        bool is_new = ok && config_is(&loaded, "new");
+        saw_old += is_old;
+        saw_new += is_new;
+
+        /* Success was reported: the new values must be what boots */
+        ok = (is_old || is_new) && (ret != ESP_OK || is_new);
+
+        /* A switched device has no legacy keys left; the next commit works */
+        if (is_new && fake_nvs_count(PROVISION_NAMESPACE) != 1) {
+            ok = false;
+        }
+        config = make_config("next");
+        ok = ok && provision_save_config(&config) == ESP_OK;
+        reboot();
+        ok = ok && provision_load_config(&loaded) == ESP_OK && config_is(&loaded, "next") &&
+             fake_nvs_count(bank_names[1 - bank_pointer()]) == 0;
+
+        if (!ok && bad++ < 5) {
+            fprintf(stderr, "%s: reset at write %ld of %ld: bad state after reboot\n", what, cut, writes);
+        }
+    }
+
+    CHECK_EQ(bad, 0);
+    CHECK(saw_old > 0 && saw_new > 0);
+    printf("  %s: %ld reset points (old %u, new %u)\n", what, writes + 1, saw_old, saw_new);
+}
+
+static void test_power_cut_during_commit(void)
+{
+    sweep_power_cuts(provision_fresh, "a", "bank to bank");
+}
+
+static void test_power_cut_during_legacy_switch(void)
+{
+    sweep_power_cuts(provision_legacy, "old", "legacy to bank");
+}
+
+static void test_clear(void)
+{
+    provision_fresh("a");
+    CHECK_EQ(provision_clear(), ESP_OK);
+    CHECK(!provision_is_provisioned());
+    CHECK_EQ(fake_nvs_count(PROVISION_NAMESPACE), 0);
+    CHECK_EQ(fake_nvs_count(PROVISION_BANK_A), 0);
+    CHECK_EQ(fake_nvs_count(PROVISION_BANK_B), 0);
+
+    reboot();
+    CHECK(!provision_is_provisioned());
+}
+
+int main(void)
+{
+    RUN_TEST(test_commit_switches_bank);
+    RUN_TEST(test_partial_stage_carries_over);
+    RUN_TEST(test_rejected_and_aborted_sessions);
+    RUN_TEST(test_stale_stage_after_reset);
+    RUN_TEST(test_legacy_layout_moves_to_bank);
+    RUN_TEST(test_power_cut_during_commit);
+    RUN_TEST(test_power_cut_during_legacy_switch);
+    RUN_TEST(test_clear);
+    return TEST_EXIT();
+}
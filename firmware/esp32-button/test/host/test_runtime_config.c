@@ -0,0 +1,202 @@
+/**
+ * Stress test for runtime_config snapshots (main/runtime_config.c)
+ *
+ * One writer applies RUNTIME_UPDATES config_set updates through
+ * runtime_config_apply() (tunables every time, IDs every ID_EVERY updates,
+ * through the provisioning bank swap) while READERS pthreads take snapshots
+ * in a loop. Every field is derived from the version it was written with,
+ * so a snapshot mixing two updates is detected.
+ */
+
+#include "runtime_config.h"
+#include "provisioning.h"
+#include "fake_nvs.h"
+#include "test_util.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define READERS 4
+#define RUNTIME_UPDATES 300000
+#define ID_EVERY 64
+
+static atomic_bool writer_done;
+
+static void expected(uint32_t version, runtime_config_update_t *u)
+{
+    uint32_t id_version = version - version % ID_EVERY;
+
+    memset(u, 0, sizeof(*u));
+    u->version = version;
+    u->fields = RUNTIME_CONFIG_SET_HEARTBEAT | RUNTIME_CONFIG_SET_RATE_MAX |
+                RUNTIME_CONFIG_SET_RATE_WINDOW | RUNTIME_CONFIG_SET_COOLDOWN | RUNTIME_CONFIG_SET_POWER;
+    if (version % ID_EVERY == 0) {
+        u->fields |= RUNTIME_CONFIG_SET_IDS;
+    }
+    u->heartbeat_interval_ms = version * 1000;
+    u->rate_limit_max_alerts = (uint16_t)version;
+    u->rate_limit_window_s = (uint16_t)(version * 7);
+    u->rate_limit_cooldown_s = version * 3;
+    u->power_profile = (power_profile_t)(version % 3);
+    snprintf(u->tenant_id, sizeof(u->tenant_id), "t-%u", (unsigned)id_version);
+    snprintf(u->building_id, sizeof(u->building_id), "b-%u", (unsigned)id_version);
+    snprintf(u->room_id, sizeof(u->room_id), "r-%u", (unsigned)id_version);
+}
+
+/* Every field matches the snapshot's version (IDs: the last ID update) */
+static bool consistent(const runtime_config_t *cfg)
+{
+    runtime_config_update_t u;
+
+    if (cfg->version < ID_EVERY) {
+        return cfg->version == 0 || cfg->heartbeat_interval_ms == cfg->version * 1000;
+    }
+    expected(cfg->version, &u);
+    return cfg->loaded &&
+           cfg->heartbeat_interval_ms == u.heartbeat_interval_ms &&
+           cfg->rate_limit_max_alerts == u.rate_limit_max_alerts &&
+           cfg->rate_limit_window_s == u.rate_limit_window_s &&
+           cfg->rate_limit_cooldown_s == u.rate_limit_cooldown_s &&
+           cfg->power_profile == u.power_profile &&
+           strcmp(cfg->tenant_id, u.tenant_id) == 0 &&
+           strcmp(cfg->building_id, u.building_id) == 0 &&
+           strcmp(cfg->room_id, u.room_id) == 0 &&
+           strcmp(cfg->device_id, "esp32-stress") == 0;
+}
+
+typedef struct {
+    uint64_t reads;
+    uint64_t torn;
+    uint64_t backwards;
+    uint32_t last_version;
+} reader_t;
+
+static void *reader_main(void *arg)
+{
+    reader_t *r = arg;
+    runtime_config_t cfg;
+
+    while (!atomic_load(&writer_done)) {
+        runtime_config_snapshot(&cfg);
+        r->reads++;
+        if (!consistent(&cfg)) {
+            if (r->torn++ == 0) {
+                fprintf(stderr, "torn snapshot: v%u heartbeat %u room %s\n",
+                        (unsigned)cfg.version, (unsigned)cfg.heartbeat_interval_ms, cfg.room_id);
+            }
+        }
+        if (cfg.version < r->last_version) {
+            r->backwards++;
+        }
+        r->last_version = cfg.version;
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint32_t first_version;
+    uint32_t failures;
+} writer_t;
+
+static void *writer_main(void *arg)
+{
+    writer_t *w = arg;
+    runtime_config_update_t u;
+
+    for (uint32_t v = w->first_version; v < w->first_version + RUNTIME_UPDATES; v++) {
+        expected(v, &u);
+        if (runtime_config_apply(&u) != ESP_OK) {
+            w->failures++;
+        }
+    }
+    atomic_store(&writer_done, true);
+    return NULL;
+}
+
+static void provision_device(void)
+{
+    device_config_t config;
+
+    memset(&config, 0, sizeof(config));
+    strcpy(config.wifi_ssid, "ssid");
+    strcpy(config.wifi_password, "password");
+    strcpy(config.device_id, "esp32-stress");
+    strcpy(config.tenant_id, "tenant-a");
+    strcpy(config.building_id, "building-a");
+    strcpy(config.room_id, "room-1");
+
+    CHECK_EQ(provision_init(), ESP_OK);
+    CHECK_EQ(provision_save_config(&config), ESP_OK);
+    CHECK_EQ(provision_mark_provisioned(), ESP_OK);
+    CHECK_EQ(runtime_config_load(), ESP_OK);
+}
+
+static void test_apply_persists(void)
+{
+    runtime_config_update_t u;
+    runtime_config_t cfg;
+
+    provision_device();
+
+    expected(ID_EVERY, &u);
+    CHECK_EQ(runtime_config_apply(&u), ESP_OK);
+    CHECK_EQ(runtime_config_apply(&u), ESP_ERR_INVALID_VERSION);
+
+    /* Reload from NVS: IDs through provisioning, tunables from runtime_cfg */
+    CHECK_EQ(runtime_config_load(), ESP_OK);
+    runtime_config_snapshot(&cfg);
+    CHECK_EQ(cfg.version, ID_EVERY);
+    CHECK(consistent(&cfg));
+}
+
+/* Continues from the device test_apply_persists provisioned */
+static void test_snapshots_under_updates(void)
+{
+    pthread_t writer;
+    pthread_t readers[READERS];
+    reader_t stats[READERS];
+    runtime_config_t cfg;
+
+    runtime_config_snapshot(&cfg);
+    writer_t w = { .first_version = cfg.version + 1 };
+    uint32_t gen_before = runtime_config_generation();
+
+    memset(stats, 0, sizeof(stats));
+    atomic_store(&writer_done, false);
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, reader_main, &stats[i]);
+    }
+    pthread_create(&writer, NULL, writer_main, &w);
+
+    pthread_join(writer, NULL);
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    uint64_t backwards = 0;
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+        reads += stats[i].reads;
+        torn += stats[i].torn;
+        backwards += stats[i].backwards;
+    }
+
+    CHECK_EQ(w.failures, 0);
+    CHECK_EQ(runtime_config_generation() - gen_before, RUNTIME_UPDATES);
+    CHECK_EQ(torn, 0);
+    CHECK_EQ(backwards, 0);
+    CHECK(reads > 0);
+    printf("  %d readers, %d updates: %llu snapshots, %llu torn\n", READERS, RUNTIME_UPDATES,
+           (unsigned long long)reads, (unsigned long long)torn);
+
+    runtime_config_snapshot(&cfg);
+    CHECK_EQ(cfg.version, w.first_version + RUNTIME_UPDATES - 1);
+    CHECK(consistent(&cfg));
+}
+
+int main(void)
+{
+    RUN_TEST(test_apply_persists);
+    RUN_TEST(test_snapshots_under_updates);
+    return TEST_EXIT();
+}
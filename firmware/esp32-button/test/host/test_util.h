@@ -0,0 +1,39 @@
+#ifndef SAFESIGNAL_TEST_UTIL_H
+#define SAFESIGNAL_TEST_UTIL_H
+
+/**
+ * Minimal host test helpers
+ *
+ * Checks report file:line and keep going; RUN_TEST prints one PASS/FAIL line
+ * per test and TEST_EXIT returns non-zero if any check failed (ctest).
+ */
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_EQ(a, b) do {                                                     \
+        long long a_ = (long long)(a), b_ = (long long)(b);                     \
+        if (a_ != b_) {                                                         \
+            fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld != %lld)\n", \
+                    __FILE__, __LINE__, #a, #b, a_, b_);                        \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define RUN_TEST(fn) do {                                                       \
+        int before_ = test_failures;                                            \
+        fn();                                                                   \
+        printf("%s %s\n", test_failures == before_ ? "PASS" : "FAIL", #fn);     \
+    } while (0)
+
+#define TEST_EXIT() (test_failures == 0 ? 0 : 1)
+
+#endif /* SAFESIGNAL_TEST_UTIL_H */
@@ -7,12 +7,21 @@
 # - PA service (client cert)
 # - Test ESP32 device (client cert)
 # - Test mobile app (client cert)
+#
+# Keys are ECDSA P-256 by default: an mTLS handshake signs with the client
+# key, and on the ESP32-S3 a P-256 signature is much cheaper than RSA-2048
+# (see the tls_bench console command). CERT_PROFILE=rsa generates the old
+# RSA profile (4096-bit CA, 2048-bit leaves) for interop testing.
+#
+# Usage: ./seed-certs.sh                  # P-256
+#        CERT_PROFILE=rsa ./seed-certs.sh
 
 set -euo pipefail
 
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 ROOT_DIR="$(dirname "$SCRIPT_DIR")"
 CERTS_DIR="${ROOT_DIR}/edge/certs"
+CERT_PROFILE="${CERT_PROFILE:-ec}"
 
 # Colors for output
 GREEN='\033[0;32m'
@@ -38,6 +47,31 @@ if ! command -v openssl &> /dev/null; then
     exit 1
 fi
 
+case "$CERT_PROFILE" in
+    ec)
+        # ECDHE-ECDSA: the key only signs, no key encipherment
+        KEY_USAGE="critical, digitalSignature"
+        ;;
+    rsa)
+        KEY_USAGE="critical, digitalSignature, keyEncipherment"
+        ;;
+    *)
+        log_error "Unknown CERT_PROFILE '$CERT_PROFILE' (use ec or rsa)"
+        exit 1
+        ;;
+esac
+
+# Generate a private key for the selected profile
+# Usage: generate_key <file> <rsa_bits>
+generate_key() {
+    if [ "$CERT_PROFILE" = "ec" ]; then
+        openssl genpkey -algorithm EC -pkeyopt ec_paramgen_curve:P-256 \
+            -pkeyopt ec_param_enc:named_curve -out "$1"
+    else
+        openssl genrsa -out "$1" "$2"
+    fi
+}
+
 # Clean and create certs directory
 log_info "Setting up certificates directory..."
 rm -rf "$CERTS_DIR"
@@ -45,9 +79,9 @@ mkdir -p "$CERTS_DIR"/{ca,emqx,policy-service,pa-service,devices,minio}
 cd "$CERTS_DIR"
 
 # Generate CA private key and certificate
-log_info "Generating Certificate Authority (CA)..."
-openssl genrsa -out ca/ca.key 4096
-openssl req -new -x509 -days 3650 -key ca/ca.key -out ca/ca.crt \
+log_info "Generating Certificate Authority (CA), profile: $CERT_PROFILE..."
+generate_key ca/ca.key 4096
+openssl req -new -x509 -days 3650 -sha256 -key ca/ca.key -out ca/ca.crt \
     -subj "/C=NO/ST=Oslo/L=Oslo/O=SafeSignal-Dev/OU=Edge-CA/CN=SafeSignal Dev CA"
 
 log_info "CA certificate generated: $(openssl x509 -in ca/ca.crt -noout -subject)"
@@ -62,12 +96,11 @@ generate_cert() {
     log_info "Generating certificate for: $cn"
 
     # Generate private key
-    openssl genrsa -out "${out_dir}/${name}.key" 2048
+    generate_key "${out_dir}/${name}.key" 2048
 
     # Create CSR config
     cat > "${out_dir}/${name}.cnf" <<EOF
 [req]
-default_bits = 2048
 prompt = no
 default_md = sha256
 distinguished_name = dn
@@ -82,7 +115,7 @@ OU=Edge
 CN=$cn
 
 [v3_req]
-keyUsage = critical, digitalSignature, keyEncipherment
+keyUsage = $KEY_USAGE
 extendedKeyUsage = $(if [ "$cert_type" = "server" ]; then echo "serverAuth"; else echo "clientAuth"; fi)
 subjectAltName = @alt_names
 
@@ -98,7 +131,7 @@ EOF
 
     # Sign certificate with CA
     openssl x509 -req -in "${out_dir}/${name}.csr" -CA ca/ca.crt -CAkey ca/ca.key \
-        -CAcreateserial -out "${out_dir}/${name}.crt" -days 365 \
+        -CAcreateserial -out "${out_dir}/${name}.crt" -days 365 -sha256 \
         -extensions v3_req -extfile "${out_dir}/${name}.cnf"
 
     # Verify certificate
@@ -116,10 +149,10 @@ generate_cert "client" "policy-service" "policy-service" "client"
 # Generate PA Service certificate (client)
 generate_cert "client" "pa-service" "pa-service" "client"
 
-# Generate test device certificates
+# Generate test device certificates (CN is the principal in edge/emqx/acl.conf)
 log_info "Generating test device certificates..."
-generate_cert "esp32-test" "device-esp32-001" "devices" "client"
-generate_cert "app-test" "device-app-001" "devices" "client"
+generate_cert "esp32-test" "device-esp32-001-tenant-a-building-a" "devices" "client"
+generate_cert "app-test" "device-app-001-tenant-a-building-a" "devices" "client"
 
 # Generate MinIO server certificate
 log_info "Generating MinIO server certificate..."
@@ -141,6 +174,7 @@ chmod 644 *//*.crt
 cat > cert-inventory.txt <<EOF
 SafeSignal Edge Development Certificates
 Generated: $(date -u +"%Y-%m-%d %H:%M:%S UTC")
+Profile: $(if [ "$CERT_PROFILE" = "ec" ]; then echo "ECDSA P-256"; else echo "RSA (CA 4096, leaves 2048)"; fi)
 
 CA Certificate:
   Location: ca/ca.crt